@@ -0,0 +1,40 @@
+# Compares RPi::GPIO::Pin against the module functions on one output pin.
+#
+#   ruby -Ilib bench/pin_bench.rb [BCM_GPIO] [ITERATIONS]
+
+require_relative '../lib/rpi_gpio'
+
+gpio = (ARGV[0] || 18).to_i
+iterations = (ARGV[1] || 1_000_000).to_i
+
+def calls_per_sec(iterations)
+  start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  yield iterations
+  iterations / (Process.clock_gettime(Process::CLOCK_MONOTONIC) - start)
+end
+
+RPi::GPIO.set_warnings false
+RPi::GPIO.set_numbering :bcm
+RPi::GPIO.setup gpio, :as => :output, :initialize => :low
+pin = RPi::GPIO::Pin.new(gpio)
+
+results = {
+  'RPi::GPIO.set_high/set_low' => calls_per_sec(iterations) { |n|
+    (n / 2).times { RPi::GPIO.set_high gpio; RPi::GPIO.set_low gpio }
+  },
+  'RPi::GPIO::Pin#high!/low!' => calls_per_sec(iterations) { |n|
+    (n / 2).times { pin.high!; pin.low! }
+  },
+  'RPi::GPIO.high?' => calls_per_sec(iterations) { |n|
+    n.times { RPi::GPIO.high? gpio }
+  },
+  'RPi::GPIO::Pin#high?' => calls_per_sec(iterations) { |n|
+    n.times { pin.high? }
+  },
+}
+
+results.each do |name, rate|
+  printf("%-30s %12.0f calls/sec\n", name, rate)
+end
+
+RPi::GPIO.reset
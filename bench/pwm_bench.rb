@@ -0,0 +1,29 @@
+# Measures the CPU used by software PWM as the number of channels grows.
+#
+#   ruby -Ilib bench/pwm_bench.rb [FREQUENCY] [SECONDS]
+
+require_relative '../lib/rpi_gpio'
+
+frequency = (ARGV[0] || 1000).to_f
+seconds = (ARGV[1] || 2).to_f
+gpios = (2..27).to_a
+
+def cpu_time
+  Process.clock_gettime(Process::CLOCK_PROCESS_CPUTIME_ID)
+end
+
+RPi::GPIO.set_warnings false
+RPi::GPIO.set_numbering :bcm
+RPi::GPIO.setup gpios, :as => :output, :initialize => :low
+
+[1, 5, 10, 20].each do |count|
+  pwms = gpios.first(count).map { |gpio| RPi::GPIO::PWM.new(gpio, frequency) }
+  pwms.each { |pwm| pwm.start 50 }
+  start = cpu_time
+  sleep seconds
+  used = cpu_time - start
+  pwms.each(&:stop)
+  printf("%2d channels at %g Hz: %5.1f%% CPU\n", count, frequency, used / seconds * 100)
+end
+
+RPi::GPIO.reset
@@ -0,0 +1,29 @@
+# Compares edge jitter and CPU cost of :sleep and :hybrid PWM timing.
+#
+#   ruby -Ilib bench/pwm_timing_bench.rb [FREQUENCY] [SECONDS] [SPIN_MARGIN_NS]
+
+require_relative '../lib/rpi_gpio'
+
+frequency = (ARGV[0] || 10_000).to_f
+seconds = (ARGV[1] || 2).to_f
+margin = ARGV[2] && ARGV[2].to_i
+
+RPi::GPIO.set_warnings false
+RPi::GPIO.set_numbering :bcm
+RPi::GPIO.setup 17, :as => :output, :initialize => :low
+puts "calibrated spin margin: #{RPi::GPIO::PWM.calibrated_spin_margin} ns"
+
+[:sleep, :hybrid].each do |timing|
+  pwm = RPi::GPIO::PWM.new(17, frequency, :timing => timing, :spin_margin => margin)
+  before = RPi::GPIO::PWM.scheduler_stats[:cpu_ns]
+  pwm.start 50
+  sleep seconds
+  stats = pwm.stats
+  cpu = RPi::GPIO::PWM.scheduler_stats[:cpu_ns] - before
+  pwm.stop
+  printf("%-6s at %g Hz: p50 %6d ns  p99 %7d ns  max %8d ns  late %6d/%d  %5.1f%% CPU (%.1f%% spinning)\n",
+    timing, frequency, stats[:percentiles][50.0], stats[:percentiles][99.0], stats[:max_overshoot_ns],
+    stats[:late], stats[:edges], cpu / (seconds * 1e7), stats[:spin_ns] / (seconds * 1e7))
+end
+
+RPi::GPIO.reset
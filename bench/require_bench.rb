@@ -0,0 +1,56 @@
+# Times `require 'rpi_gpio'` and the first call that needs the board, in
+# fresh processes: with detection and no chip cache, with a warm cache, and
+# with the board given in RPI_GPIO_BOARD.
+#
+#   ruby -Ilib bench/require_bench.rb [RUNS]
+#
+# Set RPI_GPIO_BACKEND=sim to run it away from a Pi. The simulator has no
+# chip cache, so its first two rows measure the same thing.
+
+require 'rbconfig'
+require 'tmpdir'
+
+runs = (ARGV[0] || 20).to_i
+lib = File.expand_path('../lib', __dir__)
+
+# prints the microseconds taken by require, set_numbering (board lookup) and
+# the first setup (register mapping and chip detection)
+script = <<~RUBY
+  t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC, :microsecond)
+  require '#{lib}/rpi_gpio'
+  t1 = Process.clock_gettime(Process::CLOCK_MONOTONIC, :microsecond)
+  RPi::GPIO.set_warnings false
+  RPi::GPIO.set_numbering :bcm
+  t2 = Process.clock_gettime(Process::CLOCK_MONOTONIC, :microsecond)
+  RPi::GPIO.setup 18, :as => :input
+  t3 = Process.clock_gettime(Process::CLOCK_MONOTONIC, :microsecond)
+  RPi::GPIO.reset
+  print [t1 - t0, t2 - t1, t3 - t2].join(' ')
+RUBY
+
+def run(env, script, runs)
+  command = [RbConfig.ruby] + $LOAD_PATH.map { |dir| "-I#{dir}" } + ['-e', script]
+  totals = [0, 0, 0]
+  runs.times do
+    yield if block_given?
+    times = IO.popen(env, command, &:read).split.map(&:to_i)
+    totals = totals.zip(times).map { |total, time| total + time }
+  end
+  totals.map { |total| total.to_f / runs }
+end
+
+Dir.mktmpdir do |dir|
+  cache = File.join(dir, 'board')
+  board = ENV['RPI_GPIO_BOARD'] || 'a02082'
+
+  results = {
+    'detect, no cache' => run({ 'RPI_GPIO_CACHE' => cache }, script, runs) { File.delete(cache) if File.exist?(cache) },
+    'detect, cached' => run({ 'RPI_GPIO_CACHE' => cache }, script, runs),
+    "RPI_GPIO_BOARD=#{board}" => run({ 'RPI_GPIO_CACHE' => cache, 'RPI_GPIO_BOARD' => board }, script, runs),
+  }
+
+  printf("%-24s %12s %12s %12s\n", '', 'require', 'board', 'first setup')
+  results.each do |name, (required, board_lookup, first_setup)|
+    printf("%-24s %9.0f us %9.0f us %9.0f us\n", name, required, board_lookup, first_setup)
+  end
+end
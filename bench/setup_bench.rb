@@ -0,0 +1,46 @@
+# Times setting up and cleaning up every pin of the 40-pin header, one call
+# per pin against one call for the whole list.
+#
+#   ruby -Ilib bench/setup_bench.rb [ROUNDS]
+#
+# Set RPI_GPIO_BACKEND=sim to run it away from a Pi.
+
+require_relative '../lib/rpi_gpio'
+
+rounds = (ARGV[0] || 1000).to_i
+header = [3, 5, 7, 8, 10, 11, 12, 13, 15, 16, 18, 19, 21, 22, 23, 24, 26, 29, 31, 32, 33, 35, 36, 37, 38, 40]
+
+def usec_per_round(rounds)
+  start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  rounds.times { yield }
+  (Process.clock_gettime(Process::CLOCK_MONOTONIC) - start) * 1_000_000 / rounds
+end
+
+RPi::GPIO.set_warnings false
+RPi::GPIO.set_numbering :board
+
+results = {
+  'setup, one pin per call' => usec_per_round(rounds) {
+    header.each { |pin| RPi::GPIO.setup pin, :as => :input, :pull => :up }
+    RPi::GPIO.clean_up
+  },
+  'setup, whole list' => usec_per_round(rounds) {
+    RPi::GPIO.setup header, :as => :input, :pull => :up
+    RPi::GPIO.clean_up
+  },
+  'clean_up, one pin per call' => usec_per_round(rounds) {
+    RPi::GPIO.setup header, :as => :output, :initialize => :low
+    header.each { |pin| RPi::GPIO.clean_up pin }
+  },
+  'clean_up, all pins' => usec_per_round(rounds) {
+    RPi::GPIO.setup header, :as => :output, :initialize => :low
+    RPi::GPIO.clean_up
+  },
+}
+
+puts "#{header.size} pins, #{RPi::GPIO.backend} backend"
+results.each do |name, usec|
+  printf("%-30s %10.1f usec/round\n", name, usec)
+end
+
+RPi::GPIO.reset
@@ -0,0 +1,241 @@
+# Runs every benchmark and reports the results as a table or as JSON, so runs
+# from different gem versions can be compared.
+#
+#   ruby -Ilib bench/suite.rb [options]
+#   rake bench BENCH_ARGS="--format json --output results.json"
+#
+# Options:
+#   --format text|json     how to print the results (default text)
+#   --output FILE          write them to FILE as well as printing them
+#   --quick                shorter runs, for a smoke test
+#   --only PATTERN         run only the benchmarks whose name matches
+#   --compare FILE         compare with the JSON results in FILE and exit 1 if
+#                          anything got worse by more than the threshold
+#   --threshold PERCENT    allowed change for --compare (default 10)
+#
+# Set RPI_GPIO_BACKEND=sim to run against the simulated register map. Edge
+# event latency needs an input to toggle: with the simulator it is driven
+# directly, on a Pi set BENCH_LOOPBACK=OUT,IN to two BCM GPIOs wired together.
+
+require 'json'
+require 'optparse'
+require 'time'
+require_relative '../lib/rpi_gpio'
+
+options = { :format => 'text', :threshold => 10.0 }
+OptionParser.new do |opts|
+  opts.on('--format FORMAT', %w[text json]) { |format| options[:format] = format }
+  opts.on('--output FILE') { |file| options[:output] = file }
+  opts.on('--quick') { options[:quick] = true }
+  opts.on('--only PATTERN') { |pattern| options[:only] = Regexp.new(pattern) }
+  opts.on('--compare FILE') { |file| options[:compare] = file }
+  opts.on('--threshold PERCENT', Float) { |percent| options[:threshold] = percent }
+end.parse!
+
+class BenchSuite
+  Result = Struct.new(:name, :value, :unit, :better)
+
+  attr_reader :results
+
+  def initialize(options)
+    @options = options
+    @results = []
+  end
+
+  def quick?
+    @options[:quick]
+  end
+
+  def run?(group)
+    @options[:only].nil? || @options[:only].match?(group)
+  end
+
+  # better is :higher or :lower, for comparisons
+  def record(name, value, unit, better)
+    @results << Result.new(name, value.round(1), unit, better)
+  end
+
+  def now
+    Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+  end
+
+  def per_second(iterations)
+    start = now
+    yield
+    iterations * 1e9 / (now - start)
+  end
+
+  def usec(rounds)
+    start = now
+    rounds.times { yield }
+    (now - start) / 1000.0 / rounds
+  end
+
+  def percentile(sorted, pct)
+    sorted[[(sorted.size * pct / 100.0).ceil - 1, 0].max]
+  end
+
+  def metadata
+    {
+      :suite => 'rpi_gpio',
+      :version => gem_version,
+      :backend => RPi::GPIO.backend,
+      :board => RPi::GPIO.board_info[:revision],
+      :chip => RPi::GPIO.chip[:name],
+      :ruby => RUBY_DESCRIPTION,
+      :time => Time.now.utc.iso8601,
+      :quick => quick? ? true : false,
+    }
+  end
+
+  def gem_version
+    spec = Gem.loaded_specs['rpi_gpio']
+    return spec.version.to_s if spec
+    version = `git -C #{File.expand_path('..', __dir__)} describe --always --dirty 2>/dev/null`.strip
+    version.empty? ? 'unknown' : version
+  end
+
+  # raw output_gpio/input_gpio, timed in C
+  def native
+    iterations = quick? ? 200_000 : 2_000_000
+    RPi::GPIO.setup 17, :as => :output, :initialize => :low
+    record 'native.output_gpio', iterations * 1e9 / RPi::GPIO.native_bench(:output, 17, iterations), 'ops/s', :higher
+    record 'native.input_gpio', iterations * 1e9 / RPi::GPIO.native_bench(:input, 17, iterations), 'ops/s', :higher
+    RPi::GPIO.clean_up 17
+  end
+
+  def ruby_calls
+    iterations = quick? ? 100_000 : 1_000_000
+    RPi::GPIO.setup 17, :as => :output, :initialize => :low
+    record 'ruby.set_high_low', per_second(iterations) { (iterations / 2).times { RPi::GPIO.set_high 17; RPi::GPIO.set_low 17 } }, 'calls/s', :higher
+    record 'ruby.high?', per_second(iterations) { iterations.times { RPi::GPIO.high? 17 } }, 'calls/s', :higher
+    RPi::GPIO.clean_up 17
+  end
+
+  def setup_cleanup
+    rounds = quick? ? 100 : 1000
+    header = (2..27).to_a
+    record 'setup.list_26', usec(rounds) { RPi::GPIO.setup header, :as => :input, :pull => :up; RPi::GPIO.clean_up }, 'us', :lower
+    record 'setup.per_pin_26', usec(rounds) { header.each { |gpio| RPi::GPIO.setup gpio, :as => :input, :pull => :up }; RPi::GPIO.clean_up }, 'us', :lower
+    elapsed = (1..rounds).sum do
+      RPi::GPIO.setup header, :as => :output, :initialize => :low
+      start = now
+      RPi::GPIO.clean_up
+      now - start
+    end
+    record 'cleanup.all_26', elapsed / 1000.0 / rounds, 'us', :lower
+  end
+
+  # PWM#stats measures how late each edge was written
+  def pwm_jitter
+    gpios = [5, 6, 12, 13, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27]
+    seconds = quick? ? 0.3 : 2
+    RPi::GPIO.setup gpios, :as => :output, :initialize => :low
+    [100, 1000, 10_000].each do |frequency|
+      [1, 4, 16].each do |count|
+        pwms = gpios.first(count).map { |gpio| RPi::GPIO::PWM.new(gpio, frequency) }
+        pwms.each { |pwm| pwm.start 50 }
+        sleep seconds
+        stats = pwms.map(&:stats)
+        pwms.each(&:stop)
+        name = "pwm.#{frequency}hz.#{count}ch"
+        record "#{name}.p50", stats.map { |s| s[:percentiles][50.0] }.max, 'ns', :lower
+        record "#{name}.p99", stats.map { |s| s[:percentiles][99.0] }.max, 'ns', :lower
+        record "#{name}.max", stats.map { |s| s[:max_overshoot_ns] }.max, 'ns', :lower
+      end
+    end
+    RPi::GPIO.clean_up
+  end
+
+  # from driving the edge to its Ruby callback running
+  def event_latency
+    edges = quick? ? 50 : 500
+    if RPi::GPIO.backend == :sim
+      input, detect = 24, :hardware
+      RPi::GPIO.setup input, :as => :input, :pull => :down
+      drive = lambda { |level| RPi::GPIO::Simulator.drive input, level }
+    elsif ENV['BENCH_LOOPBACK']
+      output, input = ENV['BENCH_LOOPBACK'].split(',').map(&:to_i)
+      detect = :kernel
+      RPi::GPIO.setup output, :as => :output, :initialize => :low
+      RPi::GPIO.setup input, :as => :input
+      drive = lambda { |level| level == :high ? RPi::GPIO.set_high(output) : RPi::GPIO.set_low(output) }
+    else
+      return
+    end
+
+    queue = Queue.new
+    RPi::GPIO.watch(input, :on => :both, :detect => detect) do |_pin, _value|
+      queue << now
+    end
+    sleep 0.05
+    total = []
+    edges.times do |i|
+      sent = now
+      drive.call(i.even? ? :high : :low)
+      received = queue.pop
+      total << received - sent
+      sleep 0.001
+    end
+    RPi::GPIO.stop_watching input
+    total.sort!
+    record "event.#{detect}.p50", percentile(total, 50), 'ns', :lower
+    record "event.#{detect}.p99", percentile(total, 99), 'ns', :lower
+    record "event.#{detect}.max", total.last, 'ns', :lower
+  ensure
+    RPi::GPIO::Simulator.drive input, nil if RPi::GPIO.backend == :sim && input
+    RPi::GPIO.clean_up
+  end
+
+  def run
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.set_numbering :bcm
+    {
+      'native' => :native, 'ruby' => :ruby_calls, 'setup cleanup' => :setup_cleanup,
+      'pwm' => :pwm_jitter, 'event' => :event_latency,
+    }.each do |group, method|
+      send(method) if run?(group)
+    end
+    RPi::GPIO.reset
+    self
+  end
+
+  def to_h
+    metadata.merge(:results => @results.map(&:to_h))
+  end
+
+  def to_text
+    lines = ["rpi_gpio #{gem_version}, #{RPi::GPIO.backend} backend"]
+    @results.each do |r|
+      lines << format('%-28s %16.1f %s', r.name, r.value, r.unit)
+    end
+    lines.join("\n")
+  end
+
+  # lines for every result that moved by more than threshold percent in its
+  # worse direction, compared with baseline's
+  def regressions(baseline, threshold)
+    before = baseline['results'].map { |r| [r['name'], r['value']] }.to_h
+    @results.filter_map do |r|
+      old = before[r.name]
+      next if old.nil? || old.zero?
+      change = (r.value - old) * 100.0 / old
+      worse = r.better == :higher ? -change : change
+      format('%-28s %14.1f -> %-14.1f %+.1f%%', r.name, old, r.value, change) if worse > threshold
+    end
+  end
+end
+
+suite = BenchSuite.new(options).run
+report = options[:format] == 'json' ? JSON.pretty_generate(suite.to_h) : suite.to_text
+puts report
+File.write(options[:output], JSON.pretty_generate(suite.to_h) + "\n") if options[:output]
+
+if options[:compare]
+  regressions = suite.regressions(JSON.parse(File.read(options[:compare])), options[:threshold])
+  unless regressions.empty?
+    warn "regressions of more than #{options[:threshold]}% against #{options[:compare]}:"
+    regressions.each { |line| warn line }
+    exit 1
+  end
+end
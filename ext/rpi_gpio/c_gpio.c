@@ -29,54 +29,247 @@ SOFTWARE.
 #include <stdlib.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "c_gpio.h"
+#include "sim_gpio.h"
+#include "chardev_gpio.h"
 
-#define BCM2708_PERI_BASE_DEFAULT   0x20000000
-#define BCM2709_PERI_BASE_DEFAULT   0x3f000000
 #define GPIO_BASE_OFFSET            0x200000
-#define FSEL_OFFSET                 0   // 0x0000
-#define SET_OFFSET                  7   // 0x001c / 4
-#define CLR_OFFSET                  10  // 0x0028 / 4
-#define PINLEVEL_OFFSET             13  // 0x0034 / 4
-#define EVENT_DETECT_OFFSET         16  // 0x0040 / 4
-#define RISING_ED_OFFSET            19  // 0x004c / 4
-#define FALLING_ED_OFFSET           22  // 0x0058 / 4
-#define HIGH_DETECT_OFFSET          25  // 0x0064 / 4
-#define LOW_DETECT_OFFSET           28  // 0x0070 / 4
-#define PULLUPDN_OFFSET             37  // 0x0094 / 4
-#define PULLUPDNCLK_OFFSET          38  // 0x0098 / 4
-
-#define PULLUPDN_OFFSET_2711_0      57
-#define PULLUPDN_OFFSET_2711_1      58
-#define PULLUPDN_OFFSET_2711_2      59
-#define PULLUPDN_OFFSET_2711_3      60
+#define CLOCK_BASE_OFFSET           0x101000
+#define PWM_BASE_OFFSET             0x20c000
+#define PCM_BASE_OFFSET             0x203000
+#define DMA_BASE_OFFSET             0x007000
 
 #define PAGE_SIZE  (4*1024)
-#define BLOCK_SIZE (4*1024)
+#define BLOCK_SIZE GPIO_BLOCK_SIZE
+
+// the legacy pull interface needs its control signal held for 150 cycles of
+// the core clock, which is 600 ns at the slowest 250 MHz
+#define PULL_WAIT_NS        600
+#define PULL_WAIT_MIN_LOOPS 150
+#define CALIBRATE_LOOPS     100000
 
 static volatile uint32_t *gpio_map;
+static volatile uint32_t *peripheral_map[PERIPHERAL_COUNT];
+
+// every chip the gem knows, with the defaults used when the device tree
+// doesn't say otherwise
+static const struct gpio_chip chips[] = {
+    { "BCM2835", CHIP_BCM2835, 0x20000000, 54, PULL_LEGACY, 19200000.0, 0 },
+    { "BCM2836", CHIP_BCM2836, 0x3f000000, 54, PULL_LEGACY, 19200000.0, 0 },
+    { "BCM2837", CHIP_BCM2837, 0x3f000000, 54, PULL_LEGACY, 19200000.0, 0 },
+    { "BCM2711", CHIP_BCM2711, 0xfe000000, 58, PULL_2711,   54000000.0, 0 },
+};
+static const struct gpio_chip unknown_chip = {
+    "unknown", CHIP_UNKNOWN, 0, 54, PULL_LEGACY, 0.0, 0
+};
+
+static struct gpio_chip chip;
+const struct gpio_chip *gpio_chip = NULL;
+
+static void spin(unsigned int loops)
+{
+    unsigned int i;
+
+    for (i = 0; i < loops; i++) {
+        asm volatile("nop");
+    }
+}
 
 void short_wait(void)
 {
-    int i;
+    spin(chip.pull_wait_loops);
+}
 
-    for (i=0; i<150; i++) {    // wait 150 cycles
-        asm volatile("nop");
+// how many spin loops make up PULL_WAIT_NS, taking the fastest of a few runs
+// so the wait is long enough at the highest clock speed. never fewer than
+// the fixed count used before calibration
+static unsigned int calibrate_wait(void)
+{
+    struct timespec start, end;
+    uint64_t elapsed, best = UINT64_MAX;
+    uint64_t loops;
+    int round;
+
+    for (round = 0; round < 3; round++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        spin(CALIBRATE_LOOPS);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+        if (elapsed > 0 && elapsed < best)
+            best = elapsed;
     }
+    if (best == UINT64_MAX)
+        return PULL_WAIT_MIN_LOOPS;
+
+    loops = (uint64_t)CALIBRATE_LOOPS * PULL_WAIT_NS / best + 1;
+    return loops < PULL_WAIT_MIN_LOOPS ? PULL_WAIT_MIN_LOOPS : (unsigned int)loops;
 }
 
-int setup(void)
+// the ARM physical address of the peripherals from the device tree, or 0
+static uint32_t dt_peri_base(void)
+{
+    unsigned char buf[4];
+    uint32_t peri_base = 0;
+    FILE *fp;
+
+    if ((fp = fopen("/proc/device-tree/soc/ranges", "rb")) == NULL)
+        return 0;
+    fseek(fp, 4, SEEK_SET);
+    if (fread(buf, 1, sizeof buf, fp) == sizeof buf) {
+        peri_base = buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3] << 0;
+    }
+    if (!peri_base) {
+        // the 2711 has 64-bit parent addresses, so the low word is next
+        fseek(fp, 8, SEEK_SET);
+        if (fread(buf, 1, sizeof buf, fp) == sizeof buf) {
+            peri_base = buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3] << 0;
+        }
+    }
+    fclose(fp);
+    return peri_base;
+}
+
+// the board, worked out on first use and then kept: from the revision code in
+// RPI_GPIO_BOARD if it is set, so short-lived tools and tests can skip
+// detection entirely, or else from the backend. NULL if it isn't a Pi
+static int board_given;   // the board came from RPI_GPIO_BOARD, not detection
+
+const rpi_info *get_board_info(void)
+{
+    static rpi_info board;
+    static int state = 0;   // 1 found, -1 not a Pi
+    const char *revision = getenv("RPI_GPIO_BOARD");
+    int result;
+
+    if (state == 0) {
+        board_given = revision != NULL && *revision != '\0';
+        if (board_given)
+            result = decode_revision(revision, &board);
+        else
+            result = gpio_backend->board_info(&board);
+        state = result == 0 ? 1 : -1;
+    }
+    return state > 0 ? &board : NULL;
+}
+
+// where detect_chip keeps its results between runs: RPI_GPIO_CACHE, or
+// $XDG_CACHE_HOME/rpi_gpio/board, or ~/.cache/rpi_gpio/board. an empty
+// RPI_GPIO_CACHE turns the cache off
+static int chip_cache_path(char *path, size_t size, int make_dirs)
+{
+    const char *env = getenv("RPI_GPIO_CACHE");
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+
+    if (env != NULL)
+        return *env != '\0' && snprintf(path, size, "%s", env) < (int)size ? 0 : -1;
+
+    if (base != NULL && *base != '\0')
+        n = snprintf(path, size, "%s/rpi_gpio", base);
+    else if (home != NULL && *home != '\0')
+        n = snprintf(path, size, "%s/.cache/rpi_gpio", home);
+    else
+        return -1;
+    if (n < 0 || n >= (int)size)
+        return -1;
+
+    if (make_dirs) {
+        if (base == NULL || *base == '\0') {
+            path[n - strlen("/rpi_gpio")] = '\0';
+            mkdir(path, 0700);
+            path[n - strlen("/rpi_gpio")] = '/';
+        }
+        mkdir(path, 0700);
+    }
+    return snprintf(path + n, size - n, "/board") < (int)(size - n) ? 0 : -1;
+}
+
+// the cache holds one line naming the backend and board revision it was made
+// for, then the peripheral base and delay loop count. only a file owned by
+// this user is trusted, as the base decides what gets mapped from /dev/mem
+static int read_chip_cache(const char *revision, struct gpio_chip *c)
+{
+    char path[512], backend[32], cached[64];
+    unsigned int peri_base, loops;
+    struct stat st;
+    FILE *fp;
+    int n;
+
+    if (chip_cache_path(path, sizeof(path), 0) || (fp = fopen(path, "r")) == NULL)
+        return -1;
+    if (fstat(fileno(fp), &st) != 0 || st.st_uid != geteuid()) {
+        fclose(fp);
+        return -1;
+    }
+    n = fscanf(fp, "rpi_gpio 1 %31s %63s %x %u", backend, cached, &peri_base, &loops);
+    fclose(fp);
+
+    if (n != 4 || strcmp(backend, gpio_backend->name) != 0 || strcmp(cached, revision) != 0 ||
+        loops < PULL_WAIT_MIN_LOOPS)
+        return -1;
+    c->peri_base = peri_base;
+    c->pull_wait_loops = loops;
+    return 0;
+}
+
+// written to a temporary file and renamed, so readers never see half of it
+static void write_chip_cache(const char *revision, const struct gpio_chip *c)
+{
+    char path[512], temp[544];
+    FILE *fp;
+
+    if (chip_cache_path(path, sizeof(path), 1))
+        return;
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+    if ((fp = fopen(temp, "w")) == NULL)
+        return;
+    fprintf(fp, "rpi_gpio 1 %s %s %x %u\n", gpio_backend->name, revision, c->peri_base, c->pull_wait_loops);
+    if (fclose(fp) != 0 || rename(temp, path) != 0)
+        unlink(temp);
+}
+
+// fill in the chip descriptor from the board's revision and the device tree,
+// and time the delay loop; or take the last two from the cache when it was
+// made for the same board. the cache is only for a detected board driven
+// through the registers, so the simulator or a board named in RPI_GPIO_BOARD
+// never leaves one behind. done once, before the backend is set up
+static void detect_chip(void)
+{
+    const rpi_info *info = get_board_info();
+    int cached = info != NULL && !board_given && strcmp(gpio_backend->name, "mmio") == 0;
+    uint32_t peri_base;
+    size_t i;
+
+    chip = unknown_chip;
+    if (info != NULL) {
+        for (i = 0; i < sizeof(chips) / sizeof(chips[0]); i++) {
+            if (strcmp(info->processor, chips[i].name) == 0)
+                chip = chips[i];
+        }
+    }
+
+    if (!cached || read_chip_cache(info->revision, &chip) != 0) {
+        if ((peri_base = dt_peri_base()) != 0)
+            chip.peri_base = peri_base;
+        chip.pull_wait_loops = calibrate_wait();
+        if (cached)
+            write_chip_cache(info->revision, &chip);
+    }
+    gpio_chip = &chip;
+}
+
+static void mmio_select_pulls(void);
+
+static int mmio_setup(void)
 {
     int mem_fd;
     uint8_t *gpio_mem;
-    uint32_t peri_base = 0;
     uint32_t gpio_base;
-    unsigned char buf[4];
-    FILE *fp;
-    char buffer[1024];
-    char hardware[1024];
-    int found = 0;
 
     // try /dev/gpiomem first - this does not require root privs
     if ((mem_fd = open("/dev/gpiomem", O_RDWR|O_SYNC)) > 0)
@@ -84,45 +277,15 @@ int setup(void)
         if ((gpio_map = (uint32_t *)mmap(NULL, BLOCK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, mem_fd, 0)) == MAP_FAILED) {
             return SETUP_MMAP_FAIL;
         } else {
+            mmio_select_pulls();
             return SETUP_OK;
         }
     }
 
     // revert to /dev/mem method - requires root
-
-    // determine peri_base
-    if ((fp = fopen("/proc/device-tree/soc/ranges", "rb")) != NULL) {
-        // get peri base from device tree
-        fseek(fp, 4, SEEK_SET);
-        if (fread(buf, 1, sizeof buf, fp) == sizeof buf) {
-            peri_base = buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3] << 0;
-        }
-        fclose(fp);
-    } else {
-        // guess peri base based on /proc/cpuinfo hardware field
-        if ((fp = fopen("/proc/cpuinfo", "r")) == NULL)
-            return SETUP_CPUINFO_FAIL;
-
-        while(!feof(fp) && !found && fgets(buffer, sizeof(buffer), fp)) {
-            sscanf(buffer, "Hardware	: %s", hardware);
-            if (strcmp(hardware, "BCM2708") == 0 || strcmp(hardware, "BCM2835") == 0) {
-                // pi 1 hardware
-                peri_base = BCM2708_PERI_BASE_DEFAULT;
-                found = 1;
-            } else if (strcmp(hardware, "BCM2709") == 0 || strcmp(hardware, "BCM2836") == 0) {
-                // pi 2 hardware
-                peri_base = BCM2709_PERI_BASE_DEFAULT;
-                found = 1;
-            }
-        }
-        fclose(fp);
-        if (!found)
-            return SETUP_NOT_RPI_FAIL;
-    }
-
-    if (!peri_base)
+    if (!chip.peri_base)
         return SETUP_NOT_RPI_FAIL;
-    gpio_base = peri_base + GPIO_BASE_OFFSET;
+    gpio_base = chip.peri_base + GPIO_BASE_OFFSET;
 
     // mmap the GPIO memory registers
     if ((mem_fd = open("/dev/mem", O_RDWR|O_SYNC) ) < 0)
@@ -137,135 +300,163 @@ int setup(void)
     if ((gpio_map = (uint32_t *)mmap( (void *)gpio_mem, BLOCK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, mem_fd, gpio_base)) == MAP_FAILED)
         return SETUP_MMAP_FAIL;
 
+    mmio_select_pulls();
     return SETUP_OK;
 }
 
-void clear_event_detect(int gpio)
+static void mmio_cleanup(void)
 {
-    int offset = EVENT_DETECT_OFFSET + (gpio/32);
-    int shift = (gpio%32);
+    int i;
 
-    *(gpio_map+offset) |= (1 << shift);
-    short_wait();
-    *(gpio_map+offset) = 0;
+    munmap((void *)gpio_map, BLOCK_SIZE);
+    for (i = 0; i < PERIPHERAL_COUNT; i++) {
+        if (peripheral_map[i] != NULL) {
+            munmap((void *)peripheral_map[i], PERIPHERAL_BLOCK_SIZE);
+            peripheral_map[i] = NULL;
+        }
+    }
 }
 
-int eventdetected(int gpio)
+// the status bits are write-1-to-clear, so one store acknowledges every
+// event in mask and leaves the rest latched
+static void mmio_clear_events(int bank, uint32_t mask)
 {
-    int offset, value, bit;
+    *(gpio_map+EVENT_DETECT_OFFSET+bank) = mask;
+}
 
-    offset = EVENT_DETECT_OFFSET + (gpio/32);
-    bit = (1 << (gpio%32));
-    value = *(gpio_map+offset) & bit;
-    if (value)
-        clear_event_detect(gpio);
-    return value;
+static uint32_t mmio_event_status(int bank)
+{
+    return *(gpio_map+EVENT_DETECT_OFFSET+bank);
 }
 
-void set_rising_event(int gpio, int enable)
+static void mmio_set_event(int type, int gpio, int enable)
 {
-    int offset = RISING_ED_OFFSET + (gpio/32);
-    int shift = (gpio%32);
+    static const int offsets[] = {
+        RISING_ED_OFFSET, FALLING_ED_OFFSET, HIGH_DETECT_OFFSET, LOW_DETECT_OFFSET
+    };
+    int offset = offsets[type] + GPIO_BANK(gpio);
 
     if (enable)
-        *(gpio_map+offset) |= 1 << shift;
+        *(gpio_map+offset) |= GPIO_MASK(gpio);
     else
-        *(gpio_map+offset) &= ~(1 << shift);
-    clear_event_detect(gpio);
+        *(gpio_map+offset) &= ~GPIO_MASK(gpio);
+    mmio_clear_events(GPIO_BANK(gpio), GPIO_MASK(gpio));
 }
 
-void set_falling_event(int gpio, int enable)
+// Pi 4 pull-up/down method: 2 bits per pin, 16 pins per register
+static uint32_t pull_bits_2711(int pud)
 {
-    int offset = FALLING_ED_OFFSET + (gpio/32);
-    int shift = (gpio%32);
-
-    if (enable) {
-        *(gpio_map+offset) |= (1 << shift);
-        *(gpio_map+offset) = (1 << shift);
-    } else {
-        *(gpio_map+offset) &= ~(1 << shift);
+    switch (pud) {
+        case PUD_UP:   return 1;
+        case PUD_DOWN: return 2;
+        default:       return 0; // switch PUD to OFF for other values
     }
-    clear_event_detect(gpio);
 }
 
-void set_high_event(int gpio, int enable)
+static void mmio_set_pullupdn_2711(int gpio, int pud)
 {
-    int offset = HIGH_DETECT_OFFSET + (gpio/32);
-    int shift = (gpio%32);
+    int pullreg = PULLUPDN_OFFSET_2711_0 + (gpio >> 4);
+    int pullshift = (gpio & 0xf) << 1;
+    uint32_t pullbits;
+
+    pullbits = *(gpio_map + pullreg);
+    pullbits &= ~(3 << pullshift);
+    pullbits |= (pull_bits_2711(pud) << pullshift);
+    *(gpio_map + pullreg) = pullbits;
+}
 
-    if (enable)
-        *(gpio_map+offset) |= (1 << shift);
-    else
-        *(gpio_map+offset) &= ~(1 << shift);
-    clear_event_detect(gpio);
+// legacy method: latch the pull value into the pins selected in a bank's
+// clock register. pud is PUD_OFF, PUD_DOWN or PUD_UP, which are the control
+// register's encodings
+static void legacy_clock_pull(int pud, uint32_t bank0, uint32_t bank1)
+{
+    *(gpio_map+PULLUPDN_OFFSET) = (*(gpio_map+PULLUPDN_OFFSET) & ~3) | pud;
+    short_wait();
+    if (bank0)
+        *(gpio_map+PULLUPDNCLK_OFFSET) = bank0;
+    if (bank1)
+        *(gpio_map+PULLUPDNCLK_OFFSET+1) = bank1;
+    short_wait();
+    *(gpio_map+PULLUPDN_OFFSET) &= ~3;
+    if (bank0)
+        *(gpio_map+PULLUPDNCLK_OFFSET) = 0;
+    if (bank1)
+        *(gpio_map+PULLUPDNCLK_OFFSET+1) = 0;
 }
 
-void set_low_event(int gpio, int enable)
+static void mmio_set_pullupdn_legacy(int gpio, int pud)
 {
-    int offset = LOW_DETECT_OFFSET + (gpio/32);
-    int shift = (gpio%32);
+    if (pud != PUD_DOWN && pud != PUD_UP)
+        pud = PUD_OFF;
+    legacy_clock_pull(pud, GPIO_BANK(gpio) == 0 ? GPIO_MASK(gpio) : 0, GPIO_BANK(gpio) == 1 ? GPIO_MASK(gpio) : 0);
+}
 
-    if (enable)
-        *(gpio_map+offset) |= 1 << shift;
-    else
-        *(gpio_map+offset) &= ~(1 << shift);
-    clear_event_detect(gpio);
-}
-
-void set_pullupdn(int gpio, int pud)
-{
-    // Check GPIO register
-    int is2711 = *(gpio_map+PULLUPDN_OFFSET_2711_3) != 0x6770696f;
-    if (is2711) {
-        // Pi 4 Pull-up/down method
-        int pullreg = PULLUPDN_OFFSET_2711_0 + (gpio >> 4);
-        int pullshift = (gpio & 0xf) << 1;
-        unsigned int pullbits;
-        unsigned int pull = 0;
-        switch (pud) {
-            case PUD_OFF:  pull = 0; break;
-            case PUD_UP:   pull = 1; break;
-            case PUD_DOWN: pull = 2; break;
-            default:       pull = 0; // switch PUD to OFF for other values
-        }
-        pullbits = *(gpio_map + pullreg);
-        pullbits &= ~(3 << pullshift);
-        pullbits |= (pull << pullshift);
-        *(gpio_map + pullreg) = pullbits;
-    } else {
-        // Legacy Pull-up/down method
-        int clk_offset = PULLUPDNCLK_OFFSET + (gpio/32);
-        int shift = (gpio%32);
-
-        if (pud == PUD_DOWN) {
-            *(gpio_map+PULLUPDN_OFFSET) = (*(gpio_map+PULLUPDN_OFFSET) & ~3) | PUD_DOWN;
-        } else if (pud == PUD_UP) {
-            *(gpio_map+PULLUPDN_OFFSET) = (*(gpio_map+PULLUPDN_OFFSET) & ~3) | PUD_UP;
-        } else  { // pud == PUD_OFF
-            *(gpio_map+PULLUPDN_OFFSET) &= ~3;
+// one store per function select register the plan changes
+static void mmio_plan_functions(const struct gpio_plan *plan)
+{
+    uint32_t fsel;
+    int reg;
+
+    for (reg = 0; reg < 6; reg++) {
+        fsel = *(gpio_map+FSEL_OFFSET+reg);
+        if (plan_fsel_word(plan, reg, fsel) != fsel)
+            *(gpio_map+FSEL_OFFSET+reg) = plan_fsel_word(plan, reg, fsel);
+    }
+}
+
+static int mmio_setup_many_2711(const struct gpio_plan *plan)
+{
+    uint32_t pullbits;
+    int gpio, reg, changed;
+
+    for (reg = 0; reg < 4; reg++) {
+        pullbits = *(gpio_map+PULLUPDN_OFFSET_2711_0+reg);
+        changed = 0;
+        for (gpio = reg * 16; gpio < reg * 16 + 16 && gpio < 54; gpio++) {
+            if (!(plan->mask[GPIO_BANK(gpio)] & GPIO_MASK(gpio)))
+                continue;
+            pullbits &= ~(3 << ((gpio & 0xf) << 1));
+            pullbits |= pull_bits_2711(plan->pud[gpio]) << ((gpio & 0xf) << 1);
+            changed = 1;
         }
-        short_wait();
-        *(gpio_map+clk_offset) = 1 << shift;
-        short_wait();
-        *(gpio_map+PULLUPDN_OFFSET) &= ~3;
-        *(gpio_map+clk_offset) = 0;
+        if (changed)
+            *(gpio_map+PULLUPDN_OFFSET_2711_0+reg) = pullbits;
+    }
+    mmio_plan_functions(plan);
+    return 0;
+}
+
+// every pin of the plan with the same pull value is clocked in one sequence
+static int mmio_setup_many_legacy(const struct gpio_plan *plan)
+{
+    uint32_t clock[3][2] = {{0}};
+    int gpio, pud;
+
+    for (gpio = 0; gpio < 54; gpio++) {
+        if (!(plan->mask[GPIO_BANK(gpio)] & GPIO_MASK(gpio)))
+            continue;
+        pud = plan->pud[gpio] == PUD_DOWN || plan->pud[gpio] == PUD_UP ? plan->pud[gpio] : PUD_OFF;
+        clock[pud][GPIO_BANK(gpio)] |= GPIO_MASK(gpio);
+    }
+    for (pud = PUD_OFF; pud <= PUD_UP; pud++) {
+        if (clock[pud][0] || clock[pud][1])
+            legacy_clock_pull(pud, clock[pud][0], clock[pud][1]);
     }
+    mmio_plan_functions(plan);
+    return 0;
 }
 
-void setup_gpio(int gpio, int direction, int pud)
+static int mmio_set_function(int gpio, int function)
 {
     int offset = FSEL_OFFSET + (gpio/10);
     int shift = (gpio%10)*3;
 
-    set_pullupdn(gpio, pud);
-    if (direction == OUTPUT)
-        *(gpio_map+offset) = (*(gpio_map+offset) & ~(7<<shift)) | (1<<shift);
-    else  // direction == INPUT
-        *(gpio_map+offset) = (*(gpio_map+offset) & ~(7<<shift));
+    *(gpio_map+offset) = (*(gpio_map+offset) & ~(7<<shift)) | (function<<shift);
+    return 0;
 }
 
 // Contribution by Eric Ptak <trouch@trouch.com>
-int gpio_function(int gpio)
+static int mmio_get_function(int gpio)
 {
     int offset = FSEL_OFFSET + (gpio/10);
     int shift = (gpio%10)*3;
@@ -275,31 +466,231 @@ int gpio_function(int gpio)
     return value; // 0=input, 1=output, 4=alt0
 }
 
-void output_gpio(int gpio, int value)
+static void mmio_output_bank(int bank, uint32_t set, uint32_t clr)
+{
+    if (set)
+        *(gpio_map+SET_OFFSET+bank) = set;
+    if (clr)
+        *(gpio_map+CLR_OFFSET+bank) = clr;
+}
+
+static uint32_t mmio_input_bank(int bank)
+{
+    return *(gpio_map+PINLEVEL_OFFSET+bank);
+}
+
+static volatile uint32_t *mmio_registers(void)
+{
+    return gpio_map;
+}
+
+// /dev/gpiomem only reaches the GPIO block, so the other peripherals always
+// come through /dev/mem and need root
+static volatile uint32_t *mmio_peripheral(int which)
+{
+    static const uint32_t offsets[] = {
+        PWM_BASE_OFFSET, CLOCK_BASE_OFFSET, PCM_BASE_OFFSET, DMA_BASE_OFFSET
+    };
+    void *map;
+    int mem_fd;
+
+    if (peripheral_map[which] != NULL)
+        return peripheral_map[which];
+
+    if (!chip.peri_base)
+        return NULL;
+    if ((mem_fd = open("/dev/mem", O_RDWR|O_SYNC)) < 0)
+        return NULL;
+    map = mmap(NULL, PERIPHERAL_BLOCK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, mem_fd, chip.peri_base + offsets[which]);
+    close(mem_fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    peripheral_map[which] = (volatile uint32_t *)map;
+    return peripheral_map[which];
+}
+
+// the GPIO registers of a real Pi, through /dev/gpiomem or /dev/mem. the
+// pull routines are swapped for the chip's own once the registers are mapped
+static struct gpio_backend mmio_backend = {
+    "mmio",
+    get_rpi_info,
+    mmio_setup,
+    mmio_cleanup,
+    mmio_set_function,
+    mmio_get_function,
+    mmio_set_pullupdn_legacy,
+    mmio_setup_many_legacy,
+    mmio_output_bank,
+    mmio_input_bank,
+    mmio_set_event,
+    mmio_event_status,
+    mmio_clear_events,
+    mmio_registers,
+    mmio_peripheral,
+};
+
+const struct gpio_backend *gpio_backend = &mmio_backend;
+
+// the 2711 has its own pull registers; on older chips that word reads back
+// "gpio". checked once, so the pull routines don't branch on it per call
+static void mmio_select_pulls(void)
+{
+    if (*(gpio_map+PULLUPDN_OFFSET_2711_3) != PULLUPDN_LEGACY_MAGIC) {
+        chip.pull_scheme = PULL_2711;
+        mmio_backend.set_pullupdn = mmio_set_pullupdn_2711;
+        mmio_backend.setup_many = mmio_setup_many_2711;
+    } else {
+        chip.pull_scheme = PULL_LEGACY;
+        mmio_backend.set_pullupdn = mmio_set_pullupdn_legacy;
+        mmio_backend.setup_many = mmio_setup_many_legacy;
+    }
+}
+
+// choose the backend by name; NULL or "" keeps the default. returns 0 on
+// success, -1 for an unknown name
+int select_backend(const char *name)
+{
+    if (name == NULL || *name == '\0' || strcmp(name, mmio_backend.name) == 0) {
+        gpio_backend = &mmio_backend;
+    } else if (strcmp(name, sim_backend.name) == 0) {
+        gpio_backend = &sim_backend;
+    } else if (strcmp(name, chardev_backend.name) == 0) {
+        gpio_backend = &chardev_backend;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int setup(void)
+{
+    detect_chip();
+    return gpio_backend->setup();
+}
+
+int eventdetected(int gpio)
+{
+    int bank = GPIO_BANK(gpio);
+    uint32_t value = gpio_backend->event_status(bank) & GPIO_MASK(gpio);
+
+    if (value)
+        gpio_backend->clear_events(bank, value);
+    return value != 0;
+}
+
+void set_rising_event(int gpio, int enable)
+{
+    gpio_backend->set_event(EVENT_RISING, gpio, enable);
+}
+
+void set_falling_event(int gpio, int enable)
+{
+    gpio_backend->set_event(EVENT_FALLING, gpio, enable);
+}
+
+void set_high_event(int gpio, int enable)
+{
+    gpio_backend->set_event(EVENT_HIGH, gpio, enable);
+}
+
+void set_low_event(int gpio, int enable)
+{
+    gpio_backend->set_event(EVENT_LOW, gpio, enable);
+}
+
+// 0, or -1 with errno set if the backend couldn't take the pin
+int setup_gpio(int gpio, int direction, int pud)
+{
+    gpio_backend->set_pullupdn(gpio, pud);
+    if (direction == OUTPUT)
+        return gpio_backend->set_function(gpio, FSEL_OUTPUT);
+    else  // direction == INPUT
+        return gpio_backend->set_function(gpio, FSEL_INPUT);
+}
+
+void plan_gpio(struct gpio_plan *plan, int gpio, int direction, int pud)
+{
+    plan->mask[GPIO_BANK(gpio)] |= GPIO_MASK(gpio);
+    plan->function[gpio] = direction == OUTPUT ? FSEL_OUTPUT : FSEL_INPUT;
+    plan->pud[gpio] = pud;
+}
+
+// like setup_gpio on each pin of the plan in turn, but with the register
+// writes for all of them coalesced. 0, or -1 with errno set
+int setup_gpios(const struct gpio_plan *plan)
+{
+    if (plan->mask[0] || plan->mask[1])
+        return gpio_backend->setup_many(plan);
+    return 0;
+}
+
+// function select register reg (10 pins of 3 bits) with the plan's pins
+// changed; word is its current value
+uint32_t plan_fsel_word(const struct gpio_plan *plan, int reg, uint32_t word)
 {
-    int offset, shift;
+    int gpio, shift;
 
+    for (gpio = reg * 10; gpio < reg * 10 + 10 && gpio < 54; gpio++) {
+        if (!(plan->mask[GPIO_BANK(gpio)] & GPIO_MASK(gpio)))
+            continue;
+        shift = (gpio % 10) * 3;
+        word = (word & ~(7 << shift)) | ((uint32_t)plan->function[gpio] << shift);
+    }
+    return word;
+}
+
+int gpio_function(int gpio)
+{
+    return gpio_backend->get_function(gpio);
+}
+
+void output_gpio(int gpio, int value)
+{
     if (value) // value == HIGH
-        offset = SET_OFFSET + (gpio/32);
+        gpio_backend->output_bank(GPIO_BANK(gpio), GPIO_MASK(gpio), 0);
     else       // value == LOW
-       offset = CLR_OFFSET + (gpio/32);
-
-    shift = (gpio%32);
+        gpio_backend->output_bank(GPIO_BANK(gpio), 0, GPIO_MASK(gpio));
+}
 
-    *(gpio_map+offset) = 1 << shift;
+// drive every pin in set high and every pin in clr low with one store each
+void output_gpio_bank(int bank, uint32_t set, uint32_t clr)
+{
+    gpio_backend->output_bank(bank, set, clr);
 }
 
 int input_gpio(int gpio)
 {
-   int offset, value, mask;
+    return gpio_backend->input_bank(GPIO_BANK(gpio)) & GPIO_MASK(gpio);
+}
+
+// levels of all 32 pins in a bank from a single load
+uint32_t input_gpio_bank(int bank)
+{
+    return gpio_backend->input_bank(bank);
+}
+
+// register addresses for callers that resolve a pin once and then access the
+// hardware directly (see rb_pin.c); NULL if the backend has no such registers
+volatile uint32_t *gpio_set_register(int gpio)
+{
+    volatile uint32_t *map = gpio_backend->registers();
+    return map ? map + SET_OFFSET + GPIO_BANK(gpio) : NULL;
+}
+
+volatile uint32_t *gpio_clr_register(int gpio)
+{
+    volatile uint32_t *map = gpio_backend->registers();
+    return map ? map + CLR_OFFSET + GPIO_BANK(gpio) : NULL;
+}
 
-   offset = PINLEVEL_OFFSET + (gpio/32);
-   mask = (1 << gpio%32);
-   value = *(gpio_map+offset) & mask;
-   return value;
+volatile uint32_t *gpio_level_register(int gpio)
+{
+    volatile uint32_t *map = gpio_backend->registers();
+    return map ? map + PINLEVEL_OFFSET + GPIO_BANK(gpio) : NULL;
 }
 
 void cleanup(void)
 {
-    munmap((void *)gpio_map, BLOCK_SIZE);
+    gpio_backend->cleanup();
 }
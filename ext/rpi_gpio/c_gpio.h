@@ -24,17 +24,30 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#ifndef C_GPIO_H
+#define C_GPIO_H
+
+#include <stdint.h>
+#include "cpuinfo.h"
+
 int setup(void);
-void setup_gpio(int gpio, int direction, int pud);
+const rpi_info *get_board_info(void);
+void short_wait(void);
+int setup_gpio(int gpio, int direction, int pud);
 int gpio_function(int gpio);
 void output_gpio(int gpio, int value);
+void output_gpio_bank(int bank, uint32_t set, uint32_t clr);
 int input_gpio(int gpio);
+uint32_t input_gpio_bank(int bank);
 void set_rising_event(int gpio, int enable);
 void set_falling_event(int gpio, int enable);
 void set_high_event(int gpio, int enable);
 void set_low_event(int gpio, int enable);
 int eventdetected(int gpio);
 void cleanup(void);
+volatile uint32_t *gpio_set_register(int gpio);
+volatile uint32_t *gpio_clr_register(int gpio);
+volatile uint32_t *gpio_level_register(int gpio);
 
 #define SETUP_OK           0
 #define SETUP_DEVMEM_FAIL  1
@@ -42,10 +55,15 @@ void cleanup(void);
 #define SETUP_MMAP_FAIL    3
 #define SETUP_CPUINFO_FAIL 4
 #define SETUP_NOT_RPI_FAIL 5
+#define SETUP_CHARDEV_FAIL 6
 
 #define INPUT  1 // is really 0 for control register!
 #define OUTPUT 0 // is really 1 for control register!
 #define ALT0   4
+#define ALT5   2
+
+#define FSEL_INPUT  0
+#define FSEL_OUTPUT 1
 
 #define HIGH 1
 #define LOW  0
@@ -53,3 +71,123 @@ void cleanup(void);
 #define PUD_OFF  0
 #define PUD_DOWN 1
 #define PUD_UP   2
+
+#define GPIO_BANK(gpio) ((gpio) / 32)
+#define GPIO_MASK(gpio) ((uint32_t)1 << ((gpio) % 32))
+
+#define EVENT_RISING  0
+#define EVENT_FALLING 1
+#define EVENT_HIGH    2
+#define EVENT_LOW     3
+
+// an edge seen on a pin, with a CLOCK_MONOTONIC timestamp and a sequence
+// number from whatever reported it
+struct gpio_event
+{
+    unsigned int gpio;
+    int level;
+    uint64_t timestamp_ns;
+    uint32_t seqno;
+};
+
+// many pins to set up at once (see setup_gpios): every pin in mask, per bank,
+// gets function[gpio] and pud[gpio]
+struct gpio_plan
+{
+    uint32_t mask[2];
+    uint8_t function[54];
+    uint8_t pud[54];
+};
+
+void plan_gpio(struct gpio_plan *plan, int gpio, int direction, int pud);
+int setup_gpios(const struct gpio_plan *plan);
+uint32_t plan_fsel_word(const struct gpio_plan *plan, int reg, uint32_t word);
+
+// GPIO register block layout, in 32-bit words
+#define GPIO_BLOCK_SIZE             (4*1024)
+#define FSEL_OFFSET                 0   // 0x0000
+#define SET_OFFSET                  7   // 0x001c / 4
+#define CLR_OFFSET                  10  // 0x0028 / 4
+#define PINLEVEL_OFFSET             13  // 0x0034 / 4
+#define EVENT_DETECT_OFFSET         16  // 0x0040 / 4
+#define RISING_ED_OFFSET            19  // 0x004c / 4
+#define FALLING_ED_OFFSET           22  // 0x0058 / 4
+#define HIGH_DETECT_OFFSET          25  // 0x0064 / 4
+#define LOW_DETECT_OFFSET           28  // 0x0070 / 4
+#define PULLUPDN_OFFSET             37  // 0x0094 / 4
+#define PULLUPDNCLK_OFFSET          38  // 0x0098 / 4
+
+#define PULLUPDN_OFFSET_2711_0      57
+#define PULLUPDN_OFFSET_2711_1      58
+#define PULLUPDN_OFFSET_2711_2      59
+#define PULLUPDN_OFFSET_2711_3      60
+
+// PULLUPDN_OFFSET_2711_3 reads as "gpio" on chips without the 2711 pull registers
+#define PULLUPDN_LEGACY_MAGIC       0x6770696f
+
+// peripherals other than GPIO that a backend can map (see
+// gpio_backend.peripheral), each one 4 KiB page
+#define PERIPHERAL_PWM              0
+#define PERIPHERAL_CLOCK            1
+#define PERIPHERAL_PCM              2
+#define PERIPHERAL_DMA              3
+#define PERIPHERAL_COUNT            4
+#define PERIPHERAL_BLOCK_SIZE       (4*1024)
+
+// the operations every register backend provides. a backend is chosen when
+// the gem is loaded (see select_backend) and everything above dispatches
+// through it
+struct gpio_backend
+{
+    const char *name;
+    int (*board_info)(rpi_info *info);
+    int (*setup)(void);
+    void (*cleanup)(void);
+    // 0, or -1 with errno set if the pin can't be configured
+    int (*set_function)(int gpio, int function);
+    int (*get_function)(int gpio);
+    void (*set_pullupdn)(int gpio, int pud);
+    // pulls and then functions of every pin in a plan, in as few register
+    // writes as the backend can manage. 0, or -1 with errno set
+    int (*setup_many)(const struct gpio_plan *plan);
+    void (*output_bank)(int bank, uint32_t set, uint32_t clr);
+    uint32_t (*input_bank)(int bank);
+    void (*set_event)(int type, int gpio, int enable);
+    uint32_t (*event_status)(int bank);
+    void (*clear_events)(int bank, uint32_t mask);
+    // the register block itself, if writes to it act directly on the pins;
+    // NULL otherwise
+    volatile uint32_t *(*registers)(void);
+    // the registers of another peripheral (PERIPHERAL_*), mapped on first
+    // use; NULL if the backend can't reach them
+    volatile uint32_t *(*peripheral)(int which);
+};
+
+extern const struct gpio_backend *gpio_backend;
+int select_backend(const char *name);
+
+#define CHIP_UNKNOWN  -1
+#define CHIP_BCM2835  0
+#define CHIP_BCM2836  1
+#define CHIP_BCM2837  2
+#define CHIP_BCM2711  3
+
+#define PULL_LEGACY 0   // PUD control register clocked into PUDCLK0/1
+#define PULL_2711   1   // 2 bits per pin in GPIO_PUP_PDN_CNTRL_REG0..3
+
+// the SoC, worked out once by setup() from the board's revision, the device
+// tree and, on the real registers, which pull interface is there
+struct gpio_chip
+{
+    const char *name;
+    int family;                 // CHIP_*
+    uint32_t peri_base;         // ARM physical address of the peripherals
+    int pin_count;              // GPIO lines on the chip, not all of them usable
+    int pull_scheme;            // PULL_*
+    double osc_freq;            // crystal feeding the PWM clock, in Hz
+    unsigned int pull_wait_loops;   // short_wait iterations
+};
+
+extern const struct gpio_chip *gpio_chip;   // NULL until setup()
+
+#endif /* C_GPIO_H */
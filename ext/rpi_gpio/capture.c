@@ -0,0 +1,347 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture.h"
+
+// longest single sleep, so that a stop request is noticed promptly
+#define MAX_SLEEP_NS 100000000LL
+
+struct capture
+{
+    void *base;
+    size_t length;
+    int fd;
+    int writable;
+    pthread_t thread;
+    volatile int running;
+    int started;
+    struct capture *next;
+};
+
+// captures that have started and not yet stopped
+static struct capture *captures;
+static pthread_mutex_t captures_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until(struct capture *c, int64_t deadline)
+{
+    struct timespec ts;
+    int64_t now = now_ns();
+
+    while (c->running && now < deadline)
+    {
+        if (deadline - now > MAX_SLEEP_NS)
+            deadline = now + MAX_SLEEP_NS;
+        ts.tv_sec = deadline / 1000000000LL;
+        ts.tv_nsec = deadline % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        now = now_ns();
+    }
+}
+
+// a buffer of bytes bytes, mapped from a new file at path or, without a path,
+// from anonymous memory
+struct capture *capture_create(const char *path, size_t bytes)
+{
+    struct capture *c;
+    struct capture_header *h;
+
+    if (bytes < sizeof(struct capture_header) + sizeof(struct capture_record))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((c = calloc(1, sizeof(struct capture))) == NULL)
+        return NULL;
+    c->fd = -1;
+    c->length = bytes;
+    c->writable = 1;
+
+    if (path != NULL)
+    {
+        if ((c->fd = open(path, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644)) < 0 || ftruncate(c->fd, bytes) < 0)
+            goto fail;
+        c->base = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_SHARED, c->fd, 0);
+    }
+    else
+    {
+        c->base = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    }
+    if (c->base == MAP_FAILED)
+        goto fail;
+
+    h = c->base;
+    h->magic = CAPTURE_MAGIC;
+    h->version = CAPTURE_VERSION;
+    h->capacity = (bytes - sizeof(struct capture_header)) / sizeof(struct capture_record);
+    return c;
+
+fail:
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c);
+    return NULL;
+}
+
+// map a finished capture file read-only
+struct capture *capture_open(const char *path)
+{
+    struct capture *c;
+    struct capture_header *h;
+    struct stat st;
+
+    if ((c = calloc(1, sizeof(struct capture))) == NULL)
+        return NULL;
+    if ((c->fd = open(path, O_RDONLY|O_CLOEXEC)) < 0)
+        goto fail;
+    if (fstat(c->fd, &st) < 0)
+        goto fail;
+    if ((size_t)st.st_size < sizeof(struct capture_header))
+    {
+        errno = EINVAL;
+        goto fail;
+    }
+    c->length = st.st_size;
+    if ((c->base = mmap(NULL, c->length, PROT_READ, MAP_SHARED, c->fd, 0)) == MAP_FAILED)
+        goto fail;
+
+    h = c->base;
+    if (h->magic != CAPTURE_MAGIC || h->version != CAPTURE_VERSION ||
+        h->count > (c->length - sizeof(struct capture_header)) / sizeof(struct capture_record))
+    {
+        munmap(c->base, c->length);
+        errno = EINVAL;
+        goto fail;
+    }
+    return c;
+
+fail:
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c);
+    return NULL;
+}
+
+static inline uint32_t read_bank(volatile uint32_t *reg, int bank)
+{
+    return reg != NULL ? *reg : input_gpio_bank(bank);
+}
+
+static void *capture_thread(void *arg)
+{
+    struct capture *c = arg;
+    struct capture_header *h = c->base;
+    struct capture_record *records = (struct capture_record *)(h + 1);
+    volatile uint32_t *lev0 = gpio_level_register(0);
+    volatile uint32_t *lev1 = gpio_level_register(32);
+    uint32_t prev[2], cur[2];
+    uint64_t count = 0, last = 0, gap;
+    int64_t start, now, deadline;
+
+    prev[0] = h->initial[0];
+    prev[1] = h->initial[1];
+    start = h->start_ns;
+    deadline = start;
+
+    while (c->running)
+    {
+        deadline += h->period_ns;
+        sleep_until(c, deadline);
+        if (!c->running)
+            break;
+
+        cur[0] = h->mask[0] ? read_bank(lev0, 0) & h->mask[0] : 0;
+        cur[1] = h->mask[1] ? read_bank(lev1, 1) & h->mask[1] : 0;
+        now = now_ns();
+        h->samples++;
+        if (now - deadline >= (int64_t)h->period_ns)
+        {
+            // don't try to catch up on missed samples
+            h->late_samples++;
+            deadline = now;
+        }
+
+        if (cur[0] != prev[0] || cur[1] != prev[1])
+        {
+            gap = now - start - last;
+            while (gap > UINT32_MAX && count < h->capacity)
+            {
+                records[count].delta_ns = UINT32_MAX;
+                records[count].toggled[0] = records[count].toggled[1] = 0;
+                gap -= UINT32_MAX;
+                last += UINT32_MAX;
+                count++;
+            }
+            if (count == h->capacity)
+            {
+                h->flags |= CAPTURE_FULL;
+                c->running = 0;
+                break;
+            }
+            records[count].delta_ns = gap;
+            records[count].toggled[0] = cur[0] ^ prev[0];
+            records[count].toggled[1] = cur[1] ^ prev[1];
+            last += gap;
+            count++;
+            prev[0] = cur[0];
+            prev[1] = cur[1];
+
+            // a reader may look at the records while the capture runs
+            __atomic_store_n(&h->count, count, __ATOMIC_RELEASE);
+        }
+        h->end_ns = now - start;
+    }
+    __atomic_store_n(&h->count, count, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// starts sampling on a thread run with rt, or with the default real-time
+// policy if rt is NULL
+int capture_start(struct capture *c, uint64_t period_ns, const uint32_t mask[2], const struct rt_policy *rt)
+{
+    struct capture_header *h = c->base;
+
+    if (!c->writable || c->started)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    h->period_ns = period_ns;
+    h->mask[0] = mask[0];
+    h->mask[1] = mask[1];
+    h->count = h->samples = h->late_samples = h->end_ns = 0;
+    h->flags = 0;
+    h->initial[0] = mask[0] ? input_gpio_bank(0) & mask[0] : 0;
+    h->initial[1] = mask[1] ? input_gpio_bank(1) & mask[1] : 0;
+    h->start_ns = now_ns();
+
+    c->running = 1;
+    if (rt_thread_create(&c->thread, capture_thread, c, rt) != 0)
+    {
+        c->running = 0;
+        return -1;
+    }
+    c->started = 1;
+
+    pthread_mutex_lock(&captures_lock);
+    c->next = captures;
+    captures = c;
+    pthread_mutex_unlock(&captures_lock);
+    return 0;
+}
+
+// stop sampling and, for a file, cut it down to the records written
+void capture_stop(struct capture *c)
+{
+    struct capture_header *h = c->base;
+    struct capture **link;
+
+    if (!c->started)
+        return;
+    c->running = 0;
+    pthread_join(c->thread, NULL);
+    c->started = 0;
+    c->writable = 0;
+
+    pthread_mutex_lock(&captures_lock);
+    for (link = &captures; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == c)
+        {
+            *link = c->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&captures_lock);
+
+    if (c->fd >= 0)
+    {
+        msync(c->base, c->length, MS_SYNC);
+        if (ftruncate(c->fd, sizeof(struct capture_header) + h->count * sizeof(struct capture_record)) < 0)
+            return;
+    }
+}
+
+// stop every capture that is still sampling
+void capture_stop_all(void)
+{
+    struct capture *c;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&captures_lock);
+        c = captures;
+        pthread_mutex_unlock(&captures_lock);
+        if (c == NULL)
+            return;
+        capture_stop(c);
+    }
+}
+
+int capture_running(struct capture *c)
+{
+    return c->running;
+}
+
+struct capture_header *capture_header(struct capture *c)
+{
+    return c->base;
+}
+
+const struct capture_record *capture_records(struct capture *c)
+{
+    return (const struct capture_record *)((struct capture_header *)c->base + 1);
+}
+
+// bytes of the buffer in use: the header and the records written so far
+size_t capture_length(struct capture *c)
+{
+    struct capture_header *h = c->base;
+    return sizeof(struct capture_header) +
+        __atomic_load_n(&h->count, __ATOMIC_ACQUIRE) * sizeof(struct capture_record);
+}
+
+void capture_free(struct capture *c)
+{
+    capture_stop(c);
+    munmap(c->base, c->length);
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c);
+}
@@ -0,0 +1,79 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Logic-analyzer capture: a native thread samples the pin level registers
+   and stores only the transitions, run-length encoded, in a mapped buffer */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "c_gpio.h"
+#include "realtime.h"
+
+#define CAPTURE_MAGIC   0x43475052   // "RPGC"
+#define CAPTURE_VERSION 1
+#define CAPTURE_FULL    1            // flags: stopped because the buffer filled
+
+// the buffer (and capture file) starts with this header, followed by records
+struct capture_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t period_ns;     // sampling period
+    uint64_t start_ns;      // CLOCK_MONOTONIC time of the first sample
+    uint64_t end_ns;        // time of the latest sample, from start_ns
+    uint64_t capacity;      // number of records that fit
+    uint64_t count;         // number of records written
+    uint64_t samples;
+    uint64_t late_samples;  // samples taken after the next one was due
+    uint32_t mask[2];       // GPIOs sampled
+    uint32_t initial[2];    // their levels at start_ns
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+// after delta_ns more nanoseconds, the GPIOs in toggled changed level. a
+// record with nothing toggled only carries time across gaps too long for
+// delta_ns
+struct capture_record
+{
+    uint32_t delta_ns;
+    uint32_t toggled[2];
+};
+
+struct capture;
+
+struct capture *capture_create(const char *path, size_t bytes);
+struct capture *capture_open(const char *path);
+int capture_start(struct capture *c, uint64_t period_ns, const uint32_t mask[2], const struct rt_policy *rt);
+void capture_stop(struct capture *c);
+void capture_stop_all(void);
+int capture_running(struct capture *c);
+struct capture_header *capture_header(struct capture *c);
+const struct capture_record *capture_records(struct capture *c);
+size_t capture_length(struct capture *c);
+void capture_free(struct capture *c);
+
+#endif /* CAPTURE_H */
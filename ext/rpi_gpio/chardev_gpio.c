@@ -0,0 +1,600 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "chardev_gpio.h"
+
+#define MAX_GPIOS 54
+#define MAX_CHIPS 64
+#define MAX_REQUESTS MAX_GPIOS
+#define EVENT_BATCH 64
+
+// the lines set up together are held in one line request, so reads and writes
+// of many lines are one ioctl per request. lines set up later get a request
+// of their own, which leaves the lines already held (and the levels they
+// drive) alone; a changed line is reconfigured in place
+struct line_request
+{
+    int fd;
+    int lines;
+    unsigned int gpio[GPIO_V2_LINES_MAX];
+};
+
+static int chip_fd = -1;
+static int wake_fd = -1;
+static int num_chip_lines;
+static struct line_request requests[MAX_REQUESTS];
+static int request_count;
+
+static int line_direction[MAX_GPIOS];   // -1 (not requested), INPUT or OUTPUT
+static int line_pud[MAX_GPIOS];
+static int line_edges[MAX_GPIOS];       // bit EVENT_RISING | bit EVENT_FALLING
+static int line_request[MAX_GPIOS];     // index into requests, or -1
+static int line_index[MAX_GPIOS];       // position in its request
+static uint32_t output_latch[2];
+static uint32_t event_latch[2];
+
+// settings to go back to if the kernel refuses a change
+struct line_settings
+{
+    int direction[MAX_GPIOS];
+    int pud[MAX_GPIOS];
+    int edges[MAX_GPIOS];
+};
+
+// requests are only added while nothing is polling them
+static pthread_mutex_t request_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t request_cond = PTHREAD_COND_INITIALIZER;
+static int pollers;
+static int replacing;
+
+static int chardev_board_info(rpi_info *info)
+{
+    const char *revision = getenv("RPI_GPIO_SIM_REVISION");
+
+    // gpio-sim chips on a machine that isn't a Pi stand in for this board
+    if (get_rpi_info(info) == 0)
+        return 0;
+    if (revision != NULL && *revision != '\0')
+        return decode_revision(revision, info);
+    return -1;
+}
+
+// the Pi's own GPIO controller, or RPI_GPIO_CHIP if set
+static int open_chip(void)
+{
+    const char *path = getenv("RPI_GPIO_CHIP");
+    struct gpiochip_info info;
+    char name[32];
+    int fd, i;
+
+    if (path != NULL && *path != '\0') {
+        if ((fd = open(path, O_RDWR|O_CLOEXEC)) < 0)
+            return -1;
+        if (ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info) < 0) {
+            close(fd);
+            return -1;
+        }
+        num_chip_lines = info.lines;
+        return fd;
+    }
+
+    for (i = 0; i < MAX_CHIPS; i++) {
+        snprintf(name, sizeof(name), "/dev/gpiochip%d", i);
+        if ((fd = open(name, O_RDWR|O_CLOEXEC)) < 0)
+            continue;
+        if (ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info) == 0 &&
+            (strncmp(info.label, "pinctrl-bcm", 11) == 0 || strncmp(info.label, "pinctrl-rp1", 11) == 0)) {
+            num_chip_lines = info.lines;
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+static int chardev_setup(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_GPIOS; i++) {
+        line_pud[i] = line_edges[i] = 0;
+        line_direction[i] = line_request[i] = -1;
+    }
+    request_count = 0;
+    if ((chip_fd = open_chip()) < 0)
+        return SETUP_CHARDEV_FAIL;
+    if ((wake_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK)) < 0) {
+        close(chip_fd);
+        chip_fd = -1;
+        return SETUP_CHARDEV_FAIL;
+    }
+    return SETUP_OK;
+}
+
+static void chardev_cleanup(void)
+{
+    int r;
+
+    for (r = 0; r < request_count; r++)
+        close(requests[r].fd);
+    request_count = 0;
+    if (wake_fd >= 0)
+        close(wake_fd);
+    if (chip_fd >= 0)
+        close(chip_fd);
+    wake_fd = chip_fd = -1;
+}
+
+static uint64_t line_flags(int gpio)
+{
+    uint64_t flags;
+
+    if (line_direction[gpio] == OUTPUT)
+        return GPIO_V2_LINE_FLAG_OUTPUT;
+
+    flags = GPIO_V2_LINE_FLAG_INPUT;
+    if (line_pud[gpio] == PUD_UP)
+        flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+    else if (line_pud[gpio] == PUD_DOWN)
+        flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+    else
+        flags |= GPIO_V2_LINE_FLAG_BIAS_DISABLED;
+    if (line_edges[gpio] & (1 << EVENT_RISING))
+        flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+    if (line_edges[gpio] & (1 << EVENT_FALLING))
+        flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    return flags;
+}
+
+// group a request's lines by flags; the first group uses the default flags
+// and the rest (plus the initial output levels) use attributes
+static int build_config(const struct line_request *r, struct gpio_v2_line_config *config)
+{
+    struct gpio_v2_line_config_attribute *attr;
+    uint64_t flags, outputs = 0, values = 0;
+    int i, a;
+
+    memset(config, 0, sizeof(*config));
+    for (i = 0; i < r->lines; i++) {
+        flags = line_flags(r->gpio[i]);
+        if (line_direction[r->gpio[i]] == OUTPUT) {
+            outputs |= 1ULL << i;
+            if (output_latch[GPIO_BANK(r->gpio[i])] & GPIO_MASK(r->gpio[i]))
+                values |= 1ULL << i;
+        }
+        if (i == 0) {
+            config->flags = flags;
+            continue;
+        }
+        if (flags == config->flags)
+            continue;
+        for (a = 0; a < (int)config->num_attrs; a++) {
+            if (config->attrs[a].attr.id == GPIO_V2_LINE_ATTR_ID_FLAGS && config->attrs[a].attr.flags == flags)
+                break;
+        }
+        if (a == (int)config->num_attrs) {
+            if (a == GPIO_V2_LINE_NUM_ATTRS_MAX - 1) {
+                errno = E2BIG;
+                return -1;
+            }
+            config->attrs[a].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+            config->attrs[a].attr.flags = flags;
+            config->num_attrs++;
+        }
+        config->attrs[a].mask |= 1ULL << i;
+    }
+
+    if (outputs) {
+        attr = &config->attrs[config->num_attrs++];
+        attr->attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+        attr->attr.values = values;
+        attr->mask = outputs;
+    }
+    return 0;
+}
+
+// wait until no thread is polling the requests, so one can be added
+static void begin_replace(void)
+{
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&request_lock);
+    replacing = 1;
+    while (pollers > 0) {
+        if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            break;
+        pthread_cond_wait(&request_cond, &request_lock);
+    }
+}
+
+static void end_replace(void)
+{
+    replacing = 0;
+    pthread_cond_broadcast(&request_cond);
+    pthread_mutex_unlock(&request_lock);
+}
+
+// request lines not held yet, together. -1 with errno set (EBUSY if another
+// process holds one of them) if the kernel refuses
+static int add_request(const unsigned int *gpios, int count)
+{
+    struct gpio_v2_line_request req;
+    struct line_request *r;
+    int i, result = -1;
+
+    if (request_count == MAX_REQUESTS || count > GPIO_V2_LINES_MAX) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    begin_replace();
+    r = &requests[request_count];
+    r->lines = count;
+    memcpy(r->gpio, gpios, count * sizeof(gpios[0]));
+
+    memset(&req, 0, sizeof(req));
+    memcpy(req.offsets, gpios, count * sizeof(gpios[0]));
+    strncpy(req.consumer, "rpi_gpio", sizeof(req.consumer) - 1);
+    req.num_lines = count;
+    if (build_config(r, &req.config) == 0 && ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) == 0) {
+        r->fd = req.fd;
+        fcntl(r->fd, F_SETFL, O_NONBLOCK);
+        for (i = 0; i < count; i++) {
+            line_request[gpios[i]] = request_count;
+            line_index[gpios[i]] = i;
+        }
+        request_count++;
+        result = 0;
+    }
+    end_replace();
+    return result;
+}
+
+// bring the requests up to date with the settings of the lines in mask:
+// lines not held yet are requested together, and the requests holding the
+// others are reconfigured in place. 0, or -1 with errno set
+static int update_lines(const uint32_t mask[2])
+{
+    struct gpio_v2_line_config config;
+    unsigned int added[MAX_GPIOS];
+    int changed[MAX_REQUESTS] = {0};
+    int gpio, r, n = 0;
+
+    for (gpio = 0; gpio < MAX_GPIOS; gpio++) {
+        if (!(mask[GPIO_BANK(gpio)] & GPIO_MASK(gpio)) || line_direction[gpio] < 0)
+            continue;
+        if (line_request[gpio] < 0)
+            added[n++] = gpio;
+        else
+            changed[line_request[gpio]] = 1;
+    }
+
+    if (n > 0 && add_request(added, n) < 0)
+        return -1;
+    for (r = 0; r < request_count; r++) {
+        if (!changed[r])
+            continue;
+        if (build_config(&requests[r], &config) < 0 ||
+            ioctl(requests[r].fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void save_settings(struct line_settings *saved)
+{
+    memcpy(saved->direction, line_direction, sizeof(line_direction));
+    memcpy(saved->pud, line_pud, sizeof(line_pud));
+    memcpy(saved->edges, line_edges, sizeof(line_edges));
+}
+
+// put the lines in mask back as they were after a change failed
+static void restore_settings(const struct line_settings *saved, const uint32_t mask[2])
+{
+    int err = errno;
+
+    memcpy(line_direction, saved->direction, sizeof(line_direction));
+    memcpy(line_pud, saved->pud, sizeof(line_pud));
+    memcpy(line_edges, saved->edges, sizeof(line_edges));
+    update_lines(mask);
+    errno = err;
+}
+
+static int chardev_set_function(int gpio, int function)
+{
+    struct line_settings saved;
+    uint32_t mask[2] = {0, 0};
+
+    if (gpio >= num_chip_lines) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    save_settings(&saved);
+    mask[GPIO_BANK(gpio)] = GPIO_MASK(gpio);
+    line_direction[gpio] = function == FSEL_OUTPUT ? OUTPUT : INPUT;
+    if (function == FSEL_OUTPUT)
+        line_edges[gpio] = 0;
+    if (update_lines(mask) < 0) {
+        restore_settings(&saved, mask);
+        return -1;
+    }
+    return 0;
+}
+
+static int chardev_get_function(int gpio)
+{
+    struct gpio_v2_line_info info;
+
+    if (line_direction[gpio] >= 0)
+        return line_direction[gpio] == OUTPUT ? FSEL_OUTPUT : FSEL_INPUT;
+
+    memset(&info, 0, sizeof(info));
+    info.offset = gpio;
+    if (ioctl(chip_fd, GPIO_V2_GET_LINEINFO_IOCTL, &info) < 0)
+        return FSEL_INPUT;
+    if (info.flags & GPIO_V2_LINE_FLAG_USED)
+        return ALT0;   // claimed by a kernel driver or another process
+    return (info.flags & GPIO_V2_LINE_FLAG_OUTPUT) ? FSEL_OUTPUT : FSEL_INPUT;
+}
+
+// takes effect when the line is next requested or reconfigured
+static void chardev_set_pullupdn(int gpio, int pud)
+{
+    line_pud[gpio] = pud;
+}
+
+// the plan's new lines go into a single request, and each request holding
+// the others is reconfigured once
+static int chardev_setup_many(const struct gpio_plan *plan)
+{
+    struct line_settings saved;
+    int gpio;
+
+    for (gpio = 0; gpio < MAX_GPIOS; gpio++) {
+        if ((plan->mask[GPIO_BANK(gpio)] & GPIO_MASK(gpio)) && gpio >= num_chip_lines) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    save_settings(&saved);
+    for (gpio = 0; gpio < MAX_GPIOS; gpio++) {
+        if (!(plan->mask[GPIO_BANK(gpio)] & GPIO_MASK(gpio)))
+            continue;
+        line_pud[gpio] = plan->pud[gpio];
+        line_direction[gpio] = plan->function[gpio] == FSEL_OUTPUT ? OUTPUT : INPUT;
+        if (plan->function[gpio] == FSEL_OUTPUT)
+            line_edges[gpio] = 0;
+    }
+    if (update_lines(plan->mask) < 0) {
+        restore_settings(&saved, plan->mask);
+        return -1;
+    }
+    return 0;
+}
+
+static void chardev_output_bank(int bank, uint32_t set, uint32_t clr)
+{
+    struct gpio_v2_line_values values[MAX_REQUESTS];
+    int touched[MAX_REQUESTS] = {0};
+    int gpio, r;
+
+    output_latch[bank] = (output_latch[bank] | set) & ~clr;
+    for (gpio = bank * 32; gpio < bank * 32 + 32 && gpio < MAX_GPIOS; gpio++) {
+        if ((r = line_request[gpio]) < 0 || line_direction[gpio] != OUTPUT || !((set | clr) & GPIO_MASK(gpio)))
+            continue;
+        if (!touched[r]) {
+            values[r].mask = values[r].bits = 0;
+            touched[r] = 1;
+        }
+        values[r].mask |= 1ULL << line_index[gpio];
+        if (set & GPIO_MASK(gpio))
+            values[r].bits |= 1ULL << line_index[gpio];
+    }
+    for (r = 0; r < request_count; r++) {
+        if (touched[r])
+            ioctl(requests[r].fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values[r]);
+    }
+}
+
+static uint32_t chardev_input_bank(int bank)
+{
+    struct gpio_v2_line_values values[MAX_REQUESTS];
+    int touched[MAX_REQUESTS] = {0};
+    uint32_t levels = 0;
+    int gpio, r;
+
+    for (gpio = bank * 32; gpio < bank * 32 + 32 && gpio < MAX_GPIOS; gpio++) {
+        if ((r = line_request[gpio]) < 0)
+            continue;
+        if (!touched[r]) {
+            values[r].mask = values[r].bits = 0;
+            touched[r] = 1;
+        }
+        values[r].mask |= 1ULL << line_index[gpio];
+    }
+    for (r = 0; r < request_count; r++) {
+        if (touched[r] && ioctl(requests[r].fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values[r]) < 0)
+            touched[r] = 0;
+    }
+
+    for (gpio = bank * 32; gpio < bank * 32 + 32 && gpio < MAX_GPIOS; gpio++) {
+        if ((r = line_request[gpio]) >= 0 && touched[r] && (values[r].bits & (1ULL << line_index[gpio])))
+            levels |= GPIO_MASK(gpio);
+    }
+    return levels;
+}
+
+// only edge detection exists on the character device; level detection is
+// ignored
+static void chardev_set_event(int type, int gpio, int enable)
+{
+    uint32_t mask[2] = {0, 0};
+
+    mask[GPIO_BANK(gpio)] = GPIO_MASK(gpio);
+    if (type != EVENT_RISING && type != EVENT_FALLING)
+        return;
+    if (enable)
+        line_edges[gpio] |= 1 << type;
+    else
+        line_edges[gpio] &= ~(1 << type);
+    event_latch[GPIO_BANK(gpio)] &= ~GPIO_MASK(gpio);
+    if (line_direction[gpio] >= 0)
+        update_lines(mask);
+}
+
+// read whatever events are queued on fd without blocking
+static int read_events(int fd, struct gpio_event *events, int max)
+{
+    struct gpio_v2_line_event buf[EVENT_BATCH];
+    ssize_t len;
+    int i, n = 0;
+
+    if (max > EVENT_BATCH)
+        max = EVENT_BATCH;
+    if (fd < 0 || (len = read(fd, buf, max * sizeof(buf[0]))) <= 0)
+        return 0;
+
+    for (i = 0; i < (int)(len / sizeof(buf[0])); i++) {
+        if (buf[i].offset >= MAX_GPIOS)
+            continue;
+        events[n].gpio = buf[i].offset;
+        events[n].level = buf[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+        events[n].timestamp_ns = buf[i].timestamp_ns;
+        events[n].seqno = buf[i].line_seqno;
+        event_latch[GPIO_BANK(events[n].gpio)] |= GPIO_MASK(events[n].gpio);
+        n++;
+    }
+    return n;
+}
+
+// pending edges are latched per pin, the way the event detect status
+// register would show them
+static uint32_t chardev_event_status(int bank)
+{
+    struct gpio_event events[EVENT_BATCH];
+
+    int r;
+
+    pthread_mutex_lock(&request_lock);
+    for (r = 0; r < request_count; r++) {
+        while (read_events(requests[r].fd, events, EVENT_BATCH) == EVENT_BATCH)
+            ;
+    }
+    pthread_mutex_unlock(&request_lock);
+    return event_latch[bank];
+}
+
+static void chardev_clear_events(int bank, uint32_t mask)
+{
+    event_latch[bank] &= ~mask;
+}
+
+static volatile uint32_t *chardev_registers(void)
+{
+    return NULL;
+}
+
+static volatile uint32_t *chardev_peripheral(int which)
+{
+    return NULL;
+}
+
+const struct gpio_backend chardev_backend = {
+    "chardev",
+    chardev_board_info,
+    chardev_setup,
+    chardev_cleanup,
+    chardev_set_function,
+    chardev_get_function,
+    chardev_set_pullupdn,
+    chardev_setup_many,
+    chardev_output_bank,
+    chardev_input_bank,
+    chardev_set_event,
+    chardev_event_status,
+    chardev_clear_events,
+    chardev_registers,
+    chardev_peripheral,
+};
+
+// wait up to timeout_ms (-1 for ever) for edge events and read up to max of
+// them in one go, with their kernel timestamps. returns the number read, or 0
+// on timeout or after chardev_wake
+int chardev_wait_events(struct gpio_event *events, int max, int timeout_ms)
+{
+    struct pollfd fds[MAX_REQUESTS + 1];
+    uint64_t count;
+    int r, nfds, n = 0;
+
+    pthread_mutex_lock(&request_lock);
+    while (replacing)
+        pthread_cond_wait(&request_cond, &request_lock);
+    pollers++;
+    fds[0].fd = wake_fd;
+    fds[0].events = POLLIN;
+    for (r = 0; r < request_count; r++) {
+        fds[r + 1].fd = requests[r].fd;
+        fds[r + 1].events = POLLIN;
+    }
+    nfds = request_count + 1;
+    pthread_mutex_unlock(&request_lock);
+
+    if (poll(fds, nfds, timeout_ms) > 0) {
+        if (fds[0].revents & POLLIN) {
+            if (read(wake_fd, &count, sizeof(count)) < 0)
+                count = 0;
+        }
+        for (r = 1; r < nfds && n < max; r++) {
+            if (fds[r].revents & POLLIN)
+                n += read_events(fds[r].fd, events + n, max - n);
+        }
+    }
+
+    pthread_mutex_lock(&request_lock);
+    pollers--;
+    pthread_cond_broadcast(&request_cond);
+    pthread_mutex_unlock(&request_lock);
+    return n;
+}
+
+// make a chardev_wait_events in progress return early
+void chardev_wake(void)
+{
+    uint64_t one = 1;
+
+    if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+        return;
+}
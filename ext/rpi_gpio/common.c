@@ -24,6 +24,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <string.h>
 #include "ruby.h"
 #include "c_gpio.h"
 #include "common.h"
@@ -34,6 +35,8 @@ const int pin_to_gpio_rev2[41] = {-1, -1, -1, 2, -1, 3, -1, 4, 14, -1, 15, 17, 1
 const int pin_to_gpio_rev3[41] = {-1, -1, -1, 2, -1, 3, -1, 4, 14, -1, 15, 17, 18, 27, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7, -1, -1, 5, -1, 6, 12, 13, -1, 19, 16, 26, 20, -1, 21 };
 int setup_error = 0;
 int module_setup = 0;
+int open_batches = 0;
+static struct batch *batches;   // one per thread inside RPi::GPIO.batch
 
 int check_gpio_priv(void)
 {
@@ -91,3 +94,67 @@ int get_gpio_number(int channel, unsigned int *gpio)
 
     return 0;
 }
+
+// the calling thread's batch, or NULL outside RPi::GPIO.batch. all of this
+// runs with the GVL held, so the list needs no lock of its own
+struct batch *current_batch(void)
+{
+    struct batch *b;
+    VALUE thread;
+
+    if (!open_batches)
+        return NULL;
+    thread = rb_thread_current();
+    for (b = batches; b != NULL; b = b->next) {
+        if (b->thread == thread)
+            return b;
+    }
+    return NULL;
+}
+
+void batch_open(struct batch *b)
+{
+    memset(b, 0, sizeof(*b));
+    b->thread = rb_thread_current();
+    b->next = batches;
+    batches = b;
+    open_batches++;
+}
+
+// write out everything recorded in b if flush is set, at most one SET and
+// one CLR store per bank, and forget it
+void batch_close(struct batch *b, int flush)
+{
+    struct batch **link;
+    int bank;
+
+    for (link = &batches; *link != NULL; link = &(*link)->next) {
+        if (*link == b) {
+            *link = b->next;
+            open_batches--;
+            break;
+        }
+    }
+    if (flush) {
+        for (bank = 0; bank < GPIO_BANKS; bank++) {
+            output_gpio_bank(bank, b->set[bank], b->clr[bank]);
+        }
+    }
+}
+
+// remember the level most recently requested for gpio; a later write to the
+// same pin replaces an earlier one
+void batch_record(struct batch *b, unsigned int gpio, int value)
+{
+    if (value) {
+        batch_record_bank(b, GPIO_BANK(gpio), GPIO_MASK(gpio), 0);
+    } else {
+        batch_record_bank(b, GPIO_BANK(gpio), 0, GPIO_MASK(gpio));
+    }
+}
+
+void batch_record_bank(struct batch *b, int bank, uint32_t set, uint32_t clr)
+{
+    b->set[bank] = (b->set[bank] & ~clr) | set;
+    b->clr[bank] = (b->clr[bank] & ~set) | clr;
+}
@@ -24,6 +24,11 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#ifndef COMMON_H
+#define COMMON_H
+
+#include <stdint.h>
+#include "ruby.h"
 #include "cpuinfo.h"
 
 #define MODE_UNKNOWN -1
@@ -45,3 +50,22 @@ int setup_error;
 int module_setup;
 int check_gpio_priv(void);
 int get_gpio_number(int channel, unsigned int *gpio);
+
+// output writes recorded while inside RPi::GPIO.batch. each Ruby thread has
+// its own, so a batch never holds back another thread's writes
+#define GPIO_BANKS 2
+struct batch
+{
+    VALUE thread;
+    uint32_t set[GPIO_BANKS];
+    uint32_t clr[GPIO_BANKS];
+    struct batch *next;
+};
+extern int open_batches;
+struct batch *current_batch(void);
+void batch_open(struct batch *b);
+void batch_close(struct batch *b, int flush);
+void batch_record(struct batch *b, unsigned int gpio, int value);
+void batch_record_bank(struct batch *b, int bank, uint32_t set, uint32_t clr);
+
+#endif /* COMMON_H */
@@ -42,7 +42,6 @@ int get_rpi_info(rpi_info *info)
    char hardware[1024];
    char revision[1024];
    int found = 0;
-   int len;
 
    if ((fp = fopen("/proc/device-tree/system/linux,revision", "r"))) {
       uint32_t n;
@@ -73,7 +72,15 @@ int get_rpi_info(rpi_info *info)
    if (!found)
       return -1;
 
-   if ((len = strlen(revision)) == 0)
+   return decode_revision(revision, info);
+}
+
+// fill in info from a board revision code such as "a02082"
+int decode_revision(const char *revision, rpi_info *info)
+{
+   int len;
+
+   if ((len = strlen(revision)) == 0 || len >= (int)sizeof(info->revision))
       return -1;
 
    if (len >= 6 && strtol((char[]){revision[len-6],0}, NULL, 16) & 8) {
@@ -38,3 +38,4 @@ typedef struct
 #endif /* CPUINFO_H */
 
 int get_rpi_info(rpi_info *info);
+int decode_revision(const char *revision, rpi_info *info);
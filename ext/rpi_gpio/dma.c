@@ -0,0 +1,563 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "dma.h"
+#include "hard_pwm.h"
+#include "sim_gpio.h"
+
+// words the pacer's FIFO takes before DREQ starts holding the engine back.
+// each program starts by filling it, so that every later word written waits
+// out exactly one tick
+#define PWM_FIFO_DEPTH         16
+#define PCM_FIFO_DEPTH         64
+
+#define PACER_CLOCK_HZ         10000000
+#define PLLD_HZ                500000000
+#define PLLD_HZ_2711           750000000
+
+// PCM block layout, in 32-bit words, and the bits used here
+#define PCM_CS_OFFSET          0
+#define PCM_MODE_OFFSET        2
+#define PCM_TXC_OFFSET         4
+#define PCM_DREQ_OFFSET        5
+#define PCM_CS_EN              (1 << 0)
+#define PCM_CS_TXON            (1 << 2)
+#define PCM_CS_TXCLR           (1 << 3)
+#define PCM_CS_DMAEN           (1 << 9)
+#define PCM_MODE_FLEN(x)       ((x) << 10)
+#define PCM_TXC_CH1WEX         (1U << 31)
+#define PCM_TXC_CH1EN          (1 << 30)
+#define PCM_TXC_CH1POS(x)      ((x) << 20)
+#define PCM_DREQ_TX_PANIC(x)   ((x) << 24)
+#define PCM_DREQ_TX_REQ_L(x)   ((x) << 8)
+
+// VideoCore mailbox, for memory the DMA engine can reach
+#define MAILBOX_IOCTL          _IOWR(100, 0, char *)
+#define MBOX_MEM_ALLOC         0x3000c
+#define MBOX_MEM_LOCK          0x3000d
+#define MBOX_MEM_UNLOCK        0x3000e
+#define MBOX_MEM_RELEASE       0x3000f
+#define MBOX_FLAG_DIRECT       0x04     // uncached, through the 0xc alias
+#define MBOX_FLAG_COHERENT     0x08     // the Pi 1 has no 0xc alias
+#define BUS_TO_PHYS(x)         ((x) & ~0xc0000000)
+
+#define MAX_SLEEP_NS           10000000LL
+#define PAGE_SIZE              4096
+
+static int busy;
+static pthread_mutex_t busy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int is_sim(void)
+{
+    return gpio_backend == &sim_backend;
+}
+
+static uint32_t fifo_depth(const struct dma_options *opts)
+{
+    return opts->pacer == DMA_PACER_PCM ? PCM_FIFO_DEPTH : PWM_FIFO_DEPTH;
+}
+
+int dma_check_options(const struct dma_options *opts)
+{
+    uint64_t max = opts->pacer == DMA_PACER_PCM ? DMA_MAX_TICK_NS_PCM : DMA_MAX_TICK_NS_PWM;
+
+    if (opts->tick_ns < DMA_MIN_TICK_NS || opts->tick_ns > max || opts->tick_ns % DMA_TICK_STEP_NS)
+        return DMA_BAD_TICK;
+    return DMA_OK;
+}
+
+static uint64_t step_ticks(const struct waveform_step *step, const struct dma_options *opts)
+{
+    return (step->delay_ns + opts->tick_ns / 2) / opts->tick_ns;
+}
+
+// FIFO words one control block can feed on the channel
+static uint64_t words_per_cb(const struct dma_options *opts)
+{
+    return (DMA_IS_LITE(opts->channel) ? DMA_LITE_MAX_TXFR_LEN : DMA_MAX_TXFR_LEN) / 4;
+}
+
+// control blocks needed for a delay of ticks FIFO words
+static size_t delay_cbs(uint64_t ticks, const struct dma_options *opts)
+{
+    uint64_t per_cb = words_per_cb(opts);
+    return (size_t)((ticks + per_cb - 1) / per_cb);
+}
+
+static size_t pass_cbs(const struct waveform_step *steps, size_t count, const struct dma_options *opts)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        if (steps[i].set[0] || steps[i].set[1])
+            n++;
+        if (steps[i].clr[0] || steps[i].clr[1])
+            n++;
+        n += delay_cbs(step_ticks(&steps[i], opts), opts);
+    }
+    return n;
+}
+
+static uint64_t pass_ticks(const struct waveform_step *steps, size_t count, const struct dma_options *opts)
+{
+    uint64_t ticks = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        ticks += step_ticks(&steps[i], opts);
+    return ticks;
+}
+
+// bytes of DMA memory the program needs, laid out as: the control blocks,
+// starting with the one that fills the FIFO, then a 16-byte slot holding the
+// word fed to the FIFO, then each step's SET and CLR words. only the control
+// blocks are repeated, and WAVEFORM_FOREVER loops back to the first pass.
+// 0 if the waveform can't be compiled (see dma_compile)
+size_t dma_program_size(const struct waveform_step *steps, size_t count, long repeat, const struct dma_options *opts)
+{
+    uint64_t cbs = pass_cbs(steps, count, opts);
+
+    if (count == 0 || pass_ticks(steps, count, opts) == 0)
+        return 0;
+    if (cbs == 0 || cbs > DMA_MAX_PROGRAM_SIZE / sizeof(struct dma_cb) - 1)
+        return 0;
+    // checked before multiplying, so a huge repeat can't wrap to a small size
+    if (repeat != WAVEFORM_FOREVER)
+    {
+        if ((uint64_t)repeat > (DMA_MAX_PROGRAM_SIZE / sizeof(struct dma_cb) - 1) / cbs)
+            return 0;
+        cbs *= repeat;
+    }
+    cbs += 1;
+    if (cbs > DMA_MAX_PROGRAM_SIZE / sizeof(struct dma_cb))
+        return 0;
+    return cbs * sizeof(struct dma_cb) + 16 + count * 16;
+}
+
+static struct dma_cb *emit(struct dma_memory *mem, size_t *n, uint32_t ti, uint32_t src, uint32_t dest, uint32_t len)
+{
+    struct dma_cb *cb = (struct dma_cb *)mem->virt + *n;
+
+    memset(cb, 0, sizeof(*cb));
+    cb->ti = ti;
+    cb->source_ad = src;
+    cb->dest_ad = dest;
+    cb->txfr_len = len;
+    (*n)++;
+    cb->nextconbk = mem->bus + *n * sizeof(struct dma_cb);
+    return cb;
+}
+
+static void emit_delay(struct dma_memory *mem, size_t *n, uint64_t ticks, uint32_t dummy, const struct dma_options *opts)
+{
+    uint32_t ti = DMA_TI_NO_WIDE_BURSTS | DMA_TI_WAIT_RESP | DMA_TI_DEST_DREQ |
+        DMA_TI_PERMAP(opts->pacer == DMA_PACER_PCM ? DMA_PERMAP_PCM_TX : DMA_PERMAP_PWM);
+    uint32_t fifo = opts->pacer == DMA_PACER_PCM ? BUS_PCM_FIFO : BUS_PWM_FIF1;
+    uint64_t per_cb = words_per_cb(opts);
+    uint64_t words;
+
+    while (ticks > 0)
+    {
+        words = ticks > per_cb ? per_cb : ticks;
+        emit(mem, n, ti, dummy, fifo, (uint32_t)(words * 4));
+        ticks -= words;
+    }
+}
+
+// compile the waveform into mem, which must hold dma_program_size bytes and
+// have its bus address set. returns the number of control blocks written. the
+// last control block of every pass is marked in reserved[0], which the
+// engine ignores
+size_t dma_compile(const struct waveform_step *steps, size_t count, long repeat,
+    const struct dma_options *opts, struct dma_memory *mem)
+{
+    uint32_t copy = DMA_TI_NO_WIDE_BURSTS | DMA_TI_WAIT_RESP | DMA_TI_SRC_INC | DMA_TI_DEST_INC;
+    size_t total_cbs = (dma_program_size(steps, count, repeat, opts) - 16 - count * 16) / sizeof(struct dma_cb);
+    uint32_t data = mem->bus + total_cbs * sizeof(struct dma_cb);
+    uint32_t *words = (uint32_t *)(mem->virt + total_cbs * sizeof(struct dma_cb));
+    long passes = repeat == WAVEFORM_FOREVER ? 1 : repeat;
+    size_t n = 0, i;
+    long pass;
+
+    memset(words, 0, 16 + count * 16);
+    for (i = 0; i < count; i++)
+    {
+        memcpy(&words[4 + i * 4], steps[i].set, 8);
+        memcpy(&words[6 + i * 4], steps[i].clr, 8);
+    }
+
+    emit_delay(mem, &n, fifo_depth(opts), data, opts);
+    for (pass = 0; pass < passes; pass++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            if (steps[i].set[0] || steps[i].set[1])
+                emit(mem, &n, copy, data + 16 + i * 16, BUS_GPSET0, 8);
+            if (steps[i].clr[0] || steps[i].clr[1])
+                emit(mem, &n, copy, data + 24 + i * 16, BUS_GPCLR0, 8);
+            emit_delay(mem, &n, step_ticks(&steps[i], opts), data, opts);
+        }
+        ((struct dma_cb *)mem->virt)[n - 1].reserved[0] = 1;
+    }
+
+    ((struct dma_cb *)mem->virt)[n - 1].nextconbk =
+        repeat == WAVEFORM_FOREVER ? mem->bus + sizeof(struct dma_cb) : 0;
+    return n;
+}
+
+static uint32_t mbox_property(int fd, uint32_t tag, uint32_t a, uint32_t b, uint32_t c, int args)
+{
+    uint32_t p[32] __attribute__((aligned(16)));
+    int i = 0;
+
+    p[i++] = 0;             // total size, filled in below
+    p[i++] = 0;             // process request
+    p[i++] = tag;
+    p[i++] = args * 4;      // size of the value buffer
+    p[i++] = args * 4;      // size of the request
+    p[i++] = a;
+    if (args > 1)
+        p[i++] = b;
+    if (args > 2)
+        p[i++] = c;
+    p[i++] = 0;             // end tag
+    p[0] = i * sizeof(*p);
+
+    if (ioctl(fd, MAILBOX_IOCTL, p) < 0)
+        return 0;
+    return p[5];
+}
+
+// real memory comes from the GPU through the mailbox, locked so it can't move,
+// and is mapped uncached through /dev/mem. the simulator's is ordinary memory
+// at a pretend bus address
+int dma_memory_alloc(struct dma_memory *mem, size_t size)
+{
+    uint32_t flags = MBOX_FLAG_DIRECT;
+    void *map;
+    int fd, mem_fd;
+
+    memset(mem, 0, sizeof(*mem));
+    size = (size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    if (is_sim())
+    {
+        if ((mem->virt = calloc(1, size)) == NULL)
+            return DMA_NO_MEMORY;
+        mem->bus = DMA_SIM_BUS_BASE;
+        mem->size = size;
+        return DMA_OK;
+    }
+
+    if (gpio_chip != NULL && gpio_chip->family == CHIP_BCM2835)
+        flags = MBOX_FLAG_DIRECT | MBOX_FLAG_COHERENT;
+    if ((fd = open("/dev/vcio", 0)) < 0)
+        return DMA_NO_ACCESS;
+    if ((mem->handle = mbox_property(fd, MBOX_MEM_ALLOC, size, PAGE_SIZE, flags, 3)) == 0)
+    {
+        close(fd);
+        return DMA_NO_MEMORY;
+    }
+    if ((mem->bus = mbox_property(fd, MBOX_MEM_LOCK, mem->handle, 0, 0, 1)) == 0 ||
+        (mem_fd = open("/dev/mem", O_RDWR|O_SYNC)) < 0)
+    {
+        mbox_property(fd, MBOX_MEM_RELEASE, mem->handle, 0, 0, 1);
+        close(fd);
+        return DMA_NO_ACCESS;
+    }
+    map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, mem_fd, BUS_TO_PHYS(mem->bus));
+    close(mem_fd);
+    if (map == MAP_FAILED)
+    {
+        mbox_property(fd, MBOX_MEM_UNLOCK, mem->handle, 0, 0, 1);
+        mbox_property(fd, MBOX_MEM_RELEASE, mem->handle, 0, 0, 1);
+        close(fd);
+        return DMA_NO_ACCESS;
+    }
+    close(fd);
+    mem->virt = (uint8_t *)map;
+    mem->size = size;
+    return DMA_OK;
+}
+
+void dma_memory_free(struct dma_memory *mem)
+{
+    int fd;
+
+    if (mem->virt == NULL)
+        return;
+    if (mem->handle == 0)
+    {
+        free(mem->virt);
+    }
+    else
+    {
+        munmap(mem->virt, mem->size);
+        if ((fd = open("/dev/vcio", 0)) >= 0)
+        {
+            mbox_property(fd, MBOX_MEM_UNLOCK, mem->handle, 0, 0, 1);
+            mbox_property(fd, MBOX_MEM_RELEASE, mem->handle, 0, 0, 1);
+            close(fd);
+        }
+    }
+    memset(mem, 0, sizeof(*mem));
+}
+
+// claim the DMA channel and pacer for one program at a time. returns 0 on
+// success, -1 if a program is already playing
+int dma_claim(int pacer)
+{
+    int result = -1;
+
+    pthread_mutex_lock(&busy_lock);
+    if (!busy)
+    {
+        busy = 1 + pacer;
+        result = 0;
+    }
+    pthread_mutex_unlock(&busy_lock);
+    return result;
+}
+
+void dma_release(void)
+{
+    pthread_mutex_lock(&busy_lock);
+    busy = 0;
+    pthread_mutex_unlock(&busy_lock);
+}
+
+// returns 1 if a DMA program is using pacer, 0 otherwise
+int dma_pacer_busy(int pacer)
+{
+    int result;
+
+    pthread_mutex_lock(&busy_lock);
+    result = busy == 1 + pacer;
+    pthread_mutex_unlock(&busy_lock);
+    return result;
+}
+
+static void wait_clock_idle(volatile uint32_t *clock, int ctl)
+{
+    int tries;
+
+    for (tries = 0; tries < 100 && (clock[ctl] & CM_CTL_BUSY); tries++)
+        usleep(10);
+}
+
+// run the pacer's clock from PLLD at PACER_CLOCK_HZ, so that a tick of
+// tick_ns is tick_ns / DMA_TICK_STEP_NS clock cycles
+static void clock_start(volatile uint32_t *clock, int ctl, int div)
+{
+    uint32_t plld = PLLD_HZ;
+
+    if (gpio_chip != NULL && gpio_chip->family == CHIP_BCM2711)
+        plld = PLLD_HZ_2711;
+    clock[ctl] = CM_PASSWORD | CM_CTL_SRC_PLLD;
+    wait_clock_idle(clock, ctl);
+    clock[div] = CM_PASSWORD | ((plld / PACER_CLOCK_HZ) << CM_DIV_SHIFT);
+    clock[ctl] = CM_PASSWORD | CM_CTL_SRC_PLLD | CM_CTL_ENAB;
+}
+
+static void clock_stop(volatile uint32_t *clock, int ctl)
+{
+    clock[ctl] = CM_PASSWORD | CM_CTL_SRC_PLLD;
+    wait_clock_idle(clock, ctl);
+}
+
+// set the pacer up to take one FIFO word per tick and raise DREQ while its
+// FIFO has room
+static void pacer_start(volatile uint32_t *pacer, volatile uint32_t *clock, const struct dma_options *opts)
+{
+    uint32_t bits = (uint32_t)(opts->tick_ns / DMA_TICK_STEP_NS);
+
+    if (opts->pacer == DMA_PACER_PCM)
+    {
+        pacer[PCM_CS_OFFSET] = PCM_CS_EN;
+        clock_start(clock, CM_PCMCTL_OFFSET, CM_PCMDIV_OFFSET);
+        pacer[PCM_MODE_OFFSET] = PCM_MODE_FLEN(bits - 1);
+        pacer[PCM_TXC_OFFSET] = PCM_TXC_CH1WEX | PCM_TXC_CH1EN | PCM_TXC_CH1POS(1);
+        pacer[PCM_DREQ_OFFSET] = PCM_DREQ_TX_PANIC(16) | PCM_DREQ_TX_REQ_L(30);
+        pacer[PCM_CS_OFFSET] |= PCM_CS_TXCLR;
+        usleep(10);
+        pacer[PCM_CS_OFFSET] |= PCM_CS_DMAEN;
+        pacer[PCM_CS_OFFSET] |= PCM_CS_TXON;
+    }
+    else
+    {
+        pacer[PWM_CTL_OFFSET] = 0;
+        usleep(10);
+        clock_start(clock, CM_PWMCTL_OFFSET, CM_PWMDIV_OFFSET);
+        pacer[PWM_RNG1_OFFSET] = bits;
+        pacer[PWM_DMAC_OFFSET] = PWM_DMAC_ENAB | PWM_DMAC_PANIC(15) | PWM_DMAC_DREQ(15);
+        pacer[PWM_CTL_OFFSET] = PWM_CTL_CLRF;
+        usleep(10);
+        pacer[PWM_CTL_OFFSET] = PWM_CTL_USEF | PWM_CTL_MODE | PWM_CTL_PWEN;
+    }
+}
+
+static void pacer_stop(volatile uint32_t *pacer, volatile uint32_t *clock, const struct dma_options *opts)
+{
+    if (opts->pacer == DMA_PACER_PCM)
+    {
+        pacer[PCM_CS_OFFSET] = 0;
+        clock_stop(clock, CM_PCMCTL_OFFSET);
+    }
+    else
+    {
+        pacer[PWM_CTL_OFFSET] = 0;
+        pacer[PWM_DMAC_OFFSET] = 0;
+        clock_stop(clock, CM_PWMCTL_OFFSET);
+    }
+}
+
+static struct dma_cb *bus_to_cb(struct dma_memory *mem, uint32_t bus)
+{
+    if (bus < mem->bus || bus - mem->bus + sizeof(struct dma_cb) > mem->size || (bus - mem->bus) % 32)
+        return NULL;
+    return (struct dma_cb *)(mem->virt + (bus - mem->bus));
+}
+
+static void sleep_until(volatile int *running, int64_t deadline)
+{
+    struct timespec ts;
+    int64_t now = now_ns();
+
+    while (*running && now < deadline)
+    {
+        if (deadline - now > MAX_SLEEP_NS)
+            deadline = now + MAX_SLEEP_NS;
+        ts.tv_sec = deadline / 1000000000LL;
+        ts.tv_nsec = deadline % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        now = now_ns();
+    }
+}
+
+// play the program the way the engine would: follow the control blocks
+// through the bus address space, write SET/CLR words to the simulated
+// registers, and hold back FIFO writes until the simulated pacer would have
+// room for them
+static int sim_run(struct dma_memory *mem, const struct dma_options *opts, volatile int *running, uint64_t *iterations)
+{
+    struct dma_cb *cb;
+    const uint32_t *words;
+    uint32_t addr = mem->bus;
+    uint64_t written = 0;
+    int64_t start = now_ns();
+    int bank;
+
+    while (addr != 0 && *running)
+    {
+        if ((cb = bus_to_cb(mem, addr)) == NULL)
+            return DMA_NO_ACCESS;
+        if (cb->ti & DMA_TI_DEST_DREQ)
+        {
+            // a Lite channel only reads the low 16 bits of the length
+            written += (DMA_IS_LITE(opts->channel) ? cb->txfr_len & 0xffff : cb->txfr_len) / 4;
+            if (written > fifo_depth(opts))
+                sleep_until(running, start + (int64_t)((written - fifo_depth(opts)) * opts->tick_ns));
+        }
+        else if (cb->dest_ad == BUS_GPSET0 || cb->dest_ad == BUS_GPCLR0)
+        {
+            words = (const uint32_t *)(mem->virt + (cb->source_ad - mem->bus));
+            for (bank = 0; bank < 2 && bank < (int)(cb->txfr_len / 4); bank++)
+            {
+                if (cb->dest_ad == BUS_GPSET0)
+                    output_gpio_bank(bank, words[bank], 0);
+                else
+                    output_gpio_bank(bank, 0, words[bank]);
+            }
+        }
+        if (cb->reserved[0])
+            __atomic_add_fetch(iterations, 1, __ATOMIC_RELAXED);
+        addr = cb->nextconbk;
+    }
+    return DMA_OK;
+}
+
+// start the engine on the program in mem and wait for it to finish, or for
+// *running to be cleared
+int dma_run(struct dma_memory *mem, const struct dma_options *opts, volatile int *running, uint64_t *iterations)
+{
+    volatile uint32_t *dma, *channel, *pacer, *clock;
+    struct dma_cb *cb;
+    uint64_t passes = 0;
+
+    if (is_sim())
+        return sim_run(mem, opts, running, iterations);
+
+    dma = gpio_backend->peripheral(PERIPHERAL_DMA);
+    pacer = gpio_backend->peripheral(opts->pacer == DMA_PACER_PCM ? PERIPHERAL_PCM : PERIPHERAL_PWM);
+    clock = gpio_backend->peripheral(PERIPHERAL_CLOCK);
+    if (dma == NULL || pacer == NULL || clock == NULL)
+        return DMA_NO_ACCESS;
+    channel = dma + opts->channel * DMA_CHANNEL_WORDS;
+
+    dma[DMA_ENABLE_OFFSET] |= 1 << opts->channel;
+    channel[DMA_CS_OFFSET] = DMA_CS_RESET;
+    usleep(10);
+    channel[DMA_CS_OFFSET] = DMA_CS_INT | DMA_CS_END;
+    channel[DMA_CONBLK_AD_OFFSET] = mem->bus;
+    channel[DMA_DEBUG_OFFSET] = 7;   // clear the error flags
+    pacer_start(pacer, clock, opts);
+    channel[DMA_CS_OFFSET] = DMA_CS_WAIT_WRITES | DMA_CS_PANIC_PRIORITY(15) |
+        DMA_CS_PRIORITY(15) | DMA_CS_ACTIVE;
+
+    while (*running && (channel[DMA_CS_OFFSET] & DMA_CS_ACTIVE))
+        usleep(1000);
+
+    if (channel[DMA_CS_OFFSET] & DMA_CS_ACTIVE)
+    {
+        channel[DMA_CS_OFFSET] = DMA_CS_ABORT;
+        usleep(10);
+        channel[DMA_CS_OFFSET] = DMA_CS_RESET;
+    }
+    else
+    {
+        // it ran to the end, so every pass played
+        for (cb = (struct dma_cb *)mem->virt; cb != NULL; cb = cb->nextconbk ? bus_to_cb(mem, cb->nextconbk) : NULL)
+        {
+            if (cb->reserved[0])
+                passes++;
+        }
+        __atomic_store_n(iterations, passes, __ATOMIC_RELAXED);
+    }
+    pacer_stop(pacer, clock, opts);
+    return DMA_OK;
+}
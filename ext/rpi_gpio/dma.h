@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* waveforms played by the DMA engine: steps are compiled into control blocks
+   that write the GPIO SET/CLR registers, with delays made by feeding the PWM
+   or PCM FIFO, which only takes a word every tick */
+
+#ifndef DMA_H
+#define DMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "c_gpio.h"
+#include "waveform.h"
+
+#define DMA_PACER_PWM          0
+#define DMA_PACER_PCM          1
+
+// the simulator's pretend bus address for the start of DMA memory
+#define DMA_SIM_BUS_BASE       0x40000000
+
+#define DMA_DEFAULT_CHANNEL    10
+#define DMA_DEFAULT_TICK_NS    1000
+#define DMA_MIN_TICK_NS        1000
+#define DMA_MAX_TICK_NS_PWM    1000000
+#define DMA_MAX_TICK_NS_PCM    102400   // the PCM frame is at most 1024 bits
+#define DMA_TICK_STEP_NS       100      // one bit of the 10 MHz pacer clock
+#define DMA_MAX_PROGRAM_SIZE   (4*1024*1024)
+
+#define DMA_OK                 0
+#define DMA_BAD_TICK           1
+#define DMA_TOO_LONG           2   // the program doesn't fit DMA_MAX_PROGRAM_SIZE
+#define DMA_NO_ACCESS          3   // DMA or pacer registers, or mailbox, unavailable
+#define DMA_NO_MEMORY          4
+#define DMA_PACER_BUSY         5   // the pacer is in use by hardware PWM or another waveform
+
+// a control block, as the DMA engine reads it from memory (32-byte aligned)
+struct dma_cb
+{
+    uint32_t ti;
+    uint32_t source_ad;
+    uint32_t dest_ad;
+    uint32_t txfr_len;
+    uint32_t stride;
+    uint32_t nextconbk;
+    uint32_t reserved[2];
+};
+
+// bus addresses of the peripherals, as the DMA engine sees them
+#define BUS_PERI_BASE          0x7e000000
+#define BUS_GPSET0             (BUS_PERI_BASE + 0x20001c)
+#define BUS_GPCLR0             (BUS_PERI_BASE + 0x200028)
+#define BUS_PWM_FIF1           (BUS_PERI_BASE + 0x20c018)
+#define BUS_PCM_FIFO           (BUS_PERI_BASE + 0x203004)
+
+// control block transfer information bits
+#define DMA_TI_WAIT_RESP       (1 << 3)
+#define DMA_TI_DEST_INC        (1 << 4)
+#define DMA_TI_DEST_DREQ       (1 << 6)
+#define DMA_TI_SRC_INC         (1 << 8)
+#define DMA_TI_PERMAP(x)       ((x) << 16)
+#define DMA_TI_NO_WIDE_BURSTS  (1 << 26)
+#define DMA_PERMAP_PCM_TX      2
+#define DMA_PERMAP_PWM         5
+#define DMA_MAX_TXFR_LEN       0x3ffffffc
+#define DMA_LITE_MAX_TXFR_LEN  0xfffc   // channels 7-14 are DMA Lite, with a 16-bit length
+#define DMA_IS_LITE(channel)   ((channel) >= 7 && (channel) <= 14)
+
+// DMA channel registers, in 32-bit words from the channel's base
+#define DMA_CHANNEL_WORDS      64       // 0x100 / 4
+#define DMA_CS_OFFSET          0
+#define DMA_CONBLK_AD_OFFSET   1
+#define DMA_DEBUG_OFFSET       8
+#define DMA_ENABLE_OFFSET      1020     // 0xff0 / 4, for the whole block
+
+#define DMA_CS_ACTIVE          (1 << 0)
+#define DMA_CS_END             (1 << 1)
+#define DMA_CS_INT             (1 << 2)
+#define DMA_CS_PRIORITY(x)     ((x) << 16)
+#define DMA_CS_PANIC_PRIORITY(x) ((x) << 20)
+#define DMA_CS_WAIT_WRITES     (1 << 28)
+#define DMA_CS_ABORT           (1 << 30)
+#define DMA_CS_RESET           (1 << 31)
+
+struct dma_options
+{
+    int pacer;
+    uint64_t tick_ns;
+    int channel;
+};
+
+// memory the DMA engine can read: virt is where the CPU sees it, bus where the
+// engine does
+struct dma_memory
+{
+    uint8_t *virt;
+    uint32_t bus;
+    size_t size;
+    uint32_t handle;        // mailbox handle, 0 for simulated memory
+};
+
+int dma_check_options(const struct dma_options *opts);
+size_t dma_program_size(const struct waveform_step *steps, size_t count, long repeat, const struct dma_options *opts);
+size_t dma_compile(const struct waveform_step *steps, size_t count, long repeat,
+    const struct dma_options *opts, struct dma_memory *mem);
+int dma_memory_alloc(struct dma_memory *mem, size_t size);
+void dma_memory_free(struct dma_memory *mem);
+int dma_run(struct dma_memory *mem, const struct dma_options *opts, volatile int *running, uint64_t *iterations);
+int dma_claim(int pacer);
+void dma_release(void);
+int dma_pacer_busy(int pacer);
+
+#endif /* DMA_H */
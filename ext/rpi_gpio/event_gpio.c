@@ -0,0 +1,846 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "event_gpio.h"
+#include "realtime.h"
+#include "chardev_gpio.h"
+
+#define MAX_GPIOS 54
+#define EVENT_BATCH 64
+#define STOP_KEY 0xffffffffu
+
+// one thread waits for edges, either on sysfs value files through epoll or
+// on the character device's line request, filters them, and pushes them into
+// a single-producer ring. a second thread polls the event detect registers
+// for pins watched in hardware, into a ring of its own. readers take events
+// out of both in batches
+struct watch
+{
+    int active;
+    int fd;                 // sysfs value file, or -1 for the character device
+    int edges;              // bit EVENT_RISING | bit EVENT_FALLING
+    int skip_first;         // sysfs reports the current value once on arming
+    int hardware;           // watched through the event detect registers
+    int detects;            // bits EVENT_RISING..EVENT_LOW armed in hardware
+    int masked;             // level detects turned off after they fired
+    int waited;             // edges go to the wait queue, not the rings
+    int counted;            // edges only bump the pin's counter
+    uint64_t bounce_ns;
+    uint64_t last_ns;
+    uint32_t seqno;
+};
+
+static struct watch watches[MAX_GPIOS];
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct event_ring
+{
+    struct gpio_event slots[EVENT_RING_SIZE];
+    atomic_uint head;       // written by the ring's producer thread only
+    atomic_uint tail;       // written by readers, under drain_lock
+};
+
+static struct event_ring kernel_ring;
+static struct event_ring hardware_ring;
+static atomic_ullong overflows;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// edges on pins registered with event_set_waited queue here instead, under
+// watch_lock, until a thread blocked in event_wait_any takes them
+static struct gpio_event wait_queue[WAIT_QUEUE_SIZE];
+static int wait_count;
+static unsigned int wait_wakeups;
+static pthread_cond_t wait_cond;
+static pthread_once_t wait_once = PTHREAD_ONCE_INIT;
+
+// edges on pins registered with event_set_counted are only counted. count is
+// read without a lock; the history, one slot per COUNTER_TICK_NS holding the
+// last edge's time and the count after it, is written and read under
+// watch_lock and lets event_count_rate look back over a window
+struct counter_slot
+{
+    uint64_t timestamp_ns;
+    uint64_t count;
+};
+
+struct edge_counter
+{
+    atomic_ullong count;
+    struct counter_slot *history;   // COUNTER_HISTORY slots, allocated on first use
+    uint64_t slots;                 // slots ever started; the newest is slots - 1
+    uint64_t slot_start_ns;
+    uint64_t reset_ns;
+};
+
+static struct edge_counter counters[MAX_GPIOS];
+
+static pthread_t thread;
+static int thread_running;
+static volatile int stopping;
+static int epoll_fd = -1;
+static int stop_fd = -1;
+static int notify_fd = -1;
+
+// the hardware poller; armed and masked are the pins it looks at, per bank
+static pthread_t poll_thread;
+static int poll_running;
+static volatile int poll_stopping;
+static volatile uint32_t armed[2];
+static volatile uint32_t masked[2];
+static volatile int poll_mode = EVENT_POLL_HYBRID;
+static volatile uint64_t poll_interval_ns = EVENT_POLL_DEFAULT_INTERVAL_NS;
+static volatile uint64_t poll_spin_ns = EVENT_POLL_DEFAULT_SPIN_NS;
+static pthread_cond_t arm_cond = PTHREAD_COND_INITIALIZER;   // a pin was armed, or stopping
+static atomic_ullong polls;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int ring_push(struct event_ring *ring, const struct gpio_event *event)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail >= EVENT_RING_SIZE) {
+        atomic_fetch_add_explicit(&overflows, 1, memory_order_relaxed);
+        return 0;
+    }
+    ring->slots[head & (EVENT_RING_SIZE - 1)] = *event;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+// take up to max events from ring; called with drain_lock held
+static int ring_take(struct event_ring *ring, struct gpio_event *events, int max)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    int n = 0;
+
+    while (tail != head && n < max) {
+        events[n++] = ring->slots[tail & (EVENT_RING_SIZE - 1)];
+        tail++;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    return n;
+}
+
+static int ring_empty(struct event_ring *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) ==
+        atomic_load_explicit(&ring->tail, memory_order_relaxed);
+}
+
+static void notify(void)
+{
+    uint64_t one = 1;
+
+    if (write(notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        return;
+}
+
+// waiters sleep on absolute CLOCK_MONOTONIC deadlines
+static void init_wait_cond(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wait_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// called with watch_lock held
+static void count_edge(struct edge_counter *c, uint64_t timestamp_ns)
+{
+    struct counter_slot *slot;
+    uint64_t count = atomic_fetch_add_explicit(&c->count, 1, memory_order_relaxed) + 1;
+
+    if (c->slots == 0 || timestamp_ns >= c->slot_start_ns + COUNTER_TICK_NS) {
+        c->slot_start_ns = timestamp_ns;
+        c->slots++;
+    }
+    slot = &c->history[(c->slots - 1) & (COUNTER_HISTORY - 1)];
+    slot->timestamp_ns = timestamp_ns;
+    slot->count = count;
+}
+
+// hand an accepted event to its counter, the wait queue or ring; called with
+// watch_lock held. returns 1 if it went into the ring
+static int deliver(struct watch *w, struct event_ring *ring, const struct gpio_event *event)
+{
+    if (w->counted) {
+        count_edge(&counters[event->gpio], event->timestamp_ns);
+        return 0;
+    }
+    if (!w->waited)
+        return ring_push(ring, event);
+
+    if (wait_count == WAIT_QUEUE_SIZE) {
+        atomic_fetch_add_explicit(&overflows, 1, memory_order_relaxed);
+        return 0;
+    }
+    wait_queue[wait_count++] = *event;
+    pthread_cond_broadcast(&wait_cond);
+    return 0;
+}
+
+// forget gpio's queued edges; called with watch_lock held
+static void drop_waited(unsigned int gpio)
+{
+    int i, n = 0;
+
+    for (i = 0; i < wait_count; i++) {
+        if (wait_queue[i].gpio != gpio)
+            wait_queue[n++] = wait_queue[i];
+    }
+    wait_count = n;
+}
+
+// debounce and glitch filtering; called with watch_lock held
+static int accept_event(struct watch *w, struct gpio_event *event)
+{
+    // a pulse shorter than the time it took to read the value shows up as the
+    // opposite level of the edge asked for
+    if (w->edges == 1 << EVENT_RISING && !event->level)
+        return 0;
+    if (w->edges == 1 << EVENT_FALLING && event->level)
+        return 0;
+
+    if (w->bounce_ns && w->last_ns && event->timestamp_ns >= w->last_ns &&
+        event->timestamp_ns - w->last_ns < w->bounce_ns)
+        return 0;
+    w->last_ns = event->timestamp_ns;
+    return 1;
+}
+
+static void sysfs_loop(void)
+{
+    struct epoll_event ready[EVENT_BATCH];
+    struct gpio_event event;
+    struct watch *w;
+    char buf[8];
+    int i, n, pushed;
+
+    while (!stopping) {
+        n = epoll_wait(epoll_fd, ready, EVENT_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        pushed = 0;
+        pthread_mutex_lock(&watch_lock);
+        for (i = 0; i < n; i++) {
+            if (ready[i].data.u32 == STOP_KEY || ready[i].data.u32 >= MAX_GPIOS)
+                continue;
+            w = &watches[ready[i].data.u32];
+            if (!w->active || w->fd < 0)
+                continue;
+
+            event.timestamp_ns = now_ns();
+            if (pread(w->fd, buf, sizeof(buf), 0) <= 0)
+                continue;
+            if (w->skip_first) {
+                w->skip_first = 0;
+                continue;
+            }
+            event.gpio = ready[i].data.u32;
+            event.level = buf[0] == '1';
+            event.seqno = ++w->seqno;
+            if (accept_event(w, &event))
+                pushed += deliver(w, &kernel_ring, &event);
+        }
+        pthread_mutex_unlock(&watch_lock);
+
+        if (pushed)
+            notify();
+    }
+}
+
+static void chardev_loop(void)
+{
+    struct gpio_event events[EVENT_BATCH];
+    struct watch *w;
+    int i, n, pushed;
+
+    while (!stopping) {
+        n = chardev_wait_events(events, EVENT_BATCH, -1);
+
+        pushed = 0;
+        pthread_mutex_lock(&watch_lock);
+        for (i = 0; i < n; i++) {
+            w = &watches[events[i].gpio];
+            if (w->active && !w->hardware && w->fd < 0 && accept_event(w, &events[i]))
+                pushed += deliver(w, &kernel_ring, &events[i]);
+        }
+        pthread_mutex_unlock(&watch_lock);
+
+        if (pushed)
+            notify();
+    }
+}
+
+static void *event_thread(void *arg)
+{
+    if (gpio_backend == &chardev_backend)
+        chardev_loop();
+    else
+        sysfs_loop();
+    return NULL;
+}
+
+// the level an event on w stands for, given the level read just after it
+static int event_level(struct watch *w, int level)
+{
+    int up = w->detects & ((1 << EVENT_RISING) | (1 << EVENT_HIGH));
+    int down = w->detects & ((1 << EVENT_FALLING) | (1 << EVENT_LOW));
+
+    // a short pulse may be over by the time the level is read
+    if (up && !down)
+        return 1;
+    if (down && !up)
+        return 0;
+    return level;
+}
+
+// check both banks' event detect status once; returns the number of events
+// seen. every latched bit of a bank is acknowledged with one write-1-to-clear
+// store
+static int poll_hardware(void)
+{
+    struct gpio_event event;
+    struct watch *w;
+    uint32_t status, levels, mask;
+    int bank, gpio, seen = 0, pushed = 0;
+
+    for (bank = 0; bank < 2; bank++) {
+        if (!armed[bank])
+            continue;
+        status = gpio_backend->event_status(bank) & armed[bank];
+        if (!status && !masked[bank])
+            continue;
+
+        event.timestamp_ns = now_ns();
+        pthread_mutex_lock(&watch_lock);
+        status &= armed[bank];
+        if (status)
+            gpio_backend->clear_events(bank, status);
+        levels = gpio_backend->input_bank(bank);
+
+        for (gpio = bank * 32; gpio < bank * 32 + 32 && gpio < MAX_GPIOS; gpio++) {
+            w = &watches[gpio];
+            mask = GPIO_MASK(gpio);
+
+            // level detects come back once the pin has left that level
+            if ((w->masked & (1 << EVENT_HIGH)) && !(levels & mask)) {
+                w->masked &= ~(1 << EVENT_HIGH);
+                gpio_backend->set_event(EVENT_HIGH, gpio, 1);
+            }
+            if ((w->masked & (1 << EVENT_LOW)) && (levels & mask)) {
+                w->masked &= ~(1 << EVENT_LOW);
+                gpio_backend->set_event(EVENT_LOW, gpio, 1);
+            }
+            if (!w->masked)
+                masked[bank] &= ~mask;
+
+            if (!(status & mask) || !w->active || !w->hardware)
+                continue;
+            seen++;
+            event.gpio = gpio;
+            event.level = event_level(w, (levels & mask) != 0);
+            event.seqno = ++w->seqno;
+
+            // a level detect would latch again straight away, so mask it
+            if ((w->detects & (1 << EVENT_HIGH)) && event.level) {
+                gpio_backend->set_event(EVENT_HIGH, gpio, 0);
+                w->masked |= 1 << EVENT_HIGH;
+                masked[bank] |= mask;
+            }
+            if ((w->detects & (1 << EVENT_LOW)) && !event.level) {
+                gpio_backend->set_event(EVENT_LOW, gpio, 0);
+                w->masked |= 1 << EVENT_LOW;
+                masked[bank] |= mask;
+            }
+
+            if (accept_event(w, &event))
+                pushed += deliver(w, &hardware_ring, &event);
+        }
+        pthread_mutex_unlock(&watch_lock);
+    }
+
+    if (pushed)
+        notify();
+    return seen;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+}
+
+// spin: check continuously. sleep: check every poll_interval_ns. hybrid:
+// spin for poll_spin_ns after each event, in case more follow, then sleep.
+// with no pin armed the thread waits for one instead, whatever the mode
+static void *hardware_thread(void *arg)
+{
+    uint64_t last_event = 0, now;
+
+    while (!poll_stopping) {
+        if (!armed[0] && !armed[1]) {
+            pthread_mutex_lock(&watch_lock);
+            while (!poll_stopping && !armed[0] && !armed[1])
+                pthread_cond_wait(&arm_cond, &watch_lock);
+            pthread_mutex_unlock(&watch_lock);
+            last_event = 0;
+            continue;
+        }
+        atomic_fetch_add_explicit(&polls, 1, memory_order_relaxed);
+        if (poll_hardware()) {
+            last_event = now_ns();
+            continue;
+        }
+        if (poll_mode == EVENT_POLL_SPIN)
+            continue;
+        if (poll_mode == EVENT_POLL_HYBRID) {
+            now = now_ns();
+            if (now - last_event < poll_spin_ns)
+                continue;
+        }
+        sleep_ns(poll_interval_ns);
+    }
+    return NULL;
+}
+
+static int start_notify(void)
+{
+    if (notify_fd < 0 && (notify_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK)) < 0)
+        return -1;
+    return 0;
+}
+
+static int start_poll_thread(void)
+{
+    if (poll_running)
+        return 0;
+    if (start_notify())
+        return -1;
+    poll_stopping = 0;
+    if (rt_thread_create(&poll_thread, hardware_thread, NULL, NULL) != 0)
+        return -1;
+    poll_running = 1;
+    return 0;
+}
+
+static int start_thread(void)
+{
+    struct epoll_event ev;
+
+    if (thread_running)
+        return 0;
+
+    if (start_notify())
+        return -1;
+    if (epoll_fd < 0) {
+        if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+            return -1;
+        if ((stop_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK)) < 0)
+            return -1;
+        ev.events = EPOLLIN;
+        ev.data.u32 = STOP_KEY;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev) < 0)
+            return -1;
+    }
+
+    stopping = 0;
+    if (rt_thread_create(&thread, event_thread, NULL, NULL) != 0)
+        return -1;
+    thread_running = 1;
+    return 0;
+}
+
+// start delivering edges on gpio into the ring. fd is its sysfs value file,
+// or -1 when the character device backend reports its events; edges is the
+// set of EVENT_RISING/EVENT_FALLING bits the edge detection was set up with
+int event_watch(unsigned int gpio, int fd, int edges, unsigned int bounce_ms)
+{
+    struct epoll_event ev;
+    struct watch *w;
+
+    if (gpio >= MAX_GPIOS || start_thread())
+        return -1;
+    w = &watches[gpio];
+
+    pthread_mutex_lock(&watch_lock);
+    w->fd = fd;
+    w->edges = edges;
+    w->skip_first = fd >= 0;
+    w->hardware = 0;
+    w->bounce_ns = (uint64_t)bounce_ms * 1000000ULL;
+    w->last_ns = 0;
+    w->seqno = 0;
+    w->active = 1;
+    pthread_mutex_unlock(&watch_lock);
+
+    if (fd >= 0) {
+        ev.events = EPOLLPRI | EPOLLERR;
+        ev.data.u32 = gpio;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            event_unwatch(gpio);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// watch gpio through the event detect registers instead: detects is the set
+// of EVENT_RISING, EVENT_FALLING, EVENT_HIGH and EVENT_LOW bits to arm
+int event_watch_hardware(unsigned int gpio, int detects, unsigned int bounce_ms)
+{
+    struct watch *w;
+    int type;
+
+    if (gpio >= MAX_GPIOS || detects == 0 || start_poll_thread())
+        return -1;
+    w = &watches[gpio];
+
+    pthread_mutex_lock(&watch_lock);
+    w->fd = -1;
+    w->edges = 0;
+    w->skip_first = 0;
+    w->hardware = 1;
+    w->detects = detects;
+    w->masked = 0;
+    w->bounce_ns = (uint64_t)bounce_ms * 1000000ULL;
+    w->last_ns = 0;
+    w->seqno = 0;
+    w->active = 1;
+    for (type = EVENT_RISING; type <= EVENT_LOW; type++)
+        gpio_backend->set_event(type, gpio, (detects >> type) & 1);
+    gpio_backend->clear_events(GPIO_BANK(gpio), GPIO_MASK(gpio));
+    masked[GPIO_BANK(gpio)] &= ~GPIO_MASK(gpio);
+    armed[GPIO_BANK(gpio)] |= GPIO_MASK(gpio);
+    pthread_cond_signal(&arm_cond);
+    pthread_mutex_unlock(&watch_lock);
+    return 0;
+}
+
+void event_set_poll_mode(int mode, uint64_t interval_ns, uint64_t spin_ns)
+{
+    poll_mode = mode;
+    poll_interval_ns = interval_ns;
+    poll_spin_ns = spin_ns;
+}
+
+// once this returns the event threads no longer touch the gpio's fd or its
+// event detect registers
+void event_unwatch(unsigned int gpio)
+{
+    struct watch *w;
+    int type;
+
+    if (gpio >= MAX_GPIOS)
+        return;
+    w = &watches[gpio];
+
+    pthread_mutex_lock(&watch_lock);
+    if (w->active && w->fd >= 0)
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->fd, NULL);
+    if (w->active && w->hardware) {
+        armed[GPIO_BANK(gpio)] &= ~GPIO_MASK(gpio);
+        masked[GPIO_BANK(gpio)] &= ~GPIO_MASK(gpio);
+        for (type = EVENT_RISING; type <= EVENT_LOW; type++) {
+            if ((w->detects >> type) & 1)
+                gpio_backend->set_event(type, gpio, 0);
+        }
+        w->hardware = 0;
+        w->detects = 0;
+        w->masked = 0;
+    }
+    w->active = 0;
+    w->fd = -1;
+    if (w->waited) {
+        w->waited = 0;
+        drop_waited(gpio);
+    }
+    w->counted = 0;
+    pthread_mutex_unlock(&watch_lock);
+}
+
+// route gpio's edges to event_wait_any rather than to event_drain. set before
+// event_watch so that no edge lands in the rings; event_unwatch clears it
+void event_set_waited(unsigned int gpio, int waited)
+{
+    if (gpio >= MAX_GPIOS)
+        return;
+
+    pthread_once(&wait_once, init_wait_cond);
+    pthread_mutex_lock(&watch_lock);
+    watches[gpio].waited = waited;
+    if (!waited)
+        drop_waited(gpio);
+    pthread_mutex_unlock(&watch_lock);
+}
+
+// count gpio's edges instead of delivering them, from zero. set before
+// event_watch; event_unwatch clears it but leaves the count readable
+int event_set_counted(unsigned int gpio, int counted)
+{
+    struct edge_counter *c;
+
+    if (gpio >= MAX_GPIOS)
+        return -1;
+    c = &counters[gpio];
+
+    pthread_mutex_lock(&watch_lock);
+    if (counted && c->history == NULL &&
+        (c->history = calloc(COUNTER_HISTORY, sizeof(*c->history))) == NULL) {
+        pthread_mutex_unlock(&watch_lock);
+        return -1;
+    }
+    watches[gpio].counted = counted;
+    if (counted) {
+        atomic_store_explicit(&c->count, 0, memory_order_relaxed);
+        c->slots = 0;
+        c->reset_ns = now_ns();
+    }
+    pthread_mutex_unlock(&watch_lock);
+    return 0;
+}
+
+// edges counted on gpio since event_set_counted or event_count_reset
+uint64_t event_count(unsigned int gpio)
+{
+    if (gpio >= MAX_GPIOS)
+        return 0;
+    return atomic_load_explicit(&counters[gpio].count, memory_order_relaxed);
+}
+
+void event_count_reset(unsigned int gpio)
+{
+    struct edge_counter *c;
+
+    if (gpio >= MAX_GPIOS)
+        return;
+    c = &counters[gpio];
+
+    pthread_mutex_lock(&watch_lock);
+    atomic_store_explicit(&c->count, 0, memory_order_relaxed);
+    c->slots = 0;
+    c->reset_ns = now_ns();
+    pthread_mutex_unlock(&watch_lock);
+}
+
+// edges per second on gpio over the last window_ns, from the history. a
+// window reaching back past the last reset is cut short at it, and one
+// reaching past the oldest slot at that; edges in the slot the window starts
+// in may be counted, an error of at most one COUNTER_TICK_NS
+double event_count_rate(unsigned int gpio, uint64_t window_ns)
+{
+    struct edge_counter *c;
+    uint64_t now = now_ns(), start, span, total, before = 0, first, lo, hi, mid;
+
+    if (gpio >= MAX_GPIOS || window_ns == 0)
+        return 0.0;
+    c = &counters[gpio];
+    start = now > window_ns ? now - window_ns : 0;
+
+    pthread_mutex_lock(&watch_lock);
+    total = atomic_load_explicit(&c->count, memory_order_relaxed);
+    if (c->reset_ns >= start) {
+        start = c->reset_ns;
+    } else if (c->slots > 0) {
+        // the newest slot before start holds the count the window starts from
+        first = c->slots > COUNTER_HISTORY ? c->slots - COUNTER_HISTORY : 0;
+        lo = first;
+        hi = c->slots;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (c->history[mid & (COUNTER_HISTORY - 1)].timestamp_ns < start)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo > first) {
+            before = c->history[(lo - 1) & (COUNTER_HISTORY - 1)].count;
+        } else if (first > 0) {
+            before = c->history[lo & (COUNTER_HISTORY - 1)].count;
+            start = c->history[lo & (COUNTER_HISTORY - 1)].timestamp_ns;
+        }
+    }
+    pthread_mutex_unlock(&watch_lock);
+
+    span = now - start;
+    return span ? (double)(total - before) * 1e9 / span : 0.0;
+}
+
+// take the oldest queued edge on any pin in mask (one word per bank), waiting
+// until deadline_ns on the CLOCK_MONOTONIC clock, or for ever if it is 0.
+// returns 1 with the edge in *event, 0 on timeout, or -1 after event_wait_wake
+int event_wait_any(const uint32_t mask[2], uint64_t deadline_ns, struct gpio_event *event)
+{
+    struct timespec deadline;
+    unsigned int wakeups;
+    int i, timed_out = 0, result = 0;
+
+    pthread_once(&wait_once, init_wait_cond);
+    deadline.tv_sec = deadline_ns / 1000000000ULL;
+    deadline.tv_nsec = deadline_ns % 1000000000ULL;
+
+    pthread_mutex_lock(&watch_lock);
+    wakeups = wait_wakeups;
+    for (;;) {
+        for (i = 0; i < wait_count; i++) {
+            if (mask[GPIO_BANK(wait_queue[i].gpio)] & GPIO_MASK(wait_queue[i].gpio))
+                break;
+        }
+        if (i < wait_count) {
+            *event = wait_queue[i];
+            wait_count--;
+            memmove(&wait_queue[i], &wait_queue[i + 1], (wait_count - i) * sizeof(*event));
+            result = 1;
+            break;
+        }
+        if (wait_wakeups != wakeups) {
+            result = -1;
+            break;
+        }
+        if (timed_out)
+            break;
+
+        if (deadline_ns == 0)
+            pthread_cond_wait(&wait_cond, &watch_lock);
+        else if (pthread_cond_timedwait(&wait_cond, &watch_lock, &deadline) == ETIMEDOUT)
+            timed_out = 1;  // look at the queue once more
+    }
+    pthread_mutex_unlock(&watch_lock);
+    return result;
+}
+
+// make every event_wait_any in progress return early
+void event_wait_wake(void)
+{
+    pthread_once(&wait_once, init_wait_cond);
+    pthread_mutex_lock(&watch_lock);
+    wait_wakeups++;
+    pthread_cond_broadcast(&wait_cond);
+    pthread_mutex_unlock(&watch_lock);
+}
+
+// take up to max events from the ring, waiting up to timeout_ms (-1 for ever)
+// for the first one. returns 0 on timeout or after event_wake
+int event_drain(struct gpio_event *events, int max, int timeout_ms)
+{
+    struct pollfd pfd;
+    uint64_t count;
+    int n;
+
+    if (notify_fd < 0)
+        return 0;
+
+    pthread_mutex_lock(&drain_lock);
+    if (ring_empty(&kernel_ring) && ring_empty(&hardware_ring) && timeout_ms != 0) {
+        pthread_mutex_unlock(&drain_lock);
+        pfd.fd = notify_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, timeout_ms) > 0 && read(notify_fd, &count, sizeof(count)) < 0)
+            count = 0;
+        pthread_mutex_lock(&drain_lock);
+    }
+
+    n = ring_take(&kernel_ring, events, max);
+    n += ring_take(&hardware_ring, events + n, max - n);
+    pthread_mutex_unlock(&drain_lock);
+    return n;
+}
+
+// make an event_drain in progress return early
+void event_wake(void)
+{
+    if (notify_fd >= 0)
+        notify();
+}
+
+uint64_t event_overflows(void)
+{
+    return atomic_load_explicit(&overflows, memory_order_relaxed);
+}
+
+uint64_t event_polls(void)
+{
+    return atomic_load_explicit(&polls, memory_order_relaxed);
+}
+
+void event_stop(void)
+{
+    struct gpio_event discard[EVENT_BATCH];
+    uint64_t one = 1;
+    int i;
+
+    if (poll_running) {
+        pthread_mutex_lock(&watch_lock);
+        poll_stopping = 1;
+        pthread_cond_signal(&arm_cond);
+        pthread_mutex_unlock(&watch_lock);
+        pthread_join(poll_thread, NULL);
+        poll_running = 0;
+    }
+
+    if (thread_running) {
+        stopping = 1;
+        if (gpio_backend == &chardev_backend)
+            chardev_wake();
+        else if (write(stop_fd, &one, sizeof(one)) < 0)
+            return;
+        pthread_join(thread, NULL);
+        thread_running = 0;
+        if (read(stop_fd, &one, sizeof(one)) < 0)
+            one = 0;
+    }
+
+    for (i = 0; i < MAX_GPIOS; i++)
+        event_unwatch(i);
+    pthread_mutex_lock(&drain_lock);
+    while (ring_take(&kernel_ring, discard, EVENT_BATCH) || ring_take(&hardware_ring, discard, EVENT_BATCH))
+        ;
+    pthread_mutex_unlock(&drain_lock);
+}
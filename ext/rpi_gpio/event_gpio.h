@@ -0,0 +1,56 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Native edge-event thread feeding a bounded ring of events */
+
+#include <stdint.h>
+#include "c_gpio.h"
+
+#define EVENT_RING_SIZE 1024   // must be a power of 2
+#define WAIT_QUEUE_SIZE 256    // edges held for event_wait_any
+#define COUNTER_HISTORY 4096   // slots kept per counter; must be a power of 2
+#define COUNTER_TICK_NS 1000000ULL
+
+// how the event detect registers are polled
+#define EVENT_POLL_SPIN   0
+#define EVENT_POLL_HYBRID 1
+#define EVENT_POLL_SLEEP  2
+#define EVENT_POLL_DEFAULT_INTERVAL_NS 100000ULL
+#define EVENT_POLL_DEFAULT_SPIN_NS     1000000ULL
+
+int event_watch(unsigned int gpio, int fd, int edges, unsigned int bounce_ms);
+int event_watch_hardware(unsigned int gpio, int detects, unsigned int bounce_ms);
+void event_set_poll_mode(int mode, uint64_t interval_ns, uint64_t spin_ns);
+void event_unwatch(unsigned int gpio);
+int event_drain(struct gpio_event *events, int max, int timeout_ms);
+void event_wake(void);
+void event_set_waited(unsigned int gpio, int waited);
+int event_wait_any(const uint32_t mask[2], uint64_t deadline_ns, struct gpio_event *event);
+void event_wait_wake(void);
+int event_set_counted(unsigned int gpio, int counted);
+uint64_t event_count(unsigned int gpio);
+void event_count_reset(unsigned int gpio);
+double event_count_rate(unsigned int gpio, uint64_t window_ns);
+uint64_t event_overflows(void);
+uint64_t event_polls(void);
+void event_stop(void);
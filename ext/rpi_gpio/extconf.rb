@@ -1,3 +1,7 @@
 require 'mkmf'
 
+have_header 'ruby/io/buffer.h'
+have_func 'rb_io_buffer_get_bytes_for_reading', 'ruby/io/buffer.h'
+have_func 'rb_io_buffer_new', 'ruby/io/buffer.h'
+
 create_makefile 'rpi_gpio/rpi_gpio'
@@ -0,0 +1,244 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include "c_gpio.h"
+#include "hard_pwm.h"
+#include "dma.h"
+
+// the PWM clock runs at the oscillator over this; both channels share it, so
+// it stays fixed and each channel's frequency is set by its range alone
+#define CLOCK_DIVISOR    2
+#define MIN_RANGE        2
+#define MAX_RANGE        0xffffffffUL
+#define BUSY_WAIT_TRIES  100
+
+// which PWM channel each GPIO can be routed to, and through which function
+struct route
+{
+    unsigned int gpio;
+    int channel;
+    int function;
+};
+
+static const struct route routes[] = {
+    { 12, 0, ALT0 }, { 13, 1, ALT0 }, { 18, 0, ALT5 }, { 19, 1, ALT5 },
+    { 40, 0, ALT0 }, { 41, 1, ALT0 }, { 45, 1, ALT0 },
+};
+
+struct hard_pwm
+{
+    int gpio;               // -1 while the channel is free
+    int mode;
+    uint32_t range;
+    uint32_t data;
+};
+
+static struct hard_pwm channels[2] = { { -1 }, { -1 } };
+static volatile uint32_t *pwm_regs;
+static volatile uint32_t *clock_regs;
+static double clock_freq;
+
+static const struct route *find_route(unsigned int gpio)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(routes) / sizeof(routes[0]); i++)
+    {
+        if (routes[i].gpio == gpio)
+            return &routes[i];
+    }
+    return NULL;
+}
+
+static struct hard_pwm *find_channel(unsigned int gpio)
+{
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        if (channels[i].gpio == (int)gpio)
+            return &channels[i];
+    }
+    return NULL;
+}
+
+static inline int channel_shift(struct hard_pwm *p)
+{
+    return (p == &channels[0]) ? 0 : 8;
+}
+
+// the clock manager ignores writes without its password, and the divisor
+// must only change while the clock is stopped and no longer busy
+static void wait_clock_idle(void)
+{
+    int tries;
+
+    for (tries = 0; tries < BUSY_WAIT_TRIES && (clock_regs[CM_PWMCTL_OFFSET] & CM_CTL_BUSY); tries++)
+        usleep(10);
+}
+
+static void clock_start(void)
+{
+    clock_regs[CM_PWMCTL_OFFSET] = CM_PASSWORD | CM_CTL_SRC_OSC;
+    wait_clock_idle();
+    clock_regs[CM_PWMDIV_OFFSET] = CM_PASSWORD | (CLOCK_DIVISOR << CM_DIV_SHIFT);
+    clock_regs[CM_PWMCTL_OFFSET] = CM_PASSWORD | CM_CTL_SRC_OSC;
+    clock_regs[CM_PWMCTL_OFFSET] = CM_PASSWORD | CM_CTL_SRC_OSC | CM_CTL_ENAB;
+}
+
+static void clock_stop(void)
+{
+    clock_regs[CM_PWMCTL_OFFSET] = CM_PASSWORD | CM_CTL_SRC_OSC;
+    wait_clock_idle();
+}
+
+// map the registers and work out the clock rate on first use. the PWM block
+// is the same on every chip up to the 2711; later ones have none to map
+static int map_registers(void)
+{
+    if (pwm_regs != NULL && clock_regs != NULL)
+        return HARD_PWM_OK;
+
+    if (gpio_chip == NULL || gpio_chip->family == CHIP_UNKNOWN)
+        return HARD_PWM_NO_ACCESS;
+    clock_freq = gpio_chip->osc_freq / CLOCK_DIVISOR;
+
+    pwm_regs = gpio_backend->peripheral(PERIPHERAL_PWM);
+    clock_regs = gpio_backend->peripheral(PERIPHERAL_CLOCK);
+    if (pwm_regs == NULL || clock_regs == NULL)
+    {
+        pwm_regs = clock_regs = NULL;
+        return HARD_PWM_NO_ACCESS;
+    }
+    return HARD_PWM_OK;
+}
+
+// claim gpio's PWM channel and route the pin to it, starting the PWM clock
+// if the other channel isn't already using it. claiming a channel the gpio
+// already holds just changes its mode
+int hard_pwm_setup(unsigned int gpio, int mode)
+{
+    const struct route *route;
+    struct hard_pwm *p;
+    int result;
+
+    if ((route = find_route(gpio)) == NULL)
+        return HARD_PWM_NO_CHANNEL;
+    p = &channels[route->channel];
+    if (p->gpio != -1 && p->gpio != (int)gpio)
+        return HARD_PWM_BUSY;
+    if (dma_pacer_busy(DMA_PACER_PWM))
+        return HARD_PWM_BUSY;
+    if ((result = map_registers()) != HARD_PWM_OK)
+        return result;
+
+    if (p->gpio == -1)
+    {
+        if (channels[!route->channel].gpio == -1)
+            clock_start();
+        p->gpio = gpio;
+        p->range = MIN_RANGE;
+        p->data = 0;
+        pwm_regs[PWM_CTL_OFFSET] &= ~(PWM_CTL_CHANNEL_BITS << channel_shift(p));
+        gpio_backend->set_function(gpio, route->function);
+    }
+    p->mode = mode;
+    return HARD_PWM_OK;
+}
+
+// program the channel's period and high time. with mark-space output the
+// hardware picks new values up at the end of the current period, so a
+// running channel never emits a cut-short pulse
+int hard_pwm_set(unsigned int gpio, float freq, float dutycycle)
+{
+    struct hard_pwm *p;
+    double range;
+
+    if ((p = find_channel(gpio)) == NULL)
+        return HARD_PWM_NO_CHANNEL;
+    if (freq <= 0.0)
+        return HARD_PWM_BAD_FREQ;
+
+    range = clock_freq / freq + 0.5;
+    if (range < MIN_RANGE || range > MAX_RANGE)
+        return HARD_PWM_BAD_FREQ;
+
+    p->range = (uint32_t)range;
+    p->data = (uint32_t)(p->range * (dutycycle / 100.0) + 0.5);
+    if (p == &channels[0])
+    {
+        pwm_regs[PWM_RNG1_OFFSET] = p->range;
+        pwm_regs[PWM_DAT1_OFFSET] = p->data;
+    }
+    else
+    {
+        pwm_regs[PWM_RNG2_OFFSET] = p->range;
+        pwm_regs[PWM_DAT2_OFFSET] = p->data;
+    }
+    return HARD_PWM_OK;
+}
+
+void hard_pwm_start(unsigned int gpio)
+{
+    struct hard_pwm *p;
+    uint32_t bits = PWM_CTL_PWEN;
+
+    if ((p = find_channel(gpio)) == NULL)
+        return;
+
+    if (p->mode == HARD_PWM_MARK_SPACE)
+        bits |= PWM_CTL_MSEN;
+    pwm_regs[PWM_CTL_OFFSET] = (pwm_regs[PWM_CTL_OFFSET] & ~(PWM_CTL_CHANNEL_BITS << channel_shift(p)))
+        | (bits << channel_shift(p));
+}
+
+// disable the channel, hand the pin back as a low output and free the
+// channel; the clock stops once neither channel is using it
+void hard_pwm_stop(unsigned int gpio)
+{
+    struct hard_pwm *p;
+
+    if ((p = find_channel(gpio)) == NULL)
+        return;
+
+    pwm_regs[PWM_CTL_OFFSET] &= ~(PWM_CTL_CHANNEL_BITS << channel_shift(p));
+    gpio_backend->set_function(gpio, FSEL_OUTPUT);
+    output_gpio(gpio, 0);
+    p->gpio = -1;
+    if (channels[0].gpio == -1 && channels[1].gpio == -1)
+        clock_stop();
+}
+
+// returns 1 if gpio holds a PWM channel, 0 otherwise
+int hard_pwm_exists(unsigned int gpio)
+{
+    return find_channel(gpio) != NULL;
+}
+
+// returns 1 if either channel is in use, 0 otherwise
+int hard_pwm_active(void)
+{
+    return channels[0].gpio != -1 || channels[1].gpio != -1;
+}
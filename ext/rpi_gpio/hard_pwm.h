@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef HARD_PWM_H
+#define HARD_PWM_H
+
+/* PWM from the SoC's own PWM peripheral, clocked by the clock manager */
+
+#define HARD_PWM_OK          0
+#define HARD_PWM_NO_CHANNEL  1  // the GPIO has no PWM function
+#define HARD_PWM_BUSY        2  // its PWM channel already drives another GPIO
+#define HARD_PWM_NO_ACCESS   3  // the PWM or clock registers can't be mapped
+#define HARD_PWM_BAD_FREQ    4  // the frequency is out of the clock's reach
+
+#define HARD_PWM_MARK_SPACE  0  // high for the duty cycle, then low
+#define HARD_PWM_BALANCED    1  // high time spread evenly across the period
+
+// PWM block layout, in 32-bit words
+#define PWM_CTL_OFFSET       0
+#define PWM_STA_OFFSET       1
+#define PWM_DMAC_OFFSET      2
+#define PWM_RNG1_OFFSET      4
+#define PWM_DAT1_OFFSET      5
+#define PWM_FIF1_OFFSET      6
+#define PWM_RNG2_OFFSET      8
+#define PWM_DAT2_OFFSET      9
+
+// PWM_CTL bits for channel 1; channel 2's are 8 bits higher
+#define PWM_CTL_PWEN         0x01
+#define PWM_CTL_MODE         0x02
+#define PWM_CTL_RPTL         0x04
+#define PWM_CTL_SBIT         0x08
+#define PWM_CTL_POLA         0x10
+#define PWM_CTL_USEF         0x20
+#define PWM_CTL_CLRF         0x40
+#define PWM_CTL_MSEN         0x80
+#define PWM_CTL_CHANNEL_BITS 0xbf
+
+#define PWM_DMAC_ENAB        0x80000000
+#define PWM_DMAC_PANIC(x)    ((x) << 8)
+#define PWM_DMAC_DREQ(x)     (x)
+
+// clock manager registers for the PCM and PWM clocks, in 32-bit words
+#define CM_PCMCTL_OFFSET     38 // 0x0098 / 4
+#define CM_PCMDIV_OFFSET     39 // 0x009c / 4
+#define CM_PWMCTL_OFFSET     40 // 0x00a0 / 4
+#define CM_PWMDIV_OFFSET     41 // 0x00a4 / 4
+
+#define CM_PASSWORD          0x5a000000
+#define CM_CTL_BUSY          0x80
+#define CM_CTL_ENAB          0x10
+#define CM_CTL_SRC_OSC       0x01
+#define CM_CTL_SRC_PLLD      0x06
+#define CM_DIV_SHIFT         12
+
+int hard_pwm_setup(unsigned int gpio, int mode);
+int hard_pwm_set(unsigned int gpio, float freq, float dutycycle);
+void hard_pwm_start(unsigned int gpio);
+void hard_pwm_stop(unsigned int gpio);
+int hard_pwm_exists(unsigned int gpio);
+int hard_pwm_active(void);
+
+#endif /* HARD_PWM_H */
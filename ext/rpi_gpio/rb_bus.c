@@ -0,0 +1,343 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "rb_bus.h"
+#ifdef HAVE_RUBY_IO_BUFFER_H
+#include "ruby/io/buffer.h"
+#endif
+
+extern VALUE m_GPIO;
+VALUE c_Bus = Qnil;
+
+#define BUS_MAX_WIDTH 32
+
+// SET and CLR masks that put one byte of a bus value on its pins
+struct bus_entry
+{
+  uint32_t set[GPIO_BANKS];
+  uint32_t clr[GPIO_BANKS];
+};
+
+// a group of pins written and read as one integer; bit 0 is the first pin.
+// table holds 256 entries for each byte of the bus width, so a write costs one
+// lookup per byte and one SET and one CLR store per bank
+struct bus
+{
+  int width;
+  int bytes;
+  int channel[BUS_MAX_WIDTH];
+  unsigned int gpio[BUS_MAX_WIDTH];
+  int direction[BUS_MAX_WIDTH];
+  int banks_used[GPIO_BANKS];
+  struct bus_entry *table;
+};
+
+static void bus_free(void *ptr)
+{
+  struct bus *b = (struct bus *)ptr;
+  xfree(b->table);
+  xfree(b);
+}
+
+static size_t bus_size(const void *ptr)
+{
+  const struct bus *b = (const struct bus *)ptr;
+  return sizeof(struct bus) + b->bytes * 256 * sizeof(struct bus_entry);
+}
+
+static const rb_data_type_t bus_type = {
+  "RPi::GPIO::Bus",
+  { NULL, bus_free, bus_size, },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE bus_alloc(VALUE klass)
+{
+  struct bus *b;
+  return TypedData_Make_Struct(klass, struct bus, &bus_type, b);
+}
+
+static struct bus *get_bus(VALUE self)
+{
+  struct bus *b;
+  TypedData_Get_Struct(self, struct bus, &bus_type, b);
+  if (b->table == NULL)
+  {
+    rb_raise(rb_eRuntimeError, "RPi::GPIO::Bus has not been initialized");
+  }
+  return b;
+}
+
+// the channels may have been cleaned up or set up again since the Bus was
+// created
+static void check_bus_directions(struct bus *b, int output)
+{
+  int i;
+
+  for (i = 0; i < b->width; i++)
+  {
+    if (gpio_direction[b->gpio[i]] != b->direction[i])
+    {
+      rb_raise(rb_eRuntimeError, "GPIO channel has been cleaned up or set up "
+        "again since this RPi::GPIO::Bus was created");
+    }
+    if (output && b->direction[i] != OUTPUT)
+    {
+      rb_raise(rb_eRuntimeError, "GPIO channel not setup as output");
+    }
+  }
+}
+
+static void build_table(struct bus *b)
+{
+  int byte, value, bit, i;
+  struct bus_entry *e;
+
+  b->table = ALLOC_N(struct bus_entry, b->bytes * 256);
+  MEMZERO(b->table, struct bus_entry, b->bytes * 256);
+  for (byte = 0; byte < b->bytes; byte++)
+  {
+    for (value = 0; value < 256; value++)
+    {
+      e = &b->table[byte * 256 + value];
+      for (bit = 0; bit < 8; bit++)
+      {
+        i = byte * 8 + bit;
+        if (i >= b->width)
+          break;
+        if (value & (1 << bit))
+          e->set[GPIO_BANK(b->gpio[i])] |= GPIO_MASK(b->gpio[i]);
+        else
+          e->clr[GPIO_BANK(b->gpio[i])] |= GPIO_MASK(b->gpio[i]);
+      }
+    }
+  }
+}
+
+// put one bus word, stored little-endian in bytes, on the pins
+static inline void write_word(struct bus *b, const unsigned char *bytes)
+{
+  uint32_t set[GPIO_BANKS] = {0};
+  uint32_t clr[GPIO_BANKS] = {0};
+  struct batch *batch = current_batch();
+  const struct bus_entry *e;
+  int byte, bank;
+
+  for (byte = 0; byte < b->bytes; byte++)
+  {
+    e = &b->table[byte * 256 + bytes[byte]];
+    for (bank = 0; bank < GPIO_BANKS; bank++)
+    {
+      set[bank] |= e->set[bank];
+      clr[bank] |= e->clr[bank];
+    }
+  }
+
+  for (bank = 0; bank < GPIO_BANKS; bank++)
+  {
+    if (!b->banks_used[bank])
+      continue;
+    if (batch != NULL)
+      batch_record_bank(batch, bank, set[bank], clr[bank]);
+    else
+      output_gpio_bank(bank, set[bank], clr[bank]);
+  }
+}
+
+void define_bus_class_stuff(void)
+{
+  c_Bus = rb_define_class_under(m_GPIO, "Bus", rb_cObject);
+  rb_define_alloc_func(c_Bus, bus_alloc);
+  rb_define_method(c_Bus, "initialize", Bus_initialize, 1);
+  rb_define_method(c_Bus, "width", Bus_get_width, 0);
+  rb_define_method(c_Bus, "channels", Bus_get_channels, 0);
+  rb_define_method(c_Bus, "write", Bus_write, 1);
+  rb_define_method(c_Bus, "write_all", Bus_write_all, 1);
+  rb_define_method(c_Bus, "read", Bus_read, 0);
+}
+
+// RPi::GPIO::Bus#initialize(channels)
+//
+// channels are given least significant bit first
+VALUE Bus_initialize(VALUE self, VALUE channels)
+{
+  struct bus *b;
+  int i, j, width;
+  unsigned int gpio;
+
+  TypedData_Get_Struct(self, struct bus, &bus_type, b);
+  if (b->table != NULL)
+  {
+    rb_raise(rb_eRuntimeError, "RPi::GPIO::Bus has already been initialized");
+    return Qnil;
+  }
+
+  Check_Type(channels, T_ARRAY);
+  width = RARRAY_LEN(channels);
+  if (width < 1 || width > BUS_MAX_WIDTH)
+  {
+    rb_raise(rb_eArgError, "a bus must have between 1 and %d channels", BUS_MAX_WIDTH);
+    return Qnil;
+  }
+
+  for (i = 0; i < width; i++)
+  {
+    b->channel[i] = NUM2INT(rb_ary_entry(channels, i));
+    if (get_gpio_number(b->channel[i], &gpio) || check_gpio_priv())
+      return Qnil;
+    if (gpio_direction[gpio] != INPUT && gpio_direction[gpio] != OUTPUT)
+    {
+      rb_raise(rb_eRuntimeError, "you must setup the GPIO channel first with "
+        "RPi::GPIO.setup CHANNEL, :as => :input or "
+        "RPi::GPIO.setup CHANNEL, :as => :output");
+      return Qnil;
+    }
+    for (j = 0; j < i; j++)
+    {
+      if (b->gpio[j] == gpio)
+      {
+        rb_raise(rb_eArgError, "a channel can only appear in a bus once");
+        return Qnil;
+      }
+    }
+    b->gpio[i] = gpio;
+    b->direction[i] = gpio_direction[gpio];
+    b->banks_used[GPIO_BANK(gpio)] = 1;
+  }
+
+  b->width = width;
+  b->bytes = (width + 7) / 8;
+  build_table(b);
+  return self;
+}
+
+// RPi::GPIO::Bus#width
+VALUE Bus_get_width(VALUE self)
+{
+  return INT2NUM(get_bus(self)->width);
+}
+
+// RPi::GPIO::Bus#channels
+VALUE Bus_get_channels(VALUE self)
+{
+  struct bus *b = get_bus(self);
+  VALUE channels = rb_ary_new_capa(b->width);
+  int i;
+
+  for (i = 0; i < b->width; i++)
+  {
+    rb_ary_push(channels, INT2NUM(b->channel[i]));
+  }
+  return channels;
+}
+
+// RPi::GPIO::Bus#write(value)
+VALUE Bus_write(VALUE self, VALUE value)
+{
+  struct bus *b = get_bus(self);
+  unsigned long long v;
+  unsigned char bytes[BUS_MAX_WIDTH / 8];
+  int byte;
+
+  if (FIXNUM_P(value) ? FIX2LONG(value) < 0 : RTEST(rb_funcall(value, rb_intern("negative?"), 0)))
+  {
+    rb_raise(rb_eArgError, "value does not fit in a %d-bit bus", b->width);
+    return Qnil;
+  }
+  v = NUM2ULL(value);
+  if ((v >> b->width) != 0)
+  {
+    rb_raise(rb_eArgError, "value does not fit in a %d-bit bus", b->width);
+    return Qnil;
+  }
+
+  check_bus_directions(b, 1);
+  for (byte = 0; byte < b->bytes; byte++)
+  {
+    bytes[byte] = (v >> (byte * 8)) & 0xff;
+  }
+  write_word(b, bytes);
+  return self;
+}
+
+// RPi::GPIO::Bus#write_all(data)
+//
+// writes each word of a String (or IO::Buffer) in turn; words are as many
+// bytes as the bus is wide, little-endian
+VALUE Bus_write_all(VALUE self, VALUE data)
+{
+  struct bus *b = get_bus(self);
+  const unsigned char *ptr;
+  size_t len, i;
+
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+  if (rb_obj_is_kind_of(data, rb_cIOBuffer))
+  {
+    const void *base;
+    rb_io_buffer_get_bytes_for_reading(data, &base, &len);
+    ptr = (const unsigned char *)base;
+  }
+  else
+#endif
+  {
+    StringValue(data);
+    ptr = (const unsigned char *)RSTRING_PTR(data);
+    len = RSTRING_LEN(data);
+  }
+
+  if (len % b->bytes != 0)
+  {
+    rb_raise(rb_eArgError, "data length must be a multiple of %d bytes", b->bytes);
+    return Qnil;
+  }
+
+  check_bus_directions(b, 1);
+  for (i = 0; i < len; i += b->bytes)
+  {
+    write_word(b, ptr + i);
+  }
+  RB_GC_GUARD(data);
+  return self;
+}
+
+// RPi::GPIO::Bus#read
+VALUE Bus_read(VALUE self)
+{
+  struct bus *b = get_bus(self);
+  uint32_t levels[GPIO_BANKS] = {0};
+  unsigned long long v = 0;
+  int bank, i;
+
+  check_bus_directions(b, 0);
+  for (bank = 0; bank < GPIO_BANKS; bank++)
+  {
+    if (b->banks_used[bank])
+      levels[bank] = input_gpio_bank(bank);
+  }
+  for (i = 0; i < b->width; i++)
+  {
+    if (levels[GPIO_BANK(b->gpio[i])] & GPIO_MASK(b->gpio[i]))
+      v |= 1ULL << i;
+  }
+  return ULL2NUM(v);
+}
@@ -0,0 +1,333 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <errno.h>
+#include "rb_capture.h"
+#ifdef HAVE_RUBY_IO_BUFFER_H
+#include "ruby/io/buffer.h"
+#endif
+
+extern VALUE m_GPIO;
+VALUE c_Capture = Qnil;
+
+VALUE _extract_channels(VALUE channel_or_list);
+
+#define CAPTURE_DEFAULT_RATE  100000
+#define CAPTURE_MAX_RATE      1000000000   // a sample every nanosecond
+#define CAPTURE_DEFAULT_SIZE  (4 * 1024 * 1024)
+
+struct rb_capture
+{
+  struct capture *capture;
+  uint64_t period_ns;
+  uint32_t mask[2];
+  int has_realtime;
+  struct rt_policy realtime;
+};
+
+static void capture_free_struct(void *ptr)
+{
+  struct rb_capture *c = (struct rb_capture *)ptr;
+  if (c->capture != NULL)
+    capture_free(c->capture);
+  xfree(c);
+}
+
+static size_t capture_size(const void *ptr)
+{
+  return sizeof(struct rb_capture);
+}
+
+static const rb_data_type_t capture_type = {
+  "RPi::GPIO::Capture",
+  { NULL, capture_free_struct, capture_size, },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE capture_alloc(VALUE klass)
+{
+  struct rb_capture *c;
+  return TypedData_Make_Struct(klass, struct rb_capture, &capture_type, c);
+}
+
+static struct rb_capture *get_capture(VALUE self)
+{
+  struct rb_capture *c;
+  TypedData_Get_Struct(self, struct rb_capture, &capture_type, c);
+  if (c->capture == NULL)
+  {
+    rb_raise(rb_eRuntimeError, "capture is not initialized");
+  }
+  return c;
+}
+
+void define_capture_class_stuff(void)
+{
+  c_Capture = rb_define_class_under(m_GPIO, "Capture", rb_cObject);
+  rb_define_alloc_func(c_Capture, capture_alloc);
+  rb_define_singleton_method(c_Capture, "open", Capture_open, 1);
+  rb_define_method(c_Capture, "initialize", Capture_initialize, -1);
+  rb_define_method(c_Capture, "start", Capture_start, 0);
+  rb_define_method(c_Capture, "stop", Capture_stop, 0);
+  rb_define_method(c_Capture, "running?", Capture_get_running, 0);
+  rb_define_method(c_Capture, "full?", Capture_get_full, 0);
+  rb_define_method(c_Capture, "rate", Capture_get_rate, 0);
+  rb_define_method(c_Capture, "mask", Capture_get_mask, 0);
+  rb_define_method(c_Capture, "size", Capture_get_size, 0);
+  rb_define_method(c_Capture, "duration", Capture_get_duration, 0);
+  rb_define_method(c_Capture, "samples", Capture_get_samples, 0);
+  rb_define_method(c_Capture, "late_samples", Capture_get_late_samples, 0);
+  rb_define_method(c_Capture, "each", Capture_each, 0);
+  rb_define_method(c_Capture, "buffer", Capture_buffer, 0);
+}
+
+// RPi::GPIO::Capture#initialize(hash(:channels => channels, :rate => hz,
+// :file => path, :size => bytes, :realtime => hash))
+//
+// a capture of the given channels (every GPIO by default) sampled rate times
+// a second, into a file or, without one, into memory of size bytes.
+// :realtime overrides RPi::GPIO.realtime for the sampling thread
+VALUE Capture_initialize(int argc, VALUE *argv, VALUE self)
+{
+  struct rb_capture *c;
+  VALUE hash = Qnil, channels, rate_val, file_val, size_val;
+  VALUE channel_list;
+  unsigned int gpio;
+  long rate = CAPTURE_DEFAULT_RATE;
+  size_t size = CAPTURE_DEFAULT_SIZE;
+  int i;
+
+  TypedData_Get_Struct(self, struct rb_capture, &capture_type, c);
+  rb_scan_args(argc, argv, "01", &hash);
+  if (hash == Qnil)
+    hash = rb_hash_new();
+  Check_Type(hash, T_HASH);
+
+  channels = rb_hash_aref(hash, ID2SYM(rb_intern("channels")));
+  rate_val = rb_hash_aref(hash, ID2SYM(rb_intern("rate")));
+  file_val = rb_hash_aref(hash, ID2SYM(rb_intern("file")));
+  size_val = rb_hash_aref(hash, ID2SYM(rb_intern("size")));
+  c->has_realtime = get_realtime_override(rb_hash_aref(hash, ID2SYM(rb_intern("realtime"))), &c->realtime);
+
+  if (rate_val != Qnil && ((rate = NUM2LONG(rate_val)) <= 0 || rate > CAPTURE_MAX_RATE))
+  {
+    rb_raise(rb_eArgError, "rate must be greater than 0 and at most %d", CAPTURE_MAX_RATE);
+    return Qnil;
+  }
+  if (size_val != Qnil)
+    size = NUM2SIZET(size_val);
+
+  if (channels == Qnil)
+  {
+    c->mask[0] = 0xffffffff;
+    c->mask[1] = 0x003fffff;   // GPIOs 32-53
+  }
+  else
+  {
+    channel_list = _extract_channels(channels);
+    for (i = 0; i < RARRAY_LEN(channel_list); i++)
+    {
+      if (get_gpio_number(NUM2INT(rb_ary_entry(channel_list, i)), &gpio))
+        return Qnil;
+      c->mask[GPIO_BANK(gpio)] |= GPIO_MASK(gpio);
+    }
+  }
+  c->period_ns = 1000000000ULL / rate;
+
+  if (c->capture != NULL)
+    capture_free(c->capture);
+  c->capture = capture_create(file_val == Qnil ? NULL : StringValueCStr(file_val), size);
+  if (c->capture == NULL)
+  {
+    if (errno == EINVAL)
+      rb_raise(rb_eArgError, "size is too small for a capture");
+    rb_sys_fail(file_val == Qnil ? "capture buffer" : StringValueCStr(file_val));
+    return Qnil;
+  }
+  return self;
+}
+
+// RPi::GPIO::Capture.open(path)
+//
+// loads a capture written to a file earlier
+VALUE Capture_open(VALUE klass, VALUE path)
+{
+  VALUE self = capture_alloc(klass);
+  struct rb_capture *c;
+  struct capture_header *h;
+
+  TypedData_Get_Struct(self, struct rb_capture, &capture_type, c);
+  if ((c->capture = capture_open(StringValueCStr(path))) == NULL)
+  {
+    if (errno == EINVAL)
+      rb_raise(rb_eArgError, "%s is not a capture file", StringValueCStr(path));
+    rb_sys_fail(StringValueCStr(path));
+    return Qnil;
+  }
+  h = capture_header(c->capture);
+  if (h->period_ns == 0)
+  {
+    rb_raise(rb_eArgError, "%s is not a capture file", StringValueCStr(path));
+    return Qnil;
+  }
+  c->period_ns = h->period_ns;
+  c->mask[0] = h->mask[0];
+  c->mask[1] = h->mask[1];
+  return self;
+}
+
+// RPi::GPIO::Capture#start
+VALUE Capture_start(VALUE self)
+{
+  struct rb_capture *c = get_capture(self);
+
+  if (check_gpio_priv())
+    return Qnil;
+  if (capture_start(c->capture, c->period_ns, c->mask, c->has_realtime ? &c->realtime : NULL))
+  {
+    rb_raise(rb_eRuntimeError, "capture has already been run");
+    return Qnil;
+  }
+  return self;
+}
+
+// RPi::GPIO::Capture#stop
+VALUE Capture_stop(VALUE self)
+{
+  capture_stop(get_capture(self)->capture);
+  return self;
+}
+
+// RPi::GPIO::Capture#running?
+VALUE Capture_get_running(VALUE self)
+{
+  return capture_running(get_capture(self)->capture) ? Qtrue : Qfalse;
+}
+
+// RPi::GPIO::Capture#full?
+//
+// whether sampling stopped because the buffer ran out of room
+VALUE Capture_get_full(VALUE self)
+{
+  return (capture_header(get_capture(self)->capture)->flags & CAPTURE_FULL) ? Qtrue : Qfalse;
+}
+
+// RPi::GPIO::Capture#rate
+VALUE Capture_get_rate(VALUE self)
+{
+  return ULL2NUM(1000000000ULL / get_capture(self)->period_ns);
+}
+
+// RPi::GPIO::Capture#mask
+//
+// the GPIOs sampled, bit N for GPIO N
+VALUE Capture_get_mask(VALUE self)
+{
+  struct rb_capture *c = get_capture(self);
+  return ULL2NUM(((unsigned long long)c->mask[1] << 32) | c->mask[0]);
+}
+
+// RPi::GPIO::Capture#size
+//
+// number of records stored
+VALUE Capture_get_size(VALUE self)
+{
+  struct capture_header *h = capture_header(get_capture(self)->capture);
+  return ULL2NUM(__atomic_load_n(&h->count, __ATOMIC_ACQUIRE));
+}
+
+// RPi::GPIO::Capture#duration
+//
+// nanoseconds from the first sample to the latest
+VALUE Capture_get_duration(VALUE self)
+{
+  return ULL2NUM(capture_header(get_capture(self)->capture)->end_ns);
+}
+
+// RPi::GPIO::Capture#samples
+VALUE Capture_get_samples(VALUE self)
+{
+  return ULL2NUM(capture_header(get_capture(self)->capture)->samples);
+}
+
+// RPi::GPIO::Capture#late_samples
+//
+// samples taken a whole period or more after they were due
+VALUE Capture_get_late_samples(VALUE self)
+{
+  return ULL2NUM(capture_header(get_capture(self)->capture)->late_samples);
+}
+
+// RPi::GPIO::Capture#each { |time, levels| ... }
+//
+// yields the levels at the start (time 0) and after every change, with time
+// in nanoseconds from the start and levels as an Integer with bit N set if
+// GPIO N was high
+VALUE Capture_each(VALUE self)
+{
+  struct rb_capture *c;
+  struct capture_header *h;
+  const struct capture_record *records;
+  uint64_t count, i, time = 0;
+  uint32_t levels[2];
+
+  RETURN_ENUMERATOR(self, 0, 0);
+  c = get_capture(self);
+  h = capture_header(c->capture);
+  records = capture_records(c->capture);
+  count = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+  levels[0] = h->initial[0];
+  levels[1] = h->initial[1];
+
+  rb_yield_values(2, INT2FIX(0), ULL2NUM(((unsigned long long)levels[1] << 32) | levels[0]));
+  for (i = 0; i < count; i++)
+  {
+    time += records[i].delta_ns;
+    if (!records[i].toggled[0] && !records[i].toggled[1])
+      continue;
+    levels[0] ^= records[i].toggled[0];
+    levels[1] ^= records[i].toggled[1];
+    rb_yield_values(2, ULL2NUM(time), ULL2NUM(((unsigned long long)levels[1] << 32) | levels[0]));
+  }
+  return self;
+}
+
+// RPi::GPIO::Capture#buffer
+//
+// a read-only IO::Buffer over the capture as stored (see capture.h for the
+// layout), without copying it
+VALUE Capture_buffer(VALUE self)
+{
+#ifdef HAVE_RB_IO_BUFFER_NEW
+  struct rb_capture *c = get_capture(self);
+  VALUE buffer = rb_io_buffer_new(capture_header(c->capture), capture_length(c->capture),
+    RB_IO_BUFFER_EXTERNAL | RB_IO_BUFFER_READONLY);
+
+  // the buffer points into our mapping, so keep it alive as long as the buffer
+  rb_ivar_set(buffer, rb_intern("@capture"), self);
+  return buffer;
+#else
+  rb_raise(rb_eNotImpError, "IO::Buffer is not available in this Ruby");
+  return Qnil;
+#endif
+}
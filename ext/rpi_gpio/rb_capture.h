@@ -0,0 +1,44 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "ruby.h"
+#include "capture.h"
+#include "common.h"
+#include "c_gpio.h"
+#include "rb_realtime.h"
+
+void define_capture_class_stuff(void);
+VALUE Capture_initialize(int argc, VALUE *argv, VALUE self);
+VALUE Capture_open(VALUE klass, VALUE path);
+VALUE Capture_start(VALUE self);
+VALUE Capture_stop(VALUE self);
+VALUE Capture_get_running(VALUE self);
+VALUE Capture_get_full(VALUE self);
+VALUE Capture_get_rate(VALUE self);
+VALUE Capture_get_mask(VALUE self);
+VALUE Capture_get_size(VALUE self);
+VALUE Capture_get_duration(VALUE self);
+VALUE Capture_get_samples(VALUE self);
+VALUE Capture_get_late_samples(VALUE self);
+VALUE Capture_each(VALUE self);
+VALUE Capture_buffer(VALUE self);
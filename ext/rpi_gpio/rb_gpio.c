@@ -27,6 +27,7 @@ SOFTWARE.
 #include "rb_gpio.h"
 
 extern VALUE m_GPIO;
+VALUE m_Simulator = Qnil;
 int gpio_warnings = 1;
 
 VALUE _extract_channels(VALUE channel_or_list)
@@ -54,29 +55,53 @@ void define_gpio_module_stuff(void)
     rb_define_module_function(m_GPIO, "set_numbering", GPIO_set_numbering, 1);
     rb_define_module_function(m_GPIO, "set_high", GPIO_set_high, 1);
     rb_define_module_function(m_GPIO, "set_low", GPIO_set_low, 1);
+    rb_define_module_function(m_GPIO, "batch", GPIO_batch, 0);
     rb_define_module_function(m_GPIO, "high?", GPIO_test_high, 1);
     rb_define_module_function(m_GPIO, "low?", GPIO_test_low, 1);
+    rb_define_module_function(m_GPIO, "read_all", GPIO_read_all, -1);
+    rb_define_module_function(m_GPIO, "read_many", GPIO_read_many, 1);
+    rb_define_module_function(m_GPIO, "changes_since", GPIO_changes_since, 1);
     rb_define_module_function(m_GPIO, "set_warnings", GPIO_set_warnings, 1);
     rb_define_module_function(m_GPIO, "get_gpio_number", GPIO_get_gpio_number, 1);
     rb_define_module_function(m_GPIO, "channel_from_gpio", GPIO_channel_from_gpio, 1);
     rb_define_module_function(m_GPIO, "ensure_gpio_input", GPIO_ensure_gpio_input, 1);
+    rb_define_module_function(m_GPIO, "backend", GPIO_backend, 0);
+    rb_define_module_function(m_GPIO, "chip", GPIO_chip, 0);
+    rb_define_module_function(m_GPIO, "board_info", GPIO_board_info, 0);
+    rb_define_module_function(m_GPIO, "native_bench", GPIO_native_bench, 3);
+    rb_define_module_function(m_GPIO, "set_line_edge", GPIO_set_line_edge, 2);
+    rb_define_module_function(m_GPIO, "event_watch", GPIO_event_watch, 4);
+    rb_define_module_function(m_GPIO, "event_watch_hardware", GPIO_event_watch_hardware, 3);
+    rb_define_module_function(m_GPIO, "set_poll_mode", GPIO_set_poll_mode, 3);
+    rb_define_module_function(m_GPIO, "event_unwatch", GPIO_event_unwatch, 1);
+    rb_define_module_function(m_GPIO, "event_stop", GPIO_event_stop, 0);
+    rb_define_module_function(m_GPIO, "drain_events", GPIO_drain_events, 1);
+    rb_define_module_function(m_GPIO, "event_set_waited", GPIO_event_set_waited, 2);
+    rb_define_module_function(m_GPIO, "wait_any_event", GPIO_wait_any_event, 2);
+    rb_define_module_function(m_GPIO, "event_set_counted", GPIO_event_set_counted, 2);
+    rb_define_module_function(m_GPIO, "event_count", GPIO_event_count, 1);
+    rb_define_module_function(m_GPIO, "event_count_reset", GPIO_event_count_reset, 1);
+    rb_define_module_function(m_GPIO, "event_count_rate", GPIO_event_count_rate, 2);
+    rb_define_module_function(m_GPIO, "event_overflows", GPIO_event_overflows, 0);
+    rb_define_module_function(m_GPIO, "event_polls", GPIO_event_polls, 0);
 
     for (i = 0; i < 54; i++) {
         gpio_direction[i] = -1;
     }
 
-    // detect board revision and set up accordingly
-    if (get_rpi_info(&rpiinfo)) {
-        rb_raise(rb_eRuntimeError, "this gem can only be run on a Raspberry Pi");
+    m_Simulator = rb_define_module_under(m_GPIO, "Simulator");
+    rb_define_module_function(m_Simulator, "drive", Simulator_drive, 2);
+    rb_define_module_function(m_Simulator, "registers", Simulator_registers, 1);
+
+    // pick the register backend
+    if (select_backend(getenv("RPI_GPIO_BACKEND"))) {
+        rb_raise(rb_eArgError, "unknown RPI_GPIO_BACKEND; must be mmio, sim or chardev");
         setup_error = 1;
         return;
-    } else if (rpiinfo.p1_revision == 1) {
-        pin_to_gpio = &pin_to_gpio_rev1;
-    } else if (rpiinfo.p1_revision == 2) {
-        pin_to_gpio = &pin_to_gpio_rev2;
-    } else { // assume model B+ or A+
-        pin_to_gpio = &pin_to_gpio_rev3;
     }
+
+    // the board is looked up on first use (see load_board), so requiring the
+    // gem reads no files
 }
 
 int mmap_gpio_mem(void)
@@ -103,6 +128,9 @@ int mmap_gpio_mem(void)
     } else if (result == SETUP_NOT_RPI_FAIL) {
         rb_raise(rb_eRuntimeError, "not running on a RPi");
         return 5;
+    } else if (result == SETUP_CHARDEV_FAIL) {
+        rb_raise(rb_eRuntimeError, "unable to open GPIO character device; set RPI_GPIO_CHIP or try running as root");
+        return 6;
     } else { // result == SETUP_OK
         module_setup = 1;
         return 0;
@@ -146,9 +174,33 @@ int is_gpio_input(unsigned int gpio)
     return 1;
 }
 
+// detect the board revision and set up accordingly, once; returns 0 if this
+// isn't a Pi
+static int load_board(void)
+{
+    const rpi_info *info;
+
+    if (pin_to_gpio != NULL) {
+        return 1;
+    }
+    if ((info = get_board_info()) == NULL) {
+        return 0;
+    }
+
+    rpiinfo = *info;
+    if (rpiinfo.p1_revision == 1) {
+        pin_to_gpio = &pin_to_gpio_rev1;
+    } else if (rpiinfo.p1_revision == 2) {
+        pin_to_gpio = &pin_to_gpio_rev2;
+    } else { // assume model B+ or A+
+        pin_to_gpio = &pin_to_gpio_rev3;
+    }
+    return 1;
+}
+
 int is_rpi(void)
 {
-    if (setup_error) {
+    if (setup_error || !load_board()) {
         rb_raise(rb_eRuntimeError, "this gem can only be run on a Raspberry Pi");
         return 0;
     }
@@ -156,6 +208,15 @@ int is_rpi(void)
     return 1;
 }
 
+// stop the PWM channel, servo bank and waveforms driving gpio, so that none of
+// their threads write to it once it is handed back
+static void stop_drivers(unsigned int gpio)
+{
+    hard_pwm_stop(gpio);
+    servo_stop_gpio(gpio);
+    waveform_stop_gpio(gpio);
+}
+
 // RPi::GPIO.clean_up(channel=nil)
 // clean up everything by default; otherwise, clean up given channel
 VALUE GPIO_clean_up(int argc, VALUE *argv, VALUE self)
@@ -164,6 +225,7 @@ VALUE GPIO_clean_up(int argc, VALUE *argv, VALUE self)
     int found = 0;
     int channel = -666; // lol, quite a flag
     unsigned int gpio;
+    struct gpio_plan plan;
 
     if (argc == 1) {
         channel = NUM2INT(argv[0]);
@@ -181,20 +243,27 @@ VALUE GPIO_clean_up(int argc, VALUE *argv, VALUE self)
             // clean up any /sys/class exports
             rb_funcall(m_GPIO, rb_intern("event_cleanup_all"), 0);
 
-            // set everything back to input
+            // nothing is left to sample once every pin is handed back
+            capture_stop_all();
+
+            // set everything back to input, in one batch of register writes
+            memset(&plan, 0, sizeof(plan));
             for (i = 0; i < 54; i++) {
                 if (gpio_direction[i] != -1) {
-                    setup_gpio(i, INPUT, PUD_OFF);
+                    stop_drivers(i);
+                    plan_gpio(&plan, i, INPUT, PUD_OFF);
                     gpio_direction[i] = -1;
                     found = 1;
                 }
             }
+            setup_gpios(&plan);
         } else {
             // clean up any /sys/class exports
             rb_funcall(m_GPIO, rb_intern("event_cleanup"), 1, INT2NUM(gpio));
 
             // set everything back to input
             if (gpio_direction[gpio] != -1) {
+                stop_drivers(gpio);
                 setup_gpio(gpio, INPUT, PUD_OFF);
                 gpio_direction[gpio] = -1;
                 found = 1;
@@ -243,7 +312,14 @@ VALUE GPIO_setup(VALUE self, VALUE channel, VALUE hash)
     const char *initialize_str = NULL;
     int initialize = HIGH;
 
-    // func to set up channel stored in channel variable
+    // every channel is checked first, then all of them are set up with one
+    // write per register touched
+    struct gpio_plan plan;
+    uint32_t set[2] = {0, 0};
+    uint32_t clr[2] = {0, 0};
+    int bank;
+
+    // func to plan the set up of the channel stored in channel variable
     int setup_one(void) {
         if (get_gpio_number(chan, &gpio)) {
             return 0;
@@ -271,10 +347,13 @@ VALUE GPIO_setup(VALUE self, VALUE channel, VALUE hash)
         }
 
         if (direction == OUTPUT && (initialize == LOW || initialize == HIGH)) {
-            output_gpio(gpio, initialize);
+            if (initialize == HIGH) {
+                set[GPIO_BANK(gpio)] |= GPIO_MASK(gpio);
+            } else {
+                clr[GPIO_BANK(gpio)] |= GPIO_MASK(gpio);
+            }
         }
-        setup_gpio(gpio, direction, pud);
-        gpio_direction[gpio] = direction;
+        plan_gpio(&plan, gpio, direction, pud);
         return 1;
     }
 
@@ -344,6 +423,7 @@ VALUE GPIO_setup(VALUE self, VALUE channel, VALUE hash)
         pud = PUD_OFF;
     }
 
+    memset(&plan, 0, sizeof(plan));
     for (int i = 0; i < chan_count; i++) {
       chan = NUM2INT(rb_ary_entry(channel_list, i));
       if (!setup_one()) {
@@ -351,6 +431,21 @@ VALUE GPIO_setup(VALUE self, VALUE channel, VALUE hash)
       }
     }
 
+    for (bank = 0; bank < 2; bank++) {
+        if (set[bank] || clr[bank]) {
+            output_gpio_bank(bank, set[bank], clr[bank]);
+        }
+    }
+    if (setup_gpios(&plan)) {
+        rb_sys_fail("unable to set up GPIO");
+        return Qnil;
+    }
+    for (int i = 0; i < 54; i++) {
+        if (plan.mask[GPIO_BANK(i)] & GPIO_MASK(i)) {
+            gpio_direction[i] = direction;
+        }
+    }
+
     return self;
 }
 
@@ -392,44 +487,112 @@ VALUE GPIO_set_numbering(VALUE self, VALUE mode)
     return self;
 }
 
-// RPi::GPIO.set_high(channel)
-VALUE GPIO_set_high(VALUE self, VALUE channel)
+// validate every channel in the list, then drive them all to value with one
+// store per bank (or record them if inside RPi::GPIO.batch)
+static VALUE output_channels(VALUE self, VALUE channel, int value)
 {
     unsigned int gpio;
     int chan = -1;
     VALUE channel_list = _extract_channels(channel);
     int chan_count = RARRAY_LEN(channel_list);
+    uint32_t masks[GPIO_BANKS] = {0};
+    struct batch *b = current_batch();
+    int bank;
 
     for (int i = 0; i < chan_count; i++) {
         chan = NUM2INT(rb_ary_entry(channel_list, i));
         if (get_gpio_number(chan, &gpio) || !is_gpio_output(gpio) || check_gpio_priv()) {
             return Qnil;
+        } else if (b) {
+            batch_record(b, gpio, value);
+        } else {
+            masks[GPIO_BANK(gpio)] |= GPIO_MASK(gpio);
+        }
+    }
+
+    for (bank = 0; bank < GPIO_BANKS; bank++) {
+        if (value) {
+            output_gpio_bank(bank, masks[bank], 0);
         } else {
-            output_gpio(gpio, 1);
+            output_gpio_bank(bank, 0, masks[bank]);
         }
     }
 
     return self;
 }
 
+// RPi::GPIO.set_high(channel)
+VALUE GPIO_set_high(VALUE self, VALUE channel)
+{
+    return output_channels(self, channel, 1);
+}
+
 // RPi::GPIO.set_low(channel)
 VALUE GPIO_set_low(VALUE self, VALUE channel)
 {
-    unsigned int gpio;
-    int chan = -1;
-    VALUE channel_list = _extract_channels(channel);
-    int chan_count = RARRAY_LEN(channel_list);
+    return output_channels(self, channel, 0);
+}
 
-    for (int i = 0; i < chan_count; i++) {
-        chan = NUM2INT(rb_ary_entry(channel_list, i));
-        if (get_gpio_number(chan, &gpio) || !is_gpio_output(gpio) || check_gpio_priv()) {
-            return Qnil;
-        } else {
-            output_gpio(gpio, 0);
-        }
+struct batch_state
+{
+    struct batch batch;     // the thread's batch, if this is the outermost
+    struct batch *current;
+    uint32_t saved_set[GPIO_BANKS];
+    uint32_t saved_clr[GPIO_BANKS];
+    int nested;
+    int failed;
+};
+
+static VALUE batch_yield(VALUE arg)
+{
+    return rb_yield(Qnil);
+}
+
+static VALUE batch_rescue(VALUE arg, VALUE exc)
+{
+    ((struct batch_state *)arg)->failed = 1;
+    rb_exc_raise(exc);
+    return Qnil;
+}
+
+static VALUE batch_body(VALUE arg)
+{
+    return rb_rescue2(batch_yield, Qnil, batch_rescue, arg, rb_eException, (VALUE)0);
+}
+
+static VALUE batch_finish(VALUE arg)
+{
+    struct batch_state *state = (struct batch_state *)arg;
+
+    if (!state->nested) {
+        batch_close(state->current, !state->failed);
+    } else if (state->failed) {
+        memcpy(state->current->set, state->saved_set, sizeof(state->saved_set));
+        memcpy(state->current->clr, state->saved_clr, sizeof(state->saved_clr));
     }
+    return Qnil;
+}
 
-  return self;
+// RPi::GPIO.batch { ... }
+//
+// collects set_high/set_low calls made in the block and writes them all at
+// once when the block returns; if the block raises, nothing is written.
+// nested batches are folded into the outermost one, and one that raises
+// drops only its own writes. only the calling thread's writes are collected
+VALUE GPIO_batch(VALUE self)
+{
+    struct batch_state state = {0};
+
+    rb_need_block();
+    if ((state.current = current_batch()) != NULL) {
+        state.nested = 1;
+        memcpy(state.saved_set, state.current->set, sizeof(state.saved_set));
+        memcpy(state.saved_clr, state.current->clr, sizeof(state.saved_clr));
+    } else {
+        state.current = &state.batch;
+        batch_open(state.current);
+    }
+    return rb_ensure(batch_body, (VALUE)&state, batch_finish, (VALUE)&state);
 }
 
 // RPi::GPIO.high?(channel)
@@ -450,6 +613,144 @@ VALUE GPIO_test_low(VALUE self, VALUE channel)
     return GPIO_test_high(self, channel) ? Qfalse : Qtrue;
 }
 
+// number of channels on the header in :board mode
+static int board_channel_count(void)
+{
+    if (rpiinfo.p1_revision == 1 || rpiinfo.p1_revision == 2)
+        return 26;
+    return 40;
+}
+
+// read both level registers once and pack them into an Integer with one bit
+// per channel in the current numbering mode
+static unsigned long long read_all_levels(void)
+{
+    uint32_t levels[GPIO_BANKS];
+    unsigned long long result = 0;
+    int bank, chan, gpio;
+
+    for (bank = 0; bank < GPIO_BANKS; bank++) {
+        levels[bank] = input_gpio_bank(bank);
+    }
+
+    if (gpio_mode == BCM) {
+        return ((unsigned long long)(levels[1] & 0x3fffff) << 32) | levels[0];
+    }
+
+    for (chan = 1; chan <= board_channel_count(); chan++) {
+        gpio = *(*pin_to_gpio+chan);
+        if (gpio != -1 && (levels[GPIO_BANK(gpio)] & GPIO_MASK(gpio))) {
+            result |= 1ULL << chan;
+        }
+    }
+    return result;
+}
+
+// RPi::GPIO.read_all(hash(:as => {:integer, :hash}(default :integer)))
+//
+// reads every channel at once. by default the levels come back as an Integer
+// with bit N set if channel N is high; with :as => :hash they come back as
+// { channel => true/false }
+VALUE GPIO_read_all(int argc, VALUE *argv, VALUE self)
+{
+    VALUE hash = Qnil;
+    VALUE as_val = Qnil;
+    const char *as_str = NULL;
+    int as_hash = 0;
+    unsigned long long levels;
+    VALUE result;
+    int chan;
+
+    rb_scan_args(argc, argv, "01", &hash);
+    if (hash != Qnil) {
+        as_val = rb_hash_aref(hash, ID2SYM(rb_intern("as")));
+    }
+    if (as_val != Qnil) {
+        as_str = rb_id2name(rb_to_id(as_val));
+        if (strcmp("hash", as_str) == 0) {
+            as_hash = 1;
+        } else if (strcmp("integer", as_str) != 0) {
+            rb_raise(rb_eArgError, "invalid result type; must be :integer or :hash");
+            return Qnil;
+        }
+    }
+
+    if (gpio_mode != BOARD && gpio_mode != BCM) {
+        rb_raise(rb_eRuntimeError, "please set pin numbering mode "
+          "using RPi::GPIO.set_numbering :board or "
+          "RPi::GPIO.set_numbering :bcm");
+        return Qnil;
+    }
+    if (check_gpio_priv()) {
+        return Qnil;
+    }
+
+    levels = read_all_levels();
+    if (!as_hash) {
+        return ULL2NUM(levels);
+    }
+
+    result = rb_hash_new();
+    if (gpio_mode == BCM) {
+        for (chan = 0; chan < 54; chan++) {
+            rb_hash_aset(result, INT2NUM(chan), (levels >> chan) & 1 ? Qtrue : Qfalse);
+        }
+    } else {
+        for (chan = 1; chan <= board_channel_count(); chan++) {
+            if (*(*pin_to_gpio+chan) != -1) {
+                rb_hash_aset(result, INT2NUM(chan), (levels >> chan) & 1 ? Qtrue : Qfalse);
+            }
+        }
+    }
+    return result;
+}
+
+// RPi::GPIO.read_many(channels)
+//
+// reads the given set-up channels with one register load per bank
+VALUE GPIO_read_many(VALUE self, VALUE channels)
+{
+    unsigned int gpio;
+    VALUE channel_list = _extract_channels(channels);
+    int chan_count = RARRAY_LEN(channel_list);
+    uint32_t levels[GPIO_BANKS];
+    unsigned int gpios[54];
+    VALUE result;
+    int bank, i;
+
+    if (chan_count > 54) {
+        rb_raise(rb_eArgError, "too many channels");
+        return Qnil;
+    }
+
+    for (i = 0; i < chan_count; i++) {
+        if (get_gpio_number(NUM2INT(rb_ary_entry(channel_list, i)), &gpio) ||
+            !is_gpio_initialized(gpio) || check_gpio_priv()) {
+            return Qnil;
+        }
+        gpios[i] = gpio;
+    }
+
+    for (bank = 0; bank < GPIO_BANKS; bank++) {
+        levels[bank] = input_gpio_bank(bank);
+    }
+
+    result = rb_ary_new_capa(chan_count);
+    for (i = 0; i < chan_count; i++) {
+        rb_ary_push(result, (levels[GPIO_BANK(gpios[i])] & GPIO_MASK(gpios[i])) ? Qtrue : Qfalse);
+    }
+    return result;
+}
+
+// RPi::GPIO.changes_since(snapshot)
+//
+// given an Integer from read_all, returns a mask of the channels whose level
+// has changed since
+VALUE GPIO_changes_since(VALUE self, VALUE snapshot)
+{
+    return rb_funcall(GPIO_read_all(0, NULL, self), rb_intern("^"), 1, snapshot);
+}
+
 // RPi::GPIO.set_warnings(state)
 VALUE GPIO_set_warnings(VALUE self, VALUE setting)
 {
@@ -508,3 +809,478 @@ VALUE GPIO_ensure_gpio_input(VALUE self, VALUE gpio)
     unsigned int gpio_ = NUM2INT(gpio);
     return is_gpio_input(gpio_) ? Qtrue : Qfalse;
 }
+
+// RPi::GPIO.backend
+//
+// :mmio on a Raspberry Pi, or :sim or :chardev when loaded with
+// RPI_GPIO_BACKEND set to one of those
+VALUE GPIO_backend(VALUE self)
+{
+    return ID2SYM(rb_intern(gpio_backend->name));
+}
+
+// RPi::GPIO.chip
+//
+// what the gem worked out about the SoC when it mapped the registers: its
+// :name, :peripheral_base, :pins, :pull interface (:legacy or :bcm2711),
+// :oscillator frequency in Hz and the calibrated :pull_wait_loops
+VALUE GPIO_chip(VALUE self)
+{
+    VALUE result;
+
+    if (!is_rpi() || mmap_gpio_mem()) {
+        return Qnil;
+    }
+
+    result = rb_hash_new();
+    rb_hash_aset(result, ID2SYM(rb_intern("name")), rb_str_new2(gpio_chip->name));
+    rb_hash_aset(result, ID2SYM(rb_intern("peripheral_base")), UINT2NUM(gpio_chip->peri_base));
+    rb_hash_aset(result, ID2SYM(rb_intern("pins")), INT2NUM(gpio_chip->pin_count));
+    rb_hash_aset(result, ID2SYM(rb_intern("pull")),
+        ID2SYM(rb_intern(gpio_chip->pull_scheme == PULL_2711 ? "bcm2711" : "legacy")));
+    rb_hash_aset(result, ID2SYM(rb_intern("oscillator")), DBL2NUM(gpio_chip->osc_freq));
+    rb_hash_aset(result, ID2SYM(rb_intern("pull_wait_loops")), UINT2NUM(gpio_chip->pull_wait_loops));
+    return result;
+}
+
+// RPi::GPIO.board_info
+//
+// the board's :revision code, :type, :processor, :ram, :manufacturer and
+// header :p1_revision, looked up on first use (or taken from RPI_GPIO_BOARD)
+VALUE GPIO_board_info(VALUE self)
+{
+    VALUE result;
+
+    if (!is_rpi()) {
+        return Qnil;
+    }
+
+    result = rb_hash_new();
+    rb_hash_aset(result, ID2SYM(rb_intern("revision")), rb_str_new2(rpiinfo.revision));
+    rb_hash_aset(result, ID2SYM(rb_intern("type")), rb_str_new2(rpiinfo.type));
+    rb_hash_aset(result, ID2SYM(rb_intern("processor")), rb_str_new2(rpiinfo.processor));
+    rb_hash_aset(result, ID2SYM(rb_intern("ram")), rb_str_new2(rpiinfo.ram));
+    rb_hash_aset(result, ID2SYM(rb_intern("manufacturer")), rb_str_new2(rpiinfo.manufacturer));
+    rb_hash_aset(result, ID2SYM(rb_intern("p1_revision")), INT2NUM(rpiinfo.p1_revision));
+    return result;
+}
+
+// RPi::GPIO.native_bench(op, gpio, iterations)
+//
+// times iterations of a raw register operation on gpio in C, with no Ruby
+// between them: :output toggles an output pin with output_gpio, :input reads
+// a pin with input_gpio. returns the elapsed time in nanoseconds
+VALUE GPIO_native_bench(VALUE self, VALUE op, VALUE gpio, VALUE iterations)
+{
+    const char *op_str = rb_id2name(rb_to_id(op));
+    unsigned int gpio_ = NUM2UINT(gpio);
+    long count = NUM2LONG(iterations);
+    volatile int sink = 0;
+    struct timespec start, end;
+    long i;
+
+    if (gpio_ >= 54 || count < 0) {
+        rb_raise(rb_eArgError, "invalid GPIO or iteration count");
+        return Qnil;
+    }
+    if (strcmp(op_str, "output") == 0) {
+        if (!is_gpio_output(gpio_)) {
+            return Qnil;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < count; i++) {
+            output_gpio(gpio_, i & 1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    } else if (strcmp(op_str, "input") == 0) {
+        if (!is_gpio_initialized(gpio_)) {
+            return Qnil;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < count; i++) {
+            sink += input_gpio(gpio_) != 0;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    } else {
+        rb_raise(rb_eArgError, "invalid operation; must be :output or :input");
+        return Qnil;
+    }
+
+    return ULL2NUM((uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec);
+}
+
+// RPi::GPIO.set_line_edge(gpio, edge)
+//
+// turns kernel edge detection for a GPIO on (:rising, :falling or :both) or
+// off (:none); used by the character device backend in place of sysfs
+VALUE GPIO_set_line_edge(VALUE self, VALUE gpio, VALUE edge)
+{
+    unsigned int gpio_ = NUM2INT(gpio);
+    const char *edge_str = rb_id2name(rb_to_id(edge));
+    int rising, falling;
+
+    if (gpio_ >= 54) {
+        rb_raise(rb_eArgError, "GPIO %u does not exist", gpio_);
+        return Qnil;
+    }
+    if (check_gpio_priv() || !is_gpio_input(gpio_)) {
+        return Qnil;
+    }
+
+    if (strcmp("rising", edge_str) == 0) {
+        rising = 1; falling = 0;
+    } else if (strcmp("falling", edge_str) == 0) {
+        rising = 0; falling = 1;
+    } else if (strcmp("both", edge_str) == 0) {
+        rising = 1; falling = 1;
+    } else if (strcmp("none", edge_str) == 0) {
+        rising = 0; falling = 0;
+    } else {
+        rb_raise(rb_eArgError, "`edge` must be :rising, :falling, :both, or :none");
+        return Qnil;
+    }
+
+    set_rising_event(gpio_, rising);
+    set_falling_event(gpio_, falling);
+    return Qnil;
+}
+
+static int edge_bits(VALUE edge)
+{
+    const char *edge_str = rb_id2name(rb_to_id(edge));
+
+    if (strcmp("rising", edge_str) == 0) {
+        return 1 << EVENT_RISING;
+    } else if (strcmp("falling", edge_str) == 0) {
+        return 1 << EVENT_FALLING;
+    } else if (strcmp("both", edge_str) == 0) {
+        return (1 << EVENT_RISING) | (1 << EVENT_FALLING);
+    }
+    rb_raise(rb_eArgError, "`edge` must be :rising, :falling, or :both");
+    return 0;
+}
+
+// RPi::GPIO.event_watch(gpio, fd, edge, bounce_time)
+//
+// hands a GPIO's edges over to the native event thread. fd is the sysfs
+// value file's descriptor, or nil with the character device backend;
+// bounce_time is in milliseconds, or nil
+VALUE GPIO_event_watch(VALUE self, VALUE gpio, VALUE fd, VALUE edge, VALUE bounce_time)
+{
+    unsigned int gpio_ = NUM2UINT(gpio);
+    int edges = edge_bits(edge);
+    unsigned int bounce_ms = NIL_P(bounce_time) ? 0 : NUM2UINT(bounce_time);
+
+    if (event_watch(gpio_, NIL_P(fd) ? -1 : NUM2INT(fd), edges, bounce_ms)) {
+        rb_sys_fail("unable to start edge detection");
+        return Qnil;
+    }
+    return Qnil;
+}
+
+// RPi::GPIO.event_watch_hardware(gpio, on, bounce_time)
+//
+// arms the event detect registers for a GPIO (on is :rising, :falling,
+// :both, :high or :low) and has the hardware poller report its events
+VALUE GPIO_event_watch_hardware(VALUE self, VALUE gpio, VALUE on, VALUE bounce_time)
+{
+    unsigned int gpio_ = NUM2UINT(gpio);
+    const char *on_str = rb_id2name(rb_to_id(on));
+    unsigned int bounce_ms = NIL_P(bounce_time) ? 0 : NUM2UINT(bounce_time);
+    int detects;
+
+    if (gpio_ >= 54) {
+        rb_raise(rb_eArgError, "GPIO %u does not exist", gpio_);
+        return Qnil;
+    }
+    if (check_gpio_priv() || !is_gpio_input(gpio_)) {
+        return Qnil;
+    }
+
+    if (strcmp("high", on_str) == 0) {
+        detects = 1 << EVENT_HIGH;
+    } else if (strcmp("low", on_str) == 0) {
+        detects = 1 << EVENT_LOW;
+    } else {
+        detects = edge_bits(on);
+    }
+
+    if (event_watch_hardware(gpio_, detects, bounce_ms)) {
+        rb_raise(rb_eRuntimeError, "unable to start hardware event detection");
+        return Qnil;
+    }
+    return Qnil;
+}
+
+// RPi::GPIO.set_poll_mode(mode, interval_ns, spin_ns)
+VALUE GPIO_set_poll_mode(VALUE self, VALUE mode, VALUE interval_ns, VALUE spin_ns)
+{
+    event_set_poll_mode(NUM2INT(mode), NUM2ULL(interval_ns), NUM2ULL(spin_ns));
+    return Qnil;
+}
+
+// RPi::GPIO.event_unwatch(gpio)
+VALUE GPIO_event_unwatch(VALUE self, VALUE gpio)
+{
+    event_unwatch(NUM2UINT(gpio));
+    return Qnil;
+}
+
+// RPi::GPIO.event_stop
+//
+// stops the native event thread; it starts again on the next event_watch
+VALUE GPIO_event_stop(VALUE self)
+{
+    event_stop();
+    return Qnil;
+}
+
+struct event_wait
+{
+    struct gpio_event events[64];
+    int timeout_ms;
+    int count;
+};
+
+static void *event_wait_no_gvl(void *arg)
+{
+    struct event_wait *wait = arg;
+
+    wait->count = event_drain(wait->events, 64, wait->timeout_ms);
+    return NULL;
+}
+
+static void event_wait_unblock(void *arg)
+{
+    event_wake();
+}
+
+// RPi::GPIO.drain_events(timeout_ms)
+//
+// takes a batch of edges from the native event thread, waiting (without
+// holding the GVL) up to timeout_ms, or for ever if negative, for the first.
+// returns an array of [gpio, level, timestamp_ns, seqno], empty on timeout;
+// timestamps are on the CLOCK_MONOTONIC clock, and seqno counts the pin's
+// edges (the kernel's count with the character device backend)
+VALUE GPIO_drain_events(VALUE self, VALUE timeout_ms)
+{
+    struct event_wait wait;
+    VALUE result;
+    int i;
+
+    wait.timeout_ms = NUM2INT(timeout_ms);
+    wait.count = 0;
+    rb_thread_call_without_gvl(event_wait_no_gvl, &wait, event_wait_unblock, NULL);
+
+    result = rb_ary_new_capa(wait.count);
+    for (i = 0; i < wait.count; i++) {
+        rb_ary_push(result, rb_ary_new_from_args(4,
+            UINT2NUM(wait.events[i].gpio),
+            INT2NUM(wait.events[i].level),
+            ULL2NUM(wait.events[i].timestamp_ns),
+            UINT2NUM(wait.events[i].seqno)));
+    }
+    return result;
+}
+
+// RPi::GPIO.event_set_waited(gpio, waited)
+//
+// sends gpio's edges to wait_any_event instead of drain_events
+VALUE GPIO_event_set_waited(VALUE self, VALUE gpio, VALUE waited)
+{
+    event_set_waited(NUM2UINT(gpio), RTEST(waited));
+    return Qnil;
+}
+
+struct any_wait
+{
+    uint32_t mask[2];
+    uint64_t deadline_ns;
+    struct gpio_event event;
+    int result;
+};
+
+static void *any_wait_no_gvl(void *arg)
+{
+    struct any_wait *wait = arg;
+
+    wait->result = event_wait_any(wait->mask, wait->deadline_ns, &wait->event);
+    return NULL;
+}
+
+static void any_wait_unblock(void *arg)
+{
+    event_wait_wake();
+}
+
+// RPi::GPIO.wait_any_event(gpios, timeout_ms)
+//
+// waits (without holding the GVL) for an edge on any of gpios, which must
+// have been registered with event_set_waited. the timeout is turned into a
+// deadline once, so interrupts and spurious wakeups don't extend it; negative
+// waits for ever. returns [gpio, level, timestamp_ns], or nil on timeout
+VALUE GPIO_wait_any_event(VALUE self, VALUE gpios, VALUE timeout_ms)
+{
+    struct any_wait wait;
+    struct timespec now;
+    double timeout;
+    unsigned int gpio;
+    long i;
+
+    Check_Type(gpios, T_ARRAY);
+    wait.mask[0] = wait.mask[1] = 0;
+    for (i = 0; i < RARRAY_LEN(gpios); i++) {
+        gpio = NUM2UINT(rb_ary_entry(gpios, i));
+        if (gpio >= 54) {
+            rb_raise(rb_eArgError, "invalid GPIO %u", gpio);
+            return Qnil;
+        }
+        wait.mask[GPIO_BANK(gpio)] |= GPIO_MASK(gpio);
+    }
+
+    timeout = NUM2DBL(timeout_ms);
+    wait.deadline_ns = 0;
+    if (timeout >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        wait.deadline_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec +
+            (uint64_t)(timeout * 1000000.0) + 1;
+    }
+
+    do {
+        rb_thread_call_without_gvl(any_wait_no_gvl, &wait, any_wait_unblock, NULL);
+        if (wait.result < 0)
+            rb_thread_check_ints();
+    } while (wait.result < 0);
+
+    if (!wait.result)
+        return Qnil;
+    return rb_ary_new_from_args(3,
+        UINT2NUM(wait.event.gpio),
+        INT2NUM(wait.event.level),
+        ULL2NUM(wait.event.timestamp_ns));
+}
+
+// RPi::GPIO.event_set_counted(gpio, counted)
+//
+// has the event threads count gpio's edges, from zero, instead of reporting
+// them
+VALUE GPIO_event_set_counted(VALUE self, VALUE gpio, VALUE counted)
+{
+    if (event_set_counted(NUM2UINT(gpio), RTEST(counted))) {
+        rb_raise(rb_eRuntimeError, "unable to start counting edges on GPIO %u", NUM2UINT(gpio));
+        return Qnil;
+    }
+    return Qnil;
+}
+
+// RPi::GPIO.event_count(gpio)
+VALUE GPIO_event_count(VALUE self, VALUE gpio)
+{
+    return ULL2NUM(event_count(NUM2UINT(gpio)));
+}
+
+// RPi::GPIO.event_count_reset(gpio)
+VALUE GPIO_event_count_reset(VALUE self, VALUE gpio)
+{
+    event_count_reset(NUM2UINT(gpio));
+    return Qnil;
+}
+
+// RPi::GPIO.event_count_rate(gpio, window_ns)
+//
+// counted edges per second over the last window_ns nanoseconds
+VALUE GPIO_event_count_rate(VALUE self, VALUE gpio, VALUE window_ns)
+{
+    return DBL2NUM(event_count_rate(NUM2UINT(gpio), NUM2ULL(window_ns)));
+}
+
+// RPi::GPIO.event_overflows
+//
+// number of edges dropped because the event ring was full
+VALUE GPIO_event_overflows(VALUE self)
+{
+    return ULL2NUM(event_overflows());
+}
+
+// RPi::GPIO.event_polls
+//
+// number of times the hardware poller has checked the event detect registers
+VALUE GPIO_event_polls(VALUE self)
+{
+    return ULL2NUM(event_polls());
+}
+
+// RPi::GPIO::Simulator.drive(channel, level)
+//
+// with the simulated backend, drives an input channel as an external circuit
+// would: true/:high or false/:low, or nil to stop driving it
+VALUE Simulator_drive(VALUE self, VALUE channel, VALUE level)
+{
+    unsigned int gpio;
+    int value;
+
+    if (gpio_backend != &sim_backend) {
+        rb_raise(rb_eRuntimeError, "RPi::GPIO::Simulator needs RPI_GPIO_BACKEND=sim");
+        return Qnil;
+    }
+    if (get_gpio_number(NUM2INT(channel), &gpio) || check_gpio_priv()) {
+        return Qnil;
+    }
+
+    if (level == Qnil) {
+        value = -1;
+    } else if (SYMBOL_P(level)) {
+        const char *level_str = rb_id2name(SYM2ID(level));
+        if (strcmp("high", level_str) == 0) {
+            value = 1;
+        } else if (strcmp("low", level_str) == 0) {
+            value = 0;
+        } else {
+            rb_raise(rb_eArgError, "invalid level; must be :high, :low, true, false or nil");
+            return Qnil;
+        }
+    } else {
+        value = RTEST(level) ? 1 : 0;
+    }
+
+    sim_drive(gpio, value);
+    return self;
+}
+
+// RPi::GPIO::Simulator.registers(peripheral)
+//
+// with the simulated backend, the registers last written to the :pwm block or
+// the PWM clock of the :clock manager, as a hash of register name to value
+VALUE Simulator_registers(VALUE self, VALUE peripheral)
+{
+    static const char *pwm_names[] = { "ctl", "sta", NULL, NULL, "rng1", "dat1", NULL, NULL, "rng2", "dat2" };
+    volatile uint32_t *regs;
+    const char *name;
+    VALUE result = rb_hash_new();
+    int i;
+
+    if (gpio_backend != &sim_backend) {
+        rb_raise(rb_eRuntimeError, "RPi::GPIO::Simulator needs RPI_GPIO_BACKEND=sim");
+        return Qnil;
+    }
+    if (check_gpio_priv()) {
+        return Qnil;
+    }
+
+    name = SYMBOL_P(peripheral) ? rb_id2name(SYM2ID(peripheral)) : "";
+    if (strcmp("pwm", name) == 0) {
+        regs = gpio_backend->peripheral(PERIPHERAL_PWM);
+        for (i = 0; i < (int)(sizeof(pwm_names) / sizeof(pwm_names[0])); i++) {
+            if (pwm_names[i] != NULL)
+                rb_hash_aset(result, ID2SYM(rb_intern(pwm_names[i])), UINT2NUM(regs[i]));
+        }
+    } else if (strcmp("clock", name) == 0) {
+        regs = gpio_backend->peripheral(PERIPHERAL_CLOCK);
+        rb_hash_aset(result, ID2SYM(rb_intern("ctl")), UINT2NUM(regs[CM_PWMCTL_OFFSET]));
+        rb_hash_aset(result, ID2SYM(rb_intern("div")), UINT2NUM(regs[CM_PWMDIV_OFFSET]));
+    } else {
+        rb_raise(rb_eArgError, "invalid peripheral; must be :pwm or :clock");
+        return Qnil;
+    }
+    return result;
+}
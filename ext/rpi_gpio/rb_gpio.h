@@ -25,10 +25,16 @@ SOFTWARE.
 */
 
 #include "ruby.h"
+#include "ruby/thread.h"
 #include "c_gpio.h"
 #include "cpuinfo.h"
 #include "common.h"
 #include "rb_pwm.h"
+#include "waveform.h"
+#include "capture.h"
+#include "sim_gpio.h"
+#include "chardev_gpio.h"
+#include "event_gpio.h"
 
 void define_gpio_module_stuff(void);
 int mmap_gpio_mem(void);
@@ -41,9 +47,34 @@ VALUE GPIO_setup(VALUE self, VALUE channel, VALUE hash);
 VALUE GPIO_set_numbering(VALUE self, VALUE mode);
 VALUE GPIO_set_high(VALUE self, VALUE channel);
 VALUE GPIO_set_low(VALUE self, VALUE channel);
+VALUE GPIO_batch(VALUE self);
 VALUE GPIO_test_high(VALUE self, VALUE channel);
 VALUE GPIO_test_low(VALUE self, VALUE channel);
+VALUE GPIO_read_all(int argc, VALUE *argv, VALUE self);
+VALUE GPIO_read_many(VALUE self, VALUE channels);
+VALUE GPIO_changes_since(VALUE self, VALUE snapshot);
 VALUE GPIO_set_warnings(VALUE self, VALUE setting);
 VALUE GPIO_get_gpio_number(VALUE self, VALUE channel);
 VALUE GPIO_channel_from_gpio(VALUE self, VALUE gpio);
 VALUE GPIO_ensure_gpio_input(VALUE self, VALUE gpio);
+VALUE GPIO_backend(VALUE self);
+VALUE GPIO_chip(VALUE self);
+VALUE GPIO_board_info(VALUE self);
+VALUE GPIO_native_bench(VALUE self, VALUE op, VALUE gpio, VALUE iterations);
+VALUE GPIO_set_line_edge(VALUE self, VALUE gpio, VALUE edge);
+VALUE GPIO_event_watch(VALUE self, VALUE gpio, VALUE fd, VALUE edge, VALUE bounce_time);
+VALUE GPIO_event_watch_hardware(VALUE self, VALUE gpio, VALUE on, VALUE bounce_time);
+VALUE GPIO_set_poll_mode(VALUE self, VALUE mode, VALUE interval_ns, VALUE spin_ns);
+VALUE GPIO_event_unwatch(VALUE self, VALUE gpio);
+VALUE GPIO_event_stop(VALUE self);
+VALUE GPIO_drain_events(VALUE self, VALUE timeout_ms);
+VALUE GPIO_event_set_waited(VALUE self, VALUE gpio, VALUE waited);
+VALUE GPIO_wait_any_event(VALUE self, VALUE gpios, VALUE timeout_ms);
+VALUE GPIO_event_set_counted(VALUE self, VALUE gpio, VALUE counted);
+VALUE GPIO_event_count(VALUE self, VALUE gpio);
+VALUE GPIO_event_count_reset(VALUE self, VALUE gpio);
+VALUE GPIO_event_count_rate(VALUE self, VALUE gpio, VALUE window_ns);
+VALUE GPIO_event_overflows(VALUE self);
+VALUE GPIO_event_polls(VALUE self);
+VALUE Simulator_drive(VALUE self, VALUE channel, VALUE level);
+VALUE Simulator_registers(VALUE self, VALUE peripheral);
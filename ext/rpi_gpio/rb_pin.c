@@ -0,0 +1,206 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "rb_pin.h"
+
+extern VALUE m_GPIO;
+VALUE c_Pin = Qnil;
+
+// a channel resolved once at construction time, so that the I/O methods are a
+// single register access with no argument parsing or allocation. the register
+// pointers are NULL when the backend has no directly mapped registers, in which
+// case the backend's bank operations are used instead
+struct pin
+{
+  int channel;
+  unsigned int gpio;
+  int direction;
+  uint32_t mask;
+  volatile uint32_t *set_reg;
+  volatile uint32_t *clr_reg;
+  volatile uint32_t *level_reg;
+};
+
+static size_t pin_size(const void *ptr)
+{
+  return sizeof(struct pin);
+}
+
+static const rb_data_type_t pin_type = {
+  "RPi::GPIO::Pin",
+  { NULL, RUBY_TYPED_DEFAULT_FREE, pin_size, },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE pin_alloc(VALUE klass)
+{
+  struct pin *p;
+  VALUE obj = TypedData_Make_Struct(klass, struct pin, &pin_type, p);
+  p->direction = -1;
+  return obj;
+}
+
+static struct pin *get_pin(VALUE self)
+{
+  struct pin *p;
+  TypedData_Get_Struct(self, struct pin, &pin_type, p);
+  if (p->direction == -1)
+  {
+    rb_raise(rb_eRuntimeError, "RPi::GPIO::Pin has not been initialized");
+  }
+  return p;
+}
+
+// the channel may have been cleaned up or set up in the other direction since
+// this Pin was created
+static inline void check_pin_direction(struct pin *p)
+{
+  if (gpio_direction[p->gpio] != p->direction)
+  {
+    rb_raise(rb_eRuntimeError, "GPIO channel has been cleaned up or set up "
+      "again since this RPi::GPIO::Pin was created");
+  }
+}
+
+void define_pin_class_stuff(void)
+{
+  c_Pin = rb_define_class_under(m_GPIO, "Pin", rb_cObject);
+  rb_define_alloc_func(c_Pin, pin_alloc);
+  rb_define_method(c_Pin, "initialize", Pin_initialize, 1);
+  rb_define_method(c_Pin, "gpio", Pin_get_gpio, 0);
+  rb_define_method(c_Pin, "channel", Pin_get_channel, 0);
+  rb_define_method(c_Pin, "high!", Pin_set_high, 0);
+  rb_define_method(c_Pin, "low!", Pin_set_low, 0);
+  rb_define_method(c_Pin, "high?", Pin_test_high, 0);
+  rb_define_method(c_Pin, "low?", Pin_test_low, 0);
+}
+
+// RPi::GPIO::Pin#initialize
+VALUE Pin_initialize(VALUE self, VALUE channel)
+{
+  struct pin *p;
+  int chan;
+  unsigned int gpio;
+
+  TypedData_Get_Struct(self, struct pin, &pin_type, p);
+  chan = NUM2INT(channel);
+
+  // convert channel to gpio
+  if (get_gpio_number(chan, &gpio) || check_gpio_priv())
+    return Qnil;
+
+  if (gpio_direction[gpio] != INPUT && gpio_direction[gpio] != OUTPUT)
+  {
+    rb_raise(rb_eRuntimeError, "you must setup the GPIO channel first with "
+      "RPi::GPIO.setup CHANNEL, :as => :input or "
+      "RPi::GPIO.setup CHANNEL, :as => :output");
+    return Qnil;
+  }
+
+  p->channel = chan;
+  p->gpio = gpio;
+  p->direction = gpio_direction[gpio];
+  p->mask = GPIO_MASK(gpio);
+  p->set_reg = gpio_set_register(gpio);
+  p->clr_reg = gpio_clr_register(gpio);
+  p->level_reg = gpio_level_register(gpio);
+  return self;
+}
+
+// RPi::GPIO::Pin#gpio
+VALUE Pin_get_gpio(VALUE self)
+{
+  return UINT2NUM(get_pin(self)->gpio);
+}
+
+// RPi::GPIO::Pin#channel
+VALUE Pin_get_channel(VALUE self)
+{
+  return INT2NUM(get_pin(self)->channel);
+}
+
+// RPi::GPIO::Pin#high!
+VALUE Pin_set_high(VALUE self)
+{
+  struct pin *p = get_pin(self);
+  struct batch *b;
+
+  check_pin_direction(p);
+  if (p->direction != OUTPUT)
+  {
+    rb_raise(rb_eRuntimeError, "GPIO channel not setup as output");
+    return Qnil;
+  }
+
+  if ((b = current_batch()) != NULL)
+    batch_record(b, p->gpio, 1);
+  else if (p->set_reg)
+    *p->set_reg = p->mask;
+  else
+    output_gpio_bank(GPIO_BANK(p->gpio), p->mask, 0);
+  return self;
+}
+
+// RPi::GPIO::Pin#low!
+VALUE Pin_set_low(VALUE self)
+{
+  struct pin *p = get_pin(self);
+  struct batch *b;
+
+  check_pin_direction(p);
+  if (p->direction != OUTPUT)
+  {
+    rb_raise(rb_eRuntimeError, "GPIO channel not setup as output");
+    return Qnil;
+  }
+
+  if ((b = current_batch()) != NULL)
+    batch_record(b, p->gpio, 0);
+  else if (p->clr_reg)
+    *p->clr_reg = p->mask;
+  else
+    output_gpio_bank(GPIO_BANK(p->gpio), 0, p->mask);
+  return self;
+}
+
+// RPi::GPIO::Pin#high?
+VALUE Pin_test_high(VALUE self)
+{
+  struct pin *p = get_pin(self);
+
+  check_pin_direction(p);
+  if (p->level_reg)
+    return (*p->level_reg & p->mask) ? Qtrue : Qfalse;
+  return (input_gpio_bank(GPIO_BANK(p->gpio)) & p->mask) ? Qtrue : Qfalse;
+}
+
+// RPi::GPIO::Pin#low?
+VALUE Pin_test_low(VALUE self)
+{
+  struct pin *p = get_pin(self);
+
+  check_pin_direction(p);
+  if (p->level_reg)
+    return (*p->level_reg & p->mask) ? Qfalse : Qtrue;
+  return (input_gpio_bank(GPIO_BANK(p->gpio)) & p->mask) ? Qfalse : Qtrue;
+}
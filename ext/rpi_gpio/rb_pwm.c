@@ -32,23 +32,145 @@ VALUE c_PWM = Qnil;
 void define_pwm_class_stuff(void)
 {
   c_PWM = rb_define_class_under(m_GPIO, "PWM", rb_cObject);
-  rb_define_method(c_PWM, "initialize", PWM_initialize, 2);
+  rb_define_method(c_PWM, "initialize", PWM_initialize, -1);
   rb_define_method(c_PWM, "start", PWM_start, 1);
   rb_define_method(c_PWM, "gpio", PWM_get_gpio, 0);
   rb_define_method(c_PWM, "duty_cycle", PWM_get_duty_cycle, 0);
   rb_define_method(c_PWM, "duty_cycle=", PWM_set_duty_cycle, 1);
   rb_define_method(c_PWM, "frequency", PWM_get_frequency, 0);
   rb_define_method(c_PWM, "frequency=", PWM_set_frequency, 1);
+  rb_define_method(c_PWM, "update", PWM_update, -1);
   rb_define_method(c_PWM, "stop", PWM_stop, 0);
   rb_define_method(c_PWM, "running?", PWM_get_running, 0);
+  rb_define_method(c_PWM, "hardware?", PWM_get_hardware, 0);
+  rb_define_method(c_PWM, "mode", PWM_get_mode, 0);
+  rb_define_method(c_PWM, "stats", PWM_get_stats, 0);
+  rb_define_method(c_PWM, "reset_stats", PWM_reset_stats, 0);
+  rb_define_method(c_PWM, "timing", PWM_get_timing, 0);
+  rb_define_method(c_PWM, "timing=", PWM_set_timing, 1);
+  rb_define_method(c_PWM, "spin_margin", PWM_get_spin_margin, 0);
+  rb_define_method(c_PWM, "spin_margin=", PWM_set_spin_margin, 1);
+  rb_define_singleton_method(c_PWM, "calibrated_spin_margin", PWM_s_calibrated_spin_margin, 0);
+  rb_define_singleton_method(c_PWM, "scheduler_stats", PWM_s_scheduler_stats, 0);
 }
 
-// RPi::GPIO::PWM#initialize
-VALUE PWM_initialize(VALUE self, VALUE channel, VALUE frequency)
+static int is_hardware(VALUE self)
 {
+  return RTEST(rb_iv_get(self, "@hardware"));
+}
+
+// a hardware PWM holds its channel from initialize until stop, and again
+// from start; new parameters only go to the registers while it does
+static int holds_channel(VALUE self)
+{
+  return is_hardware(self) && hard_pwm_exists(NUM2UINT(rb_iv_get(self, "@gpio")));
+}
+
+// raises for a failed hard_pwm_* call
+static void check_hard_pwm(int result)
+{
+  if (result == HARD_PWM_NO_CHANNEL)
+    rb_raise(rb_eArgError, "this GPIO channel has no hardware PWM; use GPIO "
+      "12, 13, 18, 19, 40, 41 or 45");
+  else if (result == HARD_PWM_BUSY)
+    rb_raise(rb_eRuntimeError, "the hardware PWM channel for this GPIO channel "
+      "is already in use by another GPIO channel or a DMA waveform");
+  else if (result == HARD_PWM_NO_ACCESS)
+    rb_raise(rb_eRuntimeError, "no access to the PWM registers; hardware PWM "
+      "needs root and a Pi with a BCM2835, 2836, 2837 or 2711");
+  else if (result == HARD_PWM_BAD_FREQ)
+    rb_raise(rb_eArgError, "frequency is out of range for hardware PWM");
+}
+
+// claims the hardware channel if the PWM doesn't hold it yet, and programs
+// it with dc and freq. a channel claimed here is given back if freq can't be
+// programmed
+static void hard_pwm_apply(VALUE self, float dc, float freq)
+{
+  unsigned int gpio = NUM2UINT(rb_iv_get(self, "@gpio"));
+  int mode = rb_iv_get(self, "@mode") == ID2SYM(rb_intern("balanced")) ?
+    HARD_PWM_BALANCED : HARD_PWM_MARK_SPACE;
+  int held = hard_pwm_exists(gpio);
+  int result;
+
+  check_hard_pwm(hard_pwm_setup(gpio, mode));
+  if ((result = hard_pwm_set(gpio, freq, dc)) != HARD_PWM_OK && !held)
+    hard_pwm_stop(gpio);
+  check_hard_pwm(result);
+}
+
+static void check_timing(VALUE timing)
+{
+  if (timing != ID2SYM(rb_intern("sleep")) && timing != ID2SYM(rb_intern("hybrid")))
+    rb_raise(rb_eArgError, "invalid timing; must be :sleep or :hybrid");
+}
+
+static void check_spin_margin(VALUE spin_margin)
+{
+  if (spin_margin != Qnil && NUM2LL(spin_margin) <= 0)
+    rb_raise(rb_eArgError, "spin margin must be greater than 0, or nil to calibrate it");
+}
+
+// hands @timing and @spin_margin to the scheduler
+static void apply_timing(VALUE self)
+{
+  VALUE spin_margin = rb_iv_get(self, "@spin_margin");
+
+  if (is_hardware(self))
+    return;
+  pwm_set_timing(NUM2UINT(rb_iv_get(self, "@gpio")),
+    rb_iv_get(self, "@timing") == ID2SYM(rb_intern("hybrid")) ? PWM_TIMING_HYBRID : PWM_TIMING_SLEEP,
+    spin_margin == Qnil ? 0 : NUM2LL(spin_margin));
+}
+
+static float current_duty_cycle(VALUE self)
+{
+  VALUE duty_cycle = rb_iv_get(self, "@duty_cycle");
+  return duty_cycle == Qnil ? 0.0f : (float) NUM2DBL(duty_cycle);
+}
+
+// RPi::GPIO::PWM#initialize(channel, frequency, :hardware => false,
+// :mode => :mark_space, :timing => :sleep, :spin_margin => nanoseconds)
+//
+// with :hardware => true the PWM runs on the SoC's PWM peripheral instead of
+// the software scheduler, in either :mark_space or :balanced mode. see
+// timing= for :timing and :spin_margin
+VALUE PWM_initialize(int argc, VALUE *argv, VALUE self)
+{
+  VALUE channel, frequency, hash = Qnil, hardware, mode, timing, spin_margin;
   int chan;
   unsigned int gpio;
-  
+
+  rb_scan_args(argc, argv, "21", &channel, &frequency, &hash);
+  if (hash == Qnil)
+    hash = rb_hash_new();
+  Check_Type(hash, T_HASH);
+  hardware = RTEST(rb_hash_aref(hash, ID2SYM(rb_intern("hardware")))) ? Qtrue : Qfalse;
+  mode = rb_hash_aref(hash, ID2SYM(rb_intern("mode")));
+  if (mode != Qnil && hardware == Qfalse)
+  {
+    rb_raise(rb_eArgError, "mode is only supported for hardware PWM");
+    return Qnil;
+  }
+  if (mode == Qnil)
+    mode = ID2SYM(rb_intern("mark_space"));
+  if (mode != ID2SYM(rb_intern("mark_space")) && mode != ID2SYM(rb_intern("balanced")))
+  {
+    rb_raise(rb_eArgError, "invalid mode; must be :mark_space or :balanced");
+    return Qnil;
+  }
+  timing = rb_hash_aref(hash, ID2SYM(rb_intern("timing")));
+  spin_margin = rb_hash_aref(hash, ID2SYM(rb_intern("spin_margin")));
+  if ((timing != Qnil || spin_margin != Qnil) && hardware == Qtrue)
+  {
+    rb_raise(rb_eArgError, "timing is only supported for software PWM");
+    return Qnil;
+  }
+  if (timing == Qnil)
+    timing = ID2SYM(rb_intern("sleep"));
+  check_timing(timing);
+  check_spin_margin(spin_margin);
+
   chan = NUM2INT(channel);
   
   // convert channel to gpio
@@ -56,11 +178,16 @@ VALUE PWM_initialize(VALUE self, VALUE channel, VALUE frequency)
     return Qnil;
  
   // does soft pwm already exist on this channel?
-  if (pwm_exists(gpio))
+  if (pwm_exists(gpio) || hard_pwm_exists(gpio))
   {
     rb_raise(rb_eRuntimeError, "a PWM object already exists for this GPIO channel");
     return Qnil;
   }
+  if (servo_exists(gpio))
+  {
+    rb_raise(rb_eRuntimeError, "a servo bank is driving this GPIO channel");
+    return Qnil;
+  }
   
   // ensure channel is set as output
   if (gpio_direction[gpio] != OUTPUT)
@@ -72,15 +199,33 @@ VALUE PWM_initialize(VALUE self, VALUE channel, VALUE frequency)
   
   rb_iv_set(self, "@gpio", UINT2NUM(gpio));
   rb_iv_set(self, "@running", Qfalse);
+  rb_iv_set(self, "@hardware", hardware);
+  rb_iv_set(self, "@mode", hardware == Qtrue ? mode : Qnil);
+  rb_iv_set(self, "@timing", hardware == Qtrue ? Qnil : timing);
+  rb_iv_set(self, "@spin_margin", spin_margin);
   PWM_set_frequency(self, frequency);
+  apply_timing(self);
+  if (hardware == Qtrue)
+    hard_pwm_apply(self, 0.0f, (float) NUM2DBL(frequency));
   return self;
 }
 
 // RPi::GPIO::PWM#start
 VALUE PWM_start(VALUE self, VALUE duty_cycle)
 {
-  pwm_start(NUM2UINT(rb_iv_get(self, "@gpio")));
+  // publish the duty cycle first, so the first period already runs with it
   PWM_set_duty_cycle(self, duty_cycle);
+  if (is_hardware(self))
+  {
+    // a stopped hardware PWM gave up its channel, so claim it again
+    hard_pwm_apply(self, current_duty_cycle(self), (float) NUM2DBL(rb_iv_get(self, "@frequency")));
+    hard_pwm_start(NUM2UINT(rb_iv_get(self, "@gpio")));
+  }
+  else
+  {
+    apply_timing(self);
+    pwm_start(NUM2UINT(rb_iv_get(self, "@gpio")));
+  }
   rb_iv_set(self, "@running", Qtrue);
   return self;
 }
@@ -107,8 +252,11 @@ VALUE PWM_set_duty_cycle(VALUE self, VALUE duty_cycle)
     return Qnil;
   }
   
+  if (holds_channel(self))
+    hard_pwm_apply(self, dc, (float) NUM2DBL(rb_iv_get(self, "@frequency")));
+  else if (!is_hardware(self))
+    pwm_set_duty_cycle(NUM2UINT(rb_iv_get(self, "@gpio")), dc);
   rb_iv_set(self, "@duty_cycle", duty_cycle);
-  pwm_set_duty_cycle(NUM2UINT(rb_iv_get(self, "@gpio")), dc);
   return self;
 }
 
@@ -122,21 +270,70 @@ VALUE PWM_get_frequency(VALUE self)
 VALUE PWM_set_frequency(VALUE self, VALUE frequency)
 {
   float freq = (float) NUM2DBL(frequency);
-  if (freq <= 0.0f)
+  if (freq <= 0.0f || 1e9 / freq < 1.0)
   {
-    rb_raise(rb_eArgError, "frequency must be greater than 0.0");
+    rb_raise(rb_eArgError, "frequency must be greater than 0.0 and at most 1e9");
     return Qnil;
   }
   
+  if (holds_channel(self))
+    hard_pwm_apply(self, current_duty_cycle(self), freq);
+  else if (!is_hardware(self))
+    pwm_set_frequency(NUM2UINT(rb_iv_get(self, "@gpio")), freq);
   rb_iv_set(self, "@frequency", frequency);
-  pwm_set_frequency(NUM2UINT(rb_iv_get(self, "@gpio")), freq);
+  return self;
+}
+
+// RPi::GPIO::PWM#update(:duty => DUTY_CYCLE, :frequency => FREQUENCY)
+// changes both parameters together; the running PWM switches to them at the
+// start of its next period
+VALUE PWM_update(int argc, VALUE *argv, VALUE self)
+{
+  VALUE hash = Qnil, duty_val, freq_val;
+  float dc, freq;
+
+  rb_scan_args(argc, argv, "01", &hash);
+  if (hash == Qnil)
+    hash = rb_hash_new();
+  Check_Type(hash, T_HASH);
+
+  duty_val = rb_hash_aref(hash, ID2SYM(rb_intern("duty")));
+  freq_val = rb_hash_aref(hash, ID2SYM(rb_intern("frequency")));
+  if (duty_val == Qnil)
+    duty_val = rb_iv_get(self, "@duty_cycle");
+  if (freq_val == Qnil)
+    freq_val = rb_iv_get(self, "@frequency");
+
+  dc = duty_val == Qnil ? 0.0f : (float) NUM2DBL(duty_val);
+  freq = (float) NUM2DBL(freq_val);
+  if (dc < 0.0f || dc > 100.0f)
+  {
+    rb_raise(rb_eArgError, "duty cycle must be between 0.0 and 100.0");
+    return Qnil;
+  }
+  if (freq <= 0.0f || 1e9 / freq < 1.0)
+  {
+    rb_raise(rb_eArgError, "frequency must be greater than 0.0 and at most 1e9");
+    return Qnil;
+  }
+
+  if (holds_channel(self))
+    hard_pwm_apply(self, dc, freq);
+  else if (!is_hardware(self))
+    pwm_update(NUM2UINT(rb_iv_get(self, "@gpio")), dc, freq);
+  if (duty_val != Qnil)
+    rb_iv_set(self, "@duty_cycle", duty_val);
+  rb_iv_set(self, "@frequency", freq_val);
   return self;
 }
 
 // RPi::GPIO::PWM#stop
 VALUE PWM_stop(VALUE self)
 {
-  pwm_stop(NUM2UINT(rb_iv_get(self, "@gpio")));
+  if (is_hardware(self))
+    hard_pwm_stop(NUM2UINT(rb_iv_get(self, "@gpio")));
+  else
+    pwm_stop(NUM2UINT(rb_iv_get(self, "@gpio")));
   rb_iv_set(self, "@running", Qfalse);
   return self;
 }
@@ -146,3 +343,160 @@ VALUE PWM_get_running(VALUE self)
 {
   return rb_iv_get(self, "@running");
 }
+
+// RPi::GPIO::PWM#hardware?
+VALUE PWM_get_hardware(VALUE self)
+{
+  return rb_iv_get(self, "@hardware");
+}
+
+// RPi::GPIO::PWM#mode
+//
+// :mark_space or :balanced for a hardware PWM, nil for a software one
+VALUE PWM_get_mode(VALUE self)
+{
+  return rb_iv_get(self, "@mode");
+}
+
+// the smallest latency that at least percent of the edges came in under,
+// rounded up to its histogram bucket
+static int64_t latency_percentile(const struct pwm_stats *stats, double percent)
+{
+  uint64_t seen = 0, wanted;
+  int i;
+
+  wanted = (uint64_t)(stats->edges * percent / 100.0 + 0.5);
+  if (wanted == 0)
+    wanted = 1;
+  for (i = 0; i < PWM_HISTOGRAM_BUCKETS; i++)
+  {
+    seen += stats->histogram[i];
+    if (seen >= wanted)
+      return pwm_histogram_bucket_max(i);
+  }
+  return stats->max_latency_ns;
+}
+
+// RPi::GPIO::PWM#stats
+//
+// how closely the software scheduler has kept to this PWM's timing since it
+// started or since reset_stats; nil for hardware PWM
+VALUE PWM_get_stats(VALUE self)
+{
+  static const double percents[] = { 50.0, 90.0, 99.0, 99.9 };
+  struct pwm_stats stats;
+  VALUE hash, percentiles, histogram;
+  unsigned int i;
+
+  if (is_hardware(self))
+    return Qnil;
+  pwm_get_stats(NUM2UINT(rb_iv_get(self, "@gpio")), &stats);
+
+  percentiles = rb_hash_new();
+  histogram = rb_hash_new();
+  if (stats.edges > 0)
+  {
+    for (i = 0; i < sizeof(percents) / sizeof(percents[0]); i++)
+      rb_hash_aset(percentiles, DBL2NUM(percents[i]), LL2NUM(latency_percentile(&stats, percents[i])));
+  }
+  for (i = 0; i < PWM_HISTOGRAM_BUCKETS; i++)
+  {
+    if (stats.histogram[i] > 0)
+      rb_hash_aset(histogram, LL2NUM(pwm_histogram_bucket_max(i)), ULL2NUM(stats.histogram[i]));
+  }
+
+  hash = rb_hash_new();
+  rb_hash_aset(hash, ID2SYM(rb_intern("edges")), ULL2NUM(stats.edges));
+  rb_hash_aset(hash, ID2SYM(rb_intern("late")), ULL2NUM(stats.late));
+  rb_hash_aset(hash, ID2SYM(rb_intern("max_overshoot_ns")), LL2NUM(stats.max_latency_ns));
+  rb_hash_aset(hash, ID2SYM(rb_intern("mean_latency_ns")),
+    DBL2NUM(stats.edges ? (double)stats.total_latency_ns / stats.edges : 0.0));
+  rb_hash_aset(hash, ID2SYM(rb_intern("percentiles")), percentiles);
+  rb_hash_aset(hash, ID2SYM(rb_intern("histogram")), histogram);
+  rb_hash_aset(hash, ID2SYM(rb_intern("periods")), ULL2NUM(stats.periods));
+  rb_hash_aset(hash, ID2SYM(rb_intern("frequency")), stats.total_period_ns > 0 ?
+    DBL2NUM(stats.periods * 1e9 / stats.total_period_ns) : Qnil);
+  rb_hash_aset(hash, ID2SYM(rb_intern("duty_cycle")), stats.total_period_ns > 0 ?
+    DBL2NUM(100.0 * stats.total_high_ns / stats.total_period_ns) : Qnil);
+  rb_hash_aset(hash, ID2SYM(rb_intern("spin_ns")), LL2NUM(stats.spin_ns));
+  return hash;
+}
+
+// RPi::GPIO::PWM#reset_stats
+VALUE PWM_reset_stats(VALUE self)
+{
+  if (!is_hardware(self))
+    pwm_reset_stats(NUM2UINT(rb_iv_get(self, "@gpio")));
+  return self;
+}
+
+// RPi::GPIO::PWM#timing
+VALUE PWM_get_timing(VALUE self)
+{
+  return rb_iv_get(self, "@timing");
+}
+
+// RPi::GPIO::PWM#timing=(:sleep or :hybrid)
+//
+// with :hybrid the scheduler sleeps until spin_margin before each of this
+// PWM's edges and spins on the clock for the rest, for edges accurate to a
+// microsecond or so at the cost of CPU time
+VALUE PWM_set_timing(VALUE self, VALUE timing)
+{
+  if (is_hardware(self))
+  {
+    rb_raise(rb_eArgError, "timing is only supported for software PWM");
+    return Qnil;
+  }
+  check_timing(timing);
+  rb_iv_set(self, "@timing", timing);
+  apply_timing(self);
+  return timing;
+}
+
+// RPi::GPIO::PWM#spin_margin
+VALUE PWM_get_spin_margin(VALUE self)
+{
+  return rb_iv_get(self, "@spin_margin");
+}
+
+// RPi::GPIO::PWM#spin_margin=(nanoseconds)
+//
+// how long before each edge :hybrid timing starts to spin; nil for
+// PWM.calibrated_spin_margin
+VALUE PWM_set_spin_margin(VALUE self, VALUE spin_margin)
+{
+  if (is_hardware(self))
+  {
+    rb_raise(rb_eArgError, "timing is only supported for software PWM");
+    return Qnil;
+  }
+  check_spin_margin(spin_margin);
+  rb_iv_set(self, "@spin_margin", spin_margin);
+  apply_timing(self);
+  return spin_margin;
+}
+
+// RPi::GPIO::PWM.calibrated_spin_margin
+//
+// nanoseconds, measured from how late short sleeps wake up on this system
+VALUE PWM_s_calibrated_spin_margin(VALUE klass)
+{
+  return LL2NUM(pwm_calibrated_spin_margin());
+}
+
+// RPi::GPIO::PWM.scheduler_stats
+//
+// CPU time used by the thread that drives every software PWM, and how much
+// of it went on spinning
+VALUE PWM_s_scheduler_stats(VALUE klass)
+{
+  struct pwm_scheduler_stats stats;
+  VALUE hash = rb_hash_new();
+
+  pwm_get_scheduler_stats(&stats);
+  rb_hash_aset(hash, ID2SYM(rb_intern("cpu_ns")), LL2NUM(stats.cpu_ns));
+  rb_hash_aset(hash, ID2SYM(rb_intern("spin_ns")), LL2NUM(stats.spin_ns));
+  rb_hash_aset(hash, ID2SYM(rb_intern("wakeups")), ULL2NUM(stats.wakeups));
+  return hash;
+}
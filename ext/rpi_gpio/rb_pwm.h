@@ -26,16 +26,29 @@ SOFTWARE.
 
 #include "ruby.h"
 #include "soft_pwm.h"
+#include "hard_pwm.h"
+#include "servo.h"
 #include "common.h"
 #include "c_gpio.h"
 
 void define_pwm_class_stuff(void);
-VALUE PWM_initialize(VALUE self, VALUE channel, VALUE frequency);
+VALUE PWM_initialize(int argc, VALUE *argv, VALUE self);
 VALUE PWM_start(VALUE self, VALUE duty_cycle);
 VALUE PWM_get_gpio(VALUE self);
 VALUE PWM_get_duty_cycle(VALUE self);
 VALUE PWM_set_duty_cycle(VALUE self, VALUE duty_cycle);
 VALUE PWM_get_frequency(VALUE self);
 VALUE PWM_set_frequency(VALUE self, VALUE frequency);
+VALUE PWM_update(int argc, VALUE *argv, VALUE self);
 VALUE PWM_stop(VALUE self);
 VALUE PWM_get_running(VALUE self);
+VALUE PWM_get_hardware(VALUE self);
+VALUE PWM_get_mode(VALUE self);
+VALUE PWM_get_stats(VALUE self);
+VALUE PWM_reset_stats(VALUE self);
+VALUE PWM_get_timing(VALUE self);
+VALUE PWM_set_timing(VALUE self, VALUE timing);
+VALUE PWM_get_spin_margin(VALUE self);
+VALUE PWM_set_spin_margin(VALUE self, VALUE spin_margin);
+VALUE PWM_s_calibrated_spin_margin(VALUE klass);
+VALUE PWM_s_scheduler_stats(VALUE klass);
@@ -0,0 +1,173 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <string.h>
+#include "rb_realtime.h"
+
+extern VALUE m_GPIO;
+extern int gpio_warnings;
+
+void define_realtime_stuff(void)
+{
+  rb_define_module_function(m_GPIO, "realtime", GPIO_realtime, -1);
+}
+
+// fill policy from hash(:priority => 1..99, :policy => :fifo or :rr,
+// :cpus => [core, ...]); a missing or 0 priority means the kernel's default
+// time-sharing policy
+static void hash_to_policy(VALUE hash, struct rt_policy *policy)
+{
+  VALUE priority_val, policy_val, cpus_val;
+  long i, cpu;
+
+  Check_Type(hash, T_HASH);
+  priority_val = rb_hash_aref(hash, ID2SYM(rb_intern("priority")));
+  policy_val = rb_hash_aref(hash, ID2SYM(rb_intern("policy")));
+  cpus_val = rb_hash_aref(hash, ID2SYM(rb_intern("cpus")));
+
+  memset(policy, 0, sizeof(*policy));
+  policy->priority = priority_val == Qnil ? 0 : NUM2INT(priority_val);
+  if (policy->priority != 0)
+    policy->policy = RT_FIFO;
+  if (policy_val != Qnil)
+  {
+    if (policy_val == ID2SYM(rb_intern("fifo")))
+      policy->policy = RT_FIFO;
+    else if (policy_val == ID2SYM(rb_intern("rr")))
+      policy->policy = RT_RR;
+    else if (policy_val == ID2SYM(rb_intern("other")))
+      policy->policy = RT_OTHER;
+    else
+      rb_raise(rb_eArgError, "invalid policy; must be :fifo, :rr or :other");
+  }
+  if (policy->policy != RT_OTHER && policy->priority == 0)
+    rb_raise(rb_eArgError, "a :fifo or :rr policy needs a priority");
+
+  if (cpus_val != Qnil)
+  {
+    cpus_val = rb_Array(cpus_val);
+    for (i = 0; i < RARRAY_LEN(cpus_val); i++)
+    {
+      cpu = NUM2LONG(rb_ary_entry(cpus_val, i));
+      if (cpu < 0 || cpu >= RT_MAX_CPUS)
+        rb_raise(rb_eArgError, "no such cpu: %ld", cpu);
+      policy->cpus |= 1ULL << cpu;
+    }
+  }
+  if (rt_check_policy(policy))
+    rb_raise(rb_eArgError, "priority must be from 1 to 99 and cpus must exist");
+}
+
+// for the :realtime option of objects that start their own thread: nil uses
+// RPi::GPIO.realtime's setting, false the kernel's default, and a hash as
+// for RPi::GPIO.realtime its own. returns 1 if the object overrides the
+// default
+int get_realtime_override(VALUE option, struct rt_policy *policy)
+{
+  if (option == Qnil)
+    return 0;
+  if (option == Qfalse)
+  {
+    memset(policy, 0, sizeof(*policy));
+    return 1;
+  }
+  hash_to_policy(option, policy);
+  return 1;
+}
+
+static VALUE errno_string(int err)
+{
+  return rb_str_new_cstr(strerror(err));
+}
+
+static VALUE report_to_hash(const struct rt_policy *policy, const struct rt_report *report)
+{
+  VALUE hash = rb_hash_new(), errors = rb_hash_new(), cpus = Qnil;
+  int cpu;
+
+  if (policy->cpus)
+  {
+    cpus = rb_ary_new();
+    for (cpu = 0; cpu < RT_MAX_CPUS; cpu++)
+    {
+      if (policy->cpus & (1ULL << cpu))
+        rb_ary_push(cpus, INT2NUM(cpu));
+    }
+  }
+  if (report->sched_error)
+    rb_hash_aset(errors, ID2SYM(rb_intern("policy")), errno_string(report->sched_error));
+  if (report->affinity_error)
+    rb_hash_aset(errors, ID2SYM(rb_intern("cpus")), errno_string(report->affinity_error));
+  if (report->lock_error)
+    rb_hash_aset(errors, ID2SYM(rb_intern("lock_memory")), errno_string(report->lock_error));
+
+  rb_hash_aset(hash, ID2SYM(rb_intern("policy")), ID2SYM(rb_intern(
+    policy->policy == RT_FIFO ? "fifo" : policy->policy == RT_RR ? "rr" : "other")));
+  rb_hash_aset(hash, ID2SYM(rb_intern("priority")), INT2NUM(policy->priority));
+  rb_hash_aset(hash, ID2SYM(rb_intern("cpus")), cpus);
+  rb_hash_aset(hash, ID2SYM(rb_intern("lock_memory")), report->memory_locked ? Qtrue : Qfalse);
+  rb_hash_aset(hash, ID2SYM(rb_intern("threads")), INT2NUM(report->threads));
+  rb_hash_aset(hash, ID2SYM(rb_intern("realtime_threads")), INT2NUM(report->realtime_threads));
+  rb_hash_aset(hash, ID2SYM(rb_intern("errors")), errors);
+  return hash;
+}
+
+// RPi::GPIO.realtime(hash(:priority => 1..99, :policy => :fifo or :rr,
+// :cpus => [core, ...], :lock_memory => true or false))
+//
+// sets the scheduling policy, priority and cores for every native thread the
+// gem runs (PWM, waveforms, captures, servo banks and event detection), now
+// and from then on, and optionally locks the process's memory. threads that
+// can't get the policy, for lack of privileges say, keep running with the
+// kernel's default. returns what took effect, with :errors saying what
+// didn't; with no arguments, changes nothing
+VALUE GPIO_realtime(int argc, VALUE *argv, VALUE self)
+{
+  VALUE hash = Qnil, lock_val;
+  struct rt_policy policy;
+  struct rt_report report;
+
+  rb_scan_args(argc, argv, "01", &hash);
+  if (hash == Qnil)
+  {
+    rt_get_default(&policy);
+    rt_get_report(&report);
+    return report_to_hash(&policy, &report);
+  }
+
+  hash_to_policy(hash, &policy);
+  memset(&report, 0, sizeof(report));
+  lock_val = rb_hash_aref(hash, ID2SYM(rb_intern("lock_memory")));
+  if (lock_val != Qnil)
+    report.lock_error = rt_lock_memory(RTEST(lock_val));
+  rt_set_default(&policy, &report);
+
+  if (gpio_warnings && report.sched_error)
+    rb_warn("unable to set the real-time policy (%s); threads keep the default "
+      "policy. use RPi::GPIO.set_warnings(false) to disable warnings", strerror(report.sched_error));
+  if (gpio_warnings && report.affinity_error)
+    rb_warn("unable to set the cpus (%s); threads run on any cpu", strerror(report.affinity_error));
+  if (gpio_warnings && report.lock_error)
+    rb_warn("unable to lock memory (%s)", strerror(report.lock_error));
+  return report_to_hash(&policy, &report);
+}
@@ -0,0 +1,423 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "rb_servo.h"
+
+extern VALUE m_GPIO;
+VALUE c_ServoBank = Qnil;
+
+VALUE _extract_channels(VALUE channel_or_list);
+
+struct rb_servo_bank
+{
+  struct servo_bank *bank;
+  int count;
+  unsigned int gpios[SERVO_MAX_COUNT];
+  uint32_t frame_us;
+  int has_realtime;
+  struct rt_policy realtime;
+};
+
+static void servo_bank_free_struct(void *ptr)
+{
+  struct rb_servo_bank *s = (struct rb_servo_bank *)ptr;
+  if (s->bank != NULL)
+    servo_bank_free(s->bank);
+  xfree(s);
+}
+
+static size_t servo_bank_size(const void *ptr)
+{
+  return sizeof(struct rb_servo_bank);
+}
+
+static const rb_data_type_t servo_bank_type = {
+  "RPi::GPIO::ServoBank",
+  { NULL, servo_bank_free_struct, servo_bank_size, },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE servo_bank_alloc(VALUE klass)
+{
+  struct rb_servo_bank *s;
+  return TypedData_Make_Struct(klass, struct rb_servo_bank, &servo_bank_type, s);
+}
+
+static struct rb_servo_bank *get_servo_bank(VALUE self)
+{
+  struct rb_servo_bank *s;
+  TypedData_Get_Struct(self, struct rb_servo_bank, &servo_bank_type, s);
+  if (s->bank == NULL)
+  {
+    rb_raise(rb_eRuntimeError, "servo bank is not initialized");
+  }
+  return s;
+}
+
+void define_servo_bank_class_stuff(void)
+{
+  c_ServoBank = rb_define_class_under(m_GPIO, "ServoBank", rb_cObject);
+  rb_define_alloc_func(c_ServoBank, servo_bank_alloc);
+  rb_define_method(c_ServoBank, "initialize", ServoBank_initialize, -1);
+  rb_define_method(c_ServoBank, "channels", ServoBank_get_channels, 0);
+  rb_define_method(c_ServoBank, "frame", ServoBank_get_frame, 0);
+  rb_define_method(c_ServoBank, "targets", ServoBank_get_targets, 0);
+  rb_define_method(c_ServoBank, "targets=", ServoBank_set_targets, 1);
+  rb_define_method(c_ServoBank, "[]", ServoBank_get_target, 1);
+  rb_define_method(c_ServoBank, "[]=", ServoBank_set_target, 2);
+  rb_define_method(c_ServoBank, "speeds", ServoBank_get_speeds, 0);
+  rb_define_method(c_ServoBank, "speeds=", ServoBank_set_speeds, 1);
+  rb_define_method(c_ServoBank, "positions", ServoBank_get_positions, 0);
+  rb_define_method(c_ServoBank, "start", ServoBank_start, 0);
+  rb_define_method(c_ServoBank, "stop", ServoBank_stop, 0);
+  rb_define_method(c_ServoBank, "running?", ServoBank_get_running, 0);
+}
+
+// index of channel in the bank, raising if it isn't one of the bank's
+static int servo_index(VALUE self, struct rb_servo_bank *s, VALUE channel)
+{
+  unsigned int gpio;
+  int i;
+
+  if (get_gpio_number(NUM2INT(channel), &gpio))
+    return -1;
+  for (i = 0; i < s->count; i++)
+  {
+    if (s->gpios[i] == gpio)
+      return i;
+  }
+  rb_raise(rb_eArgError, "channel %d is not in this servo bank", NUM2INT(channel));
+  return -1;
+}
+
+// a pulse width in microseconds, or nil for no pulses
+static int32_t parse_target(VALUE target)
+{
+  double us;
+
+  if (target == Qnil)
+    return SERVO_OFF;
+  us = NUM2DBL(target);
+  if (us < SERVO_MIN_PULSE_US || us > SERVO_MAX_PULSE_US)
+  {
+    rb_raise(rb_eArgError, "pulse width must be between %d and %d microseconds",
+      SERVO_MIN_PULSE_US, SERVO_MAX_PULSE_US);
+  }
+  return (int32_t)(us + 0.5);
+}
+
+// a speed in microseconds of pulse width per second, or nil for no limit
+static int32_t parse_speed(VALUE speed)
+{
+  double us;
+
+  if (speed == Qnil)
+    return SERVO_UNLIMITED;
+  us = NUM2DBL(speed);
+  if (us <= 0.0 || us > INT32_MAX)
+  {
+    rb_raise(rb_eArgError, "speed must be greater than 0 microseconds per second");
+  }
+  return (int32_t)(us + 0.5);
+}
+
+// fills values from an Array with one entry per servo, or a Hash of channel
+// to value where the servos left out keep SERVO_UNCHANGED. everything is
+// parsed before anything is applied, so a bad value changes nothing
+static void parse_values(VALUE self, struct rb_servo_bank *s, VALUE list,
+  int32_t (*parse)(VALUE), int32_t *values)
+{
+  VALUE keys;
+  int i;
+
+  for (i = 0; i < s->count; i++)
+    values[i] = SERVO_UNCHANGED;
+
+  if (RB_TYPE_P(list, T_HASH))
+  {
+    keys = rb_funcall(list, rb_intern("keys"), 0);
+    for (i = 0; i < RARRAY_LEN(keys); i++)
+    {
+      VALUE key = rb_ary_entry(keys, i);
+      values[servo_index(self, s, key)] = parse(rb_hash_aref(list, key));
+    }
+  }
+  else
+  {
+    Check_Type(list, T_ARRAY);
+    if (RARRAY_LEN(list) != s->count)
+    {
+      rb_raise(rb_eArgError, "expected %d values, one for each channel", s->count);
+    }
+    for (i = 0; i < s->count; i++)
+      values[i] = parse(rb_ary_entry(list, i));
+  }
+}
+
+static VALUE target_value(int32_t us)
+{
+  return us == SERVO_OFF ? Qnil : INT2NUM(us);
+}
+
+// RPi::GPIO::ServoBank#initialize(channels, hash(:frame => microseconds,
+// :speed => microseconds per second, :realtime => hash))
+//
+// a bank of RC servos on output channels, pulsed once every frame (20 ms by
+// default). with :speed, every servo moves towards its target by at most
+// that much pulse width per second. :realtime overrides RPi::GPIO.realtime
+// for the bank's thread
+VALUE ServoBank_initialize(int argc, VALUE *argv, VALUE self)
+{
+  struct rb_servo_bank *s;
+  VALUE channels, hash = Qnil, channel_list, frame_val, speed_val;
+  int32_t speeds[SERVO_MAX_COUNT];
+  unsigned int gpio;
+  long frame = SERVO_DEFAULT_FRAME_US;
+  int i, j, count;
+
+  TypedData_Get_Struct(self, struct rb_servo_bank, &servo_bank_type, s);
+  rb_scan_args(argc, argv, "11", &channels, &hash);
+  if (hash == Qnil)
+    hash = rb_hash_new();
+  Check_Type(hash, T_HASH);
+
+  frame_val = rb_hash_aref(hash, ID2SYM(rb_intern("frame")));
+  speed_val = rb_hash_aref(hash, ID2SYM(rb_intern("speed")));
+  s->has_realtime = get_realtime_override(rb_hash_aref(hash, ID2SYM(rb_intern("realtime"))), &s->realtime);
+  if (frame_val != Qnil)
+    frame = NUM2LONG(frame_val);
+  if (frame <= SERVO_MAX_PULSE_US || frame > SERVO_MAX_FRAME_US)
+  {
+    rb_raise(rb_eArgError, "frame must be longer than %d and at most %d microseconds",
+      SERVO_MAX_PULSE_US, SERVO_MAX_FRAME_US);
+    return Qnil;
+  }
+
+  channel_list = _extract_channels(channels);
+  count = RARRAY_LEN(channel_list);
+  if (count < 1 || count > SERVO_MAX_COUNT)
+  {
+    rb_raise(rb_eArgError, "a servo bank needs between 1 and %d channels", SERVO_MAX_COUNT);
+    return Qnil;
+  }
+  for (i = 0; i < count; i++)
+  {
+    if (get_gpio_number(NUM2INT(rb_ary_entry(channel_list, i)), &gpio))
+      return Qnil;
+    if (gpio_direction[gpio] != OUTPUT)
+    {
+      rb_raise(rb_eRuntimeError, "you must setup the GPIO channel as output "
+        "first with RPi::GPIO.setup CHANNEL, :as => :output");
+      return Qnil;
+    }
+    for (j = 0; j < i; j++)
+    {
+      if (s->gpios[j] == gpio)
+      {
+        rb_raise(rb_eArgError, "channel %d is given more than once",
+          NUM2INT(rb_ary_entry(channel_list, i)));
+        return Qnil;
+      }
+    }
+    s->gpios[i] = gpio;
+  }
+  s->count = count;
+  s->frame_us = (uint32_t)frame;
+
+  if (s->bank != NULL)
+    servo_bank_free(s->bank);
+  if ((s->bank = servo_bank_create(s->gpios, count, s->frame_us)) == NULL)
+  {
+    rb_raise(rb_eNoMemError, "out of memory");
+    return Qnil;
+  }
+  for (i = 0; i < count; i++)
+    speeds[i] = parse_speed(speed_val);
+  servo_bank_set_speeds(s->bank, speeds);
+  rb_iv_set(self, "@channels", rb_ary_dup(channel_list));
+  return self;
+}
+
+// RPi::GPIO::ServoBank#channels
+VALUE ServoBank_get_channels(VALUE self)
+{
+  return rb_ary_dup(rb_iv_get(self, "@channels"));
+}
+
+// RPi::GPIO::ServoBank#frame
+//
+// microseconds from the start of one pulse to the start of the next
+VALUE ServoBank_get_frame(VALUE self)
+{
+  return UINT2NUM(get_servo_bank(self)->frame_us);
+}
+
+// RPi::GPIO::ServoBank#targets
+//
+// each servo's target pulse width in microseconds, nil for no pulses
+VALUE ServoBank_get_targets(VALUE self)
+{
+  struct rb_servo_bank *s = get_servo_bank(self);
+  int32_t targets[SERVO_MAX_COUNT];
+  VALUE result = rb_ary_new_capa(s->count);
+  int i;
+
+  servo_bank_get(s->bank, targets, NULL, NULL);
+  for (i = 0; i < s->count; i++)
+    rb_ary_push(result, target_value(targets[i]));
+  return result;
+}
+
+// RPi::GPIO::ServoBank#targets=
+//
+// sets every target in one go, from an Array in channel order or a Hash of
+// channel to pulse width; all the servos take their new targets up in the
+// same frame
+VALUE ServoBank_set_targets(VALUE self, VALUE targets)
+{
+  struct rb_servo_bank *s = get_servo_bank(self);
+  int32_t values[SERVO_MAX_COUNT];
+
+  parse_values(self, s, targets, parse_target, values);
+  servo_bank_set_targets(s->bank, values);
+  return targets;
+}
+
+// RPi::GPIO::ServoBank#[]
+VALUE ServoBank_get_target(VALUE self, VALUE channel)
+{
+  struct rb_servo_bank *s = get_servo_bank(self);
+  int32_t targets[SERVO_MAX_COUNT];
+  int i = servo_index(self, s, channel);
+
+  servo_bank_get(s->bank, targets, NULL, NULL);
+  return target_value(targets[i]);
+}
+
+// RPi::GPIO::ServoBank#[]=
+VALUE ServoBank_set_target(VALUE self, VALUE channel, VALUE target)
+{
+  struct rb_servo_bank *s = get_servo_bank(self);
+  int32_t values[SERVO_MAX_COUNT];
+  int i;
+
+  for (i = 0; i < s->count; i++)
+    values[i] = SERVO_UNCHANGED;
+  values[servo_index(self, s, channel)] = parse_target(target);
+  servo_bank_set_targets(s->bank, values);
+  return target;
+}
+
+// RPi::GPIO::ServoBank#speeds
+//
+// each servo's speed limit in microseconds per second, nil for none
+VALUE ServoBank_get_speeds(VALUE self)
+{
+  struct rb_servo_bank *s = get_servo_bank(self);
+  int32_t speeds[SERVO_MAX_COUNT];
+  VALUE result = rb_ary_new_capa(s->count);
+  int i;
+
+  servo_bank_get(s->bank, NULL, NULL, speeds);
+  for (i = 0; i < s->count; i++)
+    rb_ary_push(result, speeds[i] == SERVO_UNLIMITED ? Qnil : INT2NUM(speeds[i]));
+  return result;
+}
+
+// RPi::GPIO::ServoBank#speeds=
+//
+// sets speed limits like targets=, with nil for no limit
+VALUE ServoBank_set_speeds(VALUE self, VALUE speeds)
+{
+  struct rb_servo_bank *s = get_servo_bank(self);
+  int32_t values[SERVO_MAX_COUNT];
+
+  parse_values(self, s, speeds, parse_speed, values);
+  servo_bank_set_speeds(s->bank, values);
+  return speeds;
+}
+
+// RPi::GPIO::ServoBank#positions
+//
+// the pulse width each servo is being sent right now, which lags behind its
+// target while it ramps; nil for no pulses
+VALUE ServoBank_get_positions(VALUE self)
+{
+  struct rb_servo_bank *s = get_servo_bank(self);
+  int32_t positions[SERVO_MAX_COUNT];
+  VALUE result = rb_ary_new_capa(s->count);
+  int i;
+
+  servo_bank_get(s->bank, NULL, positions, NULL);
+  for (i = 0; i < s->count; i++)
+    rb_ary_push(result, target_value(positions[i]));
+  return result;
+}
+
+// RPi::GPIO::ServoBank#start
+VALUE ServoBank_start(VALUE self)
+{
+  struct rb_servo_bank *s = get_servo_bank(self);
+  int i, result;
+
+  if (check_gpio_priv())
+    return Qnil;
+  if (servo_bank_running(s->bank))
+    return self;
+  for (i = 0; i < s->count; i++)
+  {
+    if (pwm_exists(s->gpios[i]) || hard_pwm_exists(s->gpios[i]))
+    {
+      rb_raise(rb_eRuntimeError, "a PWM object already exists for GPIO %u", s->gpios[i]);
+      return Qnil;
+    }
+  }
+
+  result = servo_bank_start(s->bank, s->has_realtime ? &s->realtime : NULL);
+  if (result == -1)
+  {
+    rb_raise(rb_eRuntimeError, "another servo bank is already driving one of these channels");
+    return Qnil;
+  }
+  else if (result != 0)
+  {
+    rb_raise(rb_eRuntimeError, "unable to start the servo thread");
+    return Qnil;
+  }
+  return self;
+}
+
+// RPi::GPIO::ServoBank#stop
+//
+// stops the pulses and drives the channels low
+VALUE ServoBank_stop(VALUE self)
+{
+  servo_bank_stop(get_servo_bank(self)->bank);
+  return self;
+}
+
+// RPi::GPIO::ServoBank#running?
+VALUE ServoBank_get_running(VALUE self)
+{
+  return servo_bank_running(get_servo_bank(self)->bank) ? Qtrue : Qfalse;
+}
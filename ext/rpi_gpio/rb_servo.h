@@ -0,0 +1,45 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "ruby.h"
+#include "servo.h"
+#include "soft_pwm.h"
+#include "hard_pwm.h"
+#include "common.h"
+#include "c_gpio.h"
+#include "rb_realtime.h"
+
+void define_servo_bank_class_stuff(void);
+VALUE ServoBank_initialize(int argc, VALUE *argv, VALUE self);
+VALUE ServoBank_get_channels(VALUE self);
+VALUE ServoBank_get_frame(VALUE self);
+VALUE ServoBank_get_targets(VALUE self);
+VALUE ServoBank_set_targets(VALUE self, VALUE targets);
+VALUE ServoBank_get_target(VALUE self, VALUE channel);
+VALUE ServoBank_set_target(VALUE self, VALUE channel, VALUE target);
+VALUE ServoBank_get_speeds(VALUE self);
+VALUE ServoBank_set_speeds(VALUE self, VALUE speeds);
+VALUE ServoBank_get_positions(VALUE self);
+VALUE ServoBank_start(VALUE self);
+VALUE ServoBank_stop(VALUE self);
+VALUE ServoBank_get_running(VALUE self);
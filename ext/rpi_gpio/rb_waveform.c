@@ -0,0 +1,472 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "rb_waveform.h"
+
+extern VALUE m_GPIO;
+VALUE c_Waveform = Qnil;
+
+VALUE _extract_channels(VALUE channel_or_list);
+
+struct waveform
+{
+  struct waveform_step *steps;
+  size_t count;
+  size_t capa;
+  struct waveform_player *player;
+};
+
+static void waveform_free_struct(void *ptr)
+{
+  struct waveform *w = (struct waveform *)ptr;
+  if (w->player != NULL)
+    waveform_free(w->player);
+  xfree(w->steps);
+  xfree(w);
+}
+
+static size_t waveform_size(const void *ptr)
+{
+  const struct waveform *w = (const struct waveform *)ptr;
+  return sizeof(struct waveform) + w->capa * sizeof(struct waveform_step);
+}
+
+static const rb_data_type_t waveform_type = {
+  "RPi::GPIO::Waveform",
+  { NULL, waveform_free_struct, waveform_size, },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE waveform_alloc(VALUE klass)
+{
+  struct waveform *w;
+  return TypedData_Make_Struct(klass, struct waveform, &waveform_type, w);
+}
+
+static struct waveform *get_waveform(VALUE self)
+{
+  struct waveform *w;
+  TypedData_Get_Struct(self, struct waveform, &waveform_type, w);
+  return w;
+}
+
+// add the gpio of every output channel in channel_or_list to masks
+static void channels_to_masks(VALUE channel_or_list, uint32_t *masks)
+{
+  VALUE channel_list;
+  unsigned int gpio;
+  int i;
+
+  if (channel_or_list == Qnil)
+    return;
+  channel_list = _extract_channels(channel_or_list);
+  for (i = 0; i < RARRAY_LEN(channel_list); i++)
+  {
+    if (get_gpio_number(NUM2INT(rb_ary_entry(channel_list, i)), &gpio))
+      return;
+    if (gpio_direction[gpio] != OUTPUT)
+    {
+      rb_raise(rb_eRuntimeError, "you must setup the GPIO channel as output "
+        "first with RPi::GPIO.setup CHANNEL, :as => :output");
+      return;
+    }
+    masks[GPIO_BANK(gpio)] |= GPIO_MASK(gpio);
+  }
+}
+
+void define_waveform_class_stuff(void)
+{
+  c_Waveform = rb_define_class_under(m_GPIO, "Waveform", rb_cObject);
+  rb_define_alloc_func(c_Waveform, waveform_alloc);
+  rb_define_method(c_Waveform, "step", Waveform_step, 1);
+  rb_define_method(c_Waveform, "size", Waveform_get_size, 0);
+  rb_define_method(c_Waveform, "duration", Waveform_get_duration, 0);
+  rb_define_method(c_Waveform, "play", Waveform_play, -1);
+  rb_define_method(c_Waveform, "stop", Waveform_stop, 0);
+  rb_define_method(c_Waveform, "wait", Waveform_wait, 0);
+  rb_define_method(c_Waveform, "playing?", Waveform_get_playing, 0);
+  rb_define_method(c_Waveform, "stats", Waveform_get_stats, 0);
+  rb_define_method(c_Waveform, "control_blocks", Waveform_control_blocks, -1);
+  rb_define_const(c_Waveform, "DMA_BUS_BASE", UINT2NUM(DMA_SIM_BUS_BASE));
+  rb_define_const(c_Waveform, "GPSET0", UINT2NUM(BUS_GPSET0));
+  rb_define_const(c_Waveform, "GPCLR0", UINT2NUM(BUS_GPCLR0));
+  rb_define_const(c_Waveform, "PWM_FIFO", UINT2NUM(BUS_PWM_FIF1));
+  rb_define_const(c_Waveform, "PCM_FIFO", UINT2NUM(BUS_PCM_FIFO));
+}
+
+// RPi::GPIO::Waveform#step(hash(:high => channels, :low => channels,
+// :delay => nanoseconds))
+//
+// appends a step that drives the :high channels high and the :low channels
+// low at the same moment, then waits :delay nanoseconds before the next step
+VALUE Waveform_step(VALUE self, VALUE hash)
+{
+  struct waveform *w = get_waveform(self);
+  struct waveform_step step;
+  VALUE delay_val;
+  int bank;
+
+  Check_Type(hash, T_HASH);
+  memset(&step, 0, sizeof(step));
+  channels_to_masks(rb_hash_aref(hash, ID2SYM(rb_intern("high"))), step.set);
+  channels_to_masks(rb_hash_aref(hash, ID2SYM(rb_intern("low"))), step.clr);
+  for (bank = 0; bank < GPIO_BANKS; bank++)
+  {
+    if (step.set[bank] & step.clr[bank])
+    {
+      rb_raise(rb_eArgError, "a channel cannot be both high and low in one step");
+      return Qnil;
+    }
+  }
+
+  delay_val = rb_hash_aref(hash, ID2SYM(rb_intern("delay")));
+  if (delay_val != Qnil)
+  {
+    if (NUM2LL(delay_val) < 0)
+    {
+      rb_raise(rb_eArgError, "delay must not be negative");
+      return Qnil;
+    }
+    step.delay_ns = NUM2ULL(delay_val);
+  }
+
+  if (w->count == w->capa)
+  {
+    w->capa = w->capa ? w->capa * 2 : 16;
+    REALLOC_N(w->steps, struct waveform_step, w->capa);
+  }
+  w->steps[w->count++] = step;
+  return self;
+}
+
+// RPi::GPIO::Waveform#size
+VALUE Waveform_get_size(VALUE self)
+{
+  return SIZET2NUM(get_waveform(self)->count);
+}
+
+// RPi::GPIO::Waveform#duration
+//
+// nanoseconds taken by one pass through the waveform
+VALUE Waveform_get_duration(VALUE self)
+{
+  struct waveform *w = get_waveform(self);
+  unsigned long long total = 0;
+  size_t i;
+
+  for (i = 0; i < w->count; i++)
+  {
+    total += w->steps[i].delay_ns;
+  }
+  return ULL2NUM(total);
+}
+
+// fill opts from hash(:pacer => :pwm or :pcm, :tick => nanoseconds)
+static void get_dma_options(VALUE hash, struct dma_options *opts)
+{
+  VALUE pacer_val, tick_val;
+
+  opts->pacer = DMA_PACER_PWM;
+  opts->tick_ns = DMA_DEFAULT_TICK_NS;
+  opts->channel = DMA_DEFAULT_CHANNEL;
+  if (hash == Qnil)
+    return;
+
+  pacer_val = rb_hash_aref(hash, ID2SYM(rb_intern("pacer")));
+  if (pacer_val != Qnil)
+  {
+    if (SYMBOL_P(pacer_val) && SYM2ID(pacer_val) == rb_intern("pcm"))
+      opts->pacer = DMA_PACER_PCM;
+    else if (!SYMBOL_P(pacer_val) || SYM2ID(pacer_val) != rb_intern("pwm"))
+      rb_raise(rb_eArgError, "pacer must be :pwm or :pcm");
+  }
+
+  tick_val = rb_hash_aref(hash, ID2SYM(rb_intern("tick")));
+  if (tick_val != Qnil)
+  {
+    if (NUM2LL(tick_val) < 0)
+      rb_raise(rb_eArgError, "tick must not be negative");
+    opts->tick_ns = NUM2ULL(tick_val);
+  }
+  if (dma_check_options(opts) != DMA_OK)
+  {
+    rb_raise(rb_eArgError, "tick must be a multiple of %d ns from %d to %d ns",
+      DMA_TICK_STEP_NS, DMA_MIN_TICK_NS,
+      opts->pacer == DMA_PACER_PCM ? DMA_MAX_TICK_NS_PCM : DMA_MAX_TICK_NS_PWM);
+  }
+}
+
+// returns 1 if hash asks for :engine => :dma
+static int wants_dma(VALUE hash)
+{
+  VALUE engine_val;
+
+  if (hash == Qnil)
+    return 0;
+  engine_val = rb_hash_aref(hash, ID2SYM(rb_intern("engine")));
+  if (engine_val == Qnil || (SYMBOL_P(engine_val) && SYM2ID(engine_val) == rb_intern("thread")))
+    return 0;
+  if (SYMBOL_P(engine_val) && SYM2ID(engine_val) == rb_intern("dma"))
+    return 1;
+  rb_raise(rb_eArgError, "engine must be :thread or :dma");
+  return 0;
+}
+
+static void raise_dma_error(int error)
+{
+  switch (error)
+  {
+    case DMA_TOO_LONG:
+      rb_raise(rb_eRuntimeError, "waveform is too long for DMA playback, or "
+        "shorter than one tick");
+    case DMA_NO_ACCESS:
+      rb_raise(rb_eRuntimeError, "no access to the DMA engine; are you root?");
+    case DMA_NO_MEMORY:
+      rb_raise(rb_eRuntimeError, "unable to allocate memory for DMA");
+    case DMA_PACER_BUSY:
+      rb_raise(rb_eRuntimeError, "the DMA pacer is in use by hardware PWM or "
+        "another waveform");
+    default:
+      rb_raise(rb_eRuntimeError, "unable to start waveform thread");
+  }
+}
+
+// RPi::GPIO::Waveform#play(times = 1, hash(:engine => :thread or :dma,
+// :pacer => :pwm or :pcm, :tick => nanoseconds, :realtime => hash))
+//
+// plays the waveform on a native thread, times times over or, given
+// :forever, until stopped. with :engine => :dma, the DMA engine writes the
+// steps instead, timed by the PWM or PCM peripheral to the nearest :tick
+// (default 1000); only one DMA waveform plays at a time. :realtime
+// overrides RPi::GPIO.realtime for the playback thread
+VALUE Waveform_play(int argc, VALUE *argv, VALUE self)
+{
+  struct waveform *w = get_waveform(self);
+  VALUE times_val = Qnil;
+  VALUE hash = Qnil;
+  struct dma_options opts;
+  struct rt_policy realtime;
+  int has_realtime = 0;
+  long repeat = 1;
+  size_t i;
+  int use_dma, error;
+  unsigned int bank, gpio;
+
+  rb_scan_args(argc, argv, "02", &times_val, &hash);
+  if (argc == 1 && RB_TYPE_P(times_val, T_HASH))
+  {
+    hash = times_val;
+    times_val = Qnil;
+  }
+  if (hash != Qnil)
+    Check_Type(hash, T_HASH);
+  use_dma = wants_dma(hash);
+  get_dma_options(hash, &opts);
+  if (hash != Qnil)
+    has_realtime = get_realtime_override(rb_hash_aref(hash, ID2SYM(rb_intern("realtime"))), &realtime);
+  if (times_val != Qnil)
+  {
+    if (SYMBOL_P(times_val) && SYM2ID(times_val) == rb_intern("forever"))
+    {
+      repeat = WAVEFORM_FOREVER;
+    }
+    else if ((repeat = NUM2LONG(times_val)) < 1)
+    {
+      rb_raise(rb_eArgError, "times must be at least 1, or :forever");
+      return Qnil;
+    }
+  }
+
+  if (w->count == 0)
+  {
+    rb_raise(rb_eRuntimeError, "waveform has no steps");
+    return Qnil;
+  }
+  if (w->player != NULL && waveform_running(w->player))
+  {
+    rb_raise(rb_eRuntimeError, "waveform is already playing");
+    return Qnil;
+  }
+  if (check_gpio_priv())
+    return Qnil;
+
+  // every channel used must still be set up as an output
+  for (i = 0; i < w->count; i++)
+  {
+    for (bank = 0; bank < GPIO_BANKS; bank++)
+    {
+      for (gpio = bank * 32; gpio < bank * 32 + 32 && gpio < 54; gpio++)
+      {
+        if (((w->steps[i].set[bank] | w->steps[i].clr[bank]) & GPIO_MASK(gpio)) &&
+            gpio_direction[gpio] != OUTPUT)
+        {
+          rb_raise(rb_eRuntimeError, "GPIO channel not setup as output");
+          return Qnil;
+        }
+      }
+    }
+  }
+
+  if (w->player != NULL)
+  {
+    waveform_free(w->player);
+    w->player = NULL;
+  }
+  if (use_dma)
+  {
+    if ((w->player = waveform_play_dma(w->steps, w->count, repeat, &opts,
+      has_realtime ? &realtime : NULL, &error)) == NULL)
+      raise_dma_error(error);
+  }
+  else if ((w->player = waveform_play(w->steps, w->count, repeat,
+    has_realtime ? &realtime : NULL)) == NULL)
+  {
+    rb_raise(rb_eRuntimeError, "unable to start waveform thread");
+    return Qnil;
+  }
+  return self;
+}
+
+// RPi::GPIO::Waveform#control_blocks(times = 1, hash(:pacer => :pwm or :pcm,
+// :tick => nanoseconds))
+//
+// the DMA control blocks that play(:engine => :dma) would run, as an array of
+// hashes with keys :ti, :source, :dest, :length, :next. addresses are in
+// the simulator's bus address space, starting at the first block
+VALUE Waveform_control_blocks(int argc, VALUE *argv, VALUE self)
+{
+  struct waveform *w = get_waveform(self);
+  VALUE times_val = Qnil;
+  VALUE hash = Qnil;
+  VALUE list, cb_hash;
+  struct dma_options opts;
+  struct dma_memory mem;
+  struct dma_cb *cb;
+  long repeat = 1;
+  size_t size, count, i;
+
+  rb_scan_args(argc, argv, "02", &times_val, &hash);
+  if (argc == 1 && RB_TYPE_P(times_val, T_HASH))
+  {
+    hash = times_val;
+    times_val = Qnil;
+  }
+  if (hash != Qnil)
+    Check_Type(hash, T_HASH);
+  get_dma_options(hash, &opts);
+  if (times_val != Qnil)
+  {
+    if (SYMBOL_P(times_val) && SYM2ID(times_val) == rb_intern("forever"))
+      repeat = WAVEFORM_FOREVER;
+    else if ((repeat = NUM2LONG(times_val)) < 1)
+      rb_raise(rb_eArgError, "times must be at least 1, or :forever");
+  }
+
+  if ((size = dma_program_size(w->steps, w->count, repeat, &opts)) == 0)
+    raise_dma_error(DMA_TOO_LONG);
+  memset(&mem, 0, sizeof(mem));
+  mem.virt = ALLOC_N(uint8_t, size);
+  mem.bus = DMA_SIM_BUS_BASE;
+  mem.size = size;
+  count = dma_compile(w->steps, w->count, repeat, &opts, &mem);
+
+  list = rb_ary_new2(count);
+  for (i = 0; i < count; i++)
+  {
+    cb = (struct dma_cb *)mem.virt + i;
+    cb_hash = rb_hash_new();
+    rb_hash_aset(cb_hash, ID2SYM(rb_intern("ti")), UINT2NUM(cb->ti));
+    rb_hash_aset(cb_hash, ID2SYM(rb_intern("source")), UINT2NUM(cb->source_ad));
+    rb_hash_aset(cb_hash, ID2SYM(rb_intern("dest")), UINT2NUM(cb->dest_ad));
+    rb_hash_aset(cb_hash, ID2SYM(rb_intern("length")), UINT2NUM(cb->txfr_len));
+    rb_hash_aset(cb_hash, ID2SYM(rb_intern("next")), UINT2NUM(cb->nextconbk));
+    rb_ary_push(list, cb_hash);
+  }
+  xfree(mem.virt);
+  return list;
+}
+
+// RPi::GPIO::Waveform#stop
+VALUE Waveform_stop(VALUE self)
+{
+  struct waveform *w = get_waveform(self);
+
+  if (w->player != NULL)
+    waveform_stop(w->player);
+  return self;
+}
+
+static void *wait_blocking(void *arg)
+{
+  return (void *)(intptr_t)waveform_wait((struct waveform_player *)arg);
+}
+
+static void wait_unblock(void *arg)
+{
+  waveform_wake_waiters((struct waveform_player *)arg);
+}
+
+// RPi::GPIO::Waveform#wait
+//
+// blocks until the waveform finishes playing, then returns its stats
+VALUE Waveform_wait(VALUE self)
+{
+  struct waveform *w = get_waveform(self);
+
+  if (w->player == NULL)
+    return Qnil;
+  while (!rb_thread_call_without_gvl(wait_blocking, w->player, wait_unblock, w->player))
+  {
+    rb_thread_check_ints();
+  }
+  return Waveform_get_stats(self);
+}
+
+// RPi::GPIO::Waveform#playing?
+VALUE Waveform_get_playing(VALUE self)
+{
+  struct waveform *w = get_waveform(self);
+  return (w->player != NULL && waveform_running(w->player)) ? Qtrue : Qfalse;
+}
+
+// RPi::GPIO::Waveform#stats
+//
+// how far each step's write landed from its scheduled time, in nanoseconds
+VALUE Waveform_get_stats(VALUE self)
+{
+  struct waveform *w = get_waveform(self);
+  struct waveform_stats stats;
+  VALUE hash;
+
+  if (w->player == NULL)
+    return Qnil;
+
+  waveform_get_stats(w->player, &stats);
+  hash = rb_hash_new();
+  rb_hash_aset(hash, ID2SYM(rb_intern("steps")), ULL2NUM(stats.steps));
+  rb_hash_aset(hash, ID2SYM(rb_intern("iterations")), ULL2NUM(stats.iterations));
+  rb_hash_aset(hash, ID2SYM(rb_intern("min_error_ns")), LL2NUM(stats.min_error_ns));
+  rb_hash_aset(hash, ID2SYM(rb_intern("max_error_ns")), LL2NUM(stats.max_error_ns));
+  rb_hash_aset(hash, ID2SYM(rb_intern("mean_error_ns")), DBL2NUM(stats.mean_error_ns));
+  return hash;
+}
@@ -0,0 +1,41 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "ruby.h"
+#include "ruby/thread.h"
+#include "waveform.h"
+#include "dma.h"
+#include "rb_realtime.h"
+#include "common.h"
+#include "c_gpio.h"
+
+void define_waveform_class_stuff(void);
+VALUE Waveform_step(VALUE self, VALUE hash);
+VALUE Waveform_get_size(VALUE self);
+VALUE Waveform_get_duration(VALUE self);
+VALUE Waveform_play(int argc, VALUE *argv, VALUE self);
+VALUE Waveform_stop(VALUE self);
+VALUE Waveform_wait(VALUE self);
+VALUE Waveform_get_playing(VALUE self);
+VALUE Waveform_get_stats(VALUE self);
+VALUE Waveform_control_blocks(int argc, VALUE *argv, VALUE self);
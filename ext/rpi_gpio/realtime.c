@@ -0,0 +1,282 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "realtime.h"
+
+#define MAX_THREADS 64
+
+// every native thread the gem starts goes through rt_thread_create, which
+// registers it here, so that a new default reaches threads already running
+struct rt_thread
+{
+    int in_use;
+    pthread_t thread;
+    int overridden;
+    struct rt_policy policy;
+    int applied;
+};
+
+struct rt_start
+{
+    void *(*start)(void *);
+    void *arg;
+    int overridden;
+    struct rt_policy policy;
+    int registered;
+};
+
+static struct rt_policy default_policy;
+static struct rt_thread threads[MAX_THREADS];
+static struct rt_report last_report;
+static int memory_locked;
+static pthread_mutex_t rt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rt_registered = PTHREAD_COND_INITIALIZER;
+
+// returns 0 if p can be asked for, -1 if its priority or cores are out of
+// range
+int rt_check_policy(const struct rt_policy *p)
+{
+    long cores = sysconf(_SC_NPROCESSORS_CONF);
+
+    if (p->policy == RT_OTHER)
+    {
+        if (p->priority != 0)
+            return -1;
+    }
+    else if (p->policy != RT_FIFO && p->policy != RT_RR)
+    {
+        return -1;
+    }
+    else if (p->priority < sched_get_priority_min(SCHED_FIFO) ||
+        p->priority > sched_get_priority_max(SCHED_FIFO))
+    {
+        return -1;
+    }
+    if (cores > 0 && cores < RT_MAX_CPUS && (p->cpus >> cores) != 0)
+        return -1;
+    return 0;
+}
+
+// apply p to thread. returns 1 if all of it took; errors are left in report
+static int apply(pthread_t thread, const struct rt_policy *p, struct rt_report *report)
+{
+    struct sched_param param;
+    cpu_set_t set;
+    int policy, cpu, ok = 1, err;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = p->priority;
+    policy = p->policy == RT_FIFO ? SCHED_FIFO : p->policy == RT_RR ? SCHED_RR : SCHED_OTHER;
+    if ((err = pthread_setschedparam(thread, policy, &param)) != 0)
+    {
+        report->sched_error = err;
+        ok = 0;
+    }
+
+    CPU_ZERO(&set);
+    for (cpu = 0; cpu < RT_MAX_CPUS; cpu++)
+    {
+        if (p->cpus == 0 || (p->cpus & (1ULL << cpu)))
+            CPU_SET(cpu, &set);
+    }
+    if ((err = pthread_setaffinity_np(thread, sizeof(set), &set)) != 0)
+    {
+        report->affinity_error = err;
+        ok = 0;
+    }
+    return ok;
+}
+
+static void *probe_thread(void *arg)
+{
+    struct rt_report *report = (struct rt_report *)arg;
+    apply(pthread_self(), &default_policy, report);
+    return NULL;
+}
+
+// called with rt_lock held: reapply the default to the threads that use it
+// and count them. with no threads running, a throwaway thread tries the
+// policy, so that missing privileges are reported up front
+static void refresh(struct rt_report *report)
+{
+    pthread_t probe;
+    int i;
+
+    report->threads = report->realtime_threads = 0;
+    for (i = 0; i < MAX_THREADS; i++)
+    {
+        if (!threads[i].in_use)
+            continue;
+        if (!threads[i].overridden)
+        {
+            threads[i].policy = default_policy;
+            threads[i].applied = apply(threads[i].thread, &default_policy, report);
+        }
+        report->threads++;
+        if (threads[i].applied && threads[i].policy.policy != RT_OTHER)
+            report->realtime_threads++;
+    }
+    if (report->threads == 0 && pthread_create(&probe, NULL, probe_thread, report) == 0)
+        pthread_join(probe, NULL);
+}
+
+void rt_set_default(const struct rt_policy *p, struct rt_report *report)
+{
+    pthread_mutex_lock(&rt_lock);
+    default_policy = *p;
+    memset(&last_report, 0, sizeof(last_report));
+    last_report.lock_error = report->lock_error;
+    refresh(&last_report);
+    last_report.memory_locked = memory_locked;
+    *report = last_report;
+    pthread_mutex_unlock(&rt_lock);
+}
+
+void rt_get_default(struct rt_policy *p)
+{
+    pthread_mutex_lock(&rt_lock);
+    *p = default_policy;
+    pthread_mutex_unlock(&rt_lock);
+}
+
+// lock (or with lock 0, unlock) all of the process's memory, now and in
+// future, so that page faults can't stall a thread. returns 0 or an errno
+int rt_lock_memory(int lock)
+{
+    int err = 0;
+
+    pthread_mutex_lock(&rt_lock);
+    if (lock && !memory_locked)
+    {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+            memory_locked = 1;
+        else
+            err = errno;
+    }
+    else if (!lock && memory_locked)
+    {
+        munlockall();
+        memory_locked = 0;
+    }
+    pthread_mutex_unlock(&rt_lock);
+    return err;
+}
+
+void rt_get_report(struct rt_report *report)
+{
+    int i;
+
+    pthread_mutex_lock(&rt_lock);
+    *report = last_report;
+    report->memory_locked = memory_locked;
+    report->threads = report->realtime_threads = 0;
+    for (i = 0; i < MAX_THREADS; i++)
+    {
+        if (!threads[i].in_use)
+            continue;
+        report->threads++;
+        if (threads[i].applied && threads[i].policy.policy != RT_OTHER)
+            report->realtime_threads++;
+    }
+    pthread_mutex_unlock(&rt_lock);
+}
+
+// the new thread applies its own policy before doing any work. if that
+// fails, for lack of privileges say, it carries on with the kernel's default
+// and the failure shows up in rt_get_report
+static void *trampoline(void *arg)
+{
+    struct rt_start *s = (struct rt_start *)arg;
+    struct rt_start start = *s;
+    struct rt_report report;
+    int slot = -1, applied, i;
+    void *result;
+
+    pthread_mutex_lock(&rt_lock);
+    if (!start.overridden)
+        start.policy = default_policy;
+    memset(&report, 0, sizeof(report));
+    applied = start.policy.policy == RT_OTHER && start.policy.cpus == 0 ?
+        1 : apply(pthread_self(), &start.policy, &report);
+    if (report.sched_error)
+        last_report.sched_error = report.sched_error;
+    if (report.affinity_error)
+        last_report.affinity_error = report.affinity_error;
+    for (i = 0; i < MAX_THREADS && slot < 0; i++)
+    {
+        if (!threads[i].in_use)
+            slot = i;
+    }
+    if (slot >= 0)
+    {
+        threads[slot].in_use = 1;
+        threads[slot].thread = pthread_self();
+        threads[slot].overridden = start.overridden;
+        threads[slot].policy = start.policy;
+        threads[slot].applied = applied;
+    }
+    s->registered = 1;
+    pthread_cond_broadcast(&rt_registered);
+    pthread_mutex_unlock(&rt_lock);
+
+    result = start.start(start.arg);
+
+    if (slot >= 0)
+    {
+        pthread_mutex_lock(&rt_lock);
+        threads[slot].in_use = 0;
+        pthread_mutex_unlock(&rt_lock);
+    }
+    return result;
+}
+
+// pthread_create for the gem's threads: the thread runs with override if
+// given, or with the default set by rt_set_default. returns once the thread
+// has its policy, so that it shows up in rt_get_report straight away
+int rt_thread_create(pthread_t *thread, void *(*start)(void *), void *arg, const struct rt_policy *override)
+{
+    struct rt_start s;
+    int result;
+
+    memset(&s, 0, sizeof(s));
+    s.start = start;
+    s.arg = arg;
+    s.overridden = override != NULL;
+    if (override != NULL)
+        s.policy = *override;
+    if ((result = pthread_create(thread, NULL, trampoline, &s)) != 0)
+        return result;
+
+    pthread_mutex_lock(&rt_lock);
+    while (!s.registered)
+        pthread_cond_wait(&rt_registered, &rt_lock);
+    pthread_mutex_unlock(&rt_lock);
+    return 0;
+}
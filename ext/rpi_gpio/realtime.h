@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Real-time scheduling for the native threads the gem starts */
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define RT_OTHER  0     // the kernel's default time-sharing policy
+#define RT_FIFO   1
+#define RT_RR     2
+
+#define RT_MAX_CPUS 64
+
+// what to run a thread with. cpus is a mask of the cores it may run on, 0
+// for any
+struct rt_policy
+{
+    int policy;
+    int priority;
+    uint64_t cpus;
+};
+
+// what happened the last time a policy was applied; the errors are errno
+// values, 0 on success
+struct rt_report
+{
+    int sched_error;
+    int affinity_error;
+    int lock_error;
+    int memory_locked;
+    int threads;            // native threads running
+    int realtime_threads;   // how many of those got the policy they asked for
+};
+
+int rt_check_policy(const struct rt_policy *p);
+void rt_set_default(const struct rt_policy *p, struct rt_report *report);
+void rt_get_default(struct rt_policy *p);
+int rt_lock_memory(int lock);
+void rt_get_report(struct rt_report *report);
+int rt_thread_create(pthread_t *thread, void *(*start)(void *), void *arg, const struct rt_policy *override);
+
+#endif /* REALTIME_H */
@@ -27,6 +27,12 @@ SOFTWARE.
 #include "rpi_gpio.h"
 #include "rb_pwm.h"
 #include "rb_gpio.h"
+#include "rb_pin.h"
+#include "rb_bus.h"
+#include "rb_waveform.h"
+#include "rb_capture.h"
+#include "rb_servo.h"
+#include "rb_realtime.h"
 
 VALUE m_RPi = Qnil;
 VALUE m_GPIO = Qnil;
@@ -36,6 +42,12 @@ void Init_rpi_gpio()
   define_modules();
   define_gpio_module_stuff();
   define_pwm_class_stuff();
+  define_pin_class_stuff();
+  define_bus_class_stuff();
+  define_waveform_class_stuff();
+  define_capture_class_stuff();
+  define_servo_bank_class_stuff();
+  define_realtime_stuff();
 }
 
 void define_modules(void)
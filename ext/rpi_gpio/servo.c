@@ -0,0 +1,354 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "servo.h"
+
+// longest single sleep, so that a stop request is noticed promptly
+#define MAX_SLEEP_NS 10000000LL
+
+struct servo
+{
+    unsigned int gpio;
+    int32_t target_us;
+    int32_t speed;          // microseconds of pulse width per second
+    int64_t position_ns;    // pulse width currently output, 0 for none
+    int64_t offset_ns;      // where the pulse starts in the frame
+};
+
+struct servo_bank
+{
+    struct servo servos[SERVO_MAX_COUNT];
+    int count;
+    int64_t frame_ns;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    volatile int running;
+};
+
+struct edge
+{
+    int64_t at;
+    int index;
+    int level;
+};
+
+// the running bank driving each gpio, if any
+static struct servo_bank *owners[SERVO_MAX_COUNT];
+static pthread_mutex_t claim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// sleep until the absolute CLOCK_MONOTONIC deadline, or until stopped
+static void sleep_until(struct servo_bank *b, int64_t deadline)
+{
+    struct timespec ts;
+    int64_t now = now_ns();
+
+    while (b->running && now < deadline)
+    {
+        if (deadline - now > MAX_SLEEP_NS)
+            deadline = now + MAX_SLEEP_NS;
+        ts.tv_sec = deadline / 1000000000LL;
+        ts.tv_nsec = deadline % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        now = now_ns();
+    }
+}
+
+// move every servo's pulse width one frame's worth towards its target.
+// called with the bank locked
+static void ramp(struct servo_bank *b)
+{
+    struct servo *s;
+    int64_t target, step;
+    int i;
+
+    for (i = 0; i < b->count; i++)
+    {
+        s = &b->servos[i];
+        target = (int64_t)s->target_us * 1000;
+        // from no pulses there's no known position to ramp from
+        if (target == 0 || s->position_ns == 0 || s->speed == SERVO_UNLIMITED)
+        {
+            s->position_ns = target;
+            continue;
+        }
+        step = (int64_t)s->speed * b->frame_ns / 1000000;
+        if (step < 1)
+            step = 1;
+        if (target > s->position_ns)
+            s->position_ns = (target - s->position_ns > step) ? s->position_ns + step : target;
+        else
+            s->position_ns = (s->position_ns - target > step) ? s->position_ns - step : target;
+    }
+}
+
+static void sort_edges(struct edge *edges, int n)
+{
+    struct edge e;
+    int i, j;
+
+    for (i = 1; i < n; i++)
+    {
+        e = edges[i];
+        for (j = i; j > 0 && edges[j - 1].at > e.at; j--)
+            edges[j] = edges[j - 1];
+        edges[j] = e;
+    }
+}
+
+void *servo_thread(void *arg)
+{
+    struct servo_bank *b = (struct servo_bank *)arg;
+    struct edge edges[2 * SERVO_MAX_COUNT];
+    uint32_t set[2], clr[2], mask;
+    int64_t frame_start = now_ns();
+    int64_t width;
+    int i, n, bank;
+
+    while (b->running)
+    {
+        pthread_mutex_lock(&b->lock);
+        ramp(b);
+        n = 0;
+        for (i = 0; i < b->count; i++)
+        {
+            if ((width = b->servos[i].position_ns) == 0)
+                continue;
+            edges[n].at = frame_start + b->servos[i].offset_ns;
+            edges[n].index = i;
+            edges[n++].level = 1;
+            edges[n].at = frame_start + b->servos[i].offset_ns + width;
+            edges[n].index = i;
+            edges[n++].level = 0;
+        }
+        pthread_mutex_unlock(&b->lock);
+        sort_edges(edges, n);
+
+        // write the edges due together in one store per bank, but never a
+        // pin's rise and fall in the same go
+        i = 0;
+        while (i < n && b->running)
+        {
+            sleep_until(b, edges[i].at);
+            set[0] = set[1] = clr[0] = clr[1] = 0;
+            for (; i < n && edges[i].at <= now_ns(); i++)
+            {
+                bank = GPIO_BANK(b->servos[edges[i].index].gpio);
+                mask = GPIO_MASK(b->servos[edges[i].index].gpio);
+                if ((set[bank] | clr[bank]) & mask)
+                    break;
+                if (edges[i].level)
+                    set[bank] |= mask;
+                else
+                    clr[bank] |= mask;
+            }
+            for (bank = 0; bank < 2; bank++)
+            {
+                if (set[bank] || clr[bank])
+                    output_gpio_bank(bank, set[bank], clr[bank]);
+            }
+        }
+
+        // if we've fallen more than a frame behind, start afresh rather than
+        // rushing through the missed ones
+        frame_start += b->frame_ns;
+        if (now_ns() - frame_start >= b->frame_ns)
+            frame_start = now_ns();
+        sleep_until(b, frame_start);
+    }
+    return NULL;
+}
+
+// a bank for count gpios with frames of frame_us, which must be longer than
+// the longest pulse. the pulses start spread evenly over the part of the
+// frame that leaves room for a whole pulse after them
+struct servo_bank *servo_bank_create(const unsigned int *gpios, int count, uint32_t frame_us)
+{
+    struct servo_bank *b;
+    int64_t spread;
+    int i;
+
+    if (count < 1 || count > SERVO_MAX_COUNT || frame_us <= SERVO_MAX_PULSE_US || frame_us > SERVO_MAX_FRAME_US)
+        return NULL;
+    if ((b = calloc(1, sizeof(struct servo_bank))) == NULL)
+        return NULL;
+
+    b->count = count;
+    b->frame_ns = (int64_t)frame_us * 1000;
+    spread = b->frame_ns - SERVO_MAX_PULSE_US * 1000LL;
+    for (i = 0; i < count; i++)
+    {
+        b->servos[i].gpio = gpios[i];
+        b->servos[i].offset_ns = spread * i / count;
+    }
+    pthread_mutex_init(&b->lock, NULL);
+    return b;
+}
+
+// claims the bank's gpios and starts its thread, run with rt or, if NULL, the
+// default real-time policy. returns 0 on success, -1 if
+// another bank is driving one of the gpios, -2 if the thread can't start
+int servo_bank_start(struct servo_bank *b, const struct rt_policy *rt)
+{
+    int i;
+
+    if (b->running)
+        return 0;
+
+    pthread_mutex_lock(&claim_lock);
+    for (i = 0; i < b->count; i++)
+    {
+        if (owners[b->servos[i].gpio] != NULL)
+        {
+            pthread_mutex_unlock(&claim_lock);
+            return -1;
+        }
+    }
+    b->running = 1;
+    if (rt_thread_create(&b->thread, servo_thread, (void *)b, rt) != 0)
+    {
+        b->running = 0;
+        pthread_mutex_unlock(&claim_lock);
+        return -2;
+    }
+    for (i = 0; i < b->count; i++)
+        owners[b->servos[i].gpio] = b;
+    pthread_mutex_unlock(&claim_lock);
+    return 0;
+}
+
+// stops the thread, drives the bank's pins low and releases them
+void servo_bank_stop(struct servo_bank *b)
+{
+    int i;
+
+    if (!b->running)
+        return;
+    b->running = 0;
+    pthread_join(b->thread, NULL);
+
+    pthread_mutex_lock(&claim_lock);
+    for (i = 0; i < b->count; i++)
+    {
+        output_gpio(b->servos[i].gpio, 0);
+        owners[b->servos[i].gpio] = NULL;
+    }
+    pthread_mutex_unlock(&claim_lock);
+
+    // a restarted bank has no known positions to ramp from
+    pthread_mutex_lock(&b->lock);
+    for (i = 0; i < b->count; i++)
+        b->servos[i].position_ns = 0;
+    pthread_mutex_unlock(&b->lock);
+}
+
+int servo_bank_running(struct servo_bank *b)
+{
+    return b->running;
+}
+
+// set every servo's target at once, so they all take them up in the same
+// frame. SERVO_UNCHANGED leaves a servo's target as it is
+void servo_bank_set_targets(struct servo_bank *b, const int32_t *targets_us)
+{
+    int i;
+
+    pthread_mutex_lock(&b->lock);
+    for (i = 0; i < b->count; i++)
+    {
+        if (targets_us[i] != SERVO_UNCHANGED)
+            b->servos[i].target_us = targets_us[i];
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+void servo_bank_set_speeds(struct servo_bank *b, const int32_t *speeds)
+{
+    int i;
+
+    pthread_mutex_lock(&b->lock);
+    for (i = 0; i < b->count; i++)
+    {
+        if (speeds[i] != SERVO_UNCHANGED)
+            b->servos[i].speed = speeds[i];
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+// any of the arrays may be NULL
+void servo_bank_get(struct servo_bank *b, int32_t *targets_us, int32_t *positions_us, int32_t *speeds)
+{
+    int i;
+
+    pthread_mutex_lock(&b->lock);
+    for (i = 0; i < b->count; i++)
+    {
+        if (targets_us)
+            targets_us[i] = b->servos[i].target_us;
+        if (positions_us)
+            positions_us[i] = (int32_t)((b->servos[i].position_ns + 500) / 1000);
+        if (speeds)
+            speeds[i] = b->servos[i].speed;
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+// returns 1 if a running bank is driving gpio, 0 otherwise
+int servo_exists(unsigned int gpio)
+{
+    int found;
+
+    pthread_mutex_lock(&claim_lock);
+    found = owners[gpio] != NULL;
+    pthread_mutex_unlock(&claim_lock);
+    return found;
+}
+
+// stops the bank driving gpio, if one is running
+void servo_stop_gpio(unsigned int gpio)
+{
+    struct servo_bank *b;
+
+    pthread_mutex_lock(&claim_lock);
+    b = owners[gpio];
+    pthread_mutex_unlock(&claim_lock);
+    if (b != NULL)
+        servo_bank_stop(b);
+}
+
+void servo_bank_free(struct servo_bank *b)
+{
+    servo_bank_stop(b);
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+}
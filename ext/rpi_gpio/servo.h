@@ -0,0 +1,58 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* RC servo pulses for a bank of pins, from one thread per bank. the pulses
+   start staggered across each frame, and each servo can ramp towards its
+   target at a limited speed */
+
+#ifndef SERVO_H
+#define SERVO_H
+
+#include <stdint.h>
+#include "c_gpio.h"
+#include "realtime.h"
+
+#define SERVO_MIN_PULSE_US     500
+#define SERVO_MAX_PULSE_US     2500
+#define SERVO_DEFAULT_FRAME_US 20000
+#define SERVO_MAX_FRAME_US     1000000
+#define SERVO_MAX_COUNT        54
+
+#define SERVO_OFF              0    // target: no pulses at all
+#define SERVO_UNCHANGED        -1   // target or speed: leave as it is
+#define SERVO_UNLIMITED        0    // speed: jump straight to the target
+
+struct servo_bank;
+
+struct servo_bank *servo_bank_create(const unsigned int *gpios, int count, uint32_t frame_us);
+int servo_bank_start(struct servo_bank *b, const struct rt_policy *rt);
+void servo_bank_stop(struct servo_bank *b);
+int servo_bank_running(struct servo_bank *b);
+void servo_bank_set_targets(struct servo_bank *b, const int32_t *targets_us);
+void servo_bank_set_speeds(struct servo_bank *b, const int32_t *speeds);
+void servo_bank_get(struct servo_bank *b, int32_t *targets_us, int32_t *positions_us, int32_t *speeds);
+int servo_exists(unsigned int gpio);
+void servo_stop_gpio(unsigned int gpio);
+void servo_bank_free(struct servo_bank *b);
+
+#endif /* SERVO_H */
@@ -0,0 +1,283 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sim_gpio.h"
+
+static volatile uint32_t *sim_map;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// choose the simulated board from RPI_GPIO_SIM_REVISION
+static int sim_board_info(rpi_info *info)
+{
+    const char *revision = getenv("RPI_GPIO_SIM_REVISION");
+
+    if (revision == NULL || *revision == '\0')
+        revision = SIM_DEFAULT_REVISION;
+    return decode_revision(revision, info);
+}
+
+// map an anonymous block, or RPI_GPIO_SIM_FILE if it is set, laid out like the
+// BCM GPIO registers
+static int sim_setup(void)
+{
+    const char *path = getenv("RPI_GPIO_SIM_FILE");
+    const rpi_info *info = get_board_info();
+    struct stat st;
+    int fd = -1;
+    int fresh = 1;
+
+    if (path != NULL && *path != '\0') {
+        if ((fd = open(path, O_RDWR|O_CREAT, 0644)) < 0)
+            return SETUP_DEVMEM_FAIL;
+        if (fstat(fd, &st) == 0 && st.st_size >= GPIO_BLOCK_SIZE)
+            fresh = 0;
+        else if (ftruncate(fd, GPIO_BLOCK_SIZE) != 0) {
+            close(fd);
+            return SETUP_DEVMEM_FAIL;
+        }
+        sim_map = (uint32_t *)mmap(NULL, GPIO_BLOCK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    } else {
+        sim_map = (uint32_t *)mmap(NULL, GPIO_BLOCK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    }
+    if (sim_map == MAP_FAILED) {
+        sim_map = NULL;
+        return SETUP_MMAP_FAIL;
+    }
+
+    // chips before the 2711 have no pull registers, and read back "gpio" there
+    if (fresh && (info == NULL || strcmp(info->processor, "BCM2711") != 0))
+        *(sim_map+PULLUPDN_OFFSET_2711_3) = PULLUPDN_LEGACY_MAGIC;
+    return SETUP_OK;
+}
+
+static void sim_cleanup(void)
+{
+    munmap((void *)sim_map, GPIO_BLOCK_SIZE);
+    sim_map = NULL;
+}
+
+static int sim_get_function(int gpio)
+{
+    return (*(sim_map+FSEL_OFFSET+gpio/10) >> ((gpio%10)*3)) & 7;
+}
+
+// work out the level of every pin in a bank the way the hardware would: an
+// output follows its latch, an input follows whatever drives it or else its
+// pull resistor, and a floating input keeps its last level. level changes
+// latch the enabled edge and level events. the event poller thread calls in
+// here too, so updates are serialized to latch each change only once
+static uint32_t sim_update_levels(int bank)
+{
+    uint32_t old_levels, levels, driven;
+    uint32_t outputs = 0;
+    uint32_t rising, falling;
+    int gpio;
+
+    pthread_mutex_lock(&sim_lock);
+    old_levels = levels = *(sim_map+PINLEVEL_OFFSET+bank);
+    driven = *(sim_map+SIM_DRIVE_MASK_OFFSET+bank);
+    for (gpio = bank * 32; gpio < bank * 32 + 32 && gpio < 54; gpio++) {
+        if (sim_get_function(gpio) == FSEL_OUTPUT)
+            outputs |= GPIO_MASK(gpio);
+    }
+
+    levels = (levels & ~outputs) | (*(sim_map+SIM_LATCH_OFFSET+bank) & outputs);
+    driven &= ~outputs;
+    levels = (levels & ~driven) | (*(sim_map+SIM_DRIVE_LEVEL_OFFSET+bank) & driven);
+    levels |= *(sim_map+SIM_PULL_UP_OFFSET+bank) & ~outputs & ~driven;
+    levels &= ~(*(sim_map+SIM_PULL_DOWN_OFFSET+bank) & ~outputs & ~driven);
+    *(sim_map+PINLEVEL_OFFSET+bank) = levels;
+
+    rising = levels & ~old_levels;
+    falling = ~levels & old_levels;
+    *(sim_map+EVENT_DETECT_OFFSET+bank) |=
+        (rising & *(sim_map+RISING_ED_OFFSET+bank)) |
+        (falling & *(sim_map+FALLING_ED_OFFSET+bank)) |
+        (levels & *(sim_map+HIGH_DETECT_OFFSET+bank)) |
+        (~levels & *(sim_map+LOW_DETECT_OFFSET+bank));
+    pthread_mutex_unlock(&sim_lock);
+    return levels;
+}
+
+static int sim_set_function(int gpio, int function)
+{
+    int offset = FSEL_OFFSET + (gpio/10);
+    int shift = (gpio%10)*3;
+
+    *(sim_map+offset) = (*(sim_map+offset) & ~(7<<shift)) | (function<<shift);
+    sim_update_levels(GPIO_BANK(gpio));
+    return 0;
+}
+
+static void sim_set_pullupdn(int gpio, int pud)
+{
+    int bank = GPIO_BANK(gpio);
+    uint32_t mask = GPIO_MASK(gpio);
+
+    *(sim_map+SIM_PULL_UP_OFFSET+bank) &= ~mask;
+    *(sim_map+SIM_PULL_DOWN_OFFSET+bank) &= ~mask;
+    if (pud == PUD_UP)
+        *(sim_map+SIM_PULL_UP_OFFSET+bank) |= mask;
+    else if (pud == PUD_DOWN)
+        *(sim_map+SIM_PULL_DOWN_OFFSET+bank) |= mask;
+    sim_update_levels(bank);
+}
+
+static int sim_setup_many(const struct gpio_plan *plan)
+{
+    uint32_t fsel;
+    int bank, gpio, reg;
+
+    for (gpio = 0; gpio < 54; gpio++) {
+        if (!(plan->mask[GPIO_BANK(gpio)] & GPIO_MASK(gpio)))
+            continue;
+        bank = GPIO_BANK(gpio);
+        *(sim_map+SIM_PULL_UP_OFFSET+bank) &= ~GPIO_MASK(gpio);
+        *(sim_map+SIM_PULL_DOWN_OFFSET+bank) &= ~GPIO_MASK(gpio);
+        if (plan->pud[gpio] == PUD_UP)
+            *(sim_map+SIM_PULL_UP_OFFSET+bank) |= GPIO_MASK(gpio);
+        else if (plan->pud[gpio] == PUD_DOWN)
+            *(sim_map+SIM_PULL_DOWN_OFFSET+bank) |= GPIO_MASK(gpio);
+    }
+    for (reg = 0; reg < 6; reg++) {
+        fsel = *(sim_map+FSEL_OFFSET+reg);
+        if (plan_fsel_word(plan, reg, fsel) != fsel)
+            *(sim_map+FSEL_OFFSET+reg) = plan_fsel_word(plan, reg, fsel);
+    }
+    for (bank = 0; bank < 2; bank++) {
+        if (plan->mask[bank])
+            sim_update_levels(bank);
+    }
+    return 0;
+}
+
+static void sim_output_bank(int bank, uint32_t set, uint32_t clr)
+{
+    if (set)
+        *(sim_map+SET_OFFSET+bank) = set;
+    if (clr)
+        *(sim_map+CLR_OFFSET+bank) = clr;
+    *(sim_map+SIM_LATCH_OFFSET+bank) = (*(sim_map+SIM_LATCH_OFFSET+bank) | set) & ~clr;
+    sim_update_levels(bank);
+}
+
+static uint32_t sim_input_bank(int bank)
+{
+    return sim_update_levels(bank);
+}
+
+static void sim_set_event(int type, int gpio, int enable)
+{
+    static const int offsets[] = {
+        RISING_ED_OFFSET, FALLING_ED_OFFSET, HIGH_DETECT_OFFSET, LOW_DETECT_OFFSET
+    };
+    int offset = offsets[type] + GPIO_BANK(gpio);
+
+    pthread_mutex_lock(&sim_lock);
+    if (enable)
+        *(sim_map+offset) |= GPIO_MASK(gpio);
+    else
+        *(sim_map+offset) &= ~GPIO_MASK(gpio);
+    *(sim_map+EVENT_DETECT_OFFSET+GPIO_BANK(gpio)) &= ~GPIO_MASK(gpio);
+    pthread_mutex_unlock(&sim_lock);
+}
+
+static uint32_t sim_event_status(int bank)
+{
+    sim_update_levels(bank);
+    return *(sim_map+EVENT_DETECT_OFFSET+bank);
+}
+
+static void sim_clear_events(int bank, uint32_t mask)
+{
+    pthread_mutex_lock(&sim_lock);
+    *(sim_map+EVENT_DETECT_OFFSET+bank) &= ~mask;
+    pthread_mutex_unlock(&sim_lock);
+}
+
+// writes to the simulated block don't reach any pins by themselves, so direct
+// register access is not offered
+static volatile uint32_t *sim_registers(void)
+{
+    return NULL;
+}
+
+// the other peripherals' registers live in the same block, so they can be
+// checked after the fact, or from another process through RPI_GPIO_SIM_FILE
+static volatile uint32_t *sim_peripheral(int which)
+{
+    static const int offsets[] = { SIM_PWM_OFFSET, SIM_CLOCK_OFFSET, SIM_PCM_OFFSET };
+
+    if (sim_map == NULL || which == PERIPHERAL_DMA)
+        return NULL;
+    return sim_map + offsets[which];
+}
+
+const struct gpio_backend sim_backend = {
+    "sim",
+    sim_board_info,
+    sim_setup,
+    sim_cleanup,
+    sim_set_function,
+    sim_get_function,
+    sim_set_pullupdn,
+    sim_setup_many,
+    sim_output_bank,
+    sim_input_bank,
+    sim_set_event,
+    sim_event_status,
+    sim_clear_events,
+    sim_registers,
+    sim_peripheral,
+};
+
+// act as an external circuit driving gpio high (1) or low (0), or stop
+// driving it (-1). returns -1 if the simulator isn't set up
+int sim_drive(int gpio, int level)
+{
+    int bank = GPIO_BANK(gpio);
+    uint32_t mask = GPIO_MASK(gpio);
+
+    if (sim_map == NULL)
+        return -1;
+
+    if (level < 0) {
+        *(sim_map+SIM_DRIVE_MASK_OFFSET+bank) &= ~mask;
+    } else {
+        if (level)
+            *(sim_map+SIM_DRIVE_LEVEL_OFFSET+bank) |= mask;
+        else
+            *(sim_map+SIM_DRIVE_LEVEL_OFFSET+bank) &= ~mask;
+        *(sim_map+SIM_DRIVE_MASK_OFFSET+bank) |= mask;
+    }
+    sim_update_levels(bank);
+    return 0;
+}
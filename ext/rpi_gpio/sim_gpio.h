@@ -0,0 +1,47 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Simulated GPIO register block, for running without a Raspberry Pi */
+
+#include "c_gpio.h"
+
+#define SIM_DEFAULT_REVISION "a02082"   // Pi 3 Model B
+
+// simulator state kept in the register block after the real registers, so
+// another process mapping the same RPI_GPIO_SIM_FILE can watch the outputs
+// and drive the inputs
+#define SIM_LATCH_OFFSET       512  // output latch, as last set by SET/CLR
+#define SIM_DRIVE_LEVEL_OFFSET 514  // level of externally driven pins
+#define SIM_DRIVE_MASK_OFFSET  516  // which pins are externally driven
+#define SIM_PULL_UP_OFFSET     518
+#define SIM_PULL_DOWN_OFFSET   520
+
+// the simulated PWM, PCM and clock manager registers, laid out as in their
+// own blocks but starting at these offsets. there are no DMA registers: the
+// simulator runs DMA programs itself (see dma.c)
+#define SIM_PWM_OFFSET         640
+#define SIM_PCM_OFFSET         704
+#define SIM_CLOCK_OFFSET       768
+
+extern const struct gpio_backend sim_backend;
+int sim_drive(int gpio, int level);
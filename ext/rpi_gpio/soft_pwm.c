@@ -25,97 +25,449 @@ SOFTWARE.
 */
 
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <time.h>
 #include "c_gpio.h"
 #include "soft_pwm.h"
-pthread_t threads;
+#include "realtime.h"
+
+// longest single sleep, so that channels started or stopped meanwhile are
+// picked up promptly
+#define MAX_SLEEP_NS 10000000LL
+// channels whose period is at most this long start on a multiple of their
+// period, so channels at the same frequency share their rising edges
+#define ALIGN_MAX_PERIOD_NS 100000000LL
+#define MAX_CHANNELS 54
+// bounds for the calibrated spin margin
+#define MIN_SPIN_MARGIN_NS 10000LL
+#define MAX_SPIN_MARGIN_NS 500000LL
+#define CALIBRATION_SLEEPS 50
+#define CALIBRATION_SLEEP_NS 100000LL
+
+// the timing a channel runs with for one whole period
+struct pwm_params
+{
+    int64_t period_ns;
+    int64_t on_ns;
+};
 
+// every running channel is driven by one scheduler thread, which keeps a
+// min-heap of the channels' next edges and writes all the edges due at the
+// same time with one SET and one CLR store per bank.
+//
+// parameters are double buffered: setters only write `pending`, and the
+// scheduler copies it into `active` at the start of a period, so a change
+// never shortens or stretches the period that is already underway
 struct pwm
 {
     unsigned int gpio;
     float freq;
     float dutycycle;
-    float basetime;
-    float slicetime;
-    struct timespec req_on, req_off;
+    struct pwm_params active;
+    struct pwm_params pending;
+    int pending_set;
     int running;
+    int high;               // the next edge is the falling one
+    int64_t period_start;
+    int64_t next_edge;
+    int timing;
+    int64_t spin_margin_ns; // 0 for the calibrated margin
+    int heap_index;
     struct pwm *next;
 };
 struct pwm *pwm_list = NULL;
 
-void remove_pwm(unsigned int gpio)
+// a channel's stats outlive its struct pwm, so they can still be read after
+// it stops. the scheduler updates them with pwm_lock held, which it holds
+// anyway while writing edges
+struct pwm_recorder
 {
-    struct pwm *p = pwm_list;
-    struct pwm *prev = NULL;
-    struct pwm *temp;
+    struct pwm_stats stats;
+    int64_t last_start;     // when the current period's first edge was written
+    int64_t high_since;     // when the pin went high, 0 while it is low
+    int64_t period_high_ns;
+};
+static struct pwm_recorder recorders[MAX_CHANNELS];
 
-    while (p != NULL)
+static pthread_mutex_t pwm_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pwm *heap[MAX_CHANNELS];
+static int heap_size;
+static pthread_t scheduler;
+static int scheduler_running;
+static struct pwm_scheduler_stats scheduler_stats;
+static int64_t calibrated_margin_ns;
+
+static inline int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline int64_t thread_cpu_ns(clockid_t clock)
+{
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) != 0)
+        return 0;
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#elif defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause");
+#endif
+}
+
+// how late clock_nanosleep wakes up here: the second worst of a run of short
+// sleeps, plus a quarter for safety. measured once, on first use, without
+// holding pwm_lock so that running channels aren't held up
+int64_t pwm_calibrated_spin_margin(void)
+{
+    struct timespec ts;
+    int64_t deadline, late, margin, worst = 0, second = 0;
+    int i;
+
+    pthread_mutex_lock(&pwm_lock);
+    margin = calibrated_margin_ns;
+    pthread_mutex_unlock(&pwm_lock);
+    if (margin != 0)
+        return margin;
+
+    for (i = 0; i < CALIBRATION_SLEEPS; i++)
     {
-        if (p->gpio == gpio)
+        deadline = now_ns() + CALIBRATION_SLEEP_NS;
+        ts.tv_sec = deadline / 1000000000LL;
+        ts.tv_nsec = deadline % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        late = now_ns() - deadline;
+        if (late > worst)
         {
-            if (prev == NULL) {
-                pwm_list = p->next;
-            } else {
-                prev->next = p->next;
-            }
-            temp = p;
-            p = p->next;
-            temp->running = 0; // signal the thread to stop. The thread will free() the pwm struct when it's done with it.
-        } else {
-            prev = p;
-            p = p->next;
+            second = worst;
+            worst = late;
         }
+        else if (late > second)
+        {
+            second = late;
+        }
+    }
+    margin = second + second / 4;
+    if (margin < MIN_SPIN_MARGIN_NS)
+        margin = MIN_SPIN_MARGIN_NS;
+    if (margin > MAX_SPIN_MARGIN_NS)
+        margin = MAX_SPIN_MARGIN_NS;
+
+    pthread_mutex_lock(&pwm_lock);
+    calibrated_margin_ns = margin;
+    pthread_mutex_unlock(&pwm_lock);
+    return margin;
+}
+
+// called with pwm_lock held: how long before p's next edge the scheduler
+// should stop sleeping and spin
+static int64_t spin_margin(struct pwm *p)
+{
+    if (p->timing != PWM_TIMING_HYBRID)
+        return 0;
+    return p->spin_margin_ns > 0 ? p->spin_margin_ns : calibrated_margin_ns;
+}
+
+static void heap_swap(int a, int b)
+{
+    struct pwm *tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+    heap[a]->heap_index = a;
+    heap[b]->heap_index = b;
+}
+
+static void heap_up(int i)
+{
+    while (i > 0 && heap[(i - 1) / 2]->next_edge > heap[i]->next_edge)
+    {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
     }
 }
 
-void calculate_times(struct pwm *p)
+static void heap_down(int i)
 {
-    long long usec;
+    int smallest, child;
 
-    usec = (long long)(p->dutycycle * p->slicetime * 1000.0);
-    p->req_on.tv_sec = (int)(usec / 1000000LL);
-    usec -= (long long)p->req_on.tv_sec * 1000000LL;
-    p->req_on.tv_nsec = (long)usec * 1000L;
+    for (;;)
+    {
+        smallest = i;
+        for (child = 2 * i + 1; child <= 2 * i + 2 && child < heap_size; child++)
+        {
+            if (heap[child]->next_edge < heap[smallest]->next_edge)
+                smallest = child;
+        }
+        if (smallest == i)
+            return;
+        heap_swap(i, smallest);
+        i = smallest;
+    }
+}
 
-    usec = (long long)((100.0-p->dutycycle) * p->slicetime * 1000.0);
-    p->req_off.tv_sec = (int)(usec / 1000000LL);
-    usec -= (long long)p->req_off.tv_sec * 1000000LL;
-    p->req_off.tv_nsec = (long)usec * 1000L;
+static void heap_push(struct pwm *p)
+{
+    p->heap_index = heap_size;
+    heap[heap_size++] = p;
+    heap_up(p->heap_index);
 }
 
-void full_sleep(struct timespec *req)
+static void heap_remove(struct pwm *p)
 {
-    struct timespec rem = {0};
+    int i = p->heap_index;
 
-    if (nanosleep(req,&rem) == -1)
-        full_sleep(&rem);
+    if (i < 0)
+        return;
+    p->heap_index = -1;
+    if (i == --heap_size)
+        return;
+    heap[i] = heap[heap_size];
+    heap[i]->heap_index = i;
+    heap_up(i);
+    heap_down(heap[i]->heap_index);
 }
 
-void *pwm_thread(void *threadarg)
+// the channel's edge at next_edge is being written now: add it to the store
+// masks and work out when its following edge is due
+static void advance(struct pwm *p, int64_t now, uint32_t *set, uint32_t *clr)
 {
-    struct pwm *p = (struct pwm *)threadarg;
+    int bank = GPIO_BANK(p->gpio);
+    uint32_t mask = GPIO_MASK(p->gpio);
 
-    while (p->running)
+    if (p->high)
+    {
+        clr[bank] |= mask;
+        p->high = 0;
+        p->next_edge = p->period_start + p->active.period_ns;
+        return;
+    }
+
+    // a new period: pick up any parameters published since the last one
+    if (p->pending_set)
+    {
+        p->active = p->pending;
+        p->pending_set = 0;
+    }
+
+    // if we've fallen more than a period behind, start afresh rather than
+    // rushing through the missed ones
+    p->period_start = p->next_edge;
+    if (now - p->period_start >= p->active.period_ns)
+        p->period_start = now;
+
+    if (p->active.on_ns <= 0)
+    {
+        clr[bank] |= mask;
+        p->next_edge = p->period_start + p->active.period_ns;
+    }
+    else if (p->active.on_ns >= p->active.period_ns)
     {
+        set[bank] |= mask;
+        p->next_edge = p->period_start + p->active.period_ns;
+    }
+    else
+    {
+        set[bank] |= mask;
+        p->high = 1;
+        p->next_edge = p->period_start + p->active.on_ns;
+    }
+}
+
+static int histogram_bucket(int64_t ns)
+{
+    int msb, bucket;
+
+    if (ns < (2 << PWM_HISTOGRAM_SUB_BITS))
+        return ns < 0 ? 0 : (int)ns;
+    msb = 63 - __builtin_clzll((uint64_t)ns);
+    bucket = (2 << PWM_HISTOGRAM_SUB_BITS) + (msb - PWM_HISTOGRAM_SUB_BITS - 1) * (1 << PWM_HISTOGRAM_SUB_BITS) +
+        (int)((ns >> (msb - PWM_HISTOGRAM_SUB_BITS)) & ((1 << PWM_HISTOGRAM_SUB_BITS) - 1));
+    return bucket < PWM_HISTOGRAM_BUCKETS ? bucket : PWM_HISTOGRAM_BUCKETS - 1;
+}
+
+// the largest latency counted in bucket
+int64_t pwm_histogram_bucket_max(int bucket)
+{
+    int msb, sub;
+
+    if (bucket < (2 << PWM_HISTOGRAM_SUB_BITS))
+        return bucket;
+    msb = (bucket - (2 << PWM_HISTOGRAM_SUB_BITS)) / (1 << PWM_HISTOGRAM_SUB_BITS) + PWM_HISTOGRAM_SUB_BITS + 1;
+    sub = (bucket - (2 << PWM_HISTOGRAM_SUB_BITS)) % (1 << PWM_HISTOGRAM_SUB_BITS);
+    return ((int64_t)((1 << PWM_HISTOGRAM_SUB_BITS) + sub + 1) << (msb - PWM_HISTOGRAM_SUB_BITS)) - 1;
+}
 
-        if (p->dutycycle > 0.0)
+// account for an edge of p's that was due at due and written at written,
+// leaving the pin high if high. starting is set for the first edge of a period
+static void record_edge(struct pwm *p, int64_t due, int64_t written, int starting, int high)
+{
+    struct pwm_recorder *r = &recorders[p->gpio];
+    int64_t latency = written - due;
+
+    r->stats.edges++;
+    r->stats.total_latency_ns += latency;
+    if (latency > r->stats.max_latency_ns)
+        r->stats.max_latency_ns = latency;
+    if (latency > PWM_LATE_NS)
+        r->stats.late++;
+    r->stats.histogram[histogram_bucket(latency)]++;
+
+    if (r->high_since && (starting || !high))
+    {
+        r->period_high_ns += written - r->high_since;
+        r->high_since = 0;
+    }
+    if (starting)
+    {
+        if (r->last_start)
         {
-            output_gpio(p->gpio, 1);
-            full_sleep(&p->req_on);
+            r->stats.periods++;
+            r->stats.total_period_ns += written - r->last_start;
+            r->stats.total_high_ns += r->period_high_ns;
         }
+        r->period_high_ns = 0;
+        r->last_start = written;
+    }
+    if (high && !r->high_since)
+        r->high_since = written;
+}
 
-        if (p->dutycycle < 100.0)
+void *pwm_scheduler(void *arg)
+{
+    struct pwm *due[MAX_CHANNELS];
+    int64_t due_at[MAX_CHANNELS];
+    int starting[MAX_CHANNELS];
+    struct timespec ts;
+    uint32_t set[2], clr[2];
+    int64_t now, wake, written, margin, spun;
+    unsigned int spin_gpio;
+    clockid_t cpu_clock;
+    int i, count, bank;
+
+    if (pthread_getcpuclockid(pthread_self(), &cpu_clock) != 0)
+        cpu_clock = CLOCK_THREAD_CPUTIME_ID;
+
+    pthread_mutex_lock(&pwm_lock);
+    while (heap_size > 0)
+    {
+        now = now_ns();
+        if (heap[0]->next_edge > now)
         {
-            output_gpio(p->gpio, 0);
-            full_sleep(&p->req_off);
+            wake = heap[0]->next_edge;
+            margin = spin_margin(heap[0]);
+
+            // close enough to a hybrid channel's edge: spin the rest of the
+            // way rather than trust the sleep to wake on time
+            if (margin > 0 && wake - now <= margin)
+            {
+                spin_gpio = heap[0]->gpio;
+                pthread_mutex_unlock(&pwm_lock);
+                while (now_ns() < wake)
+                    cpu_relax();
+                spun = now_ns() - now;
+                pthread_mutex_lock(&pwm_lock);
+                recorders[spin_gpio].stats.spin_ns += spun;
+                scheduler_stats.spin_ns += spun;
+                continue;
+            }
+
+            wake -= margin;
+            if (wake - now > MAX_SLEEP_NS)
+                wake = now + MAX_SLEEP_NS;
+            pthread_mutex_unlock(&pwm_lock);
+            ts.tv_sec = wake / 1000000000LL;
+            ts.tv_nsec = wake % 1000000000LL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            pthread_mutex_lock(&pwm_lock);
+            scheduler_stats.wakeups++;
+            continue;
+        }
+
+        // take every channel with an edge due, each for one edge only
+        count = 0;
+        while (heap_size > 0 && heap[0]->next_edge <= now)
+        {
+            due[count] = heap[0];
+            heap_remove(due[count]);
+            count++;
+        }
+
+        set[0] = set[1] = clr[0] = clr[1] = 0;
+        for (i = 0; i < count; i++)
+        {
+            due_at[i] = due[i]->next_edge;
+            starting[i] = !due[i]->high;
+            advance(due[i], now, set, clr);
+        }
+        for (bank = 0; bank < 2; bank++)
+        {
+            if (set[bank] || clr[bank])
+                output_gpio_bank(bank, set[bank], clr[bank]);
+        }
+        written = now_ns();
+        for (i = 0; i < count; i++)
+        {
+            record_edge(due[i], due_at[i], written, starting[i],
+                (set[GPIO_BANK(due[i]->gpio)] & GPIO_MASK(due[i]->gpio)) != 0);
+            heap_push(due[i]);
         }
     }
+    scheduler_stats.cpu_ns += thread_cpu_ns(cpu_clock);
+    scheduler_running = 0;
+    pthread_mutex_unlock(&pwm_lock);
+    return NULL;
+}
+
+// called with pwm_lock held; publishes freq and dutycycle for the scheduler
+// to take up at the channel's next period
+static void calculate_times(struct pwm *p)
+{
+    p->pending.period_ns = (int64_t)(1000000000.0 / p->freq);
+    p->pending.on_ns = (int64_t)(p->pending.period_ns * (p->dutycycle / 100.0));
+    p->pending_set = 1;
+    if (!p->running)
+    {
+        p->active = p->pending;
+        p->pending_set = 0;
+    }
+}
+
+void remove_pwm(unsigned int gpio)
+{
+    struct pwm *p = pwm_list;
+    struct pwm *prev = NULL;
+    struct pwm *temp;
 
-    // clean up
-    output_gpio(p->gpio, 0);
-    free(p);
-    pthread_exit(NULL);
+    while (p != NULL)
+    {
+        if (p->gpio == gpio)
+        {
+            if (prev == NULL) {
+                pwm_list = p->next;
+            } else {
+                prev->next = p->next;
+            }
+            temp = p;
+            p = p->next;
+            if (temp->running)
+            {
+                heap_remove(temp);
+                output_gpio(temp->gpio, 0);
+            }
+            free(temp);
+        } else {
+            prev = p;
+            p = p->next;
+        }
+    }
 }
 
 struct pwm *add_new_pwm(unsigned int gpio)
@@ -123,14 +475,18 @@ struct pwm *add_new_pwm(unsigned int gpio)
     struct pwm *new_pwm;
 
     new_pwm = malloc(sizeof(struct pwm));
+    memset(&recorders[gpio], 0, sizeof(recorders[gpio]));
     new_pwm->gpio = gpio;
     new_pwm->running = 0;
+    new_pwm->high = 0;
+    new_pwm->pending_set = 0;
+    new_pwm->timing = PWM_TIMING_SLEEP;
+    new_pwm->spin_margin_ns = 0;
+    new_pwm->heap_index = -1;
     new_pwm->next = NULL;
     // default to 1 kHz frequency, dutycycle 0.0
     new_pwm->freq = 1000.0;
     new_pwm->dutycycle = 0.0;
-    new_pwm->basetime = 1.0;    // 1 ms
-    new_pwm->slicetime = 0.01;  // 0.01 ms
     calculate_times(new_pwm);
     return new_pwm;
 }
@@ -170,66 +526,163 @@ void pwm_set_duty_cycle(unsigned int gpio, float dutycycle)
         return;
     }
 
+    pthread_mutex_lock(&pwm_lock);
     if ((p = find_pwm(gpio)) != NULL)
     {
         p->dutycycle = dutycycle;
         calculate_times(p);
     }
+    pthread_mutex_unlock(&pwm_lock);
 }
 
 void pwm_set_frequency(unsigned int gpio, float freq)
 {
     struct pwm *p;
 
-    if (freq <= 0.0) // to avoid divide by zero
+    if (freq <= 0.0 || 1e9 / freq < 1.0) // to avoid a period of 0
     {
         // btc fixme - error
         return;
     }
 
+    pthread_mutex_lock(&pwm_lock);
     if ((p = find_pwm(gpio)) != NULL)
     {
-        p->basetime = 1000.0 / freq;    // calculated in ms
-        p->slicetime = p->basetime / 100.0;
+        p->freq = freq;
         calculate_times(p);
     }
+    pthread_mutex_unlock(&pwm_lock);
+}
+
+// sets both parameters at once, so that the scheduler never runs a period
+// with the new value of one and the old value of the other
+void pwm_update(unsigned int gpio, float dutycycle, float freq)
+{
+    struct pwm *p;
+
+    if (dutycycle < 0.0 || dutycycle > 100.0 || freq <= 0.0 || 1e9 / freq < 1.0)
+    {
+        // btc fixme - error
+        return;
+    }
+
+    pthread_mutex_lock(&pwm_lock);
+    if ((p = find_pwm(gpio)) != NULL)
+    {
+        p->dutycycle = dutycycle;
+        p->freq = freq;
+        calculate_times(p);
+    }
+    pthread_mutex_unlock(&pwm_lock);
 }
 
 void pwm_start(unsigned int gpio)
 {
     struct pwm *p;
+    int64_t now = now_ns();
 
+    pthread_mutex_lock(&pwm_lock);
     if (((p = find_pwm(gpio)) == NULL) || p->running)
+    {
+        pthread_mutex_unlock(&pwm_lock);
         return;
+    }
 
+    memset(&recorders[gpio], 0, sizeof(recorders[gpio]));
+    p->high = 0;
+    p->next_edge = now;
+    if (p->active.period_ns > 0 && p->active.period_ns <= ALIGN_MAX_PERIOD_NS)
+        p->next_edge += p->active.period_ns - now % p->active.period_ns;
     p->running = 1;
-    if (pthread_create(&threads, NULL, pwm_thread, (void *)p) != 0)
+    heap_push(p);
+
+    if (!scheduler_running)
     {
-        // btc fixme - error
-        p->running = 0;
-        return;
+        if (rt_thread_create(&scheduler, pwm_scheduler, NULL, NULL) != 0)
+        {
+            // btc fixme - error
+            heap_remove(p);
+            p->running = 0;
+            pthread_mutex_unlock(&pwm_lock);
+            return;
+        }
+        pthread_detach(scheduler);
+        scheduler_running = 1;
     }
-    pthread_detach(threads);
+    pthread_mutex_unlock(&pwm_lock);
 }
 
 void pwm_stop(unsigned int gpio)
 {
+    pthread_mutex_lock(&pwm_lock);
     remove_pwm(gpio);
+    pthread_mutex_unlock(&pwm_lock);
 }
 
 // returns 1 if there is a PWM for this gpio, 0 otherwise
 int pwm_exists(unsigned int gpio)
 {
-    struct pwm *p = pwm_list;
+    struct pwm *p;
+    int found = 0;
 
+    pthread_mutex_lock(&pwm_lock);
+    p = pwm_list;
     while (p != NULL)
     {
         if (p->gpio == gpio)
         {
-            return 1;
+            found = 1;
+            break;
         } else {
             p = p->next;
         }
     }
-    return 0;
+    pthread_mutex_unlock(&pwm_lock);
+    return found;
+}
+
+void pwm_get_stats(unsigned int gpio, struct pwm_stats *stats)
+{
+    pthread_mutex_lock(&pwm_lock);
+    *stats = recorders[gpio].stats;
+    pthread_mutex_unlock(&pwm_lock);
+}
+
+// clears the stats without disturbing the running channel; achieved
+// frequency and duty cycle are measured afresh from its next period
+void pwm_reset_stats(unsigned int gpio)
+{
+    pthread_mutex_lock(&pwm_lock);
+    memset(&recorders[gpio].stats, 0, sizeof(recorders[gpio].stats));
+    recorders[gpio].last_start = 0;
+    recorders[gpio].period_high_ns = 0;
+    pthread_mutex_unlock(&pwm_lock);
+}
+
+// spin_margin_ns of 0 uses the calibrated margin
+void pwm_set_timing(unsigned int gpio, int timing, int64_t spin_margin_ns)
+{
+    struct pwm *p;
+
+    if (timing == PWM_TIMING_HYBRID && spin_margin_ns == 0)
+        pwm_calibrated_spin_margin();
+
+    pthread_mutex_lock(&pwm_lock);
+    if ((p = find_pwm(gpio)) != NULL)
+    {
+        p->timing = timing;
+        p->spin_margin_ns = spin_margin_ns;
+    }
+    pthread_mutex_unlock(&pwm_lock);
+}
+
+void pwm_get_scheduler_stats(struct pwm_scheduler_stats *stats)
+{
+    clockid_t cpu_clock;
+
+    pthread_mutex_lock(&pwm_lock);
+    *stats = scheduler_stats;
+    if (scheduler_running && pthread_getcpuclockid(scheduler, &cpu_clock) == 0)
+        stats->cpu_ns += thread_cpu_ns(cpu_clock);
+    pthread_mutex_unlock(&pwm_lock);
 }
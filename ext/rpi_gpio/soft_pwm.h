@@ -24,10 +24,60 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-/* Software PWM using threads */
- 
+/* Software PWM driven by a single scheduler thread */
+
+#ifndef SOFT_PWM_H
+#define SOFT_PWM_H
+
+#include <stdint.h>
+
+#define PWM_TIMING_SLEEP  0   // sleep right up to each edge
+#define PWM_TIMING_HYBRID 1   // sleep until a margin before it, then spin
+
+// edges written more than this long after they were due count as late
+#define PWM_LATE_NS 50000
+
+// edge latencies are kept in a log-linear histogram, as HdrHistogram does:
+// exact below 16 ns, then 8 buckets per power of two, so every bucket is
+// within 12.5% of the values it holds
+#define PWM_HISTOGRAM_SUB_BITS 3
+#define PWM_HISTOGRAM_BUCKETS  320
+
+// timing of the edges written for one channel since it started or its stats
+// were last reset; latencies are how long after its scheduled time each edge
+// was written
+struct pwm_stats
+{
+    uint64_t edges;
+    uint64_t late;
+    int64_t max_latency_ns;
+    int64_t total_latency_ns;
+    uint64_t periods;
+    int64_t total_period_ns;    // rising edge to rising edge, as written
+    int64_t total_high_ns;
+    int64_t spin_ns;            // CPU time spent spinning for this channel's edges
+    uint64_t histogram[PWM_HISTOGRAM_BUCKETS];
+};
+
+// CPU used by the scheduler thread, over every time it has run
+struct pwm_scheduler_stats
+{
+    int64_t cpu_ns;
+    int64_t spin_ns;
+    uint64_t wakeups;
+};
+
 void pwm_set_duty_cycle(unsigned int gpio, float dutycycle);
 void pwm_set_frequency(unsigned int gpio, float freq);
+void pwm_update(unsigned int gpio, float dutycycle, float freq);
 void pwm_start(unsigned int gpio);
 void pwm_stop(unsigned int gpio);
 int pwm_exists(unsigned int gpio);
+void pwm_get_stats(unsigned int gpio, struct pwm_stats *stats);
+void pwm_reset_stats(unsigned int gpio);
+int64_t pwm_histogram_bucket_max(int bucket);
+void pwm_set_timing(unsigned int gpio, int timing, int64_t spin_margin_ns);
+int64_t pwm_calibrated_spin_margin(void);
+void pwm_get_scheduler_stats(struct pwm_scheduler_stats *stats);
+
+#endif /* SOFT_PWM_H */
@@ -0,0 +1,377 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "waveform.h"
+#include "dma.h"
+#include "hard_pwm.h"
+
+// longest single sleep, so that a stop request is noticed promptly
+#define MAX_SLEEP_NS 100000000LL
+
+struct waveform_player
+{
+    struct waveform_step *steps;
+    size_t count;
+    long repeat;
+    pthread_t thread;
+    volatile int running;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+    int woken;
+    struct waveform_stats stats;
+    int64_t total_error_ns;
+    int use_dma;
+    struct dma_options dma;
+    struct dma_memory program;
+    uint32_t mask[2];       // gpios the steps drive
+    struct waveform_player *next;
+};
+
+// every player not yet freed, so that clean_up can stop the ones on its pins
+static struct waveform_player *players;
+static pthread_mutex_t players_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static inline struct timespec ns_to_timespec(int64_t ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    return ts;
+}
+
+static inline int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_to_ns(&ts);
+}
+
+// sleep until the absolute CLOCK_MONOTONIC deadline, or until stopped
+static void sleep_until(struct waveform_player *p, int64_t deadline)
+{
+    struct timespec ts;
+    int64_t now = now_ns();
+
+    while (p->running && now < deadline)
+    {
+        if (deadline - now > MAX_SLEEP_NS)
+            ts = ns_to_timespec(now + MAX_SLEEP_NS);
+        else
+            ts = ns_to_timespec(deadline);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        now = now_ns();
+    }
+}
+
+// timing errors of the steps played since they were last published, kept by
+// the player thread so that p->lock is only taken once per iteration
+struct error_tally
+{
+    uint64_t steps;
+    int64_t min_ns;
+    int64_t max_ns;
+    int64_t total_ns;
+};
+
+static inline void tally_error(struct error_tally *t, int64_t error)
+{
+    if (t->steps == 0 || error < t->min_ns)
+        t->min_ns = error;
+    if (t->steps == 0 || error > t->max_ns)
+        t->max_ns = error;
+    t->total_ns += error;
+    t->steps++;
+}
+
+static void publish_errors(struct waveform_player *p, struct error_tally *t, int iteration)
+{
+    pthread_mutex_lock(&p->lock);
+    if (t->steps > 0)
+    {
+        if (p->stats.steps == 0 || t->min_ns < p->stats.min_error_ns)
+            p->stats.min_error_ns = t->min_ns;
+        if (p->stats.steps == 0 || t->max_ns > p->stats.max_error_ns)
+            p->stats.max_error_ns = t->max_ns;
+        p->total_error_ns += t->total_ns;
+        p->stats.steps += t->steps;
+    }
+    if (iteration)
+        p->stats.iterations++;
+    pthread_mutex_unlock(&p->lock);
+    memset(t, 0, sizeof(*t));
+}
+
+void *waveform_thread(void *threadarg)
+{
+    struct waveform_player *p = (struct waveform_player *)threadarg;
+    const struct waveform_step *s;
+    struct error_tally tally = {0};
+    int64_t deadline = now_ns();
+    size_t i;
+    int bank;
+
+    while (p->running && (p->repeat == WAVEFORM_FOREVER || p->stats.iterations < (uint64_t)p->repeat))
+    {
+        for (i = 0; i < p->count && p->running; i++)
+        {
+            s = &p->steps[i];
+            sleep_until(p, deadline);
+            if (!p->running)
+                break;
+            for (bank = 0; bank < 2; bank++)
+                output_gpio_bank(bank, s->set[bank], s->clr[bank]);
+            tally_error(&tally, now_ns() - deadline);
+            deadline += s->delay_ns;
+        }
+        // a stopped, partial iteration still reports the steps it played
+        publish_errors(p, &tally, i == p->count);
+    }
+
+    // let the last step's delay run out before reporting completion
+    sleep_until(p, deadline);
+
+    pthread_mutex_lock(&p->lock);
+    p->running = 0;
+    p->done = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// the DMA engine plays the steps; this thread only starts it, waits, and gives
+// the engine back. its writes land exactly on the pacer's ticks, so no timing
+// error is recorded
+void *waveform_dma_thread(void *threadarg)
+{
+    struct waveform_player *p = (struct waveform_player *)threadarg;
+
+    dma_run(&p->program, &p->dma, &p->running, &p->stats.iterations);
+    dma_memory_free(&p->program);
+    dma_release();
+
+    pthread_mutex_lock(&p->lock);
+    p->use_dma = 0;
+    p->stats.steps = p->stats.iterations * p->count;
+    p->running = 0;
+    p->done = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static struct waveform_player *player_new(const struct waveform_step *steps, size_t count, long repeat)
+{
+    struct waveform_player *p;
+    size_t i;
+    int bank;
+
+    if ((p = calloc(1, sizeof(struct waveform_player))) == NULL)
+        return NULL;
+    if ((p->steps = malloc(count * sizeof(struct waveform_step))) == NULL)
+    {
+        free(p);
+        return NULL;
+    }
+    memcpy(p->steps, steps, count * sizeof(struct waveform_step));
+    p->count = count;
+    p->repeat = repeat;
+    p->running = 1;
+    for (i = 0; i < count; i++)
+    {
+        for (bank = 0; bank < 2; bank++)
+            p->mask[bank] |= steps[i].set[bank] | steps[i].clr[bank];
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+
+    pthread_mutex_lock(&players_lock);
+    p->next = players;
+    players = p;
+    pthread_mutex_unlock(&players_lock);
+    return p;
+}
+
+static void player_delete(struct waveform_player *p)
+{
+    struct waveform_player **link;
+
+    pthread_mutex_lock(&players_lock);
+    for (link = &players; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == p)
+        {
+            *link = p->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&players_lock);
+
+    if (p->use_dma)
+    {
+        dma_memory_free(&p->program);
+        dma_release();
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+    free(p->steps);
+    free(p);
+}
+
+// rt is the real-time policy for the playback thread, NULL for the default
+struct waveform_player *waveform_play(const struct waveform_step *steps, size_t count, long repeat,
+    const struct rt_policy *rt)
+{
+    struct waveform_player *p;
+
+    if ((p = player_new(steps, count, repeat)) == NULL)
+        return NULL;
+    if (rt_thread_create(&p->thread, waveform_thread, (void *)p, rt) != 0)
+    {
+        player_delete(p);
+        return NULL;
+    }
+    return p;
+}
+
+// compile the steps into a DMA program and start it. on failure returns NULL
+// with *error set to a DMA_* code, or to DMA_OK if the thread couldn't start
+struct waveform_player *waveform_play_dma(const struct waveform_step *steps, size_t count, long repeat,
+    const struct dma_options *opts, const struct rt_policy *rt, int *error)
+{
+    struct waveform_player *p;
+    size_t size;
+
+    *error = dma_check_options(opts);
+    if (*error != DMA_OK)
+        return NULL;
+    if ((size = dma_program_size(steps, count, repeat, opts)) == 0)
+    {
+        *error = DMA_TOO_LONG;
+        return NULL;
+    }
+    if ((opts->pacer == DMA_PACER_PWM && hard_pwm_active()) || dma_claim(opts->pacer) != 0)
+    {
+        *error = DMA_PACER_BUSY;
+        return NULL;
+    }
+    if ((p = player_new(steps, count, repeat)) == NULL)
+    {
+        dma_release();
+        *error = DMA_NO_MEMORY;
+        return NULL;
+    }
+    p->use_dma = 1;
+    p->dma = *opts;
+    if ((*error = dma_memory_alloc(&p->program, size)) != DMA_OK)
+    {
+        player_delete(p);
+        return NULL;
+    }
+    dma_compile(steps, count, repeat, opts, &p->program);
+
+    if (rt_thread_create(&p->thread, waveform_dma_thread, (void *)p, rt) != 0)
+    {
+        player_delete(p);
+        return NULL;
+    }
+    return p;
+}
+
+void waveform_stop(struct waveform_player *p)
+{
+    p->running = 0;
+}
+
+// stop every player that drives gpio, and wait until none of them can write
+// to it again
+void waveform_stop_gpio(unsigned int gpio)
+{
+    struct waveform_player *p;
+
+    pthread_mutex_lock(&players_lock);
+    for (p = players; p != NULL; p = p->next)
+    {
+        if (!(p->mask[gpio / 32] & GPIO_MASK(gpio)))
+            continue;
+        waveform_stop(p);
+        pthread_mutex_lock(&p->lock);
+        while (!p->done)
+            pthread_cond_wait(&p->cond, &p->lock);
+        pthread_mutex_unlock(&p->lock);
+    }
+    pthread_mutex_unlock(&players_lock);
+}
+
+// block until the waveform finishes or waveform_wake_waiters is called;
+// returns 1 if it finished
+int waveform_wait(struct waveform_player *p)
+{
+    int done;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->done && !p->woken)
+        pthread_cond_wait(&p->cond, &p->lock);
+    p->woken = 0;
+    done = p->done;
+    pthread_mutex_unlock(&p->lock);
+    return done;
+}
+
+void waveform_wake_waiters(struct waveform_player *p)
+{
+    pthread_mutex_lock(&p->lock);
+    p->woken = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+int waveform_running(struct waveform_player *p)
+{
+    return p->running;
+}
+
+void waveform_get_stats(struct waveform_player *p, struct waveform_stats *stats)
+{
+    pthread_mutex_lock(&p->lock);
+    *stats = p->stats;
+    stats->mean_error_ns = p->stats.steps ? (double)p->total_error_ns / p->stats.steps : 0.0;
+    pthread_mutex_unlock(&p->lock);
+}
+
+// stops the waveform if it is still playing and releases it
+void waveform_free(struct waveform_player *p)
+{
+    waveform_stop(p);
+    pthread_join(p->thread, NULL);
+    player_delete(p);
+}
@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2014-2020 Nick Lowery
+(github.com/clockvapor)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Precompiled multi-pin waveforms played back by a native thread */
+
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "c_gpio.h"
+#include "realtime.h"
+
+#define WAVEFORM_FOREVER -1
+
+struct waveform_step
+{
+    uint32_t set[2];
+    uint32_t clr[2];
+    uint64_t delay_ns;
+};
+
+struct waveform_stats
+{
+    uint64_t steps;
+    uint64_t iterations;
+    int64_t min_error_ns;
+    int64_t max_error_ns;
+    double mean_error_ns;
+};
+
+struct waveform_player;
+
+struct waveform_player *waveform_play(const struct waveform_step *steps, size_t count, long repeat,
+    const struct rt_policy *rt);
+struct dma_options;
+struct waveform_player *waveform_play_dma(const struct waveform_step *steps, size_t count, long repeat,
+    const struct dma_options *opts, const struct rt_policy *rt, int *error);
+void waveform_stop(struct waveform_player *p);
+void waveform_stop_gpio(unsigned int gpio);
+int waveform_wait(struct waveform_player *p);
+void waveform_wake_waiters(struct waveform_player *p);
+int waveform_running(struct waveform_player *p);
+void waveform_get_stats(struct waveform_player *p, struct waveform_stats *stats);
+void waveform_free(struct waveform_player *p);
+
+#endif /* WAVEFORM_H */
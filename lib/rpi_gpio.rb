@@ -1,17 +1,26 @@
 require 'rpi_gpio/rpi_gpio'
-require 'epoll'
+require_relative 'rpi_gpio/callback_executor'
+require_relative 'rpi_gpio/capture'
+require_relative 'rpi_gpio/counter'
 
 module RPi
   module GPIO
-    def self.watch(channel, on:, bounce_time: nil, &block) 
+    def self.watch(channel, on:, bounce_time: nil, queue_depth: nil, overflow: :drop, detect: :kernel, &block) 
       gpio = get_gpio_number(channel)
       ensure_gpio_input(gpio)
-      validate_edge(on)
+      validate_detect(detect)
+      validate_edge(on, detect)
       if bounce_time && bounce_time <= 0
         raise ArgumentError, "`bounce_time` must be greater than 0; given #{bounce_time}"
       end
-      add_edge_detect(gpio, on, bounce_time)
-      add_callback(gpio, &block)
+      if queue_depth && (!queue_depth.is_a?(Integer) || queue_depth <= 0)
+        raise ArgumentError, "`queue_depth` must be a positive integer; given #{queue_depth}"
+      end
+      unless CallbackExecutor::POLICIES.include?(overflow)
+        raise ArgumentError, "`overflow` must be :drop or :coalesce; given #{overflow.inspect}"
+      end
+      add_edge_detect(gpio, on, bounce_time, detect)
+      add_callback(gpio, queue_depth, overflow, &block)
     end
 
     def self.stop_watching(channel)
@@ -21,14 +30,44 @@ module RPi
       remove_callbacks(gpio)
     end
 
-    def self.wait_for_edge(channel, edge, bounce_time: nil, timeout: -1)
+    # number of threads that run watch callbacks; callbacks for one pin always
+    # run one at a time and in order
+    def self.set_callback_workers(count)
+      unless count.is_a?(Integer) && count > 0
+        raise ArgumentError, "`count` must be a positive integer; given #{count}"
+      end
+      @@executor.resize(count)
+    end
+
+    # queue and timing figures for a watched channel's callbacks, or nil
+    def self.callback_stats(channel)
+      @@executor.stats(get_gpio_number(channel))
+    end
+
+    # how often the event detect registers are checked for pins watched with
+    # `detect: :hardware`: :spin checks continuously, :sleep every `interval`
+    # microseconds, and :hybrid spins for `spin` microseconds after an event
+    # and sleeps otherwise
+    def self.set_event_polling(mode, interval: 100, spin: 1000)
+      modes = { :spin => 0, :hybrid => 1, :sleep => 2 }
+      unless modes.key?(mode)
+        raise ArgumentError, "`mode` must be :spin, :hybrid, or :sleep; given #{mode.inspect}"
+      end
+      if interval <= 0 || spin < 0
+        raise ArgumentError, "`interval` must be greater than 0 and `spin` must not be negative"
+      end
+      set_poll_mode(modes[mode], (interval * 1000).to_i, (spin * 1000).to_i)
+    end
+
+    def self.wait_for_edge(channel, edge, bounce_time: nil, timeout: -1, detect: :kernel)
       gpio = get_gpio_number(channel)
       if callback_exists(gpio)
         raise RuntimeError, "conflicting edge detection already enabled for GPIO #{gpio}"
       end
 
       ensure_gpio_input(gpio)
-      validate_edge(edge)
+      validate_detect(detect)
+      validate_edge(edge, detect)
       was_gpio_new = false
       current_edge = get_event_edge(gpio)
       if current_edge == edge
@@ -38,69 +77,69 @@ module RPi
         end
       elsif current_edge.nil?
         was_gpio_new = true
-        g = new_gpio(gpio)
-        set_edge(gpio, edge)
+        g = new_gpio(gpio, detect == :hardware)
+        set_edge(gpio, edge) unless g.hardware
         g.edge = edge
         g.bounce_time = bounce_time
       else
         g = get_gpio(gpio)
-        set_edge(gpio, edge)
+        set_edge(gpio, edge) unless g.hardware
         g.edge = edge
         g.bounce_time = bounce_time
-        g.initial_wait = 1
-      end
-
-      if @@epoll_blocking.nil?
-        @@epoll_blocking = Epoll.create
       end
-      @@epoll_blocking.add(g.value_file, Epoll::PRI)
 
-      initial_edge = true
-      the_value = nil
-      timed_out = false
+      waiter = add_waiter(gpio)
       begin
-        while the_value.nil? && !timed_out do
-          events = @@epoll_blocking.wait(timeout)
-          if events.empty?
-            timed_out = true
-          end
-          events.each do |event|
-            if event.events & Epoll::PRI != 0
-              event.data.seek(0, IO::SEEK_SET)
-              value = event.data.read.chomp.to_i
-              if event.data == g.value_file
-                if initial_edge # ignore first epoll trigger
-                  initial_edge = false
-                else
-                  now = Time.now.to_f
-                  if g.bounce_time.nil? || g.last_call == 0 || g.last_call > now ||
-                     (now - g.last_call) * 1000 > g.bounce_time then
-                    g.last_call = now
-                    the_value = value
-                  end
-                end
-              end
-            end
-          end
-        end
-
-        if the_value
-          return the_value
-        end
+        arm_gpio(g)
+        start_event_thread
+        wait_for_event(waiter, timeout)
       ensure
-        @@epoll_blocking.del(g.value_file)
+        event_unwatch(gpio)
+        remove_waiter(gpio)
         if was_gpio_new
+          set_line_edge(gpio, :none) if chardev? && !g.hardware
           delete_gpio(gpio)
         end
       end
     end
 
+    # waits for an edge on any of channels and returns [channel, level,
+    # timestamp], the timestamp in CLOCK_MONOTONIC nanoseconds, or nil once
+    # `timeout` milliseconds have passed. the channels stay registered after
+    # it returns, so edges in between calls are queued rather than lost and a
+    # loop calling it again does no setup; stop_watching or clean_up releases
+    # them
+    def self.wait_for_any_edge(channels, edge: :both, timeout: -1, bounce_time: nil, detect: :kernel)
+      gpios = Array(channels).map { |channel| get_gpio_number(channel) }
+      if gpios.empty?
+        raise ArgumentError, "`channels` must not be empty"
+      end
+
+      gpios.each { |gpio| add_waited_edge_detect(gpio, edge, bounce_time, detect) }
+      event = wait_any_event(gpios, timeout)
+      event && [channel_from_gpio(event[0]), event[1], event[2]]
+    end
+
+    # counts edges on channel in native code, without a Ruby call per edge,
+    # and returns a Counter to read the count and rate from. calling it again
+    # with the same settings returns a Counter over the same count; a counted
+    # channel can't be watched or waited on until stop_watching or clean_up
+    def self.counter(channel, edge: :both, bounce_time: nil, detect: :kernel)
+      gpio = get_gpio_number(channel)
+      add_counted_edge_detect(gpio, edge, bounce_time, detect)
+      Counter.new(channel, gpio, edge)
+    end
+
     private
-      @@callbacks = []
+      @@executor = CallbackExecutor.new
       @@gpios = []
-      @@epoll = nil
-      @@epoll_thread = nil
-      @@epoll_blocking = nil
+      @@event_thread = nil
+      @@waiters = {}
+      @@waiters_lock = Mutex.new
+
+      def self.chardev?
+        backend == :chardev
+      end
   
       def self.export(gpio)
         unless File.exist?("/sys/class/gpio/gpio#{gpio}")
@@ -133,6 +172,7 @@ module RPi
 
       def self.set_edge(gpio, edge)
         validate_edge(edge)
+        return set_line_edge(gpio, edge.to_sym) if chardev?
         tries = 0
         begin
           File.open("/sys/class/gpio/gpio#{gpio}/edge", 'w') do |file|
@@ -150,23 +190,25 @@ module RPi
         File.open("/sys/class/gpio/gpio#{gpio}/value", 'r')
       end
 
-      def self.new_gpio(gpio)
+      def self.new_gpio(gpio, hardware = false)
         g = GPIO.new
         g.gpio = gpio
-        export(gpio)
-        g.exported = true
-        set_direction(gpio, :in)
-        begin
-          g.value_file = open_value_file(gpio)
-        rescue
-          unexport(gpio)
-          raise
+        g.hardware = hardware
+        unless chardev? || hardware
+          export(gpio)
+          g.exported = true
+          set_direction(gpio, :in)
+          begin
+            g.value_file = open_value_file(gpio)
+          rescue
+            unexport(gpio)
+            raise
+          end
         end
-        g.initial_thread = true
-        g.initial_wait = true
         g.bounce_time = nil
-        g.last_call = 0
         g.thread_added = false
+        g.waited = false
+        g.counted = false
         @@gpios << g
         g
       end
@@ -179,10 +221,6 @@ module RPi
         @@gpios.find { |g| g.gpio == gpio }
       end
 
-      def self.get_gpio_by_value_file(value_file)
-        @@gpios.find { |g| g.value_file == value_file }
-      end
-
       def self.get_event_edge(gpio) # gpio_event_added in python library
         g = @@gpios.find { |g| g.gpio == gpio }
         if g
@@ -190,43 +228,116 @@ module RPi
         end
       end
 
-      def self.add_edge_detect(gpio, edge, bounce_time = nil)
+      def self.add_edge_detect(gpio, edge, bounce_time = nil, detect = :kernel)
         current_edge = get_event_edge(gpio)
         if current_edge.nil?
-          g = new_gpio(gpio)
-          set_edge(gpio, edge)
+          g = new_gpio(gpio, detect == :hardware)
+          set_edge(gpio, edge) unless g.hardware
           g.edge = edge
           g.bounce_time = bounce_time
         elsif current_edge == edge
           g = get_gpio(gpio)
-          if (bounce_time && g.bounce_time != bounce_time) || g.thread_added
+          if (bounce_time && g.bounce_time != bounce_time) || g.thread_added || g.waited || g.counted
             raise RuntimeError, "conflicting edge detection already enabled for GPIO #{gpio}"
           end
         else
           raise RuntimeError, "conflicting edge detection already enabled for GPIO #{gpio}"
         end
 
-        if @@epoll.nil?
-          @@epoll = Epoll.create
+        arm_gpio(g)
+        g.thread_added = true
+        start_event_thread
+      end
+
+      # registers gpio for wait_for_any_edge; a no-op once it is registered
+      # with the same settings
+      def self.add_waited_edge_detect(gpio, edge, bounce_time, detect)
+        g = get_gpio(gpio)
+        if g && g.waited && g.edge == edge && g.bounce_time == bounce_time && g.hardware == (detect == :hardware)
+          return
+        end
+        if g && !g.waited
+          raise RuntimeError, "conflicting edge detection already enabled for GPIO #{gpio}"
+        end
+
+        ensure_gpio_input(gpio)
+        validate_detect(detect)
+        validate_edge(edge, detect)
+        if bounce_time && bounce_time <= 0
+          raise ArgumentError, "`bounce_time` must be greater than 0; given #{bounce_time}"
         end
+        remove_edge_detect(gpio) if g
 
+        g = new_gpio(gpio, detect == :hardware)
         begin
-          @@epoll.add(g.value_file, Epoll::PRI)
+          set_edge(gpio, edge) unless g.hardware
+          g.edge = edge
+          g.bounce_time = bounce_time
+          g.waited = true
+          event_set_waited(gpio, true)
+          arm_gpio(g)
         rescue
           remove_edge_detect(gpio)
           raise
         end
+      end
 
-        g.thread_added = true
-        if @@epoll_thread.nil? || !@@epoll_thread.alive?
-          @@epoll_thread = Thread.new { poll_thread }
+      # registers gpio for counter; a no-op once it is registered with the
+      # same settings, so the count carries on
+      def self.add_counted_edge_detect(gpio, edge, bounce_time, detect)
+        g = get_gpio(gpio)
+        if g && g.counted && g.edge == edge && g.bounce_time == bounce_time && g.hardware == (detect == :hardware)
+          return
+        end
+        if g
+          raise RuntimeError, "conflicting edge detection already enabled for GPIO #{gpio}"
+        end
+
+        ensure_gpio_input(gpio)
+        validate_detect(detect)
+        validate_edge(edge)
+        if edge.to_s == 'none'
+          raise ArgumentError, "`edge` must be 'rising', 'falling', or 'both'; given 'none'"
+        end
+        if bounce_time && bounce_time <= 0
+          raise ArgumentError, "`bounce_time` must be greater than 0; given #{bounce_time}"
+        end
+
+        g = new_gpio(gpio, detect == :hardware)
+        begin
+          set_edge(gpio, edge) unless g.hardware
+          g.edge = edge
+          g.bounce_time = bounce_time
+          g.counted = true
+          event_set_counted(gpio, true)
+          arm_gpio(g)
+        rescue
+          remove_edge_detect(gpio)
+          raise
+        end
+      end
+
+      def self.arm_gpio(g)
+        if g.hardware
+          event_watch_hardware(g.gpio, g.edge, g.bounce_time)
+        else
+          event_watch(g.gpio, g.value_file && g.value_file.fileno, g.edge, g.bounce_time)
         end
       end
 
       def self.remove_edge_detect(gpio)
         g = get_gpio(gpio)
-        if g and @@epoll
-          @@epoll.del(g.value_file)
+        if g and g.hardware
+          event_unwatch(gpio)
+          g.edge = :none
+          delete_gpio(gpio)
+        elsif g and chardev?
+          event_unwatch(gpio)
+          set_line_edge(gpio, :none)
+          g.edge = :none
+          delete_gpio(gpio)
+        elsif g
+          event_unwatch(gpio)
           set_edge(gpio, :none)
           g.edge = :none
           g.value_file.close
@@ -235,31 +346,64 @@ module RPi
         end
       end
 
-      def self.poll_thread
+      # edges are read, debounced and timestamped by a native thread; this
+      # thread takes them in batches and hands them to callbacks or to a
+      # blocked wait_for_edge
+      def self.start_event_thread
+        if @@event_thread.nil? || !@@event_thread.alive?
+          @@event_thread = Thread.new { event_thread }
+        end
+      end
+
+      def self.event_thread
         loop do
-          begin
-            events = @@epoll.wait
-          rescue IOError # empty interest list
-            break
+          drain_events(-1).each do |gpio, value, timestamp|
+            g = get_gpio(gpio)
+            if g.nil?
+              next
+            elsif g.thread_added
+              run_callbacks(gpio, value, timestamp)
+            else
+              deliver_event(gpio, value)
+            end
+          end
+        end
+      end
+
+      def self.deliver_event(gpio, value)
+        @@waiters_lock.synchronize do
+          waiter = @@waiters[gpio]
+          if waiter && waiter[:value].nil?
+            waiter[:value] = value
+            waiter[:cond].broadcast
           end
-          events.each do |event|
-            if event.events & Epoll::PRI != 0
-              event.data.seek(0, IO::SEEK_SET)
-              g = get_gpio_by_value_file(event.data)
-              value = event.data.read.chomp.to_i
-              if g.initial_thread # ignore first epoll trigger
-                g.initial_thread = false
-              else
-                now = Time.now.to_f
-                if g.bounce_time.nil? || g.last_call == 0 || g.last_call > now ||
-                   (now - g.last_call) * 1000 > g.bounce_time then
-                  g.last_call = now
-                  run_callbacks(g.gpio, value)
-                end
-              end
+        end
+      end
+
+      def self.add_waiter(gpio)
+        waiter = { value: nil, cond: ConditionVariable.new }
+        @@waiters_lock.synchronize { @@waiters[gpio] = waiter }
+        waiter
+      end
+
+      def self.remove_waiter(gpio)
+        @@waiters_lock.synchronize { @@waiters.delete(gpio) }
+      end
+
+      def self.wait_for_event(waiter, timeout)
+        deadline = timeout >= 0 ? Process.clock_gettime(Process::CLOCK_MONOTONIC) + timeout / 1000.0 : nil
+        @@waiters_lock.synchronize do
+          while waiter[:value].nil?
+            if deadline
+              remaining = deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC)
+              break if remaining <= 0
+              waiter[:cond].wait(@@waiters_lock, remaining)
+            else
+              waiter[:cond].wait(@@waiters_lock)
             end
           end
         end
+        waiter[:value]
       end
 
       def self.event_cleanup(gpio)
@@ -269,8 +413,13 @@ module RPi
           end
         end
 
-        if @@gpios.empty? && @@epoll_thread
-          @@epoll_thread.terminate
+        if @@gpios.empty? && @@event_thread
+          @@event_thread.terminate
+          @@event_thread = nil
+          event_stop
+          @@executor.shutdown
+        elsif @@gpios.empty?
+          event_stop
         end
       end
 
@@ -278,24 +427,20 @@ module RPi
         event_cleanup(nil)
       end
 
-      def self.add_callback(gpio, &block)
-        @@callbacks << Callback.new(gpio, &block)
+      def self.add_callback(gpio, queue_depth = nil, overflow = :drop, &block)
+        @@executor.add(gpio, channel_from_gpio(gpio), queue_depth, overflow, &block)
       end
 
       def self.remove_callbacks(gpio)
-        @@callbacks.delete_if { |g| g.gpio == gpio }
+        @@executor.remove(gpio)
       end
 
       def self.callback_exists(gpio)
         @@gpios.find { |g| g.gpio == gpio } != nil
       end
 
-      def self.run_callbacks(gpio, value)
-        @@callbacks.each do |callback|
-          if callback.gpio == gpio
-            callback.block.call(channel_from_gpio(gpio), value)
-          end
-        end
+      def self.run_callbacks(gpio, value, timestamp = Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond))
+        @@executor.submit(gpio, value, timestamp)
       end
 
       def self.validate_direction(direction)
@@ -305,25 +450,27 @@ module RPi
         end
       end
 
-      def self.validate_edge(edge)
+      def self.validate_edge(edge, detect = :kernel)
         edge = edge.to_s
+        if detect == :hardware && (edge == 'high' || edge == 'low')
+          return
+        end
         if edge != 'rising' && edge != 'falling' && edge != 'both' && edge != 'none'
           raise ArgumentError, "`edge` must be 'rising', 'falling', 'both', or 'none'; given '#{edge}'"
         end
       end
 
-      class GPIO
-        attr_accessor :gpio, :exported, :value_file, :initial_thread, :initial_wait, :bounce_time, :last_call,
-          :thread_added, :edge
+      def self.validate_detect(detect)
+        if detect != :kernel && detect != :hardware
+          raise ArgumentError, "`detect` must be :kernel or :hardware; given #{detect.inspect}"
+        end
+        if detect == :hardware && chardev?
+          raise ArgumentError, "`detect: :hardware` needs the event detect registers, which the chardev backend doesn't map"
+        end
       end
 
-      class Callback
-        attr_accessor :gpio, :block
-
-        def initialize(gpio, &block)
-          @gpio = gpio
-          @block = block
-        end
+      class GPIO
+        attr_accessor :gpio, :exported, :value_file, :bounce_time, :thread_added, :edge, :hardware, :waited, :counted
       end
   end
 end
@@ -0,0 +1,206 @@
+module RPi
+  module GPIO
+    # Runs watch callbacks on a pool of worker threads. Each pin has its own
+    # queue of edges and is handed to at most one worker at a time, so a pin's
+    # callbacks see its edges in order while different pins run in parallel.
+    class CallbackExecutor
+      POLICIES = [:drop, :coalesce].freeze
+
+      def initialize(workers = 1)
+        @lock = Mutex.new
+        @pins = {}
+        @ready = Queue.new
+        @threads = []
+        @generation = 0
+        @size = workers
+      end
+
+      attr_reader :size
+
+      def resize(workers)
+        @lock.synchronize do
+          @size = workers
+          stop_threads
+        end
+      end
+
+      def add(gpio, channel, queue_depth, overflow, &block)
+        @lock.synchronize do
+          pin = (@pins[gpio] ||= Pin.new(gpio, channel))
+          pin.queue_depth = queue_depth
+          pin.overflow = overflow
+          pin.callbacks << Callback.new(gpio, &block)
+        end
+      end
+
+      def remove(gpio)
+        @lock.synchronize do
+          pin = @pins.delete(gpio)
+          pin.events.clear if pin
+        end
+      end
+
+      # queue an edge for gpio's callbacks; timestamp is in CLOCK_MONOTONIC
+      # nanoseconds
+      def submit(gpio, value, timestamp)
+        @lock.synchronize do
+          pin = @pins[gpio]
+          return if pin.nil?
+
+          pin.stats.events += 1
+          if pin.queue_depth && pin.events.size >= pin.queue_depth
+            if pin.overflow == :coalesce && !pin.events.empty?
+              pin.events[-1] = [value, timestamp]
+              pin.stats.coalesced += 1
+            else
+              pin.stats.dropped += 1
+            end
+            return
+          end
+
+          pin.events << [value, timestamp]
+          unless pin.scheduled
+            pin.scheduled = true
+            start_threads
+            @ready << pin
+          end
+        end
+      end
+
+      def stats(gpio)
+        @lock.synchronize do
+          pin = @pins[gpio]
+          pin && pin.stats.to_h.merge(
+            :queued => pin.events.size,
+            :callbacks => pin.callbacks.map { |callback| callback.stats.to_h })
+        end
+      end
+
+      def shutdown
+        @lock.synchronize do
+          @pins.each_value { |pin| pin.events.clear }
+          @pins.clear
+          stop_threads
+        end
+      end
+
+      private
+        def start_threads
+          @threads.select!(&:alive?)
+          while @threads.size < @size
+            @threads << Thread.new(@generation) { |generation| work(generation) }
+          end
+        end
+
+        # workers from before a resize or shutdown finish the pin they are
+        # running and exit; the nils only wake the idle ones. a worker of the
+        # current generation ignores them, so a stale nil can't stop it
+        def stop_threads
+          @generation += 1
+          @threads.size.times { @ready << nil }
+          @threads = []
+        end
+
+        def work(generation)
+          loop do
+            pin = @ready.pop
+            run(pin) if pin
+            break if @lock.synchronize { generation != @generation }
+          end
+        end
+
+        def run(pin)
+          value, timestamp = @lock.synchronize { pin.events.shift }
+          if timestamp
+            started = now
+            pin.stats.queue_time.add(started - timestamp)
+            pin.callbacks.each do |callback|
+              begin
+                callback.block.call(pin.channel, value)
+              rescue StandardError => e
+                warn "rpi_gpio: callback for GPIO #{pin.gpio} raised #{e.class}: #{e.message}"
+              end
+              finished = now
+              callback.stats.latency.add(finished - started)
+              started = finished
+            end
+          end
+
+          @lock.synchronize do
+            if pin.events.empty? || !@pins[pin.gpio].equal?(pin)
+              pin.scheduled = false
+            else
+              # this worker may be about to exit after a resize
+              start_threads
+              @ready << pin
+            end
+          end
+        end
+
+        def now
+          Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+        end
+
+      class Pin
+        attr_accessor :gpio, :channel, :callbacks, :events, :scheduled, :queue_depth, :overflow, :stats
+
+        def initialize(gpio, channel)
+          @gpio = gpio
+          @channel = channel
+          @callbacks = []
+          @events = []
+          @scheduled = false
+          @stats = PinStats.new(0, 0, 0, Timing.new)
+        end
+      end
+
+      class Callback
+        attr_accessor :gpio, :block, :stats
+
+        def initialize(gpio, &block)
+          @gpio = gpio
+          @block = block
+          @stats = CallbackStats.new(Timing.new)
+        end
+      end
+
+      PinStats = Struct.new(:events, :dropped, :coalesced, :queue_time) do
+        def to_h
+          { :events => events, :dropped => dropped, :coalesced => coalesced, :queue_time => queue_time.to_h }
+        end
+      end
+
+      CallbackStats = Struct.new(:latency) do
+        def to_h
+          { :calls => latency.count, :latency => latency.to_h }
+        end
+      end
+
+      # count, mean and max of a duration in nanoseconds
+      class Timing
+        attr_reader :count, :max
+
+        def initialize
+          @count = 0
+          @total = 0
+          @max = 0
+        end
+
+        def add(ns)
+          ns = 0 if ns < 0
+          @count += 1
+          @total += ns
+          @max = ns if ns > @max
+        end
+
+        def mean
+          @count.zero? ? 0 : @total / @count
+        end
+
+        def to_h
+          { :count => @count, :mean_ns => mean, :max_ns => @max }
+        end
+      end
+    end
+  end
+end
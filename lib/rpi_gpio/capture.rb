@@ -0,0 +1,61 @@
+module RPi
+  module GPIO
+    class Capture
+      include Enumerable
+
+      # writes the capture as a Value Change Dump, one wire per sampled GPIO,
+      # to io or to a file at path
+      def to_vcd(io_or_path)
+        if io_or_path.respond_to?(:write)
+          write_vcd(io_or_path)
+        else
+          File.open(io_or_path, 'w') { |file| write_vcd(file) }
+        end
+      end
+
+      private
+        VCD_FIRST_ID = 33 # '!'
+        VCD_CHUNK = 64 * 1024
+
+        def write_vcd(io)
+          gpios = (0...54).select { |gpio| mask[gpio] == 1 }
+          ids = {}
+          gpios.each_with_index { |gpio, i| ids[gpio] = (VCD_FIRST_ID + i).chr }
+
+          io.write "$date #{Time.now} $end\n"
+          io.write "$version rpi_gpio capture at #{rate} Hz $end\n"
+          io.write "$timescale 1ns $end\n"
+          io.write "$scope module gpio $end\n"
+          gpios.each { |gpio| io.write "$var wire 1 #{ids[gpio]} gpio#{gpio} $end\n" }
+          io.write "$upscope $end\n"
+          io.write "$enddefinitions $end\n"
+
+          out = String.new
+          previous = nil
+          last_time = 0
+          each do |time, levels|
+            if previous.nil?
+              out << "$dumpvars\n"
+              gpios.each { |gpio| out << "#{levels[gpio]}#{ids[gpio]}\n" }
+              out << "$end\n"
+            else
+              changed = levels ^ previous
+              out << "##{time}\n"
+              gpios.each do |gpio|
+                out << "#{levels[gpio]}#{ids[gpio]}\n" if changed[gpio] == 1
+              end
+            end
+            previous = levels
+            last_time = time
+            if out.bytesize > VCD_CHUNK
+              io.write out
+              out.clear
+            end
+          end
+          out << "##{duration}\n" if duration > last_time
+          io.write out
+          io
+        end
+    end
+  end
+end
@@ -0,0 +1,44 @@
+module RPi
+  module GPIO
+    # Reads the native edge count kept for a channel by RPi::GPIO.counter.
+    # Edges are counted by the event threads as they arrive, so sampling it is
+    # cheap and doesn't depend on how often Ruby gets to run.
+    class Counter
+      attr_reader :channel, :edge
+
+      def initialize(channel, gpio, edge)
+        @channel = channel
+        @gpio = gpio
+        @edge = edge
+      end
+
+      # edges counted since the counter started or was last reset
+      def count
+        RPi::GPIO.event_count(@gpio)
+      end
+
+      def reset
+        RPi::GPIO.event_count_reset(@gpio)
+        self
+      end
+
+      # edges per second over the last `window` seconds, or since the last
+      # reset if that is sooner. about 4 seconds of history are kept at high
+      # edge rates; a longer window gives the rate over the history there is
+      def rate(window: 1.0)
+        unless window.is_a?(Numeric) && window > 0
+          raise ArgumentError, "`window` must be greater than 0; given #{window.inspect}"
+        end
+        RPi::GPIO.event_count_rate(@gpio, (window * 1_000_000_000).to_i)
+      end
+
+      # stops counting; count and rate keep their last values until the
+      # channel is counted again
+      def stop
+        g = RPi::GPIO.get_gpio(@gpio)
+        RPi::GPIO.event_cleanup(@gpio) if g && g.counted
+        self
+      end
+    end
+  end
+end
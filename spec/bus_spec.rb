@@ -0,0 +1,131 @@
+require_relative "spec_helper"
+
+describe "RPi::GPIO::Bus" do
+  before :each do
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+    RPi::GPIO.set_warnings false
+  end
+
+  after :each do
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+  end
+
+  describe "#initialize" do
+    context "before numbering is set" do
+      it "raises an error" do
+        expect { RPi::GPIO::Bus.new([11, 12]) } .to raise_error RuntimeError
+      end
+    end
+
+    context "after numbering is set" do
+      before :each do
+        RPi::GPIO.set_numbering :board
+      end
+
+      context "given an invalid channel" do
+        it "raises an error" do
+          expect { RPi::GPIO::Bus.new([0, 11]) } .to raise_error ArgumentError
+        end
+      end
+
+      context "given a valid, unset channel" do
+        it "raises an error" do
+          expect { RPi::GPIO::Bus.new([11, 12]) } .to raise_error RuntimeError
+        end
+      end
+
+      context "given no channels" do
+        it "raises an error" do
+          expect { RPi::GPIO::Bus.new([]) } .to raise_error ArgumentError
+        end
+      end
+
+      context "given the same channel twice" do
+        before :each do
+          RPi::GPIO.setup 11, :as => :output
+        end
+
+        it "raises an error" do
+          expect { RPi::GPIO::Bus.new([11, 11]) } .to raise_error ArgumentError
+        end
+      end
+
+      context "given valid output channels" do
+        before :each do
+          RPi::GPIO.setup [11, 12, 13], :as => :output
+        end
+
+        let(:bus) { RPi::GPIO::Bus.new([11, 12, 13]) }
+
+        it "returns a Bus object" do
+          expect(bus).to be_a RPi::GPIO::Bus
+        end
+
+        it "has one bit per channel" do
+          expect(bus.width).to eq 3
+          expect(bus.channels).to eq [11, 12, 13]
+        end
+      end
+    end
+  end
+
+  describe "#write" do
+    before :each do
+      RPi::GPIO.set_numbering :board
+    end
+
+    context "given output channels" do
+      before :each do
+        RPi::GPIO.setup [11, 12, 13], :as => :output
+      end
+
+      let(:bus) { RPi::GPIO::Bus.new([11, 12, 13]) }
+
+      it "sets each channel from its bit of the value" do
+        bus.write 0b101
+        expect(RPi::GPIO.high? 11).to eq true
+        expect(RPi::GPIO.high? 12).to eq false
+        expect(RPi::GPIO.high? 13).to eq true
+        expect(bus.read).to eq 0b101
+      end
+
+      it "raises an error given a value wider than the bus" do
+        expect { bus.write 0b1000 } .to raise_error ArgumentError
+      end
+
+      it "raises an error given a negative value" do
+        expect { bus.write(-1) } .to raise_error ArgumentError
+      end
+    end
+
+    context "given an input channel" do
+      before :each do
+        RPi::GPIO.setup [11, 12], :as => :input
+      end
+
+      it "raises an error" do
+        expect { RPi::GPIO::Bus.new([11, 12]).write 1 } .to raise_error RuntimeError
+      end
+    end
+  end
+
+  describe "#write_all" do
+    before :each do
+      RPi::GPIO.set_numbering :board
+      RPi::GPIO.setup [11, 12, 13, 15, 16, 18, 22, 7, 29], :as => :output
+    end
+
+    let(:bus) { RPi::GPIO::Bus.new([11, 12, 13, 15, 16, 18, 22, 7, 29]) }
+
+    it "leaves the bus at the last word written" do
+      bus.write_all [1, 0x1ff, 0x0a5].pack("v*")
+      expect(bus.read).to eq 0x0a5
+    end
+
+    it "raises an error given a partial word" do
+      expect { bus.write_all "\x01\x02\x03" } .to raise_error ArgumentError
+    end
+  end
+end
@@ -0,0 +1,139 @@
+require_relative "spec_helper"
+
+describe RPi::GPIO::CallbackExecutor do
+  let(:executor) { RPi::GPIO::CallbackExecutor.new(2) }
+
+  after :each do
+    executor.shutdown
+  end
+
+  def now
+    Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+  end
+
+  def wait_until
+    200.times do
+      return if yield
+      sleep 0.01
+    end
+  end
+
+  it "runs a pin's callbacks in order" do
+    seen = []
+    executor.add(17, 11, nil, :drop) { |pin, value| seen << value }
+    10.times { |i| executor.submit(17, i, now) }
+    wait_until { seen.size == 10 }
+    expect(seen).to eq (0...10).to_a
+  end
+
+  it "passes the channel rather than the gpio" do
+    seen = nil
+    executor.add(17, 11, nil, :drop) { |pin, value| seen = pin }
+    executor.submit(17, 1, now)
+    wait_until { seen }
+    expect(seen).to eq 11
+  end
+
+  it "doesn't let a slow pin hold up another" do
+    release = Queue.new
+    fast = []
+    executor.add(17, 11, nil, :drop) { |pin, value| release.pop }
+    executor.add(27, 13, nil, :drop) { |pin, value| fast << value }
+    executor.submit(17, 1, now)
+    executor.submit(27, 1, now)
+    wait_until { fast.size == 1 }
+    expect(fast).to eq [1]
+    release << true
+  end
+
+  it "keeps serving a pin resized away from while its callback runs" do
+    seen = []
+    executor.add(17, 11, nil, :drop) do |pin, value|
+      sleep 0.05 if value == 1
+      seen << value
+    end
+    executor.submit(17, 1, now)
+    sleep 0.01
+    executor.submit(17, 2, now)
+    executor.resize(1)
+    wait_until { seen.size == 2 }
+    executor.submit(17, 3, now)
+    wait_until { seen.size == 3 }
+    expect(seen).to eq [1, 2, 3]
+  end
+
+  it "serves a pin added after shutdown while an old worker is busy" do
+    executor.resize(1)
+    release = Queue.new
+    seen = []
+    executor.add(17, 11, nil, :drop) { |pin, value| release.pop }
+    executor.submit(17, 1, now)
+    sleep 0.01
+    executor.shutdown
+    executor.add(27, 13, nil, :drop) { |pin, value| seen << value }
+    executor.submit(27, 1, now)
+    wait_until { seen.size == 1 }
+    expect(seen).to eq [1]
+    release << true
+    executor.submit(27, 2, now)
+    wait_until { seen.size == 2 }
+    expect(seen).to eq [1, 2]
+  end
+
+  context "when a pin's queue is full" do
+    before :each do
+      @release = Queue.new
+      @seen = []
+      executor.add(17, 11, 2, @policy) do |pin, value|
+        @release.pop
+        @seen << value
+      end
+    end
+
+    context "with :drop" do
+      before(:all) { @policy = :drop }
+
+      it "drops new edges" do
+        executor.submit(17, 0, now)
+        wait_until { executor.stats(17)[:queued] == 0 }
+        [1, 2, 3].each { |value| executor.submit(17, value, now) }
+        4.times { @release << true }
+        wait_until { @seen.size == 3 }
+        expect(@seen).to eq [0, 1, 2]
+        expect(executor.stats(17)[:dropped]).to eq 1
+      end
+    end
+
+    context "with :coalesce" do
+      before(:all) { @policy = :coalesce }
+
+      it "replaces the newest queued edge" do
+        executor.submit(17, 0, now)
+        wait_until { executor.stats(17)[:queued] == 0 }
+        [1, 2, 3].each { |value| executor.submit(17, value, now) }
+        4.times { @release << true }
+        wait_until { @seen.size == 3 }
+        expect(@seen).to eq [0, 1, 3]
+        expect(executor.stats(17)[:coalesced]).to eq 1
+      end
+    end
+  end
+
+  describe "#stats" do
+    it "reports queue time and callback latency" do
+      done = Queue.new
+      executor.add(17, 11, nil, :drop) { |pin, value| sleep 0.01; done << true }
+      executor.submit(17, 1, now)
+      done.pop
+      wait_until { executor.stats(17)[:callbacks][0][:calls] == 1 }
+      stats = executor.stats(17)
+      expect(stats[:events]).to eq 1
+      expect(stats[:queue_time][:count]).to eq 1
+      expect(stats[:callbacks][0][:latency][:max_ns]).to be >= 10_000_000
+    end
+
+    it "returns nil for a pin without callbacks" do
+      expect(executor.stats(5)).to eq nil
+    end
+  end
+end
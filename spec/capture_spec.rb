@@ -0,0 +1,129 @@
+require_relative "spec_helper"
+require "stringio"
+require "tmpdir"
+
+describe "RPi::GPIO::Capture" do
+  before :each do
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+    RPi::GPIO.set_warnings false
+  end
+
+  after :each do
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+  end
+
+  describe "#initialize" do
+    context "before numbering is set" do
+      it "raises an error when given channels" do
+        expect { RPi::GPIO::Capture.new :channels => [11] } .to raise_error RuntimeError
+      end
+    end
+
+    context "after numbering is set" do
+      before :each do
+        RPi::GPIO.set_numbering :bcm
+      end
+
+      it "samples every GPIO by default" do
+        expect(RPi::GPIO::Capture.new.mask).to eq (1 << 54) - 1
+      end
+
+      it "samples only the given channels" do
+        expect(RPi::GPIO::Capture.new(:channels => [17, 27]).mask).to eq (1 << 17) | (1 << 27)
+      end
+
+      it "rejects a rate of 0" do
+        expect { RPi::GPIO::Capture.new :rate => 0 } .to raise_error ArgumentError
+      end
+
+      it "rejects a rate faster than one sample a nanosecond" do
+        expect { RPi::GPIO::Capture.new :rate => 2_000_000_000 } .to raise_error ArgumentError
+        expect(RPi::GPIO::Capture.new(:rate => 1_000_000_000).rate).to eq 1_000_000_000
+      end
+
+      it "rejects a buffer too small for any records" do
+        expect { RPi::GPIO::Capture.new :size => 16 } .to raise_error ArgumentError
+      end
+    end
+  end
+
+  context "while RPi::GPIO cleans up" do
+    before :each do
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup 17, :as => :output
+      @capture = RPi::GPIO::Capture.new(:channels => [17], :rate => 10_000)
+      @capture.start
+    end
+
+    after :each do
+      @capture.stop
+    end
+
+    it "keeps sampling when one channel is cleaned up" do
+      RPi::GPIO.clean_up 17
+      expect(@capture.running?).to eq true
+    end
+
+    it "stops when every channel is cleaned up" do
+      RPi::GPIO.clean_up
+      expect(@capture.running?).to eq false
+    end
+  end
+
+  context "capturing output channels" do
+    before :each do
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup [17, 27], :as => :output, :initialize => :low
+      @capture = RPi::GPIO::Capture.new(:channels => [17, 27], :rate => 10_000)
+      @capture.start
+      sleep 0.01
+      RPi::GPIO.set_high 17
+      sleep 0.01
+      RPi::GPIO.set_high 27
+      sleep 0.01
+      RPi::GPIO.set_low [17, 27]
+      sleep 0.01
+      @capture.stop
+    end
+
+    it "records only the transitions" do
+      expect(@capture.size).to eq 3
+      expect(@capture.to_a.map { |time, levels| levels })
+        .to eq [0, 1 << 17, (1 << 17) | (1 << 27), 0]
+    end
+
+    it "orders the transitions in time" do
+      times = @capture.map { |time, levels| time }
+      expect(times).to eq times.sort
+      expect(@capture.duration).to be >= times.last
+    end
+
+    it "exports a Value Change Dump" do
+      vcd = @capture.to_vcd(StringIO.new).string
+      expect(vcd).to include "$var wire 1 ! gpio17 $end"
+      expect(vcd).to include "$var wire 1 \" gpio27 $end"
+      expect(vcd.scan(/^#\d+$/).size).to be >= 3
+    end
+
+    it "can be reloaded from a file" do
+      Dir.mktmpdir do |dir|
+        path = File.join(dir, "capture.bin")
+        capture = RPi::GPIO::Capture.new(:channels => [17], :rate => 10_000, :file => path)
+        capture.start
+        sleep 0.01
+        RPi::GPIO.set_high 17
+        sleep 0.01
+        capture.stop
+        expect(RPi::GPIO::Capture.open(path).to_a).to eq capture.to_a
+      end
+    end
+
+    if defined?(IO::Buffer)
+      it "exposes the stored capture as an IO::Buffer" do
+        expect(@capture.buffer.get_value(:u32, 0)).to eq 0x43475052
+      end
+    end
+  end
+end
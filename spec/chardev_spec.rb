@@ -0,0 +1,165 @@
+require_relative "spec_helper"
+require "json"
+require "rbconfig"
+
+# The character device backend against a gpio-sim chip. Making one needs
+# configfs, the gpio-sim module and root, so these are skipped without them.
+# The backend is picked when the extension loads, so each example runs its
+# script in a process of its own.
+describe "chardev backend" do
+  GPIO_SIM = "/sys/kernel/config/gpio-sim"
+  SIM_LINES = 32
+
+  before :all do
+    @sim = nil
+    if File.directory?(GPIO_SIM) && File.writable?(GPIO_SIM)
+      @config = File.join(GPIO_SIM, "rpi_gpio_spec_#{Process.pid}")
+      Dir.mkdir @config
+      Dir.mkdir File.join(@config, "bank0")
+      File.write File.join(@config, "bank0", "num_lines"), SIM_LINES.to_s
+      File.write File.join(@config, "live"), "1"
+      chip = File.read(File.join(@config, "bank0", "chip_name")).strip
+      device = File.read(File.join(@config, "dev_name")).strip
+      @sim = { :chip => "/dev/#{chip}", :lines => "/sys/devices/platform/#{device}/#{chip}" }
+    end
+  end
+
+  after :all do
+    if @config && File.directory?(@config)
+      File.write File.join(@config, "live"), "0"
+      Dir.rmdir File.join(@config, "bank0")
+      Dir.rmdir @config
+    end
+  end
+
+  before :each do
+    skip "needs gpio-sim (configfs, the gpio-sim module and root)" unless @sim
+  end
+
+  def env
+    { "RPI_GPIO_BACKEND" => "chardev", "RPI_GPIO_CHIP" => @sim[:chip],
+      "RPI_GPIO_SIM_REVISION" => "a02082" }
+  end
+
+  # drive(gpio, level) pulls a simulated line, as an external circuit would;
+  # level(gpio) reads what the chip is driving on it
+  def command(script)
+    lib = File.expand_path("../lib", __dir__)
+    prelude = <<~RUBY
+      require '#{lib}/rpi_gpio'
+      require 'json'
+      def drive(gpio, level)
+        File.write("#{@sim[:lines]}/sim_gpio\#{gpio}/pull", level == :high ? "pull-up" : "pull-down")
+        sleep 0.01
+      end
+      def level(gpio)
+        File.read("#{@sim[:lines]}/sim_gpio\#{gpio}/value").to_i
+      end
+      RPi::GPIO.set_warnings false
+      RPi::GPIO.set_numbering :bcm
+    RUBY
+    [RbConfig.ruby] + $LOAD_PATH.map { |dir| "-I#{dir}" } + ["-e", prelude + script]
+  end
+
+  # runs script with the chardev backend and returns what it printed as JSON
+  def chardev_process(script)
+    output = IO.popen(env, command(script), :err => [:child, :out], &:read)
+    JSON.parse(output.lines.last || "null")
+  end
+
+  it "sets up outputs and inputs on the chip's lines" do
+    result = chardev_process(<<~RUBY)
+      RPi::GPIO.setup 17, :as => :output, :initialize => :high
+      RPi::GPIO.setup 27, :as => :input
+      drive 27, :high
+      high = RPi::GPIO.high?(27)
+      drive 27, :low
+      print JSON.generate([level(17), high, RPi::GPIO.high?(27)])
+    RUBY
+    expect(result).to eq [1, true, false]
+  end
+
+  it "keeps driving the lines it holds when more are set up" do
+    result = chardev_process(<<~RUBY)
+      RPi::GPIO.setup 17, :as => :output, :initialize => :high
+      RPi::GPIO.setup [22, 23], :as => :output, :initialize => :low
+      RPi::GPIO.setup 24, :as => :input, :pull => :up
+      print JSON.generate([level(17), level(22), level(23)])
+    RUBY
+    expect(result).to eq [1, 0, 0]
+  end
+
+  it "writes and reads many lines at once" do
+    result = chardev_process(<<~RUBY)
+      RPi::GPIO.setup [5, 6, 13], :as => :output, :initialize => :low
+      RPi::GPIO.setup [19, 26], :as => :input
+      RPi::GPIO.batch do
+        RPi::GPIO.set_high 5
+        RPi::GPIO.set_high 13
+      end
+      drive 19, :high
+      drive 26, :low
+      print JSON.generate([[5, 6, 13].map { |gpio| level(gpio) }, RPi::GPIO.read_many([19, 26])])
+    RUBY
+    expect(result).to eq [[1, 0, 1], [true, false]]
+  end
+
+  it "reports edges with kernel timestamps and sequence numbers" do
+    result = chardev_process(<<~RUBY)
+      RPi::GPIO.setup 22, :as => :input, :pull => :down
+      RPi::GPIO.set_line_edge 22, :both
+      RPi::GPIO.event_watch 22, nil, :both, nil
+      started = Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+      3.times { drive 22, :high; drive 22, :low }
+      events = []
+      deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + 2
+      while events.size < 6 && Process.clock_gettime(Process::CLOCK_MONOTONIC) < deadline
+        events.concat RPi::GPIO.drain_events(100)
+      end
+      print JSON.generate([started, events])
+    RUBY
+    started, events = result
+    expect(events.map { |event| event[0] }.uniq).to eq [22]
+    expect(events.map { |event| event[1] }).to eq [1, 0, 1, 0, 1, 0]
+    expect(events.map { |event| event[3] }).to eq [1, 2, 3, 4, 5, 6]
+    timestamps = events.map { |event| event[2] }
+    expect(timestamps.first).to be > started
+    expect(timestamps).to eq timestamps.sort
+  end
+
+  it "raises when another process holds the line" do
+    holder = IO.popen(env, command(<<~RUBY), "r")
+      RPi::GPIO.setup 17, :as => :output
+      puts "ready"
+      $stdout.flush
+      sleep 10
+    RUBY
+    begin
+      expect(holder.gets).to eq "ready\n"
+      result = chardev_process(<<~RUBY)
+        begin
+          RPi::GPIO.setup 17, :as => :output
+          print JSON.generate("ok")
+        rescue SystemCallError => e
+          print JSON.generate(e.class.name)
+        end
+      RUBY
+      expect(result).to eq "Errno::EBUSY"
+    ensure
+      Process.kill("TERM", holder.pid)
+      holder.close
+    end
+  end
+
+  it "raises for a line the chip doesn't have" do
+    result = chardev_process(<<~RUBY)
+      begin
+        RPi::GPIO.setup #{SIM_LINES + 1}, :as => :input
+        print JSON.generate("ok")
+      rescue SystemCallError => e
+        print JSON.generate(e.class.name)
+      end
+    RUBY
+    expect(result).to eq "Errno::EINVAL"
+  end
+end
@@ -1,4 +1,5 @@
 require "spec_helper"
+require "etc"
 
 describe RPi::GPIO do
   before :each do
@@ -408,6 +409,102 @@ describe RPi::GPIO do
     end
   end
 
+  describe "batch" do
+    context "before numbering is set" do
+      it "raises an error" do
+        expect { RPi::GPIO.batch { RPi::GPIO.set_high 18 } } .to raise_error RuntimeError
+      end
+    end
+
+    context "after numbering is set" do
+      before :each do
+        RPi::GPIO.set_numbering :board
+      end
+
+      context "given no block" do
+        it "raises an error" do
+          expect { RPi::GPIO.batch } .to raise_error LocalJumpError
+        end
+      end
+
+      context "given valid output channels" do
+        before :each do
+          RPi::GPIO.setup [18, 19], :as => :output, :initialize => :low
+        end
+
+        it "returns the block's value" do
+          expect(RPi::GPIO.batch { 42 }).to eq 42
+        end
+
+        it "doesn't write anything until the block ends" do
+          RPi::GPIO.batch do
+            RPi::GPIO.set_high [18, 19]
+            expect(RPi::GPIO.high? 18).to eq false
+          end
+          expect(RPi::GPIO.high? 18).to eq true
+          expect(RPi::GPIO.high? 19).to eq true
+        end
+
+        it "uses the last level written to each channel" do
+          RPi::GPIO.batch do
+            RPi::GPIO.set_high 18
+            RPi::GPIO.set_low 18
+            RPi::GPIO.set_low 19
+            RPi::GPIO.set_high 19
+          end
+          expect(RPi::GPIO.high? 18).to eq false
+          expect(RPi::GPIO.high? 19).to eq true
+        end
+
+        it "writes nothing if the block raises an error" do
+          expect {
+            RPi::GPIO.batch do
+              RPi::GPIO.set_high 18
+              raise "oops"
+            end
+          } .to raise_error RuntimeError
+          expect(RPi::GPIO.high? 18).to eq false
+        end
+
+        it "drops only a nested block's writes when it raises" do
+          RPi::GPIO.batch do
+            RPi::GPIO.set_high 18
+            begin
+              RPi::GPIO.batch do
+                RPi::GPIO.set_high 19
+                RPi::GPIO.set_low 18
+                raise "oops"
+              end
+            rescue RuntimeError
+            end
+          end
+          expect(RPi::GPIO.high? 18).to eq true
+          expect(RPi::GPIO.high? 19).to eq false
+        end
+
+        it "doesn't hold back writes from other threads" do
+          RPi::GPIO.batch do
+            Thread.new { RPi::GPIO.set_high 19 }.join
+            expect(RPi::GPIO.high? 19).to eq true
+            RPi::GPIO.set_high 18
+            expect(RPi::GPIO.high? 18).to eq false
+          end
+          expect(RPi::GPIO.high? 18).to eq true
+        end
+      end
+
+      context "given a valid input channel" do
+        before :each do
+          RPi::GPIO.setup 18, :as => :input
+        end
+
+        it "raises an error" do
+          expect { RPi::GPIO.batch { RPi::GPIO.set_high 18 } } .to raise_error RuntimeError
+        end
+      end
+    end
+  end
+
   describe "high?" do
     context "before numbering is set" do
       it "raises an error" do
@@ -500,6 +597,81 @@ describe RPi::GPIO do
     end
   end
 
+  describe "read_all" do
+    context "before numbering is set" do
+      it "raises an error" do
+        expect { RPi::GPIO.read_all } .to raise_error RuntimeError
+      end
+    end
+
+    context "after numbering is set" do
+      before :each do
+        RPi::GPIO.set_numbering :board
+        RPi::GPIO.setup 18, :as => :output, :initialize => :high
+      end
+
+      it "returns an Integer with a bit per channel" do
+        expect(RPi::GPIO.read_all).to be_a Integer
+        expect(RPi::GPIO.read_all[18]).to eq 1
+        RPi::GPIO.set_low 18
+        expect(RPi::GPIO.read_all[18]).to eq 0
+      end
+
+      it "returns a Hash of channels given :as => :hash" do
+        levels = RPi::GPIO.read_all :as => :hash
+        expect(levels[18]).to eq true
+        expect(levels).to_not have_key 0
+      end
+
+      it "raises an error given an invalid result type" do
+        expect { RPi::GPIO.read_all :as => :nope } .to raise_error ArgumentError
+      end
+    end
+  end
+
+  describe "read_many" do
+    before :each do
+      RPi::GPIO.set_numbering :board
+    end
+
+    context "given valid channels" do
+      before :each do
+        RPi::GPIO.setup 18, :as => :output, :initialize => :high
+        RPi::GPIO.setup 19, :as => :output, :initialize => :low
+      end
+
+      it "returns each channel's level in order" do
+        expect(RPi::GPIO.read_many [18, 19, 18]).to eq [true, false, true]
+      end
+    end
+
+    context "given a valid, unset channel" do
+      it "raises an error" do
+        expect { RPi::GPIO.read_many [18] } .to raise_error RuntimeError
+      end
+    end
+
+    context "given an invalid channel" do
+      it "raises an error" do
+        expect { RPi::GPIO.read_many [0] } .to raise_error ArgumentError
+      end
+    end
+  end
+
+  describe "changes_since" do
+    before :each do
+      RPi::GPIO.set_numbering :board
+      RPi::GPIO.setup 18, :as => :output, :initialize => :low
+    end
+
+    it "returns a mask of the channels that changed" do
+      snapshot = RPi::GPIO.read_all
+      expect(RPi::GPIO.changes_since(snapshot)[18]).to eq 0
+      RPi::GPIO.set_high 18
+      expect(RPi::GPIO.changes_since(snapshot)[18]).to eq 1
+    end
+  end
+
   describe "watch" do
     context "before numbering is set" do
       it "raises an error" do
@@ -708,4 +880,65 @@ describe RPi::GPIO do
       end
     end
   end
+
+  describe "drain_events" do
+    it "returns an empty batch on timeout" do
+      expect(RPi::GPIO.drain_events(10)).to eq []
+    end
+  end
+
+  describe "event_overflows" do
+    it "returns a count" do
+      expect(RPi::GPIO.event_overflows).to be_a Integer
+    end
+  end
+
+  describe "realtime" do
+    after :each do
+      RPi::GPIO.realtime :priority => 0
+    end
+
+    it "reports the current setting" do
+      report = RPi::GPIO.realtime
+      expect(report[:policy]).to eq :other
+      expect(report[:priority]).to eq 0
+      expect(report[:errors]).to be_a Hash
+    end
+
+    it "applies a policy or reports why it couldn't" do
+      report = RPi::GPIO.realtime :priority => 10, :policy => :rr, :cpus => [0]
+      expect(report[:policy]).to eq :rr
+      expect(report[:cpus]).to eq [0]
+      expect(report[:errors].keys - [:policy, :cpus]).to eq []
+    end
+
+    it "reaches threads that are already running" do
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup 17, :as => :output
+      waveform = RPi::GPIO::Waveform.new.step(:high => 17, :delay => 1_000_000)
+      waveform.play :forever
+      report = RPi::GPIO.realtime :priority => 10
+      waveform.stop
+      waveform.wait
+      expect(report[:threads]).to be >= 1
+      expect(report[:realtime_threads]).to eq(report[:errors].key?(:policy) ? 0 : report[:threads])
+    end
+
+    it "lets an object override the setting" do
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup 17, :as => :output
+      capture = RPi::GPIO::Capture.new(:channels => [17], :realtime => { :priority => 5 })
+      capture.start
+      report = RPi::GPIO.realtime
+      capture.stop
+      expect(report[:realtime_threads]).to eq(report[:errors].key?(:policy) ? 0 : 1)
+    end
+
+    it "raises an error given an invalid setting" do
+      expect { RPi::GPIO.realtime :priority => 100 } .to raise_error ArgumentError
+      expect { RPi::GPIO.realtime :priority => 10, :policy => :batch } .to raise_error ArgumentError
+      expect { RPi::GPIO.realtime :policy => :fifo } .to raise_error ArgumentError
+      expect { RPi::GPIO.realtime :cpus => [Etc.nprocessors] } .to raise_error ArgumentError
+    end
+  end
 end
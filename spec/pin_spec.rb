@@ -0,0 +1,123 @@
+require_relative "spec_helper"
+
+describe "RPi::GPIO::Pin" do
+  before :each do
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+    RPi::GPIO.set_warnings false
+  end
+
+  after :each do
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+  end
+
+  describe "#initialize" do
+    context "before numbering is set" do
+      it "raises an error" do
+        expect { RPi::GPIO::Pin.new(18) } .to raise_error RuntimeError
+      end
+    end
+
+    context "after numbering is set" do
+      before :each do
+        RPi::GPIO.set_numbering :board
+      end
+
+      context "given an invalid channel" do
+        it "raises an error" do
+          expect { RPi::GPIO::Pin.new(0) } .to raise_error ArgumentError
+        end
+      end
+
+      context "given a valid, unset channel" do
+        it "raises an error" do
+          expect { RPi::GPIO::Pin.new(18) } .to raise_error RuntimeError
+        end
+      end
+
+      context "given a valid output channel" do
+        before :each do
+          RPi::GPIO.setup 18, :as => :output
+        end
+
+        it "returns a Pin object" do
+          expect(RPi::GPIO::Pin.new(18)).to be_a RPi::GPIO::Pin
+        end
+      end
+    end
+  end
+
+  describe "#gpio" do
+    before :each do
+      RPi::GPIO.set_numbering :board
+      RPi::GPIO.setup 18, :as => :output
+    end
+
+    # pin number is 18, but GPIO number is 24
+    it "gives the associated GPIO number" do
+      expect(RPi::GPIO::Pin.new(18).gpio).to eq 24
+    end
+
+    it "gives the channel it was created with" do
+      expect(RPi::GPIO::Pin.new(18).channel).to eq 18
+    end
+  end
+
+  describe "#high! and #low!" do
+    before :each do
+      RPi::GPIO.set_numbering :board
+    end
+
+    context "given an output channel" do
+      before :each do
+        RPi::GPIO.setup 18, :as => :output
+      end
+
+      let(:pin) { RPi::GPIO::Pin.new(18) }
+
+      it "doesn't raise an error" do
+        expect { pin.high! } .to_not raise_error
+        expect { pin.low! } .to_not raise_error
+      end
+
+      context "after the channel is cleaned up" do
+        before :each do
+          pin
+          RPi::GPIO.clean_up 18
+        end
+
+        it "raises an error" do
+          expect { pin.high! } .to raise_error RuntimeError
+        end
+      end
+    end
+
+    context "given an input channel" do
+      before :each do
+        RPi::GPIO.setup 18, :as => :input
+      end
+
+      let(:pin) { RPi::GPIO::Pin.new(18) }
+
+      it "raises an error" do
+        expect { pin.high! } .to raise_error RuntimeError
+        expect { pin.low! } .to raise_error RuntimeError
+      end
+    end
+  end
+
+  describe "#high? and #low?" do
+    before :each do
+      RPi::GPIO.set_numbering :board
+      RPi::GPIO.setup 18, :as => :input
+    end
+
+    let(:pin) { RPi::GPIO::Pin.new(18) }
+
+    it "agrees with RPi::GPIO.high?" do
+      expect(pin.high?).to eq RPi::GPIO.high?(18)
+      expect(pin.low?).to eq RPi::GPIO.low?(18)
+    end
+  end
+end
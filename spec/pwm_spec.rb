@@ -71,6 +71,10 @@ describe "RPi::GPIO::PWM" do
           it "raises an error" do
             expect { RPi::GPIO::PWM.new(18, 0) } .to raise_error ArgumentError
           end
+
+          it "raises an error when its period would round to 0 ns" do
+            expect { RPi::GPIO::PWM.new(18, 2_000_000_000) } .to raise_error ArgumentError
+          end
         end
       end
     end
@@ -275,6 +279,64 @@ describe "RPi::GPIO::PWM" do
     end
   end
 
+  describe "#update" do
+    before :each do
+      RPi::GPIO.set_numbering :board
+      RPi::GPIO.setup 18, :as => :output
+    end
+
+    let(:pwm) do
+      p = RPi::GPIO::PWM.new(18, 100)
+      p.start(5)
+      p
+    end
+
+    after :each do
+      pwm.stop
+    end
+
+    context "given a duty cycle and frequency" do
+      it "sets both" do
+        pwm.update(:duty => 25, :frequency => 50)
+        expect([pwm.duty_cycle, pwm.frequency]).to eq [25, 50]
+      end
+    end
+
+    context "given only a duty cycle" do
+      it "keeps the frequency" do
+        pwm.update(:duty => 25)
+        expect([pwm.duty_cycle, pwm.frequency]).to eq [25, 100]
+      end
+    end
+
+    context "given an invalid frequency" do
+      let(:update) { pwm.update(:duty => 25, :frequency => 0) }
+
+      it "raises an error" do
+        expect { update } .to raise_error ArgumentError
+      end
+
+      it "sets neither" do
+        update rescue nil
+        expect([pwm.duty_cycle, pwm.frequency]).to eq [5, 100]
+      end
+    end
+
+    context "given a frequency above 1 GHz" do
+      it "raises an error" do
+        expect { pwm.update(:frequency => 2_000_000_000) } .to raise_error ArgumentError
+        expect { pwm.frequency = 2_000_000_000 } .to raise_error ArgumentError
+        expect(pwm.frequency).to eq 100
+      end
+    end
+
+    context "given a duty cycle greater than 100" do
+      it "raises an error" do
+        expect { pwm.update(:duty => 101) } .to raise_error ArgumentError
+      end
+    end
+  end
+
   describe "#stop" do
     before :each do
       RPi::GPIO.set_numbering :board
@@ -295,4 +357,249 @@ describe "RPi::GPIO::PWM" do
       expect { pwm.stop } .to change { pwm.running? } .from(true).to(false)
     end
   end
+
+  describe "#stats" do
+    before :each do
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup 17, :as => :output, :initialize => :low
+    end
+
+    let(:pwm) { RPi::GPIO::PWM.new(17, 100) }
+
+    after :each do
+      pwm.stop
+    end
+
+    it "records every edge's latency" do
+      pwm.start 25
+      sleep 0.1
+      stats = pwm.stats
+      expect(stats[:edges]).to be > 10
+      expect(stats[:histogram].values.sum).to eq stats[:edges]
+      expect(stats[:max_overshoot_ns]).to be >= stats[:percentiles][50.0]
+      expect(stats[:late]).to be <= stats[:edges]
+    end
+
+    it "measures the achieved frequency and duty cycle" do
+      pwm.start 25
+      sleep 0.2
+      stats = pwm.stats
+      expect(stats[:periods]).to be > 10
+      expect(stats[:frequency]).to be_within(5).of(100)
+      expect(stats[:duty_cycle]).to be_within(5).of(25)
+    end
+
+    it "is empty before the PWM starts" do
+      expect(pwm.stats[:edges]).to eq 0
+      expect(pwm.stats[:frequency]).to be_nil
+    end
+
+    it "keeps the stats after the PWM stops" do
+      pwm.start 50
+      sleep 0.05
+      pwm.stop
+      expect(pwm.stats[:edges]).to be > 0
+    end
+
+    it "clears the stats on reset_stats" do
+      pwm.start 50
+      sleep 0.05
+      pwm.stop
+      pwm.reset_stats
+      expect(pwm.stats[:edges]).to eq 0
+      expect(pwm.stats[:histogram]).to eq({})
+    end
+  end
+
+  describe "#timing" do
+    before :each do
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup [17, 27], :as => :output, :initialize => :low
+    end
+
+    let(:pwm) { RPi::GPIO::PWM.new(17, 1000) }
+
+    after :each do
+      pwm.stop
+    end
+
+    it "sleeps by default" do
+      expect(pwm.timing).to eq :sleep
+      expect(pwm.spin_margin).to be_nil
+    end
+
+    it "can be set when created" do
+      hybrid = RPi::GPIO::PWM.new(27, 1000, :timing => :hybrid, :spin_margin => 50_000)
+      expect(hybrid.timing).to eq :hybrid
+      expect(hybrid.spin_margin).to eq 50_000
+      hybrid.stop
+    end
+
+    it "spins before the edges of a hybrid PWM" do
+      pwm.timing = :hybrid
+      pwm.spin_margin = 100_000
+      pwm.start 50
+      sleep 0.05
+      pwm.stop
+      expect(pwm.stats[:spin_ns]).to be > 0
+      expect(RPi::GPIO::PWM.scheduler_stats[:spin_ns]).to be >= pwm.stats[:spin_ns]
+    end
+
+    it "doesn't spin for a sleeping PWM" do
+      pwm.start 50
+      sleep 0.05
+      pwm.stop
+      expect(pwm.stats[:spin_ns]).to eq 0
+    end
+
+    it "reports the scheduler's CPU time" do
+      pwm.start 50
+      sleep 0.05
+      expect(RPi::GPIO::PWM.scheduler_stats[:cpu_ns]).to be > 0
+    end
+
+    it "calibrates the spin margin" do
+      expect(RPi::GPIO::PWM.calibrated_spin_margin).to be_within(245_000).of(255_000)
+    end
+
+    it "raises an error given an invalid timing or margin" do
+      expect { pwm.timing = :busy } .to raise_error ArgumentError
+      expect { pwm.spin_margin = 0 } .to raise_error ArgumentError
+    end
+  end
+
+  describe "output" do
+    before :each do
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup [17, 27], :as => :output, :initialize => :low
+    end
+
+    it "toggles channels at the same frequency together" do
+      pwms = [17, 27].map { |gpio| RPi::GPIO::PWM.new(gpio, 50) }
+      capture = RPi::GPIO::Capture.new(:channels => [17, 27], :rate => 10_000)
+      pwms.each { |pwm| pwm.start 50 }
+      capture.start
+      sleep 0.2
+      capture.stop
+      pwms.each(&:stop)
+
+      levels = capture.map { |time, levels| levels }.drop(1)
+      expect(levels.size).to be >= 10
+      expect(levels.uniq.sort).to eq [0, (1 << 17) | (1 << 27)]
+    end
+
+    it "finishes the current period before switching parameters" do
+      pwm = RPi::GPIO::PWM.new(17, 5)
+      capture = RPi::GPIO::Capture.new(:channels => [17], :rate => 2_000)
+      capture.start
+      pwm.start 50
+      sleep 0.03
+      pwm.update(:duty => 10, :frequency => 10)
+      sleep 0.3
+      capture.stop
+      pwm.stop
+
+      # 100ms high and 100ms low at the old 5 Hz, 50%, then 10ms high at 10 Hz
+      edges = capture.map { |time, levels| time }.drop(1)
+      widths = edges.each_cons(2).map { |start, finish| ((finish - start) / 1_000_000.0).round }
+      expect(widths.size).to be >= 3
+      expect(widths[0]).to be_within(10).of(100)
+      expect(widths[1]).to be_within(10).of(100)
+      expect(widths[2]).to be_within(5).of(10)
+    end
+  end
+
+  describe "hardware" do
+    before :each do
+      skip "needs RPI_GPIO_BACKEND=sim" unless RPi::GPIO.backend == :sim
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup [12, 13, 17, 18], :as => :output
+    end
+
+    # the simulated Pi 3 clocks PWM at 19.2 MHz / 2
+    let(:pwm) { RPi::GPIO::PWM.new(18, 1000, :hardware => true) }
+    let(:pwm_registers) { RPi::GPIO::Simulator.registers(:pwm) }
+    let(:clock_registers) { RPi::GPIO::Simulator.registers(:clock) }
+
+    after :each do
+      pwm.stop
+    end
+
+    it "is a hardware PWM in mark-space mode" do
+      expect([pwm.hardware?, pwm.mode]).to eq [true, :mark_space]
+    end
+
+    it "starts the PWM clock from the oscillator" do
+      pwm
+      expect(clock_registers[:ctl]).to eq 0x5a000011
+      expect(clock_registers[:div]).to eq 0x5a000000 | (2 << 12)
+    end
+
+    it "programs the range for the frequency" do
+      pwm
+      expect(pwm_registers[:rng1]).to eq 9600
+    end
+
+    it "enables the channel in mark-space mode on start" do
+      pwm.start 25
+      expect(pwm_registers[:dat1]).to eq 2400
+      expect(pwm_registers[:ctl] & 0xff).to eq 0x81
+    end
+
+    it "reprograms the registers on update" do
+      pwm.start 25
+      pwm.update(:duty => 10, :frequency => 2000)
+      expect([pwm_registers[:rng1], pwm_registers[:dat1]]).to eq [4800, 480]
+    end
+
+    it "drives channel 2 in balanced mode" do
+      pwm2 = RPi::GPIO::PWM.new(13, 100, :hardware => true, :mode => :balanced)
+      pwm2.start 50
+      expect([pwm_registers[:rng2], pwm_registers[:dat2]]).to eq [96000, 48000]
+      expect(pwm_registers[:ctl] & 0xff00).to eq 0x0100
+      pwm2.stop
+    end
+
+    it "disables the channel and the clock on stop" do
+      pwm.start 25
+      pwm.stop
+      expect(pwm_registers[:ctl] & 0xff).to eq 0
+      expect(clock_registers[:ctl] & 0x10).to eq 0
+    end
+
+    it "gives the pin back as an output on stop" do
+      pwm.start 25
+      pwm.stop
+      RPi::GPIO.set_high 18
+      expect(RPi::GPIO.high?(18)).to eq true
+    end
+
+    it "rejects a pin without hardware PWM" do
+      expect { RPi::GPIO::PWM.new(17, 1000, :hardware => true) } .to raise_error ArgumentError
+    end
+
+    it "rejects a second pin on the same channel" do
+      pwm
+      expect { RPi::GPIO::PWM.new(12, 1000, :hardware => true) } .to raise_error RuntimeError
+    end
+
+    it "rejects a frequency the clock can't reach, and frees the channel" do
+      expect { RPi::GPIO::PWM.new(12, 10_000_000, :hardware => true) } .to raise_error ArgumentError
+      expect { pwm } .to_not raise_error
+    end
+
+    it "rejects a timing mode" do
+      expect { RPi::GPIO::PWM.new(12, 1000, :hardware => true, :timing => :hybrid) } .to raise_error ArgumentError
+      expect { pwm.timing = :hybrid } .to raise_error ArgumentError
+    end
+
+    it "has no stats" do
+      pwm.start 50
+      expect(pwm.stats).to be_nil
+    end
+
+    it "rejects a mode for software PWM" do
+      expect { RPi::GPIO::PWM.new(17, 1000, :mode => :balanced) } .to raise_error ArgumentError
+    end
+  end
 end
@@ -0,0 +1,171 @@
+require_relative "spec_helper"
+
+describe "RPi::GPIO::ServoBank" do
+  before :each do
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+    RPi::GPIO.set_warnings false
+  end
+
+  after :each do
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+  end
+
+  describe "#initialize" do
+    before :each do
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup [17, 27], :as => :output
+    end
+
+    it "takes output channels" do
+      expect(RPi::GPIO::ServoBank.new([17, 27]).channels).to eq [17, 27]
+    end
+
+    it "uses a 20 ms frame by default" do
+      expect(RPi::GPIO::ServoBank.new([17]).frame).to eq 20_000
+    end
+
+    it "raises an error for a channel that isn't an output" do
+      expect { RPi::GPIO::ServoBank.new([17, 22]) } .to raise_error RuntimeError
+    end
+
+    it "raises an error for a repeated channel" do
+      expect { RPi::GPIO::ServoBank.new([17, 17]) } .to raise_error ArgumentError
+    end
+
+    it "raises an error for a frame too short to fit a pulse" do
+      expect { RPi::GPIO::ServoBank.new([17], :frame => 2000) } .to raise_error ArgumentError
+    end
+
+    it "applies :speed to every servo" do
+      expect(RPi::GPIO::ServoBank.new([17, 27], :speed => 500).speeds).to eq [500, 500]
+    end
+  end
+
+  describe "#targets=" do
+    before :each do
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup [17, 27], :as => :output
+    end
+
+    let(:bank) { RPi::GPIO::ServoBank.new([17, 27]) }
+
+    it "starts with no pulses" do
+      expect(bank.targets).to eq [nil, nil]
+    end
+
+    it "sets every target from an Array" do
+      bank.targets = [1000, 2000]
+      expect(bank.targets).to eq [1000, 2000]
+    end
+
+    it "sets only the channels in a Hash" do
+      bank.targets = [1000, 2000]
+      bank.targets = { 27 => 1500 }
+      expect(bank.targets).to eq [1000, 1500]
+    end
+
+    it "sets one target through []=" do
+      bank[27] = 1200
+      expect([bank[17], bank[27]]).to eq [nil, 1200]
+    end
+
+    it "raises an error for a pulse out of range and changes nothing" do
+      bank.targets = [1000, 2000]
+      expect { bank.targets = [1500, 2600] } .to raise_error ArgumentError
+      expect(bank.targets).to eq [1000, 2000]
+    end
+
+    it "raises an error for the wrong number of targets" do
+      expect { bank.targets = [1500] } .to raise_error ArgumentError
+    end
+
+    it "raises an error for a channel not in the bank" do
+      expect { bank.targets = { 22 => 1500 } } .to raise_error ArgumentError
+    end
+  end
+
+  describe "output" do
+    before :each do
+      skip "needs RPI_GPIO_BACKEND=sim" unless RPi::GPIO.backend == :sim
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup [17, 27], :as => :output, :initialize => :low
+    end
+
+    let(:bank) { RPi::GPIO::ServoBank.new([17, 27]) }
+
+    after :each do
+      bank.stop
+    end
+
+    # [start, width] in microseconds of each of gpio's high pulses
+    def pulses(capture, gpio)
+      last = 0
+      rise = nil
+      capture.each_with_object([]) do |(time, levels), result|
+        level = levels[gpio]
+        rise = time if level == 1 && last == 0
+        result << [rise / 1000, (time - rise) / 1000] if level == 0 && last == 1 && rise
+        last = level
+      end
+    end
+
+    it "sends each servo its pulse width, staggered across the frame" do
+      capture = RPi::GPIO::Capture.new(:channels => [17, 27], :rate => 20_000)
+      bank.targets = [1000, 2000]
+      bank.start
+      capture.start
+      sleep 0.1
+      capture.stop
+
+      first = pulses(capture, 17)
+      second = pulses(capture, 27)
+      expect(first.size).to be >= 3
+      expect(second.size).to be >= 3
+      expect(first.map(&:last).sort[first.size / 2]).to be_within(200).of(1000)
+      expect(second.map(&:last).sort[second.size / 2]).to be_within(200).of(2000)
+      # (20 ms - 2.5 ms) / 2 servos apart
+      expect((second[1][0] - first[1][0]) % 20_000).to be_within(1000).of(8750)
+    end
+
+    it "ramps towards a new target at the speed limit" do
+      bank.speeds = [10_000, nil]
+      bank.targets = [1000, 1000]
+      bank.start
+      sleep 0.05
+      bank.targets = [2000, 2000]
+      sleep 0.03
+      first, second = bank.positions
+      expect(first).to be > 1000
+      expect(first).to be < 2000
+      expect(second).to eq 2000
+      sleep 0.2
+      expect(bank.positions).to eq [2000, 2000]
+    end
+
+    it "drives the channels low on stop" do
+      bank.targets = [2400, 2400]
+      bank.start
+      sleep 0.05
+      bank.stop
+      expect(bank.running?).to eq false
+      expect([RPi::GPIO.low?(17), RPi::GPIO.low?(27)]).to eq [true, true]
+    end
+
+    it "keeps a PWM off its channels while running" do
+      bank.start
+      expect { RPi::GPIO::PWM.new(17, 50) } .to raise_error RuntimeError
+    end
+
+    it "stops when RPi::GPIO.clean_up hands back one of its channels" do
+      bank.start
+      RPi::GPIO.clean_up 17
+      expect(bank.running?).to eq false
+      RPi::GPIO.setup 17, :as => :output
+      pwm = RPi::GPIO::PWM.new(17, 50)
+      expect(pwm.gpio).to eq 17
+      pwm.stop
+    end
+  end
+end
@@ -0,0 +1,382 @@
+require_relative "spec_helper"
+require "tmpdir"
+
+describe "RPi::GPIO::Simulator" do
+  before :each do
+    skip "needs RPI_GPIO_BACKEND=sim" unless RPi::GPIO.backend == :sim
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.set_numbering :board
+  end
+
+  after :each do
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+  end
+
+  describe ".drive" do
+    context "given an input channel" do
+      before :each do
+        RPi::GPIO.setup 18, :as => :input, :pull => :down
+      end
+
+      after :each do
+        RPi::GPIO::Simulator.drive 18, nil
+      end
+
+      it "sets the channel's level" do
+        RPi::GPIO::Simulator.drive 18, :high
+        expect(RPi::GPIO.high? 18).to eq true
+        RPi::GPIO::Simulator.drive 18, false
+        expect(RPi::GPIO.high? 18).to eq false
+      end
+
+      it "leaves the channel to its pull resistor when released" do
+        RPi::GPIO::Simulator.drive 18, true
+        RPi::GPIO::Simulator.drive 18, nil
+        expect(RPi::GPIO.high? 18).to eq false
+      end
+
+      it "raises an error given an invalid level" do
+        expect { RPi::GPIO::Simulator.drive 18, :nope } .to raise_error ArgumentError
+      end
+    end
+
+    context "given an output channel" do
+      before :each do
+        RPi::GPIO.setup 18, :as => :output, :initialize => :low
+      end
+
+      it "doesn't override the output" do
+        RPi::GPIO::Simulator.drive 18, :high
+        expect(RPi::GPIO.high? 18).to eq false
+        RPi::GPIO::Simulator.drive 18, nil
+      end
+    end
+  end
+
+  describe "pull resistors" do
+    it "set the level of an undriven input" do
+      RPi::GPIO.setup 18, :as => :input, :pull => :up
+      expect(RPi::GPIO.high? 18).to eq true
+      RPi::GPIO.setup 18, :as => :input, :pull => :down
+      expect(RPi::GPIO.high? 18).to eq false
+    end
+  end
+
+  describe ".chip" do
+    it "describes the simulated board's SoC" do
+      chip = RPi::GPIO.chip
+      expect(chip[:name]).to eq "BCM2837"
+      expect(chip[:peripheral_base]).to eq 0x3f000000
+      expect([chip[:pins], chip[:pull], chip[:oscillator]]).to eq [54, :legacy, 19_200_000.0]
+    end
+
+    it "calibrates the pull delay loop" do
+      expect(RPi::GPIO.chip[:pull_wait_loops]).to be >= 150
+    end
+  end
+
+  describe ".native_bench" do
+    it "times raw register writes and reads" do
+      RPi::GPIO.setup 11, :as => :output
+      expect(RPi::GPIO.native_bench(:output, 17, 1000)).to be > 0
+      expect(RPi::GPIO.native_bench(:input, 17, 1000)).to be > 0
+    end
+
+    it "only writes to an output" do
+      RPi::GPIO.setup 11, :as => :input
+      expect { RPi::GPIO.native_bench(:output, 17, 1000) } .to raise_error RuntimeError
+    end
+  end
+
+  describe "board detection" do
+    # runs script in a fresh process, where the board hasn't been looked up
+    def fresh_process(env, script)
+      lib = File.expand_path("../lib", __dir__)
+      command = [RbConfig.ruby] + $LOAD_PATH.map { |dir| "-I#{dir}" } + ["-e", "require '#{lib}/rpi_gpio'; #{script}"]
+      IO.popen({ "RPI_GPIO_BACKEND" => "sim" }.merge(env), command, &:read)
+    end
+
+    it "takes the board from RPI_GPIO_BOARD" do
+      output = fresh_process({ "RPI_GPIO_BOARD" => "c03111" },
+        "print RPi::GPIO.board_info[:type], ',', RPi::GPIO.chip[:name]")
+      expect(output).to eq "Pi 4 Model B,BCM2711"
+    end
+
+    it "doesn't read a chip cache for the simulator" do
+      Dir.mktmpdir do |dir|
+        cache = File.join(dir, "board")
+        File.write(cache, "rpi_gpio 1 sim a02082 3f000000 4321\n")
+        env = { "RPI_GPIO_SIM_REVISION" => "a02082", "RPI_GPIO_CACHE" => cache }
+        expect(fresh_process(env, "print RPi::GPIO.chip[:pull_wait_loops]")).not_to eq "4321"
+      end
+    end
+
+    it "doesn't write a chip cache for the simulator or a board given in RPI_GPIO_BOARD" do
+      Dir.mktmpdir do |dir|
+        cache = File.join(dir, "board")
+        fresh_process({ "RPI_GPIO_CACHE" => cache }, "RPi::GPIO.chip")
+        fresh_process({ "RPI_GPIO_BOARD" => "c03111", "RPI_GPIO_CACHE" => cache }, "RPi::GPIO.chip")
+        expect(File.exist?(cache)).to eq false
+      end
+    end
+  end
+
+  describe ".setup given a list of channels" do
+    let(:header) { [3, 5, 7, 8, 10, 11, 12, 13, 15, 16, 18, 19, 21, 22, 23, 24, 26, 29, 31, 32, 33, 35, 36, 37, 38, 40] }
+
+    it "applies the pull to every channel" do
+      RPi::GPIO.setup header, :as => :input, :pull => :up
+      expect(header.map { |channel| RPi::GPIO.high? channel }.uniq).to eq [true]
+      RPi::GPIO.setup header, :as => :input, :pull => :down
+      expect(header.map { |channel| RPi::GPIO.high? channel }.uniq).to eq [false]
+    end
+
+    it "initializes every output" do
+      RPi::GPIO.setup header, :as => :output, :initialize => :low
+      expect(header.map { |channel| RPi::GPIO.high? channel }.uniq).to eq [false]
+      RPi::GPIO.setup header, :as => :output, :initialize => :high
+      expect(header.map { |channel| RPi::GPIO.high? channel }.uniq).to eq [true]
+    end
+
+    it "sets up none of them if one is invalid" do
+      expect { RPi::GPIO.setup [11, 12, 1], :as => :output } .to raise_error ArgumentError
+      expect { RPi::GPIO.high? 11 } .to raise_error RuntimeError
+    end
+
+    it "puts every channel back to a floating input on clean_up" do
+      RPi::GPIO.setup header, :as => :output, :initialize => :high
+      RPi::GPIO.clean_up
+      RPi::GPIO.setup header, :as => :input
+      expect(header.map { |channel| RPi::GPIO.high? channel }.uniq).to eq [true]
+    end
+  end
+
+  describe "hardware event detection" do
+    before :each do
+      RPi::GPIO.setup 18, :as => :input, :pull => :down
+      @events = Queue.new
+    end
+
+    after :each do
+      RPi::GPIO::Simulator.drive 18, nil
+    end
+
+    def events_after(seconds)
+      sleep seconds
+      result = []
+      result << @events.pop until @events.empty?
+      result
+    end
+
+    it "reports edges" do
+      RPi::GPIO.watch(18, :on => :both, :detect => :hardware) { |pin, value| @events << [pin, value] }
+      RPi::GPIO::Simulator.drive 18, :high
+      sleep 0.01
+      RPi::GPIO::Simulator.drive 18, :low
+      expect(events_after(0.05)).to eq [[18, 1], [18, 0]]
+    end
+
+    it "reports a level once until the pin leaves it" do
+      RPi::GPIO.watch(18, :on => :high, :detect => :hardware) { |pin, value| @events << [pin, value] }
+      RPi::GPIO::Simulator.drive 18, :high
+      expect(events_after(0.05)).to eq [[18, 1]]
+      RPi::GPIO::Simulator.drive 18, :low
+      sleep 0.01
+      RPi::GPIO::Simulator.drive 18, :high
+      expect(events_after(0.05)).to eq [[18, 1]]
+    end
+
+    it "stops reporting after stop_watching" do
+      RPi::GPIO.watch(18, :on => :rising, :detect => :hardware) { |pin, value| @events << [pin, value] }
+      RPi::GPIO.stop_watching 18
+      RPi::GPIO::Simulator.drive 18, :high
+      expect(events_after(0.02)).to eq []
+    end
+
+    it "works with wait_for_edge" do
+      waiter = Thread.new { RPi::GPIO.wait_for_edge 18, :rising, :detect => :hardware, :timeout => 1000 }
+      sleep 0.02
+      RPi::GPIO::Simulator.drive 18, :high
+      expect(waiter.value).to eq 1
+    end
+
+    [:spin, :hybrid, :sleep].each do |mode|
+      it "polls in #{mode} mode" do
+        RPi::GPIO.set_event_polling mode
+        RPi::GPIO.watch(18, :on => :rising, :detect => :hardware) { |pin, value| @events << [pin, value] }
+        RPi::GPIO::Simulator.drive 18, :high
+        100.times { @events.empty? ? sleep(0.01) : break }
+        expect(events_after(0)).to eq [[18, 1]]
+        RPi::GPIO.set_event_polling :hybrid
+      end
+    end
+
+    it "stops polling once the last hardware pin is removed" do
+      RPi::GPIO.set_event_polling :spin
+      RPi::GPIO.watch(18, :on => :rising, :detect => :hardware) { |pin, value| @events << [pin, value] }
+      sleep 0.01
+      RPi::GPIO.stop_watching 18
+      sleep 0.01
+      polls = RPi::GPIO.event_polls
+      sleep 0.05
+      expect(RPi::GPIO.event_polls).to eq polls
+
+      RPi::GPIO.watch(18, :on => :rising, :detect => :hardware) { |pin, value| @events << [pin, value] }
+      RPi::GPIO::Simulator.drive 18, :high
+      100.times { @events.empty? ? sleep(0.01) : break }
+      expect(events_after(0)).to eq [[18, 1]]
+      expect(RPi::GPIO.event_polls).to be > polls
+      RPi::GPIO.set_event_polling :hybrid
+    end
+
+    it "accepts :high only for hardware detection" do
+      expect { RPi::GPIO.watch(18, :on => :high) { } } .to raise_error ArgumentError
+    end
+  end
+
+  describe "wait_for_any_edge" do
+    before :each do
+      RPi::GPIO.setup [18, 23], :as => :input, :pull => :down
+    end
+
+    after :each do
+      RPi::GPIO::Simulator.drive 18, nil
+      RPi::GPIO::Simulator.drive 23, nil
+    end
+
+    def wait_any(timeout = 1000)
+      RPi::GPIO.wait_for_any_edge([18, 23], :edge => :rising, :detect => :hardware, :timeout => timeout)
+    end
+
+    it "returns the channel, level and timestamp of the first edge" do
+      waiter = Thread.new { wait_any }
+      sleep 0.02
+      before = Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+      RPi::GPIO::Simulator.drive 23, :high
+      channel, level, timestamp = waiter.value
+      expect([channel, level]).to eq [23, 1]
+      expect(timestamp).to be >= before
+    end
+
+    it "returns nil once the timeout has passed" do
+      started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      expect(wait_any(50)).to eq nil
+      expect(Process.clock_gettime(Process::CLOCK_MONOTONIC) - started).to be_within(0.04).of(0.07)
+    end
+
+    it "queues edges between calls" do
+      expect(wait_any(0)).to eq nil
+      RPi::GPIO::Simulator.drive 18, :high
+      sleep 0.01
+      RPi::GPIO::Simulator.drive 23, :high
+      sleep 0.02
+      expect(wait_any.first(2)).to eq [18, 1]
+      expect(wait_any.first(2)).to eq [23, 1]
+    end
+
+    it "keeps its registration until stop_watching" do
+      wait_any(0)
+      expect { RPi::GPIO.watch(18, :on => :rising, :detect => :hardware) { } } .to raise_error RuntimeError
+      RPi::GPIO.stop_watching 18
+      RPi::GPIO::Simulator.drive 18, :high
+      sleep 0.02
+      expect(RPi::GPIO.wait_for_any_edge([23], :edge => :rising, :detect => :hardware, :timeout => 10)).to eq nil
+    end
+
+    it "releases the GVL while waiting" do
+      waiter = Thread.new { wait_any(200) }
+      count = 0
+      count += 1 while waiter.alive?
+      expect(waiter.value).to eq nil
+      expect(count).to be > 1000
+    end
+
+    it "refuses a channel that's already being watched" do
+      RPi::GPIO.watch(18, :on => :rising, :detect => :hardware) { }
+      expect { wait_any(0) } .to raise_error RuntimeError
+    end
+  end
+
+  describe "counter" do
+    before :each do
+      RPi::GPIO.setup [18, 23], :as => :input, :pull => :down
+    end
+
+    after :each do
+      RPi::GPIO::Simulator.drive 18, nil
+    end
+
+    def pulse(times)
+      times.times do
+        RPi::GPIO::Simulator.drive 18, :high
+        sleep 0.003
+        RPi::GPIO::Simulator.drive 18, :low
+        sleep 0.003
+      end
+    end
+
+    it "counts the edges asked for" do
+      rising = RPi::GPIO.counter(18, :edge => :rising, :detect => :hardware)
+      pulse 5
+      expect(rising.count).to eq 5
+      RPi::GPIO.stop_watching 18
+      both = RPi::GPIO.counter(18, :edge => :both, :detect => :hardware)
+      pulse 5
+      expect(both.count).to eq 10
+    end
+
+    it "starts again from zero on reset" do
+      counter = RPi::GPIO.counter(18, :edge => :rising, :detect => :hardware)
+      pulse 3
+      expect(counter.reset.count).to eq 0
+      pulse 2
+      expect(counter.count).to eq 2
+    end
+
+    it "carries on the count when asked for the same counter again" do
+      RPi::GPIO.counter(18, :edge => :rising, :detect => :hardware)
+      pulse 3
+      expect(RPi::GPIO.counter(18, :edge => :rising, :detect => :hardware).count).to eq 3
+    end
+
+    it "gives the rate over a window" do
+      started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      counter = RPi::GPIO.counter(18, :edge => :rising, :detect => :hardware)
+      pulse 20
+      rate = counter.rate(:window => 10)
+      elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+      expect(rate * elapsed).to be_within(3).of(20)
+      sleep 0.1
+      expect(counter.rate(:window => 0.05)).to eq 0.0
+    end
+
+    it "stops counting when stopped, keeping its count" do
+      counter = RPi::GPIO.counter(18, :edge => :rising, :detect => :hardware)
+      pulse 2
+      counter.stop
+      pulse 2
+      expect(counter.count).to eq 2
+      RPi::GPIO.watch(18, :on => :rising, :detect => :hardware) { }
+    end
+
+    it "refuses a channel that's already being watched" do
+      RPi::GPIO.watch(18, :on => :rising, :detect => :hardware) { }
+      expect { RPi::GPIO.counter(18, :detect => :hardware) } .to raise_error RuntimeError
+    end
+
+    it "can't be watched while counting" do
+      RPi::GPIO.counter(18, :detect => :hardware)
+      expect { RPi::GPIO.watch(18, :on => :both, :detect => :hardware) { } } .to raise_error RuntimeError
+      expect { RPi::GPIO.wait_for_any_edge([18], :detect => :hardware, :timeout => 0) } .to raise_error RuntimeError
+    end
+
+    it "raises on a bad window or edge" do
+      counter = RPi::GPIO.counter(18, :detect => :hardware)
+      expect { counter.rate(:window => 0) } .to raise_error ArgumentError
+      expect { RPi::GPIO.counter(23, :edge => :high, :detect => :hardware) } .to raise_error ArgumentError
+    end
+  end
+end
@@ -0,0 +1,259 @@
+require_relative "spec_helper"
+
+describe "RPi::GPIO::Waveform" do
+  before :each do
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+    RPi::GPIO.set_warnings false
+  end
+
+  after :each do
+    RPi::GPIO.set_warnings false
+    RPi::GPIO.reset
+  end
+
+  let(:waveform) { RPi::GPIO::Waveform.new }
+
+  describe "#step" do
+    context "before numbering is set" do
+      it "raises an error" do
+        expect { waveform.step :high => 18, :delay => 1000 } .to raise_error RuntimeError
+      end
+    end
+
+    context "after numbering is set" do
+      before :each do
+        RPi::GPIO.set_numbering :board
+      end
+
+      context "given output channels" do
+        before :each do
+          RPi::GPIO.setup [18, 19], :as => :output
+        end
+
+        it "adds a step" do
+          expect { waveform.step :high => 18, :low => 19, :delay => 1000 }
+            .to change { waveform.size } .from(0).to(1)
+        end
+
+        it "adds up the steps' delays" do
+          waveform.step(:high => 18, :delay => 1000).step(:low => 18, :delay => 500)
+          expect(waveform.duration).to eq 1500
+        end
+
+        it "raises an error given a channel both high and low" do
+          expect { waveform.step :high => [18, 19], :low => 19 } .to raise_error ArgumentError
+        end
+
+        it "raises an error given a negative delay" do
+          expect { waveform.step :high => 18, :delay => -1 } .to raise_error ArgumentError
+        end
+      end
+
+      context "given an input channel" do
+        before :each do
+          RPi::GPIO.setup 18, :as => :input
+        end
+
+        it "raises an error" do
+          expect { waveform.step :high => 18 } .to raise_error RuntimeError
+        end
+      end
+    end
+  end
+
+  describe "#play" do
+    before :each do
+      RPi::GPIO.set_numbering :board
+      RPi::GPIO.setup [18, 19], :as => :output, :initialize => :low
+    end
+
+    after :each do
+      waveform.stop
+    end
+
+    context "with no steps" do
+      it "raises an error" do
+        expect { waveform.play } .to raise_error RuntimeError
+      end
+    end
+
+    context "with steps" do
+      before :each do
+        waveform.step :high => 18, :delay => 100_000
+        waveform.step :low => 18, :high => 19, :delay => 100_000
+      end
+
+      it "plays every step the given number of times" do
+        stats = waveform.play(3).wait
+        expect(stats[:steps]).to eq 6
+        expect(stats[:iterations]).to eq 3
+        expect(stats[:max_error_ns]).to be >= stats[:min_error_ns]
+      end
+
+      it "leaves the channels at the last step's levels" do
+        waveform.play.wait
+        expect(RPi::GPIO.high? 18).to eq false
+        expect(RPi::GPIO.high? 19).to eq true
+      end
+
+      it "plays until stopped given :forever" do
+        waveform.play :forever
+        expect(waveform.playing?).to eq true
+        waveform.stop
+        waveform.wait
+        expect(waveform.playing?).to eq false
+      end
+
+      it "raises an error if already playing" do
+        waveform.play :forever
+        expect { waveform.play } .to raise_error RuntimeError
+      end
+
+      it "stops when RPi::GPIO.clean_up hands back one of its channels" do
+        waveform.play :forever
+        RPi::GPIO.clean_up 18
+        expect(waveform.playing?).to eq false
+        expect(waveform.wait[:iterations]).to be >= 0
+      end
+
+      it "raises an error given an invalid repeat count" do
+        expect { waveform.play 0 } .to raise_error ArgumentError
+      end
+    end
+
+    context "with :engine => :dma" do
+      before :each do
+        waveform.step :high => 18, :delay => 10_000_000
+        waveform.step :low => 18, :high => 19, :delay => 10_000_000
+      end
+
+      after :each do
+        waveform.stop
+        waveform.wait
+      end
+
+      it "plays every step the given number of times" do
+        started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        stats = waveform.play(3, :engine => :dma).wait
+        expect(Process.clock_gettime(Process::CLOCK_MONOTONIC) - started).to be >= 0.05
+        expect(stats[:steps]).to eq 6
+        expect(stats[:iterations]).to eq 3
+      end
+
+      it "keeps a step's timing past the DMA Lite channel's transfer length" do
+        long = RPi::GPIO::Waveform.new.step(:high => 18, :delay => 40_000_000).step(:low => 18, :delay => 1000)
+        started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        long.play(:engine => :dma).wait
+        expect(Process.clock_gettime(Process::CLOCK_MONOTONIC) - started).to be >= 0.035
+      end
+
+      it "leaves the channels at the last step's levels" do
+        waveform.play(:engine => :dma).wait
+        expect(RPi::GPIO.high? 18).to eq false
+        expect(RPi::GPIO.high? 19).to eq true
+      end
+
+      it "plays until stopped given :forever" do
+        waveform.play :forever, :engine => :dma, :pacer => :pcm
+        expect(waveform.playing?).to eq true
+        waveform.stop
+        waveform.wait
+        expect(waveform.playing?).to eq false
+      end
+
+      it "plays only one DMA waveform at a time" do
+        other = RPi::GPIO::Waveform.new.step(:high => 18, :delay => 1000)
+        waveform.play :forever, :engine => :dma
+        expect { other.play :engine => :dma } .to raise_error RuntimeError
+        other.play.wait
+      end
+
+      it "refuses the PWM pacer while hardware PWM is running" do
+        skip "needs RPI_GPIO_BACKEND=sim" unless RPi::GPIO.backend == :sim
+        RPi::GPIO.setup 12, :as => :output
+        pwm = RPi::GPIO::PWM.new(12, 1000, :hardware => true)
+        pwm.start 50
+        expect { waveform.play :engine => :dma } .to raise_error RuntimeError
+        pwm.stop
+      end
+
+      it "raises an error given an invalid tick" do
+        expect { waveform.play :engine => :dma, :tick => 150 } .to raise_error ArgumentError
+        expect { waveform.play :engine => :dma, :pacer => :pcm, :tick => 200_000 } .to raise_error ArgumentError
+      end
+
+      it "raises an error given a repeat count too large for DMA memory" do
+        expect { waveform.play 2**62, :engine => :dma } .to raise_error RuntimeError
+      end
+
+      it "raises an error given an unknown engine" do
+        expect { waveform.play :engine => :fast } .to raise_error ArgumentError
+      end
+    end
+  end
+
+  describe "#control_blocks" do
+    before :each do
+      RPi::GPIO.set_numbering :bcm
+      RPi::GPIO.setup [18, 19], :as => :output
+      waveform.step :high => 18, :delay => 5000
+      waveform.step :low => 18, :high => 19, :delay => 3000
+    end
+
+    let(:cbs) { waveform.control_blocks }
+
+    it "fills the pacer's FIFO first" do
+      expect(cbs[0][:dest]).to eq RPi::GPIO::Waveform::PWM_FIFO
+      expect(cbs[0][:length]).to eq 16 * 4
+    end
+
+    it "writes each step's levels, then one FIFO word per tick" do
+      expect(cbs[1..-1].map { |cb| [cb[:dest], cb[:length]] }).to eq [
+        [RPi::GPIO::Waveform::GPSET0, 8],
+        [RPi::GPIO::Waveform::PWM_FIFO, 5 * 4],
+        [RPi::GPIO::Waveform::GPSET0, 8],
+        [RPi::GPIO::Waveform::GPCLR0, 8],
+        [RPi::GPIO::Waveform::PWM_FIFO, 3 * 4]]
+    end
+
+    it "chains the blocks and ends the last one" do
+      cbs[0..-2].each_with_index do |cb, i|
+        expect(cb[:next]).to eq RPi::GPIO::Waveform::DMA_BUS_BASE + (i + 1) * 32
+      end
+      expect(cbs[-1][:next]).to eq 0
+    end
+
+    it "loops back past the first block given :forever" do
+      expect(waveform.control_blocks(:forever)[-1][:next]).to eq RPi::GPIO::Waveform::DMA_BUS_BASE + 32
+    end
+
+    it "unrolls a repeat count" do
+      expect(waveform.control_blocks(3).size).to eq 1 + 3 * 5
+    end
+
+    it "rounds delays to the tick and paces with the PCM FIFO" do
+      cbs = waveform.control_blocks(:pacer => :pcm, :tick => 2000)
+      expect(cbs[0][:length]).to eq 64 * 4
+      expect([cbs[2][:dest], cbs[2][:length]]).to eq [RPi::GPIO::Waveform::PCM_FIFO, 3 * 4]
+      expect([cbs[5][:dest], cbs[5][:length]]).to eq [RPi::GPIO::Waveform::PCM_FIFO, 2 * 4]
+    end
+
+    it "splits a long delay to fit the DMA Lite channel's 16-bit length" do
+      cbs = RPi::GPIO::Waveform.new.step(:high => 18, :delay => 20_000_000).control_blocks
+      delays = cbs[2..-1].map { |cb| cb[:length] }
+      expect(cbs.size).to eq 4
+      expect(delays).to eq [65532, 20_000 * 4 - 65532]
+    end
+
+    it "raises an error for a repeat count too large for DMA memory" do
+      expect { waveform.control_blocks(2**62) } .to raise_error RuntimeError
+      expect { waveform.control_blocks(2**40) } .to raise_error RuntimeError
+    end
+
+    it "raises an error for a waveform shorter than one tick" do
+      expect { RPi::GPIO::Waveform.new.step(:high => 18, :delay => 100).control_blocks }
+        .to raise_error RuntimeError
+    end
+  end
+end